@@ -0,0 +1,214 @@
+/*
+ * Thin client for "shell --server SOCKET": shellc SOCKET COMMAND [ARG...]
+ *
+ * Runs COMMAND (the arguments joined with spaces, as ssh does) in a worker
+ * of the already running shell server. The worker gets this process's
+ * stdin, stdout, stderr, working directory and environment (exported over
+ * the server's); shellc exits with the
+ * command's status. SIGINT, SIGTERM, SIGHUP and SIGQUIT are forwarded to
+ * the worker's process group, and if the command dies from one of them,
+ * so does shellc. Exits with 255 if the server cannot be reached.
+ *
+ *   make
+ *   ./bin/shell --server /tmp/shell.sock -c ~/.shellrc &
+ *   ./bin/shellc /tmp/shell.sock 'make -C src 2>&1 | tail -n 5'
+ */
+
+#include "include/shell_server_protocol.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+extern char **environ;
+
+static volatile sig_atomic_t worker = 0;     /* Process group to signal */
+static volatile sig_atomic_t forwarded = 0;  /* Last signal received */
+
+static void forward_signal(int signo)
+{
+  forwarded = signo;
+  if (worker > 0)
+    kill(-worker, signo);
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = buf;
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+static int read_int(int fd, int32_t *value)
+{
+  char *p = (char *)value;
+  size_t len = sizeof(*value);
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  return 0;
+}
+
+/* Send the header with our stdio descriptors attached */
+static int send_request(int sock, const struct shell_server_request *req)
+{
+  struct iovec iov;
+  iov.iov_base = (void *)req;
+  iov.iov_len = sizeof(*req);
+
+  union
+  {
+    struct cmsghdr align;
+    char buf[CMSG_SPACE(3 * sizeof(int))];
+  } control;
+  memset(&control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control.buf;
+  msg.msg_controllen = sizeof(control.buf);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(3 * sizeof(int));
+  int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+  memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+  ssize_t n;
+  do
+  {
+    n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+  } while (n < 0 && errno == EINTR);
+  return n == (ssize_t)sizeof(*req) ? 0 : -1;
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 3)
+  {
+    fprintf(stderr, "usage: shellc SOCKET COMMAND [ARG...]\n");
+    return 2;
+  }
+
+  size_t command_len = 0;
+  for (int i = 2; i < argc; i++)
+    command_len += strlen(argv[i]) + 1;
+  char *command = malloc(command_len);
+  char *cwd = getcwd(NULL, 0);
+  if (command == NULL || cwd == NULL)
+  {
+    perror("shellc");
+    return 255;
+  }
+  char *p = command;
+  for (int i = 2; i < argc; i++)
+  {
+    size_t len = strlen(argv[i]);
+    memcpy(p, argv[i], len);
+    p += len;
+    *p++ = ' ';
+  }
+  command_len--; /* No trailing space */
+
+  /* NAME=value entries, each ending with a NUL */
+  size_t env_len = 0;
+  for (char **env = environ; *env != NULL; env++)
+    env_len += strlen(*env) + 1;
+  char *env_text = malloc(env_len + 1);
+  if (env_text == NULL)
+  {
+    perror("shellc");
+    return 255;
+  }
+  p = env_text;
+  for (char **env = environ; *env != NULL; env++)
+  {
+    size_t len = strlen(*env) + 1;
+    memcpy(p, *env, len);
+    p += len;
+  }
+
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (strlen(argv[1]) >= sizeof(addr.sun_path))
+  {
+    fprintf(stderr, "shellc: socket path too long: %s\n", argv[1]);
+    return 255;
+  }
+  strcpy(addr.sun_path, argv[1]);
+
+  int sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    fprintf(stderr, "shellc: %s: %s\n", argv[1], strerror(errno));
+    return 255;
+  }
+
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  sigemptyset(&action.sa_mask);
+  action.sa_handler = forward_signal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  sigaction(SIGHUP, &action, NULL);
+  sigaction(SIGQUIT, &action, NULL);
+  signal(SIGPIPE, SIG_IGN); /* A vanished server is reported below */
+
+  struct shell_server_request req;
+  req.magic = SHELL_SERVER_MAGIC;
+  req.cwd_len = (uint32_t)strlen(cwd);
+  req.command_len = (uint32_t)command_len;
+  req.env_len = (uint32_t)env_len;
+  int32_t pid, status;
+  errno = 0;
+  if (send_request(sock, &req) < 0 || write_all(sock, cwd, req.cwd_len) < 0 ||
+      write_all(sock, command, command_len) < 0 || write_all(sock, env_text, env_len) < 0 ||
+      read_int(sock, &pid) < 0)
+  {
+    fprintf(stderr, "shellc: request failed: %s\n", errno ? strerror(errno) : "server closed the connection");
+    return 255;
+  }
+
+  /* A signal that arrived before the worker was known is forwarded now */
+  worker = pid;
+  if (forwarded)
+    kill(-pid, forwarded);
+
+  if (read_int(sock, &status) < 0)
+  {
+    if (forwarded)
+    {
+      signal(forwarded, SIG_DFL);
+      raise(forwarded);
+    }
+    fprintf(stderr, "shellc: server closed the connection\n");
+    return 255;
+  }
+  return status & 0xff;
+}
@@ -0,0 +1,64 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <memory_resource>
+
+/**
+ * Get the per-line arena.
+ * Parse trees, argument lists and paths built while running one command
+ * line are allocated from this bump allocator. Memory is never freed
+ * individually; the whole arena is rewound by reset_line_arena(), and an
+ * ArenaScope gives back what was allocated while it was alive.
+ * @return Memory resource for the current command line
+ */
+std::pmr::memory_resource *line_arena();
+
+/**
+ * Release everything allocated from the per-line arena.
+ * Must only be called when no object allocated from it is still alive
+ * (the REPL calls it before reading each new command line).
+ */
+void reset_line_arena();
+
+/**
+ * Position in the per-line arena, from line_arena_mark()
+ */
+struct ArenaMark
+{
+  void *block;    // Block in use (nullptr: the static first block)
+  char *position; // Next free byte in it
+};
+
+/**
+ * Remember how much of the per-line arena is in use
+ * @return Mark to pass to rewind_line_arena()
+ */
+ArenaMark line_arena_mark();
+
+/**
+ * Release everything allocated from the per-line arena since a mark.
+ * Objects allocated after the mark must be dead, and containers allocated
+ * before it must not have grown since.
+ * @param mark Mark from line_arena_mark() that is still valid (marks are
+ *        released last in, first out)
+ */
+void rewind_line_arena(const ArenaMark &mark);
+
+/**
+ * Gives back the arena memory allocated during its lifetime. Loop
+ * iterations and function calls run in one, so a loop over a million
+ * lines needs no more arena than a single iteration.
+ */
+class ArenaScope
+{
+public:
+  ArenaScope() : mark_(line_arena_mark()) {}
+  ~ArenaScope() { rewind_line_arena(mark_); }
+  ArenaScope(const ArenaScope &) = delete;
+  ArenaScope &operator=(const ArenaScope &) = delete;
+
+private:
+  ArenaMark mark_;
+};
+
+#endif // ARENA_H
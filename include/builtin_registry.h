@@ -0,0 +1,74 @@
+#ifndef BUILTIN_REGISTRY_H
+#define BUILTIN_REGISTRY_H
+
+#include <string_view>
+#include <vector>
+#include "include/command_parser.h"
+
+struct ShellContext;
+
+/**
+ * Builtin behaviour flags
+ */
+enum BuiltinFlags : unsigned
+{
+  BUILTIN_RUNS_IN_PARENT = 1 << 0,     // Changes shell state; only useful in the shell process
+  BUILTIN_PIPELINE_SAFE = 1 << 1,      // May run as a pipeline stage (in a forked child)
+  BUILTIN_KEEPS_REDIRECTIONS = 1 << 2, // Its redirections stay applied afterwards (exec)
+};
+
+/**
+ * Builtin entry point
+ * @param args Vector of arguments (including the builtin name as first element)
+ * @param ctx Shell state
+ * @return Exit status
+ */
+using BuiltinFunction = int (*)(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Readline generator used to complete a builtin's arguments
+ * (same contract as readline's rl_compentry_func_t)
+ */
+using BuiltinCompleter = char *(*)(const char *text, int state);
+
+/**
+ * Registry entry describing one builtin
+ */
+struct BuiltinInfo
+{
+  const char *name;           // Command name
+  BuiltinFunction function;   // Entry point
+  unsigned flags;             // BuiltinFlags
+  BuiltinCompleter completer; // Argument completion (nullptr for filenames)
+};
+
+/**
+ * Look up a builtin by name.
+ * Core builtins live in a perfect-hash table computed at compile time;
+ * builtins added with register_builtin() are checked afterwards.
+ * @param name Command name
+ * @return Registry entry, or nullptr if name is not a builtin
+ */
+const BuiltinInfo *find_builtin(std::string_view name);
+
+/**
+ * Check whether a command name is a builtin
+ * @param name Command name
+ * @return true if find_builtin() would succeed
+ */
+bool is_builtin(std::string_view name);
+
+/**
+ * Register an additional builtin at runtime
+ * @param info Entry to add; the name is copied
+ * @return false if a builtin with that name already exists
+ */
+bool register_builtin(const BuiltinInfo &info);
+
+/**
+ * List every builtin, sorted by name
+ * @return Pointers to all registry entries
+ */
+std::vector<const BuiltinInfo *> list_builtins();
+
+#endif // BUILTIN_REGISTRY_H
@@ -1,47 +1,205 @@
 #ifndef BUILTINS_H
 #define BUILTINS_H
 
-#include <string>
-#include <vector>
-#include <set>
+#include "include/command_parser.h"
+
+struct ShellContext;
+
+// Every builtin has the BuiltinFunction signature (see builtin_registry.h):
+// it receives its arguments (including its own name as first element) and
+// the shell state, and returns an exit status. Redirections are applied by
+// the caller before the builtin runs.
 
 /**
- * Execute the echo builtin command
- * @param args Vector of arguments (including "echo" as first element)
- * @param redirect_file Filename to redirect output to (empty for no redirection)
- * @param redirect_stderr If true, redirect stderr; if false, redirect stdout
- * @param append_mode If true, append to file; if false, truncate file
+ * Execute the echo builtin command: print arguments separated by spaces
  */
-void builtin_echo(const std::vector<std::string> &args,
-                  const std::string &redirect_file = "",
-                  bool redirect_stderr = false,
-                  bool append_mode = false);
+int builtin_echo(const ArgList &args, ShellContext &ctx);
 
 /**
  * Execute the pwd builtin command
  */
-void builtin_pwd();
+int builtin_pwd(const ArgList &args, ShellContext &ctx);
 
 /**
  * Execute the cd builtin command
- * @param path Directory to change to (empty string means HOME)
- * @return true if successful, false otherwise
+ * Changes to args[1], or to HOME when no directory is given; records the
+ * visit for z. "cd -j terms" jumps like z.
+ * @return 0 if successful, 1 otherwise
  */
-bool builtin_cd(const std::string &path);
+int builtin_cd(const ArgList &args, ShellContext &ctx);
 
 /**
- * Execute the type builtin command
- * @param arg Command name to check
- * @param builtins Set of builtin command names
+ * Execute the type builtin command: report whether each argument is a
+ * builtin or an executable in PATH
  */
-void builtin_type(const std::string &arg, const std::set<std::string> &builtins);
+int builtin_type(const ArgList &args, ShellContext &ctx);
 
 /**
  * Execute the history builtin command
- * @param args Vector of arguments (including "history" as first element)
- * @param history_offset Reference to the history offset counter
- * @return true if shell should continue, false if should exit
+ * Lists history, or reads/writes/appends the history file with -r/-w/-a.
+ * Loads a pending history file first (see shell_history.h).
+ */
+int builtin_history(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the exit builtin command
+ * Sets ctx.exit_requested; the optional argument is the exit status
+ */
+int builtin_exit(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the return builtin command: end the running function.
+ * Sets ctx.return_requested; the optional argument is the function's
+ * status (default $?)
+ * @return The function's status, or 1 outside a function
+ */
+int builtin_return(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the exec builtin command: "exec 3>>file" keeps its redirections
+ * open in the shell (3>&- closes one again); "exec command args" replaces
+ * the shell with the command.
+ * @return 0 without a command, 127 if it is not found, 126 if it cannot run
+ */
+int builtin_exec(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the read builtin command: read one line from stdin into variables
+ * Supports -r (raw mode); remaining arguments are variable names, the last
+ * one receiving the rest of the line (default REPLY)
+ * @return 0 if a full line was read, 1 at end of input or on error
+ */
+int builtin_read(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the export builtin command
+ * Each argument is NAME or NAME=value; with no arguments the exported
+ * environment is listed
+ * @return 0 on success, 1 if a name was invalid
+ */
+int builtin_export(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the alias builtin command
+ * NAME=value defines an alias, NAME prints it; with no arguments all
+ * aliases are listed
+ * @return 0 on success, 1 if a name was not found
+ */
+int builtin_alias(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the unalias builtin command: remove each named alias
+ * @return 0 on success, 1 if a name was not found
+ */
+int builtin_unalias(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the z builtin command: change to the most frecent recorded
+ * directory matching the arguments (see frecency.h)
+ * With -l, or no arguments, matches are listed with their scores instead.
+ * @return 0 on success, 1 if nothing matched
+ */
+int builtin_z(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the listdir builtin command: list directories fast, for ones
+ * with millions of entries. Entries are streamed unsorted in on-disk order
+ * without stat (see dir_reader.h). -a includes hidden entries, -F appends
+ * a type indicator from d_type, -l adds mode, size and mtime from statx
+ * calls batched across threads.
+ * @return 0 on success, 1 if a directory could not be read
+ */
+int builtin_listdir(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the ulimit builtin command: show or set a resource limit for the
+ * programs the shell starts (-c -d -f -m -n -s -t -u -v, -f by default;
+ * sizes in KiB). -a shows every limit. The shell itself is not limited.
+ * @return 0 on success, 1 for an invalid value or one above the hard limit
+ */
+int builtin_ulimit(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the limit builtin command: run each following job in its own
+ * cgroup (see job_limits.h). "limit on" only reports usage, "limit
+ * cpu=50% memory=512M pids=100" also caps it, "limit off" stops, and no
+ * arguments show the current mode.
+ * @return 0 on success, 1 if cgroups cannot be used, 2 for bad arguments
+ */
+int builtin_limit(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the sched builtin command: CPU affinity, nice value and I/O
+ * priority for the programs the shell starts, applied between fork and
+ * exec (see job_limits.h). "sched cpus=0-3 nice=10 io=idle" sets them for
+ * every following job, "sched spread=on" pins each pipeline stage to its
+ * own core, "sched off" resets everything, and "sched SETTING... -- command"
+ * applies the settings to one command (or one pipeline stage) only.
+ * @return 0 on success, 2 for an invalid setting, else the command's status
+ */
+int builtin_sched(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the true builtin command
+ * @return 0
+ */
+int builtin_true(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the false builtin command
+ * @return 1
+ */
+int builtin_false(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the test builtin command, also run as "[" (which requires a
+ * closing "]"). Expressions follow POSIX, including its rules by argument
+ * count, -a/-o/!/parentheses, and the common -nt, -ot, -ef, == and <, >.
+ * @return 0 if the expression is true, 1 if false, 2 on a syntax error
+ */
+int builtin_test(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the printf builtin command: POSIX printf, with the format reused
+ * until the arguments are consumed, %b escapes and * widths
+ * @return 0 on success, 1 if an argument was not a valid number
+ */
+int builtin_printf(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the enable builtin command: "enable -f plugin.so [name ...]"
+ * loads builtins from a plugin (see shell_plugin.h); without arguments the
+ * builtins are listed, with the plugin each was loaded from.
+ * @return 0 on success, 1 if the plugin or a builtin could not be loaded
+ */
+int builtin_enable(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the set builtin command: "set -o NAME" / "set +o NAME" turn a
+ * shell option (pipefail, fusefilters) on or off, "set -o" lists them and
+ * "set -- arg ..." replaces the positional parameters.
+ * @return 0 on success, 1 for an unknown option, 2 for bad usage
+ */
+int builtin_set(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the timeout builtin command: "timeout [-s SIG] [-k DURATION]
+ * [--foreground] DURATION command [arg ...]" runs the command and signals
+ * its process group if it is still running after DURATION (seconds, or
+ * with an s, m, h or d suffix; 0 means no limit).
+ * See execute_with_timeout().
+ * @return The command's status, 124 on timeout, 125 if timeout failed
+ */
+int builtin_timeout(const ArgList &args, ShellContext &ctx);
+
+/**
+ * Execute the profile builtin command: "profile [-o FILE] [-f chrome|folded]
+ * command [arg ...]" runs the command and records every process it starts,
+ * with start and exit times, parent, command line and CPU time, as a
+ * Chrome trace (default FILE profile.json) or folded stacks for
+ * flamegraph.pl (default FILE profile.folded). See execute_profiled().
+ * @return The command's status, 125 if profiling failed
  */
-bool builtin_history(const std::vector<std::string> &args, int &history_offset);
+int builtin_profile(const ArgList &args, ShellContext &ctx);
 
 #endif // BUILTINS_H
@@ -0,0 +1,46 @@
+#ifndef CHILD_PROCESS_H
+#define CHILD_PROCESS_H
+
+#include <chrono>
+#include <cstddef>
+#include <sys/types.h>
+
+/**
+ * A forked child the shell waits for
+ */
+struct ChildProcess
+{
+  pid_t pid;
+  int pidfd;   // From pidfd_open(), or -1 where the kernel lacks it
+  bool exited; // Reaped by wait_children()
+  int status;  // Wait status once exited (see waitpid)
+};
+
+/**
+ * Start tracking a forked child through a pidfd
+ * @param pid Process ID returned by fork()
+ * @return Child record for wait_children(); close it with release_child()
+ */
+ChildProcess track_child(pid_t pid);
+
+/**
+ * Wait until the children have exited, sleeping in poll() on their
+ * pidfds. Only these processes are reaped; other children of the shell
+ * are left alone.
+ * @param children Children to wait for; exited and status are filled in
+ * @param count Number of children
+ * @param deadline Stop waiting at this time; nullptr waits until all have
+ *                 exited. Ignored for children without a pidfd, which are
+ *                 waited for with a blocking waitpid().
+ * @return true if all children have exited, false if the deadline passed
+ */
+bool wait_children(ChildProcess *children, size_t count,
+                   const std::chrono::steady_clock::time_point *deadline = nullptr);
+
+/**
+ * Close a child's pidfd
+ * @param child Child from track_child()
+ */
+void release_child(ChildProcess &child);
+
+#endif // CHILD_PROCESS_H
@@ -1,30 +1,72 @@
 #ifndef COMMAND_EXECUTOR_H
 #define COMMAND_EXECUTOR_H
 
+#include <chrono>
 #include <string>
 #include <vector>
-#include <set>
+#include "include/command_parser.h"
+#include "include/process_profile.h"
 
 /**
- * Execute an external command with optional output redirection
+ * Execute an external command with optional redirections
  * @param path Full path to the executable
  * @param args Vector of command arguments (including program name as first element)
- * @param redirect_file Filename to redirect output to (empty for no redirection)
- * @param redirect_stderr If true, redirect stderr; if false, redirect stdout
- * @param append_mode If true, append to file; if false, truncate file
+ * @param redirections Redirections to apply in the child (see redirection.h)
+ * @return Exit status of the command (128 + signal number if it was killed)
  */
-void execute_command(const std::string &path,
-                     const std::vector<std::string> &args,
-                     const std::string &redirect_file = "",
-                     bool redirect_stderr = false,
-                     bool append_mode = false);
+int execute_command(const std::pmr::string &path,
+                    const ArgList &args,
+                    const std::pmr::vector<Redirection> &redirections = {});
 
 /**
  * Execute a pipeline of commands
  * @param commands Vector of command strings to execute in a pipeline
- * @param builtins Set of builtin command names
+ * @param stage_statuses If not null, receives the exit status of each stage
+ * @return Exit status of the last command in the pipeline; with the
+ *         pipefail option, of the last command that failed
  */
-void execute_pipeline(const std::vector<std::string> &commands,
-                      const std::set<std::string> &builtins);
+int execute_pipeline(const std::vector<std::string> &commands, std::vector<int> *stage_statuses = nullptr);
+
+/**
+ * Run a command with a time limit (the timeout builtin). The command is
+ * forked into its own process group, which gets the terminal while it runs;
+ * the shell sleeps on the child's pidfd until it exits or the deadline
+ * passes, then signals the whole group.
+ * @param args Command and arguments (a program, function or builtin)
+ * @param duration Time limit
+ * @param signo Signal sent when the limit is reached
+ * @param kill_after If positive, send SIGKILL this long after signo
+ * @param foreground Leave the command in the shell's process group; only
+ *                   the command itself is signalled, not its children
+ * @return Exit status of the command, 124 if it timed out, 137 if it had
+ *         to be killed with SIGKILL
+ */
+int execute_with_timeout(const ArgList &args, std::chrono::nanoseconds duration, int signo,
+                         std::chrono::nanoseconds kill_after, bool foreground);
+
+/**
+ * Run a command under the process-tree profiler (the profile builtin). A
+ * forked profiler process becomes a child subreaper, forks the command in
+ * the shell's process group and follows it and every descendant until all
+ * have exited (see profile_descendants), then writes the profile and a
+ * summary on stderr. Ctrl+C interrupts the command; the profile is still
+ * written, without waiting for descendants that survive it.
+ * @param args Command and arguments (a program, function or builtin)
+ * @param output File to write
+ * @param format Format of the file
+ * @return Exit status of the command, 127 if it was not found, 125 if the
+ *         profiler failed
+ */
+int execute_profiled(const ArgList &args, const std::string &output, ProfileFormat format);
+
+/**
+ * Run command substitutions: each command runs in a forked subshell with
+ * stdout on a pipe. All commands run concurrently; their output is read in
+ * large chunks as it arrives and trailing newlines are removed.
+ * @param commands Command texts (script source)
+ * @param outputs Receives the output of each command
+ * @return Exit status of the last command
+ */
+int capture_output(const std::vector<std::string> &commands, std::vector<std::string> &outputs);
 
 #endif // COMMAND_EXECUTOR_H
@@ -0,0 +1,77 @@
+#ifndef COMMAND_INDEX_H
+#define COMMAND_INDEX_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <ostream>
+#include <ctime>
+
+/**
+ * One PATH directory covered by the executable index, with the
+ * modification time it had when it was scanned
+ */
+struct IndexedDir
+{
+  std::string path;
+  struct timespec mtime;
+};
+
+/**
+ * Get the names of all executables reachable through PATH.
+ * The index is built on first use and rebuilt only when PATH or the
+ * modification time of one of its directories changes.
+ * @return Sorted, de-duplicated executable names
+ */
+const std::vector<std::string> &executable_names();
+
+/**
+ * Get the directories the current index was built from
+ * @return Scanned directories (empty if the index has not been built)
+ */
+const std::vector<IndexedDir> &indexed_directories();
+
+/**
+ * Get the PATH value the current index was built from
+ * @return PATH at the time of the last scan
+ */
+const std::string &indexed_path();
+
+/**
+ * Install a previously saved index (see rc_file.h) instead of scanning PATH.
+ * It is validated like a scanned index: a PATH or directory change causes
+ * a rescan on the next use.
+ * @param path_env PATH value the index was built from
+ * @param dirs Directories with their modification times at scan time
+ * @param names Sorted, de-duplicated executable names
+ */
+void restore_command_index(const std::string &path_env, std::vector<IndexedDir> dirs,
+                           std::vector<std::string> names);
+
+/**
+ * Compute the Levenshtein distance between two strings.
+ * Uses a bit-parallel algorithm (one machine word per column) when the
+ * first string is at most 64 characters long.
+ * @param a First string
+ * @param b Second string
+ * @return Minimum number of single-character edits turning a into b
+ */
+int edit_distance(std::string_view a, std::string_view b);
+
+/**
+ * Suggest executables and builtins with names close to a mistyped command
+ * @param name The command that was not found
+ * @param max_suggestions Maximum number of names to return
+ * @return Closest names, best match first (empty if nothing is close)
+ */
+std::vector<std::string> suggest_commands(std::string_view name,
+                                          size_t max_suggestions = 3);
+
+/**
+ * Print the "command not found" message followed by any suggestions
+ * @param name The command that was not found
+ * @param out Stream to print to
+ */
+void report_command_not_found(std::string_view name, std::ostream &out);
+
+#endif // COMMAND_INDEX_H
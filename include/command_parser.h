@@ -2,33 +2,94 @@
 #define COMMAND_PARSER_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <memory_resource>
 
 /**
- * Parse a command string into individual arguments, handling quotes and escapes
+ * Argument list; strings and storage come from one memory resource
+ * (usually the per-line arena, see arena.h)
+ */
+using ArgList = std::pmr::vector<std::pmr::string>;
+
+/**
+ * Parse a command string into individual arguments, handling quotes and escapes.
+ * $(...) and `...` are replaced by the output of the command; all
+ * substitutions of the string run concurrently (see capture_output()) and
+ * do not change $?, so $? expands to the status of the previous command.
  * @param command The command string to parse
+ * @param mem Memory resource for the returned arguments
+ * @param expand_aliases Replace an alias in the first word by its value
+ *                       (for command lines, not for other word lists)
+ * @param substitution_status Receives the exit status of the last command
+ *                            substitution, if there was one
  * @return Vector of parsed arguments
  */
-std::vector<std::string> parse_args(const std::string &command);
+ArgList parse_args(std::string_view command,
+                   std::pmr::memory_resource *mem = std::pmr::get_default_resource(),
+                   bool expand_aliases = false,
+                   int *substitution_status = nullptr);
+
+/**
+ * Measure a command substitution, so scanners can skip over separators and
+ * quotes inside it
+ * @param text Text containing the substitution
+ * @param pos Position of its "$(" or opening backquote
+ * @return Length including the delimiters, or 0 if it is not terminated
+ */
+size_t substitution_length(std::string_view text, size_t pos);
+
+/**
+ * One redirection operator and its target
+ */
+struct Redirection
+{
+  enum Kind
+  {
+    READ,      // N<file
+    WRITE,     // N>file
+    APPEND,    // N>>file
+    DUPLICATE, // N>&M or N<&M
+    CLOSE,     // N>&- or N<&-
+  };
+
+  Kind kind;
+  int fd;                    // Descriptor being redirected (0-9)
+  int source_fd;             // DUPLICATE: descriptor copied onto fd
+  std::pmr::string filename; // READ, WRITE, APPEND: file to open
+
+  Redirection(Kind kind, int fd, std::pmr::memory_resource *mem)
+      : kind(kind), fd(fd), source_fd(-1), filename(mem)
+  {
+  }
+};
 
 /**
- * Struct to hold information about output redirection
+ * Struct to hold the redirections of a command
  */
 struct RedirectInfo
 {
-  bool has_redirect;    // true if redirection found
-  std::string command;  // command without redirection part
-  std::string filename; // filename to redirect to
-  bool redirect_stderr; // true if 2> or 2>>, false if 1> or > or 1>> or >>
-  bool append_mode;     // true if >> or 1>> or 2>>, false if > or 1> or 2>
+  bool has_redirect;                           // true if redirection found
+  std::pmr::string command;                    // command without redirection part
+  std::pmr::vector<Redirection> redirections; // in the order they are applied
+  std::pmr::string error;                      // non-empty if a redirection is malformed
+
+  explicit RedirectInfo(std::pmr::memory_resource *mem = std::pmr::get_default_resource())
+      : has_redirect(false), command(mem), redirections(mem), error(mem)
+  {
+  }
 };
 
 /**
- * Parse redirection operators from a command
+ * Parse redirection operators from a command: [N]>file, [N]>>file,
+ * [N]<file, [N]>&M, [N]<&M and [N]>&- / [N]<&- (close). N is a single
+ * digit; without it > redirects stdout and < stdin.
  * @param full_command The full command string potentially containing redirection
+ * @param mem Memory resource for the strings in the result
  * @return RedirectInfo structure with parsed redirection information
  */
-RedirectInfo parse_redirect(const std::string &full_command);
+RedirectInfo parse_redirect(std::string_view full_command,
+                            std::pmr::memory_resource *mem = std::pmr::get_default_resource());
 
 /**
  * Parse a command into pipeline segments (split by |)
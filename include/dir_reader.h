@@ -0,0 +1,45 @@
+#ifndef DIR_READER_H
+#define DIR_READER_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+/**
+ * Called for each entry read by read_directory()
+ * @param name Entry name (valid only during the call)
+ * @param type d_type of the entry (DT_DIR, DT_REG, ..., or DT_UNKNOWN)
+ * @return false to stop reading
+ */
+using DirEntryVisitor = std::function<bool(std::string_view name, unsigned char type)>;
+
+/**
+ * Read a directory's entries in on-disk order with getdents64 and large
+ * buffers, without stat()ing anything. "." and ".." are skipped.
+ * @param dir_fd Open directory descriptor (its offset is advanced)
+ * @param visit Visitor for each entry
+ * @return false if reading failed or the visitor stopped early
+ */
+bool read_directory(int dir_fd, const DirEntryVisitor &visit);
+
+/**
+ * Open a directory and read it with read_directory()
+ * @param path Directory path
+ * @param visit Visitor for each entry
+ * @return false if the directory could not be opened or read, or the
+ *         visitor stopped early
+ */
+bool read_directory(const std::string &path, const DirEntryVisitor &visit);
+
+/**
+ * Check whether an entry is a directory, trusting d_type and falling back
+ * to stat for DT_UNKNOWN (some filesystems) and, if asked, symlinks
+ * @param dir_fd Directory containing the entry
+ * @param name Entry name
+ * @param type d_type from read_directory()
+ * @param follow_links true to count symlinks to directories
+ * @return true for a directory
+ */
+bool entry_is_directory(int dir_fd, std::string_view name, unsigned char type, bool follow_links);
+
+#endif // DIR_READER_H
@@ -0,0 +1,28 @@
+#ifndef DIR_WALKER_H
+#define DIR_WALKER_H
+
+#include <functional>
+#include <string>
+#include <string_view>
+
+/**
+ * Called for each directory found by walk_directories(), concurrently from
+ * several threads
+ * @param path Directory path relative to the walk's root
+ * @return false to stop the walk
+ */
+using DirectoryVisitor = std::function<bool(std::string_view path)>;
+
+/**
+ * Visit every directory below root.
+ * The tree is walked by a pool of threads that steal work from each other,
+ * skipping hidden directories and anything matched by .gitignore files.
+ * Completed walks are cached per root and reused while the modification
+ * time of every directory in the tree is unchanged.
+ * @param root Directory to start from
+ * @param visit Visitor for each directory (not called for root itself)
+ * @return true if the whole tree was visited, false if the visitor stopped it
+ */
+bool walk_directories(const std::string &root, const DirectoryVisitor &visit);
+
+#endif // DIR_WALKER_H
@@ -0,0 +1,61 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <chrono>
+#include <functional>
+
+/**
+ * Work run by the event loop on the main thread
+ */
+using EventCallback = std::function<void()>;
+
+/**
+ * Create the event loop (an epoll instance). Call once, before anything is
+ * watched; until then posted callbacks are only queued.
+ * @return true if the loop is usable
+ */
+bool init_event_loop();
+
+/**
+ * Call a function whenever a descriptor becomes readable
+ * @param fd Descriptor to watch (replaces an earlier watch of the same fd)
+ * @param on_readable Called on the main thread; must consume the input
+ */
+void watch_input(int fd, EventCallback on_readable);
+
+/**
+ * Stop watching a descriptor
+ * @param fd Descriptor passed to watch_input()
+ */
+void unwatch_input(int fd);
+
+/**
+ * Deliver a signal through the loop instead of a signal handler.
+ * The signal is blocked and read from a signalfd, so the callback may do
+ * anything. exec_image() unblocks it again for programs the shell starts.
+ * @param signo Signal number (e.g. SIGCHLD, SIGWINCH)
+ * @param on_signal Called on the main thread after the signal arrived
+ */
+void watch_signal(int signo, EventCallback on_signal);
+
+/**
+ * Call a function periodically while the loop runs (a timerfd). Expiries
+ * missed while the loop was not running collapse into one call.
+ * @param interval Time between calls
+ * @param on_expire Called on the main thread
+ */
+void add_timer(std::chrono::milliseconds interval, EventCallback on_expire);
+
+/**
+ * Hand work to the main thread; safe to call from any thread
+ * @param callback Run by the loop in the order posted
+ */
+void post_event(EventCallback callback);
+
+/**
+ * Dispatch events until a callback sets stop
+ * @param stop Checked after every batch of events
+ */
+void run_event_loop(const bool &stop);
+
+#endif // EVENT_LOOP_H
@@ -0,0 +1,47 @@
+#ifndef EXEC_IMAGE_H
+#define EXEC_IMAGE_H
+
+#include "include/command_parser.h"
+
+/**
+ * Everything execve needs for one command, built in the parent before fork
+ * so the child only indexes into memory it already has.
+ */
+struct ExecImage
+{
+  const char *path; // Full path to the executable
+  char **argv;      // Null-terminated; argv[-1] is reserved for the ENOEXEC fallback
+  char **envp;      // Shared, cached environment block
+};
+
+/**
+ * Build the argv block for a command (one allocation for the pointers and
+ * one for the strings) and attach the cached environment
+ * @param path Full path to the executable
+ * @param args Vector of command arguments (including program name as first element)
+ * @param mem Memory resource for the argv block
+ * @return Image ready to pass to exec_image()
+ */
+ExecImage build_exec_image(const std::pmr::string &path,
+                           const ArgList &args,
+                           std::pmr::memory_resource *mem);
+
+/**
+ * Replace the current process with the command (call in the child after fork).
+ * Files without a #! line that the kernel rejects with ENOEXEC are run as
+ * shell scripts with /bin/sh, reusing the already-resolved path. Signals
+ * blocked for the event loop (see event_loop.h) are unblocked first, and ulimit
+ * limits and sched settings (see job_limits.h) applied.
+ * Only async-signal-safe calls are made; returns only if execve failed.
+ * @param image Image from build_exec_image()
+ */
+void exec_image(const ExecImage &image);
+
+/**
+ * Get the environment block passed to child processes.
+ * The block is rebuilt only when the exported environment has changed.
+ * @return Null-terminated array of NAME=value strings
+ */
+char **exec_environment();
+
+#endif // EXEC_IMAGE_H
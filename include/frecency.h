@@ -0,0 +1,42 @@
+#ifndef FRECENCY_H
+#define FRECENCY_H
+
+#include <string>
+#include <vector>
+
+/**
+ * A directory ranked by frecency (frequency weighted by recency)
+ */
+struct FrecencyEntry
+{
+  std::string path;
+  double score;
+};
+
+/**
+ * Choose the frecency database and whether cd records visits in it.
+ * Without a call, the database is ~/.shell_frecency and nothing is recorded.
+ * @param path Database file
+ * @param record_visits true to record directory changes (interactive shells)
+ */
+void set_frecency_database(const std::string &path, bool record_visits);
+
+/**
+ * Record a visit to a directory.
+ * Each visit is one O_APPEND write of a self-describing record, so any
+ * number of shells can record into the same database without locking.
+ * Does nothing unless visits are being recorded.
+ * @param dir Absolute directory path
+ */
+void record_directory_visit(const std::string &dir);
+
+/**
+ * Rank the recorded directories that match a list of terms.
+ * A directory matches when the terms appear in its path in order, the last
+ * one after the last '/' (case-insensitive unless a term has uppercase).
+ * @param terms Search terms (empty matches every directory)
+ * @return Matching directories, best first
+ */
+std::vector<FrecencyEntry> rank_directories(const std::vector<std::string> &terms);
+
+#endif // FRECENCY_H
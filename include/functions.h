@@ -0,0 +1,116 @@
+#ifndef FUNCTIONS_H
+#define FUNCTIONS_H
+
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "include/command_parser.h"
+#include "include/name_table.h"
+#include "include/script.h"
+
+/**
+ * A simple command of a function body, with the parts that are the same on
+ * every call worked out when the function is defined
+ */
+struct PreparedCommand
+{
+  RedirectInfo redirect;   // Redirections and the command text without them
+  bool fixed_args = false; // args holds the words: the command has no expansions
+  ArgList args;            // Words of the command, if fixed_args
+};
+
+/**
+ * A shell function: its parsed body and the source text the body points into
+ */
+struct FunctionDef
+{
+  std::string source; // Body source; owns the text of every node in body
+  ScriptNode body;    // Parsed body (heap allocated, outlives the line arena)
+  std::vector<std::unique_ptr<PreparedCommand>> prepared; // Of body's nodes
+};
+
+/**
+ * Define or replace a shell function.
+ * The body tree is copied out of the line arena once, so calls never parse,
+ * and its simple commands are tokenized once (see PreparedCommand): a call
+ * only parses again the commands that contain $ or command substitutions.
+ * @param name Function name
+ * @param body Parsed body (a LIST node)
+ */
+void define_function(std::string_view name, const ScriptNode &body);
+
+/**
+ * Look up a shell function
+ * @param name Function name
+ * @return The definition (kept alive while the caller holds it, even if the
+ *         function is redefined meanwhile), or nullptr
+ */
+std::shared_ptr<const FunctionDef> find_function(std::string_view name);
+
+/**
+ * Run a function with args[1..] as its positional parameters
+ * @param fn Function to run
+ * @param args Command words (args[0] is the function name)
+ * @param ctx Shell state
+ * @return Exit status of the last command in the body, or the status
+ *         given to return
+ */
+int call_function(const FunctionDef &fn, const ArgList &args, ShellContext &ctx);
+
+/**
+ * Check whether a function body is running (return is only allowed there)
+ */
+bool in_function();
+
+/**
+ * List the names of all functions, sorted
+ * @return Function names
+ */
+std::vector<std::string> list_functions();
+
+/**
+ * Define or replace an alias
+ * @param name Alias name
+ * @param value Replacement text for the command word
+ */
+void set_alias(std::string_view name, std::string_view value);
+
+/**
+ * Look up an alias
+ * @param name Alias name
+ * @return The alias value (stable until the alias is changed), or nullptr
+ */
+const std::string *find_alias(std::string_view name);
+
+/**
+ * Remove an alias
+ * @param name Alias name
+ * @return false if no such alias exists
+ */
+bool unset_alias(std::string_view name);
+
+/**
+ * List all aliases sorted by name
+ * @return (name, value) pairs
+ */
+std::vector<std::pair<std::string, std::string>> list_aliases();
+
+/**
+ * Function and alias definitions of a shell instance that is not running
+ * (see libshell.h)
+ */
+struct FunctionScope
+{
+  NameTable<std::shared_ptr<const FunctionDef>> functions;
+  NameTable<std::string> aliases;
+};
+
+/**
+ * Exchange the live function and alias definitions with a saved set
+ * @param scope Definitions to install; receives the ones they replace
+ */
+void swap_function_scope(FunctionScope &scope);
+
+#endif // FUNCTIONS_H
@@ -0,0 +1,18 @@
+#ifndef FUZZY_MATCH_H
+#define FUZZY_MATCH_H
+
+#include <string_view>
+
+/**
+ * Score how well a pattern matches a candidate, in the style of fzf.
+ * The pattern's characters must appear in the candidate in order; matches
+ * at the start of words or path components and consecutive runs score
+ * higher, gaps lower. Matching is case-insensitive unless the pattern
+ * contains an uppercase letter.
+ * @param pattern Text typed by the user
+ * @param candidate String to score
+ * @return Score (higher is better), or -1 if the pattern does not match
+ */
+int fuzzy_score(std::string_view pattern, std::string_view candidate);
+
+#endif // FUZZY_MATCH_H
@@ -0,0 +1,168 @@
+#ifndef JOB_LIMITS_H
+#define JOB_LIMITS_H
+
+#include <string>
+#include <sys/resource.h>
+#include <sched.h>
+
+/**
+ * Set a resource limit for every program the shell starts from now on
+ * (ulimit). The shell itself is not limited; the limit is applied in each
+ * child just before exec.
+ * @param resource RLIMIT_* constant
+ * @param value New soft and hard limit (RLIM_INFINITY for none)
+ * @return false if the limit would exceed the shell's hard limit
+ */
+bool set_job_rlimit(int resource, rlim_t value);
+
+/**
+ * Get the limit programs started by the shell run with
+ * @param resource RLIMIT_* constant
+ * @return Soft limit set with set_job_rlimit(), else the shell's own
+ */
+rlim_t get_job_rlimit(int resource);
+
+/**
+ * Apply the limits from set_job_rlimit() to the calling process.
+ * Async-signal-safe; called in forked children before exec.
+ */
+void apply_job_rlimits();
+
+/**
+ * Limits for jobs run in cgroups; empty fields are not limited
+ */
+struct CgroupLimits
+{
+  std::string cpu_max;    // cpu.max value, e.g. "50000 100000"
+  std::string memory_max; // memory.max value in bytes
+  std::string pids_max;   // pids.max value
+};
+
+/**
+ * Run every following job in its own transient cgroup v2 under the
+ * shell's cgroup (or $SHELL_CGROUP), with the given limits, and report its
+ * cpu.stat and memory.peak when it finishes.
+ * @param limits Limits written into each job's cgroup
+ * @param error Set to the reason when cgroups cannot be used
+ * @return true if enabled
+ */
+bool enable_job_cgroups(const CgroupLimits &limits, std::string &error);
+
+/**
+ * Stop putting jobs into cgroups
+ */
+void disable_job_cgroups();
+
+/**
+ * Describe the cgroup mode for the limit builtin
+ * @return "off", or the parent cgroup and limits in use
+ */
+std::string describe_job_cgroups();
+
+/**
+ * Scheduling settings for programs the shell starts (sched builtin);
+ * fields without their has_ flag are inherited from the shell
+ */
+struct JobSched
+{
+  bool has_cpus = false;
+  cpu_set_t cpus;       // CPU affinity (sched_setaffinity)
+  bool has_nice = false;
+  int nice = 0;         // Absolute nice value (setpriority)
+  bool has_ioprio = false;
+  int ioprio = 0;       // I/O class and level (ioprio_set)
+  bool spread = false;  // Pin each pipeline stage to its own core
+};
+
+/**
+ * Parse one sched setting: cpus=LIST (e.g. 0-3,6), nice=N (-20..19),
+ * io=CLASS[:LEVEL] (idle, be:0-7, rt:0-7) or spread=on|off
+ * @param word Setting as written
+ * @param sched Settings to update
+ * @param error Set to the reason when the setting is invalid
+ * @return false for an invalid setting
+ */
+bool parse_job_sched(const std::string &word, JobSched &sched, std::string &error);
+
+/**
+ * Get the scheduling settings in effect
+ * @return Settings from set_job_sched()
+ */
+const JobSched &get_job_sched();
+
+/**
+ * Replace the scheduling settings for programs started from now on
+ * @param sched New settings
+ */
+void set_job_sched(const JobSched &sched);
+
+/**
+ * Describe the scheduling settings for the sched builtin
+ * @return "default", or the settings as sched would accept them
+ */
+std::string describe_job_sched();
+
+/**
+ * Apply the settings from set_job_sched() to the calling process, unless
+ * enter_pipeline_stage() already did. Failures (for example raising the
+ * priority without privileges) are ignored.
+ * Async-signal-safe; called in forked children before exec.
+ */
+void apply_job_sched();
+
+/**
+ * Choose a CPU for each stage of a pipeline about to start. With spread
+ * on, stages go to distinct physical cores of the allowed CPUs (SMT
+ * siblings only once every core has a stage), wrapping around.
+ * @param count Number of stages
+ * @param cpus Receives a CPU per stage, or -1 for no placement
+ */
+void plan_pipeline_cpus(int count, int *cpus);
+
+/**
+ * Apply the scheduling settings in a pipeline stage's child, pinned to its
+ * planned CPU; builtins and loops running in the stage are covered too
+ * @param cpu CPU from plan_pipeline_cpus(), or -1
+ */
+void enter_pipeline_stage(int cpu);
+
+/**
+ * Check whether children need per-job setup (limits, a cgroup or
+ * scheduling settings), which the spawn helper cannot do
+ * @return true if ulimit, cgroup mode or sched settings are in effect
+ */
+bool job_limits_active();
+
+/**
+ * A job's transient cgroup; path is empty when cgroups are off
+ */
+struct JobCgroup
+{
+  std::string path;
+  int procs_fd = -1; // cgroup.procs, written by the job's processes
+};
+
+/**
+ * Create the cgroup for a job about to start. Does nothing when cgroups
+ * are off or the shell is itself running inside a job.
+ * @param job Receives the cgroup
+ * @return false if the cgroup could not be set up (reported on stderr);
+ *         the job must not be run unconfined
+ */
+bool start_job_cgroup(JobCgroup &job);
+
+/**
+ * Move the calling process into the job's cgroup.
+ * Async-signal-safe; called in forked children before exec.
+ * @param job Cgroup from start_job_cgroup()
+ */
+void enter_job_cgroup(const JobCgroup &job);
+
+/**
+ * After the job's processes were reaped: report the cgroup's statistics
+ * on stderr, kill anything left behind and remove the cgroup
+ * @param job Cgroup from start_job_cgroup()
+ */
+void finish_job_cgroup(JobCgroup &job);
+
+#endif // JOB_LIMITS_H
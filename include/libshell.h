@@ -0,0 +1,161 @@
+#ifndef LIBSHELL_H
+#define LIBSHELL_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include "include/functions.h"
+#include "include/script.h"
+#include "include/variables.h"
+
+/**
+ * A shell instance for programs linking libshell (make lib), and the core
+ * of bin/shell itself. Commands run in the calling process like they do in
+ * the interactive shell: builtins, functions and assignments change the
+ * instance, external programs are forked.
+ *
+ * Each instance has its own variables, exported environment, options,
+ * functions, aliases and working directory. The interpreter keeps this
+ * state in the process (environ, the cwd), so only one instance is live at
+ * a time: calling an instance makes it live and parks the previous one.
+ * While an instance is live, the process environment and directory are
+ * its own. Not thread-safe; process-wide settings (ulimit, sched, loaded
+ * plugins) are shared by all instances.
+ *
+ *   Shell sh;
+ *   sh.execute("cd /tmp; export GREETING=hi");
+ *   std::string out;
+ *   int status = sh.capture("echo $GREETING from $(pwd) | tr a-z A-Z", out);
+ */
+class Shell
+{
+public:
+  /**
+   * Create an instance with no shell variables, functions or aliases. Its
+   * environment and working directory are those the process had before
+   * any instance ran.
+   */
+  Shell();
+
+  /**
+   * Destroy the instance; if it is live, the process gets back its own
+   * environment and working directory
+   */
+  ~Shell();
+
+  Shell(const Shell &) = delete;
+  Shell &operator=(const Shell &) = delete;
+
+  /**
+   * Parse command source without running it
+   * @param source The command text (may span several lines)
+   * @param root Receives the parsed tree; it points into source
+   * @param error Receives a message when ERROR is returned
+   * @return Parse status (INCOMPLETE for an unterminated quote or loop)
+   */
+  static ParseStatus parse(std::string_view source, ScriptNode &root, std::string &error);
+
+  /**
+   * Parse and run command source; output goes to the process's stdout and
+   * stderr. Syntax errors are reported on stderr.
+   * @param source The command text
+   * @return Exit status of the last command (2 on syntax error)
+   */
+  int execute(std::string_view source);
+
+  /**
+   * Run a tree from parse()
+   * @param root Parsed command source
+   * @return Exit status of the last command
+   */
+  int execute(const ScriptNode &root);
+
+  /**
+   * Run command source with its output collected in memory. Standard
+   * output (and standard error if err is given) of the shell and every
+   * command it starts go to anonymous files while it runs.
+   * @param source The command text
+   * @param out Receives standard output
+   * @param err Receives standard error, or nullptr to leave it alone
+   * @return Exit status of the last command (2 on syntax error)
+   */
+  int capture(std::string_view source, std::string &out, std::string *err = nullptr);
+
+  /**
+   * Run the shell's config file into this instance (see rc_file.h)
+   * @param path Config file
+   * @param snapshot_path Snapshot file, or empty to always run the file
+   * @return true if the state was restored from the snapshot
+   */
+  bool load_config(const std::string &path, const std::string &snapshot_path = "");
+
+  /**
+   * Exit status of the last command run ($?)
+   */
+  int last_status();
+
+  /**
+   * Set $?, e.g. after a syntax error the caller reported itself
+   * @param status New exit status
+   */
+  void set_last_status(int status);
+
+  /**
+   * Exit statuses of every stage of the last pipeline ($PIPESTATUS)
+   */
+  std::vector<int> pipe_status();
+
+  /**
+   * Check whether the last execute() ran the exit builtin
+   */
+  bool exit_requested() const { return ctx_.exit_requested; }
+
+  /**
+   * Status passed to the exit builtin
+   */
+  int exit_status() const { return ctx_.exit_status; }
+
+  /**
+   * Look up a variable of this instance
+   * @param name Variable name (special parameters are allowed)
+   * @return Value, or empty string if it is not set
+   */
+  std::string variable(const std::string &name);
+
+  /**
+   * Set a variable of this instance
+   * @param name Variable name
+   * @param value New value
+   * @param exported Also export it to commands the instance runs
+   */
+  void set_variable(const std::string &name, const std::string &value, bool exported = false);
+
+  /**
+   * Get the instance's working directory
+   */
+  std::string cwd();
+
+  /**
+   * Change the instance's working directory
+   * @param path Directory, relative to the current one
+   * @return false if the directory could not be entered (errno is set)
+   */
+  bool change_directory(const std::string &path);
+
+private:
+  // Make this instance live, parking the one that was
+  void activate();
+
+  // Exchange the live state with the one kept in the members below
+  void swap_state();
+
+  ShellContext ctx_;
+
+  // While parked: this instance's state. While live: the state it
+  // replaced, which is put back when it is parked again.
+  VariableScope variables_;
+  FunctionScope functions_;
+  std::string directory_;
+};
+
+#endif // LIBSHELL_H
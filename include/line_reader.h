@@ -0,0 +1,68 @@
+#ifndef LINE_READER_H
+#define LINE_READER_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Buffered line reader over a file descriptor.
+ * Reads in large chunks and splits lines with memchr instead of issuing one
+ * read(2) per byte. Bytes read past the last consumed line can be handed
+ * back to the descriptor with release() when it is seekable.
+ */
+class LineReader
+{
+public:
+  explicit LineReader(int fd);
+
+  /**
+   * Read the next line (without the trailing newline)
+   * @param line Receives the line; holds any partial data at end of input
+   * @return true if a newline-terminated line was read, false at end of input
+   */
+  bool read_line(std::string &line);
+
+  /**
+   * Give unconsumed buffered bytes back to the file descriptor.
+   * Seekable descriptors are rewound to the end of the last consumed line;
+   * for pipes and terminals the buffer is kept for the next read_line call.
+   */
+  void release();
+
+  /**
+   * Drop all buffered data without touching the file descriptor
+   */
+  void reset();
+
+  int fd() const { return fd_; }
+
+private:
+  int fd_;
+  std::vector<char> buffer_;
+  size_t start_; // First unconsumed byte
+  size_t end_;   // One past the last buffered byte
+  bool eof_;
+};
+
+/**
+ * Get the shared line reader for a file descriptor.
+ * Every reader of the same descriptor (the read builtin and the
+ * non-interactive command loop) must go through this so they share one buffer.
+ * @param fd File descriptor to read from
+ * @return Reader bound to fd
+ */
+LineReader &line_reader_for(int fd);
+
+/**
+ * Release all shared readers (see LineReader::release).
+ * Called before the shell hands a descriptor to another process.
+ */
+void release_line_readers();
+
+/**
+ * Drop all shared readers' buffers. Used in forked children whose
+ * descriptors have been replaced.
+ */
+void reset_line_readers();
+
+#endif // LINE_READER_H
@@ -0,0 +1,56 @@
+#ifndef LINE_SCAN_H
+#define LINE_SCAN_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+/**
+ * Characters classified per call of classify_block()
+ */
+static const size_t CHAR_CLASS_BLOCK = 64;
+
+/**
+ * Character classes of one block; bit i describes character i
+ */
+struct CharClassMasks
+{
+  uint64_t special; // Metacharacters: ' " \ | < > & ; $ ` and newline
+  uint64_t blank;   // Spaces, which separate words
+};
+
+/**
+ * Classify up to CHAR_CLASS_BLOCK characters at once (AVX2 or SSE2 where
+ * available, otherwise a lookup table). A command line without special
+ * characters is just words separated by spaces.
+ * @param text Start of the block
+ * @param length Number of characters available; only the first
+ *               CHAR_CLASS_BLOCK are classified, bits past the end are zero
+ * @return Masks of special characters and spaces
+ */
+CharClassMasks classify_block(const char *text, size_t length);
+
+/**
+ * Finds the metacharacters of a text in order, so scanners can skip plain
+ * text in bulk. Consecutive lookups within one block reuse its mask.
+ */
+class MetacharacterScanner
+{
+public:
+  explicit MetacharacterScanner(std::string_view text) : text_(text) {}
+
+  /**
+   * Find the next metacharacter
+   * @param pos Position to start at
+   * @return Position of the first special character at or after pos, or
+   *         std::string_view::npos if there is none
+   */
+  size_t next(size_t pos);
+
+private:
+  std::string_view text_;
+  size_t block_start_ = std::string_view::npos;
+  uint64_t special_ = 0;
+};
+
+#endif // LINE_SCAN_H
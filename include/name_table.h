@@ -0,0 +1,119 @@
+#ifndef NAME_TABLE_H
+#define NAME_TABLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * Seeded FNV-1a hash of a command name.
+ * constexpr so the builtin registry can build its perfect hash at compile time.
+ * @param name Name to hash
+ * @param seed Seed mixed into the initial state
+ * @return 32-bit hash
+ */
+constexpr uint32_t name_hash(std::string_view name, uint32_t seed = 0)
+{
+  uint32_t hash = 2166136261u ^ seed;
+  for (char c : name)
+  {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+/**
+ * Hash table from command names to values, looked up by string_view without
+ * building a std::string. Used for everything that can be defined at
+ * runtime under a command name (builtins, functions, aliases).
+ * Entries are heap nodes, so references stay valid until the entry is
+ * replaced or erased.
+ */
+template <typename T>
+class NameTable
+{
+public:
+  struct Entry
+  {
+    std::string name;
+    T value;
+  };
+
+  /**
+   * Look up a name
+   * @param name Name to find
+   * @return The stored value, or nullptr if the name is not defined
+   */
+  T *find(std::string_view name) const
+  {
+    if (entries.empty())
+    {
+      return nullptr;
+    }
+    auto it = entries.find(name);
+    return it != entries.end() ? &it->second->value : nullptr;
+  }
+
+  /**
+   * Define or replace a name
+   * @param name Name to define (copied)
+   * @param value Value to store
+   * @return The stored entry
+   */
+  Entry &set(std::string_view name, T value)
+  {
+    auto it = entries.find(name);
+    if (it != entries.end())
+    {
+      it->second->value = std::move(value);
+      return *it->second;
+    }
+
+    auto entry = std::make_unique<Entry>(Entry{std::string(name), std::move(value)});
+    Entry &stored = *entry;
+    entries.emplace(stored.name, std::move(entry)); // Key views the entry's own name
+    return stored;
+  }
+
+  /**
+   * Remove a name
+   * @param name Name to remove
+   * @return false if the name was not defined
+   */
+  bool erase(std::string_view name)
+  {
+    return entries.erase(name) > 0;
+  }
+
+  /**
+   * List all entries sorted by name
+   * @return Pointers to the entries
+   */
+  std::vector<const Entry *> sorted() const
+  {
+    std::vector<const Entry *> all;
+    for (const auto &entry : entries)
+    {
+      all.push_back(entry.second.get());
+    }
+    std::sort(all.begin(), all.end(),
+              [](const Entry *a, const Entry *b)
+              { return a->name < b->name; });
+    return all;
+  }
+
+private:
+  struct Hash
+  {
+    size_t operator()(std::string_view name) const { return name_hash(name); }
+  };
+
+  std::unordered_map<std::string_view, std::unique_ptr<Entry>, Hash> entries;
+};
+
+#endif // NAME_TABLE_H
@@ -2,27 +2,34 @@
 #define PATH_UTILS_H
 
 #include <string>
+#include <string_view>
 #include <vector>
+#include <memory_resource>
 
 /**
  * Split PATH environment variable into individual directory paths
  * @param path_env The PATH environment variable string
- * @return Vector of directory paths
+ * @param mem Memory resource for the returned vector
+ * @return Vector of directory paths (views into path_env)
  */
-std::vector<std::string> split_path(const std::string &path_env);
+std::pmr::vector<std::string_view> split_path(std::string_view path_env,
+                                              std::pmr::memory_resource *mem = std::pmr::get_default_resource());
 
 /**
  * Check if a file exists and is executable
  * @param filepath Path to the file to check
  * @return true if file is executable, false otherwise
  */
-bool is_executable(const std::string &filepath);
+bool is_executable(const char *filepath);
 
 /**
  * Find an executable program in the system PATH
- * @param program Name of the program to find
+ * @param program Name of the program to find (names containing '/' are
+ *                checked as paths without searching PATH)
+ * @param mem Memory resource for the returned path
  * @return Full path to the program, or empty string if not found
  */
-std::string find_in_path(const std::string &program);
+std::pmr::string find_in_path(std::string_view program,
+                              std::pmr::memory_resource *mem = std::pmr::get_default_resource());
 
 #endif // PATH_UTILS_H
@@ -0,0 +1,25 @@
+#ifndef PLUGINS_H
+#define PLUGINS_H
+
+#include <string>
+#include <vector>
+
+/**
+ * Load a builtin plugin (see shell_plugin.h) and register its builtins.
+ * Paths without a '/' are looked up in $SHELL_PLUGIN_PATH (colon-separated
+ * directories). Plugins stay loaded until the shell exits.
+ * @param path Shared object to load
+ * @param names Builtins to register; empty registers all the plugin defines
+ * @param error Set to the reason when nothing could be registered
+ * @return true if every requested builtin was registered
+ */
+bool load_plugin(const std::string &path, const std::vector<std::string> &names, std::string &error);
+
+/**
+ * Find the plugin a builtin was loaded from
+ * @param name Builtin name
+ * @return Path of the plugin, or nullptr for builtins that are not plugins
+ */
+const std::string *plugin_for_builtin(const std::string &name);
+
+#endif // PLUGINS_H
@@ -0,0 +1,71 @@
+#ifndef PROCESS_PROFILE_H
+#define PROCESS_PROFILE_H
+
+#include <ostream>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+
+/**
+ * One process seen by the profiler. Times are microseconds since
+ * profiling started.
+ */
+struct ProfiledProcess
+{
+  pid_t pid;
+  pid_t ppid;           // Parent when first seen (0 if never seen alive)
+  std::string name;     // Executable name (comm), updated after exec
+  std::string command;  // Command line, updated after exec
+  long long start = 0;
+  long long end = -1;   // -1: still running when profiling stopped
+  long long user = 0;   // CPU time of the process itself, without children
+  long long system = 0;
+  long max_rss = 0;     // Peak resident set in KiB, if reaped by the profiler
+  int status = -1;      // Wait status, if reaped by the profiler
+  bool reaped = false;  // Exit time exact, CPU times final (from wait4)
+};
+
+/**
+ * Output formats for write_profile()
+ */
+enum class ProfileFormat
+{
+  CHROME, // Chrome trace event JSON (chrome://tracing, Perfetto)
+  FOLDED  // Folded stacks for flamegraph.pl, weighted by CPU microseconds
+};
+
+/**
+ * Follow a freshly forked command and all its descendants until they have
+ * exited. The caller must already be a child subreaper
+ * (PR_SET_CHILD_SUBREAPER) with SIGCHLD, SIGINT and SIGQUIT blocked, so
+ * orphaned descendants become its children. Those and the command are
+ * reaped with wait4() for exact exit times and rusage; everything else is
+ * sampled from /proc (start time, parent, command line, CPU time) every
+ * few milliseconds. After SIGINT or SIGQUIT, profiling stops once the
+ * command itself has exited.
+ * @param child The command, a child of the caller
+ * @param processes Receives every process seen, the command first
+ * @return Wait status of the command
+ */
+int profile_descendants(pid_t child, std::vector<ProfiledProcess> &processes);
+
+/**
+ * Write a profile
+ * @param path Output file
+ * @param format File format
+ * @param processes Processes from profile_descendants()
+ * @return false if the file could not be written
+ */
+bool write_profile(const std::string &path, ProfileFormat format,
+                   const std::vector<ProfiledProcess> &processes);
+
+/**
+ * Print a summary: process count, wall and CPU time, and the processes
+ * that ran longest
+ * @param out Stream to print to
+ * @param processes Processes from profile_descendants()
+ * @param top Number of processes to list
+ */
+void print_profile_summary(std::ostream &out, const std::vector<ProfiledProcess> &processes, size_t top);
+
+#endif // PROCESS_PROFILE_H
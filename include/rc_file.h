@@ -0,0 +1,23 @@
+#ifndef RC_FILE_H
+#define RC_FILE_H
+
+#include <string>
+#include "include/script.h"
+
+/**
+ * Run the shell's config (rc) file.
+ * With a snapshot path, the state the file produced (variables, exported
+ * environment, aliases, functions and the executable index) is saved after
+ * running it. Later starts mmap the snapshot and restore that state instead
+ * of running the file, as long as the file and the inherited environment
+ * are unchanged. Side effects such as output are then not repeated.
+ * A config file that sets state the snapshot cannot hold (ulimit, limit and
+ * sched settings, plugins loaded with enable -f) runs on every start.
+ * @param path Config file
+ * @param snapshot_path Snapshot file, or empty to always run the config file
+ * @param ctx Shell state
+ * @return true if the state was restored from the snapshot
+ */
+bool load_config(const std::string &path, const std::string &snapshot_path, ShellContext &ctx);
+
+#endif // RC_FILE_H
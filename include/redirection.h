@@ -0,0 +1,58 @@
+#ifndef REDIRECTION_H
+#define REDIRECTION_H
+
+#include <memory>
+#include "include/command_parser.h"
+
+class LineReader;
+
+/**
+ * Descriptors replaced by apply_redirections(), so the shell can put them
+ * back after running a builtin or function
+ */
+struct SavedDescriptors
+{
+  int copies[10];                     // Copy of each replaced descriptor (-1 if it was closed)
+  unsigned saved = 0;                 // Bit N is set once descriptor N has been saved
+  std::unique_ptr<LineReader> input;  // Buffered stdin while fd 0 is redirected
+
+  SavedDescriptors();
+  ~SavedDescriptors();
+};
+
+/**
+ * Apply redirections in order, replacing descriptors 0-9.
+ * Files are opened without O_CLOEXEC on their target descriptor, so
+ * programs started afterwards inherit them; a DUPLICATE needs only a dup2.
+ * Errors are reported on stderr.
+ * @param redirections Redirections of the command
+ * @param saved If not null, receives the descriptors that were replaced
+ *              (for restore_redirections); null makes the change permanent
+ * @return false if a file could not be opened or a source descriptor is
+ *         not open; redirections before it stay applied
+ */
+bool apply_redirections(const std::pmr::vector<Redirection> &redirections, SavedDescriptors *saved);
+
+/**
+ * Put back the descriptors saved by apply_redirections()
+ * @param saved Descriptors to restore; emptied afterwards
+ */
+void restore_redirections(SavedDescriptors &saved);
+
+/**
+ * Record redirections made permanent with exec, so commands know which of
+ * descriptors 3-9 the shell holds open for them
+ * @param redirections Redirections applied without saving
+ */
+void keep_redirections(const std::pmr::vector<Redirection> &redirections);
+
+/**
+ * Check whether a command must inherit descriptors above stderr: its own
+ * redirections name one, or exec left one open in the shell. The spawn
+ * server only passes stdin, stdout and stderr.
+ * @param redirections Redirections of the command
+ * @return true if the command needs descriptors 3-9
+ */
+bool needs_extra_descriptors(const std::pmr::vector<Redirection> &redirections);
+
+#endif // REDIRECTION_H
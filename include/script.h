@@ -0,0 +1,101 @@
+#ifndef SCRIPT_H
+#define SCRIPT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory_resource>
+
+/**
+ * State shared by everything executed from one shell instance
+ */
+struct ShellContext
+{
+  bool exit_requested = false;   // Set by the exit builtin
+  int exit_status = 0;           // Status to exit the shell with
+  bool return_requested = false; // Set by the return builtin: the function ends
+  int return_status = 0;         // Status the function returns
+};
+
+struct PreparedCommand; // See functions.h
+
+/**
+ * Node of a parsed command line.
+ * Nodes are allocator-aware so a whole tree can live in the per-line arena;
+ * text points into the parsed source, which must outlive the tree.
+ */
+struct ScriptNode
+{
+  using allocator_type = std::pmr::polymorphic_allocator<ScriptNode>;
+
+  enum Type
+  {
+    SIMPLE,   // A single command; text holds the command line
+    PIPELINE, // Commands joined by |; children are the stages
+    LIST,     // Pipelines separated by ; or newlines; children run in order
+    WHILE,    // while LIST; do LIST; done; children are condition and body
+    FUNCTION  // name() { LIST; }; the child is the body
+  };
+
+  Type type = SIMPLE;
+  std::string_view text;                 // Source text of this node
+  std::pmr::vector<ScriptNode> children; // Sub-nodes (see Type)
+  const PreparedCommand *prepared = nullptr; // SIMPLE in a function body: words
+                                             // tokenized at definition, or nullptr
+
+  explicit ScriptNode(const allocator_type &alloc = {}) : children(alloc) {}
+  // A copy is not prepared: prepared belongs to the function of the original
+  ScriptNode(const ScriptNode &other, const allocator_type &alloc = {})
+      : type(other.type), text(other.text), children(other.children, alloc) {}
+  ScriptNode(ScriptNode &&other) = default;
+  ScriptNode(ScriptNode &&other, const allocator_type &alloc)
+      : type(other.type), text(other.text), children(std::move(other.children), alloc),
+        prepared(other.prepared) {}
+  ScriptNode &operator=(const ScriptNode &other) = default;
+  ScriptNode &operator=(ScriptNode &&other) = default;
+};
+
+/**
+ * Result of parsing a command line
+ */
+enum class ParseStatus
+{
+  OK,         // Input parsed completely
+  INCOMPLETE, // Input ends inside a quote or compound command; more lines needed
+  ERROR       // Syntax error
+};
+
+/**
+ * Parse command source into a tree of lists, pipelines and compound commands
+ * @param source The command text (may span several lines)
+ * @param root Receives the parsed LIST node (nodes use root's allocator)
+ * @param error Receives a message when ERROR is returned
+ * @return Parse status
+ */
+ParseStatus parse_script(std::string_view source, ScriptNode &root, std::string &error);
+
+/**
+ * Execute a parsed node
+ * @param node Node to execute
+ * @param ctx Shell state
+ * @return Exit status of the last command executed
+ */
+int execute_node(const ScriptNode &node, ShellContext &ctx);
+
+/**
+ * Parse and execute command source, reporting syntax errors on stderr
+ * @param source The command text
+ * @param ctx Shell state
+ * @return Exit status of the last command executed (2 on syntax error)
+ */
+int execute_script(std::string_view source, ShellContext &ctx);
+
+/**
+ * Check if a pipeline stage is a compound command (while loop or function
+ * definition)
+ * @param command The stage's command text
+ * @return true if the stage must be run through execute_script
+ */
+bool is_compound_command(std::string_view command);
+
+#endif // SCRIPT_H
@@ -0,0 +1,42 @@
+#ifndef SHELL_HISTORY_H
+#define SHELL_HISTORY_H
+
+#include <string>
+
+/**
+ * Start loading the history file.
+ * In background mode a thread reads and splits the file while the shell
+ * shows its first prompt, then posts the merge to the event loop; a
+ * keystroke that arrives first merges right away. Otherwise nothing is
+ * read until wait_for_history() is called.
+ * @param path History file path
+ * @param background true to load on a background thread (interactive use)
+ */
+void start_history(const std::string &path, bool background);
+
+/**
+ * Make sure the history file has been loaded into readline's history list.
+ * Entries added before the load stay after the loaded ones.
+ * Cheap once the history is loaded; call before any access to the list.
+ */
+void wait_for_history();
+
+/**
+ * Get the number of history entries that are already in the history file
+ * @return Entries at the front of the history list that need no saving
+ */
+int saved_history_entries();
+
+/**
+ * Record how many history entries are in the history file
+ * @param count Entries at the front of the history list that need no saving
+ */
+void set_saved_history_entries(int count);
+
+/**
+ * Append the entries added since the last save to the history file
+ * @return Number of entries written
+ */
+int save_history();
+
+#endif // SHELL_HISTORY_H
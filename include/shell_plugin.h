@@ -0,0 +1,83 @@
+#ifndef SHELL_PLUGIN_H
+#define SHELL_PLUGIN_H
+
+/*
+ * C ABI for builtins loaded with "enable -f plugin.so [name ...]".
+ *
+ * A plugin is a shared object exporting shell_plugin_init(). The shell calls
+ * it once after dlopen() and registers the builtins it returns; they then
+ * run inside the shell process (or inside a pipeline stage's child) like the
+ * core builtins. Plugins must not depend on C++ types or the shell's symbols:
+ * everything they may call is in struct shell_plugin_host.
+ *
+ * Compatibility: new fields of shell_builtin_def and shell_plugin_host are
+ * only appended, and each side says how large its struct is. The shell steps
+ * through a plugin's builtins by builtin_def_size and treats fields past it
+ * as zero; a plugin checks the host's size before using a field added after
+ * it was built. SHELL_PLUGIN_ABI_VERSION changes when an existing field or
+ * shell_plugin_info changes.
+ */
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SHELL_PLUGIN_ABI_VERSION 2
+
+/* Builtin flags */
+#define SHELL_BUILTIN_NOT_IN_PIPELINE 0x1u /* Only run in the shell process */
+
+  /*
+   * Builtin entry point.
+   * argv[0] is the builtin's name and argv[argc] is NULL; the strings are
+   * valid only during the call. Input and output go through the given
+   * descriptors (redirections are already applied). Returns the exit status.
+   */
+  typedef int (*shell_builtin_fn)(int argc, char **argv, int in_fd, int out_fd, int err_fd);
+
+  /*
+   * Argument completion with readline's generator contract: called with
+   * state 0 and then increasing states, returns malloc()ed matches and NULL
+   * when done. May be NULL to complete filenames.
+   */
+  typedef char *(*shell_completer_fn)(const char *text, int state);
+
+  struct shell_builtin_def
+  {
+    const char *name;
+    shell_builtin_fn run;
+    shell_completer_fn complete;
+    unsigned flags; /* SHELL_BUILTIN_* */
+  };
+
+  /* Services the shell offers to plugins */
+  struct shell_plugin_host
+  {
+    unsigned abi_version;
+    unsigned size; /* sizeof(struct shell_plugin_host) in the shell */
+    /* Value of a shell variable (including $?, $1, ...), or "" if unset.
+       The result stays valid until the next get_variable call. */
+    const char *(*get_variable)(const char *name);
+    /* Set a shell variable; returns 0, or -1 for an invalid name */
+    int (*set_variable)(const char *name, const char *value);
+  };
+
+  struct shell_plugin_info
+  {
+    unsigned abi_version;                      /* SHELL_PLUGIN_ABI_VERSION */
+    unsigned builtin_def_size;                 /* sizeof(struct shell_builtin_def) */
+    const struct shell_builtin_def *builtins; /* Ends with a NULL name */
+  };
+
+  /*
+   * Exported by every plugin. The host pointer stays valid for the life of
+   * the process. Returns NULL if the plugin cannot run with this host.
+   */
+  const struct shell_plugin_info *shell_plugin_init(const struct shell_plugin_host *host);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SHELL_PLUGIN_H */
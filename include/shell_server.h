@@ -0,0 +1,22 @@
+#ifndef SHELL_SERVER_H
+#define SHELL_SERVER_H
+
+#include <string>
+#include "include/libshell.h"
+
+/**
+ * Serve command requests on a Unix domain socket (--server) until SIGINT
+ * or SIGTERM. The shell has already run its config file; every request is
+ * handled by a worker forked from this warm state, which takes over the
+ * client's stdin, stdout and stderr (passed with SCM_RIGHTS), changes to
+ * the client's working directory, runs the command and reports its exit
+ * status. Only clients with the server's user ID are accepted. See
+ * include/shell_server_protocol.h for the wire format.
+ * @param socket_path Path to bind; a stale socket left there is replaced
+ * @param shell Configured instance the workers inherit
+ * @return Exit status for the server process (1 if the socket could not
+ *         be set up)
+ */
+int run_shell_server(const std::string &socket_path, Shell &shell);
+
+#endif // SHELL_SERVER_H
@@ -0,0 +1,35 @@
+#ifndef SHELL_SERVER_PROTOCOL_H
+#define SHELL_SERVER_PROTOCOL_H
+
+/*
+ * Wire format between "shell --server SOCKET" and its clients (shellc).
+ *
+ * A client connects to the Unix stream socket and sends one
+ * struct shell_server_request with its stdin, stdout and stderr attached as
+ * SCM_RIGHTS, followed by cwd_len bytes of working directory, command_len
+ * bytes of command text (neither NUL-terminated) and env_len bytes of
+ * environment: NAME=value entries, each ending with a NUL. The server
+ * answers with two int32_t values in host byte order: the PID of the
+ * worker running the command (its process group ID as well, so the client
+ * can forward signals to it), then the command's exit status. If the
+ * connection closes before the status arrives, the worker was killed.
+ *
+ * Plain C so the client can be built without the shell's C++ code.
+ */
+
+#include <stdint.h>
+
+#define SHELL_SERVER_MAGIC 0x53485632u /* "SHV2"; changes with the format */
+
+/* Longest working directory, command or environment a server accepts */
+#define SHELL_SERVER_MAX_TEXT (1u << 20)
+
+struct shell_server_request
+{
+  uint32_t magic;
+  uint32_t cwd_len;
+  uint32_t command_len;
+  uint32_t env_len;
+};
+
+#endif /* SHELL_SERVER_PROTOCOL_H */
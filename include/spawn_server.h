@@ -0,0 +1,41 @@
+#ifndef SPAWN_SERVER_H
+#define SPAWN_SERVER_H
+
+#include "include/exec_image.h"
+
+/**
+ * Start the spawn server (zygote) helper process.
+ * The helper is forked from the shell once and then forks every external
+ * command on the shell's behalf, so it should be started as early as
+ * possible, before history and readline grow the shell's heap.
+ * @return true if the helper is running
+ */
+bool spawn_server_start();
+
+/**
+ * Check whether the spawn server helper is running
+ * @return true if spawn requests can be sent to the helper
+ */
+bool spawn_server_active();
+
+/**
+ * Stop the spawn server helper and reap it
+ */
+void spawn_server_stop();
+
+/**
+ * Reap the helper if it has died, so commands fall back to fork.
+ * Cheap when it is alive; called when the shell gets SIGCHLD.
+ */
+void spawn_server_reap();
+
+/**
+ * Launch a program through the spawn server and wait for it to finish
+ * @param image Prebuilt path, argv and envp (see exec_image.h)
+ * @param fds File descriptors to install as the child's stdin, stdout and stderr
+ * @return Wait status of the child as reported by waitpid, or -1 if the
+ *         request could not be delivered to the helper
+ */
+int spawn_server_run(const ExecImage &image, const int fds[3]);
+
+#endif // SPAWN_SERVER_H
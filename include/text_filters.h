@@ -0,0 +1,69 @@
+#ifndef TEXT_FILTERS_H
+#define TEXT_FILTERS_H
+
+#include <string>
+#include <utility>
+#include <vector>
+#include "include/command_parser.h"
+
+/**
+ * A grep, head, wc or cut pipeline stage the shell can run itself (the
+ * fusefilters option). Only option combinations whose output is known to
+ * match the GNU tools byte for byte are accepted.
+ */
+struct TextFilter
+{
+  enum Kind
+  {
+    GREP, // grep [-vciFGE] PATTERN: fixed strings only
+    HEAD, // head [-n N | -N]
+    WC,   // wc -l, wc -c or wc -w
+    CUT   // cut -f LIST [-d C] [-s], cut -b LIST, cut -c LIST
+  };
+  Kind kind = GREP;
+
+  std::string pattern;      // grep: text to find (lowercase with ignore_case)
+  bool invert = false;      // grep -v
+  bool count = false;       // grep -c
+  bool ignore_case = false; // grep -i (C locale only)
+  bool utf8 = false;        // grep: UTF-8 locale, printed lines must be valid
+
+  unsigned long long lines = 10; // head: lines to pass through
+
+  char unit = 'l'; // wc: 'l' lines, 'c' bytes, 'w' words
+
+  bool fields = false;         // cut -f (else bytes)
+  char delimiter = '\t';       // cut -d
+  bool only_delimited = false; // cut -s
+  std::vector<std::pair<size_t, size_t>> ranges; // cut: 1-based, sorted, merged
+};
+
+/**
+ * Recognize a stage that run_text_filters() can replace. The stage must
+ * read standard input (no file operands); unknown options, regular
+ * expressions and locale-dependent cases are rejected so the real tool runs.
+ * @param args Expanded arguments; args[0] is grep, head, wc or cut (any
+ *             directory prefix is ignored)
+ * @param filter Receives the parsed stage
+ * @return true if the stage can be fused
+ */
+bool parse_text_filter(const ArgList &args, TextFilter &filter);
+
+/**
+ * Run consecutive filter stages in the calling process: standard input is
+ * read in large chunks, each chunk of whole lines is passed through every
+ * stage in turn and the last stage's output is written to standard output.
+ * When head has all its lines, a stage before it is cut off as if it had
+ * written to a closed pipe once its unread output would no longer fit in
+ * the pipe, and once none is left standard input is closed so the program
+ * feeding us gets SIGPIPE.
+ * @param filters Stages in pipeline order
+ * @param count Number of stages
+ * @param pipe_capacity Bytes a pipe between the separate tools would hold
+ * @param statuses Receives the exit status of each stage (141 for a stage
+ *                 cut off by SIGPIPE)
+ * @return Exit status of the last stage
+ */
+int run_text_filters(const TextFilter *filters, size_t count, size_t pipe_capacity, int *statuses);
+
+#endif // TEXT_FILTERS_H
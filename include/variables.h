@@ -0,0 +1,132 @@
+#ifndef VARIABLES_H
+#define VARIABLES_H
+
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+#include <utility>
+
+/**
+ * Look up a shell variable, falling back to the process environment
+ * @param name Variable name (special parameters "?", "#", "@", "*" and
+ *             positional parameters "1", "2", ... are allowed)
+ * @return Value of the variable, or empty string if it is not set
+ */
+std::string get_variable(const std::string &name);
+
+/**
+ * Look up a shell variable without copying its value
+ * @param name Variable name (no special parameters)
+ * @return Value of the variable (valid until it changes), or empty if unset
+ */
+std::string_view peek_variable(const std::string &name);
+
+/**
+ * Set a shell variable (updates the environment if the variable is exported)
+ * @param name Variable name
+ * @param value New value
+ */
+void set_variable(const std::string &name, const std::string &value);
+
+/**
+ * Mark a variable as exported so child processes receive it.
+ * Exported variables live in the process environment.
+ * @param name Variable name
+ */
+void export_variable(const std::string &name);
+
+/**
+ * Get a counter that changes whenever the exported environment changes
+ * @return Current environment generation
+ */
+unsigned long environment_generation();
+
+/**
+ * Remove a shell variable (and its exported copy, if any)
+ * @param name Variable name
+ */
+void unset_variable(const std::string &name);
+
+/**
+ * Check if a string is a valid variable name ([A-Za-z_][A-Za-z0-9_]*)
+ * @param name Name to check
+ * @return true if the name can be assigned to
+ */
+bool is_valid_variable_name(std::string_view name);
+
+/**
+ * Record the exit status of the last command (exposed as $?)
+ * @param status Exit status
+ */
+void set_last_status(int status);
+
+/**
+ * Record the exit status of every stage of the last pipeline (exposed as
+ * $PIPESTATUS, a space-separated list; one entry for a simple command)
+ * @param statuses Exit status of each stage, in order
+ * @param count Number of stages
+ */
+void set_pipe_status(const int *statuses, size_t count);
+
+/**
+ * Change a shell option (set -o NAME / set +o NAME)
+ * @param name Option name, e.g. "pipefail"
+ * @param on New state
+ * @return false if there is no such option
+ */
+bool set_shell_option(std::string_view name, bool on);
+
+/**
+ * Check a shell option
+ * @param name Option name
+ * @return true if the option is on
+ */
+bool shell_option(std::string_view name);
+
+/**
+ * List the shell options
+ * @return (name, state) pairs, sorted by name
+ */
+std::vector<std::pair<std::string, bool>> list_shell_options();
+
+/**
+ * List the shell variables that are not exported (special parameters such
+ * as "?" are left out)
+ * @return (name, value) pairs in no particular order
+ */
+std::vector<std::pair<std::string, std::string>> list_shell_variables();
+
+/**
+ * Replace the positional parameters ($1, $2, ...)
+ * @param params New parameters
+ * @return The previous parameters, for the caller to restore
+ */
+std::vector<std::string> set_positional_parameters(std::vector<std::string> params);
+
+/**
+ * Get the positional parameters one by one, for "$@"
+ * @return $1, $2, ... (empty at top level)
+ */
+const std::vector<std::string> &get_positional_parameters();
+
+/**
+ * Variable state of a shell instance that is not running (see libshell.h):
+ * everything the functions above read and change
+ */
+struct VariableScope
+{
+  std::unordered_map<std::string, std::string> variables; // Not exported
+  std::vector<std::string> environment;                   // NAME=value, exported
+  std::vector<std::string> positional;                    // $1, $2, ...
+  std::vector<bool> options;                              // Empty: all options off
+};
+
+/**
+ * Exchange the live variable state (including the process environment)
+ * with a saved one
+ * @param scope State to install; receives the state it replaces
+ */
+void swap_variable_scope(VariableScope &scope);
+
+#endif // VARIABLES_H
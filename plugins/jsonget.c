@@ -0,0 +1,303 @@
+/*
+ * Example builtin plugin: jsonget PATH...
+ *
+ * Reads a JSON document from standard input and prints the value at each
+ * PATH (keys and array indexes separated by dots, e.g. "items.0.name").
+ * Strings are printed unescaped, other values as they appear. Exits with 1
+ * if a path does not exist and 2 for invalid JSON.
+ *
+ *   make plugins
+ *   enable -f ./bin/plugins/jsonget.so
+ *   curl -s https://example.com/api | jsonget data.id
+ */
+
+#include "include/shell_plugin.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct buffer
+{
+  char *data;
+  size_t size;
+  size_t capacity;
+};
+
+static int append(struct buffer *b, const char *data, size_t size)
+{
+  if (b->size + size > b->capacity)
+  {
+    size_t capacity = b->capacity ? b->capacity * 2 : 65536;
+    while (capacity < b->size + size)
+      capacity *= 2;
+    char *grown = realloc(b->data, capacity);
+    if (!grown)
+      return -1;
+    b->data = grown;
+    b->capacity = capacity;
+  }
+  memcpy(b->data + b->size, data, size);
+  b->size += size;
+  return 0;
+}
+
+static const char *skip_space(const char *p, const char *end)
+{
+  while (p < end && isspace((unsigned char)*p))
+    p++;
+  return p;
+}
+
+/* Returns the end of the string starting at p (the opening quote), or NULL */
+static const char *skip_string(const char *p, const char *end)
+{
+  for (p++; p < end; p++)
+  {
+    if (*p == '\\')
+      p++;
+    else if (*p == '"')
+      return p + 1;
+  }
+  return NULL;
+}
+
+/* Returns the end of the value starting at p, or NULL for invalid JSON */
+static const char *skip_value(const char *p, const char *end)
+{
+  p = skip_space(p, end);
+  if (p >= end)
+    return NULL;
+  if (*p == '"')
+    return skip_string(p, end);
+  if (*p == '{' || *p == '[')
+  {
+    char close = *p == '{' ? '}' : ']';
+    p = skip_space(p + 1, end);
+    if (p < end && *p == close)
+      return p + 1;
+    for (;;)
+    {
+      if (close == '}')
+      {
+        p = skip_space(p, end);
+        if (p >= end || *p != '"' || !(p = skip_string(p, end)))
+          return NULL;
+        p = skip_space(p, end);
+        if (p >= end || *p++ != ':')
+          return NULL;
+      }
+      if (!(p = skip_value(p, end)))
+        return NULL;
+      p = skip_space(p, end);
+      if (p < end && *p == ',')
+        p++;
+      else if (p < end && *p == close)
+        return p + 1;
+      else
+        return NULL;
+    }
+  }
+  /* Number, true, false or null */
+  const char *start = p;
+  while (p < end && (isalnum((unsigned char)*p) || *p == '-' || *p == '+' || *p == '.'))
+    p++;
+  return p > start ? p : NULL;
+}
+
+/* Find the member or element named by one path component; NULL if absent */
+static const char *find_child(const char *p, const char *end, const char *name, size_t length, int *invalid)
+{
+  p = skip_space(p, end);
+  if (p >= end || (*p != '{' && *p != '['))
+    return NULL;
+
+  int is_object = *p == '{';
+  char *index_end;
+  long index = is_object ? 0 : strtol(name, &index_end, 10);
+  if (!is_object && (index_end != name + length || length == 0 || index < 0))
+    return NULL;
+
+  p = skip_space(p + 1, end);
+  if (p < end && (*p == '}' || *p == ']'))
+    return NULL;
+  for (long i = 0;; i++)
+  {
+    int match = !is_object && i == index;
+    if (is_object)
+    {
+      const char *key = p;
+      if (p >= end || *p != '"' || !(p = skip_string(p, end)))
+        break;
+      match = (size_t)(p - key - 2) == length && memcmp(key + 1, name, length) == 0;
+      p = skip_space(p, end);
+      if (p >= end || *p++ != ':')
+        break;
+    }
+    p = skip_space(p, end);
+    if (match)
+      return p;
+    if (!(p = skip_value(p, end)))
+      break;
+    p = skip_space(p, end);
+    if (p < end && *p == ',')
+      p = skip_space(p + 1, end);
+    else if (p < end && (*p == '}' || *p == ']'))
+      return NULL;
+    else
+      break;
+  }
+  *invalid = 1;
+  return NULL;
+}
+
+static void put_utf8(struct buffer *out, unsigned long code)
+{
+  char bytes[4];
+  size_t n;
+  if (code < 0x80)
+  {
+    bytes[0] = (char)code;
+    n = 1;
+  }
+  else if (code < 0x800)
+  {
+    bytes[0] = (char)(0xC0 | (code >> 6));
+    bytes[1] = (char)(0x80 | (code & 0x3F));
+    n = 2;
+  }
+  else if (code < 0x10000)
+  {
+    bytes[0] = (char)(0xE0 | (code >> 12));
+    bytes[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+    bytes[2] = (char)(0x80 | (code & 0x3F));
+    n = 3;
+  }
+  else
+  {
+    bytes[0] = (char)(0xF0 | (code >> 18));
+    bytes[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+    bytes[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+    bytes[3] = (char)(0x80 | (code & 0x3F));
+    n = 4;
+  }
+  append(out, bytes, n);
+}
+
+/* Append a string value without its quotes and escapes */
+static void unescape(struct buffer *out, const char *p, const char *end)
+{
+  for (p++; p < end - 1; p++)
+  {
+    if (*p != '\\')
+    {
+      append(out, p, 1);
+      continue;
+    }
+    char c = *++p;
+    const char *plain = strchr("\"\\/bfnrt", c);
+    if (plain && c)
+    {
+      append(out, &"\"\\/\b\f\n\r\t"[plain - "\"\\/bfnrt"], 1);
+    }
+    else if (c == 'u' && end - p > 4)
+    {
+      char hex[5] = {p[1], p[2], p[3], p[4], 0};
+      unsigned long code = strtoul(hex, NULL, 16);
+      p += 4;
+      /* Surrogate pair */
+      if (code >= 0xD800 && code < 0xDC00 && end - p > 6 && p[1] == '\\' && p[2] == 'u')
+      {
+        char low_hex[5] = {p[3], p[4], p[5], p[6], 0};
+        unsigned long low = strtoul(low_hex, NULL, 16);
+        if (low >= 0xDC00 && low < 0xE000)
+        {
+          code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+          p += 6;
+        }
+      }
+      put_utf8(out, code);
+    }
+  }
+}
+
+static void report(int fd, const char *message)
+{
+  ssize_t written = write(fd, message, strlen(message));
+  (void)written;
+}
+
+static int jsonget(int argc, char **argv, int in_fd, int out_fd, int err_fd)
+{
+  if (argc < 2)
+  {
+    report(err_fd, "jsonget: usage: jsonget PATH...\n");
+    return 2;
+  }
+
+  struct buffer input = {0}, out = {0};
+  char chunk[65536];
+  ssize_t n;
+  while ((n = read(in_fd, chunk, sizeof(chunk))) > 0)
+  {
+    if (append(&input, chunk, (size_t)n) < 0)
+      break;
+  }
+  const char *end = input.data + input.size;
+  const char *document = skip_space(input.data, end);
+
+  int status = 0;
+  for (int i = 1; i < argc; i++)
+  {
+    const char *value = document;
+    int invalid = 0;
+    for (const char *name = argv[i]; value && *name;)
+    {
+      const char *dot = strchr(name, '.');
+      size_t length = dot ? (size_t)(dot - name) : strlen(name);
+      value = find_child(value, end, name, length, &invalid);
+      name += length + (dot ? 1 : 0);
+    }
+    const char *value_end = value ? skip_value(value, end) : NULL;
+    if (document == end || invalid || (value && !value_end))
+    {
+      report(err_fd, "jsonget: invalid JSON\n");
+      status = 2;
+      break;
+    }
+    if (!value)
+    {
+      status = 1;
+      continue;
+    }
+    if (*value == '"')
+      unescape(&out, value, value_end);
+    else
+      append(&out, value, (size_t)(value_end - value));
+    append(&out, "\n", 1);
+  }
+
+  for (size_t done = 0; done < out.size;)
+  {
+    ssize_t written = write(out_fd, out.data + done, out.size - done);
+    if (written <= 0)
+      break;
+    done += (size_t)written;
+  }
+  free(input.data);
+  free(out.data);
+  return status;
+}
+
+static const struct shell_builtin_def builtins[] = {
+    {"jsonget", jsonget, NULL, 0},
+    {NULL, NULL, NULL, 0},
+};
+
+static const struct shell_plugin_info info = {SHELL_PLUGIN_ABI_VERSION, sizeof(struct shell_builtin_def), builtins};
+
+const struct shell_plugin_info *shell_plugin_init(const struct shell_plugin_host *host)
+{
+  (void)host;
+  return &info;
+}
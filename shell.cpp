@@ -1,6 +1,8 @@
 #include <iostream>
+#include <iomanip>
 #include <string>
-#include <set>
+#include <chrono>
+#include <csignal>
 #include <unistd.h>
 #include <readline/readline.h>
 #include <readline/history.h>
@@ -11,9 +13,180 @@
 #include "include/command_executor.h"
 #include "include/builtins.h"
 #include "include/completion.h"
+#include "include/spawn_server.h"
+#include "include/script.h"
+#include "include/variables.h"
+#include "include/line_reader.h"
+#include "include/arena.h"
+#include "include/shell_history.h"
+#include "include/rc_file.h"
+#include "include/frecency.h"
+#include "include/event_loop.h"
+#include "include/shell_server.h"
+#include "include/libshell.h"
+
+// Startup phases timed for --startup-profile. Marks are always taken (a
+// clock read each); they are only printed when asked for.
+struct StartupPhase
+{
+  const char *name;
+  std::chrono::steady_clock::time_point end;
+};
+static std::chrono::steady_clock::time_point startup_begin;
+static StartupPhase startup_phases[8];
+static int startup_phase_count = 0;
+
+static void mark_phase(const char *name)
+{
+  if (startup_phase_count < 8)
+  {
+    startup_phases[startup_phase_count++] = {name, std::chrono::steady_clock::now()};
+  }
+}
+
+static void print_startup_profile()
+{
+  auto us = [](std::chrono::steady_clock::duration d)
+  { return std::chrono::duration_cast<std::chrono::microseconds>(d).count(); };
+
+  std::cerr << "startup profile (from main):" << std::endl;
+  auto previous = startup_begin;
+  for (int i = 0; i < startup_phase_count; i++)
+  {
+    std::cerr << "  " << std::left << std::setw(16) << startup_phases[i].name
+              << std::right << std::setw(8) << us(startup_phases[i].end - previous) << " us" << std::endl;
+    previous = startup_phases[i].end;
+  }
+  std::cerr << "  " << std::left << std::setw(16) << "total"
+            << std::right << std::setw(8) << us(previous - startup_begin) << " us" << std::endl;
+}
+
+// Expand a PS1/PS2 prompt format. Supported escapes: \w (directory, with ~
+// for HOME), \W (last directory component), \u (user), \h (host), \$ (#
+// for root, $ otherwise), \n (newline) and a doubled backslash.
+static void expand_prompt(std::string_view format, std::pmr::string &prompt)
+{
+  char cwd[1024];
+  std::string_view dir;
+  if (getcwd(cwd, sizeof(cwd)) != nullptr)
+  {
+    dir = cwd;
+  }
+
+  for (size_t i = 0; i < format.length(); i++)
+  {
+    if (format[i] != '\\' || i + 1 == format.length())
+    {
+      prompt += format[i];
+      continue;
+    }
+
+    switch (format[++i])
+    {
+    case 'w':
+    {
+      std::string_view cwd_str = dir;
+      const char *home = getenv("HOME");
+      if (home && *home && cwd_str.find(home) == 0)
+      {
+        // Replace home directory with ~
+        prompt += '~';
+        cwd_str.remove_prefix(strlen(home));
+      }
+      prompt += cwd_str;
+      break;
+    }
+    case 'W':
+      prompt += dir.length() > 1 ? dir.substr(dir.find_last_of('/') + 1) : dir;
+      break;
+    case 'u':
+    {
+      const char *user = getenv("USER");
+      prompt += user ? user : "";
+      break;
+    }
+    case 'h':
+    {
+      char host[256];
+      if (gethostname(host, sizeof(host)) == 0)
+      {
+        host[sizeof(host) - 1] = '\0';
+        std::string_view host_str(host);
+        prompt += host_str.substr(0, host_str.find('.'));
+      }
+      break;
+    }
+    case '$':
+      prompt += geteuid() == 0 ? '#' : '$';
+      break;
+    case 'n':
+      prompt += '\n';
+      break;
+    case '\\':
+      prompt += '\\';
+      break;
+    default:
+      prompt += '\\';
+      prompt += format[i];
+      break;
+    }
+  }
+}
+
+// Interactive shells append new history entries this often while idle
+static const std::chrono::seconds HISTORY_FLUSH_INTERVAL(30);
+
+// Line delivered by readline's callback interface
+static char *pending_line = nullptr;
+static bool line_ready = false;
+
+static void line_handler(char *line)
+{
+  pending_line = line;
+  line_ready = true;
+  rl_callback_handler_remove(); // Restores the terminal for the command
+}
+
+// Show a prompt and serve the event loop until readline has a whole line
+// (nullptr at end of input). Timers, signals and worker results are
+// handled while the user types.
+static char *read_interactive_line(const char *prompt)
+{
+  line_ready = false;
+  rl_callback_handler_install(prompt, line_handler);
+  run_event_loop(line_ready);
+  return pending_line;
+}
+
+// Put the interactive shell's input and housekeeping on the event loop
+static void init_interactive_loop(bool flush_history)
+{
+  if (!init_event_loop())
+  {
+    std::cerr << "Warning: could not create event loop" << std::endl;
+    return;
+  }
+
+  watch_input(STDIN_FILENO, []()
+              { rl_callback_read_char(); });
+
+  // Readline's own SIGWINCH handler is replaced by the signalfd
+  rl_catch_sigwinch = 0;
+  watch_signal(SIGWINCH, []()
+               { rl_resize_terminal(); });
+  watch_signal(SIGCHLD, spawn_server_reap);
+
+  if (flush_history)
+  {
+    add_timer(HISTORY_FLUSH_INTERVAL, []()
+              { save_history(); });
+  }
+}
 
 int main(int argc, char **argv)
 {
+  startup_begin = std::chrono::steady_clock::now();
+
   // Parse command line arguments with CLI11
   CLI::App app{"Custom Shell - A feature-rich command line shell"};
   
@@ -21,11 +194,20 @@ int main(int argc, char **argv)
   std::string history_file;
   bool no_history = false;
   bool verbose = false;
+  bool use_zygote = false;
+  bool startup_profile = false;
+  bool use_snapshot = false;
+  std::string server_socket;
   
   app.add_option("-c,--config", config_file, "Configuration file path");
   app.add_option("-H,--history-file", history_file, "Custom history file path");
   app.add_flag("--no-history", no_history, "Disable command history");
   app.add_flag("-v,--verbose", verbose, "Enable verbose output");
+  auto *zygote_flag = app.add_flag("--zygote", use_zygote, "Launch external commands through a pre-forked spawn helper");
+  app.add_flag("--startup-profile", startup_profile, "Print how long each startup phase took");
+  app.add_flag("--snapshot", use_snapshot, "Reuse the state produced by the config file while it is unchanged");
+  app.add_option("--server", server_socket, "Serve commands from shellc clients on this Unix socket")
+      ->excludes(zygote_flag);
   app.set_version_flag("-V,--version", "1.0.0");
   
   try {
@@ -37,6 +219,14 @@ int main(int argc, char **argv)
   // Flush after every std::cout / std::cerr
   std::cout << std::unitbuf;
   std::cerr << std::unitbuf;
+  mark_phase("options");
+
+  // Start the spawn helper before history and readline grow the heap
+  if (use_zygote && !spawn_server_start())
+  {
+    std::cerr << "Warning: could not start spawn helper, using fork" << std::endl;
+  }
+  mark_phase("spawn helper");
 
   if (verbose)
   {
@@ -45,10 +235,7 @@ int main(int argc, char **argv)
       std::cout << "Using config file: " << config_file << std::endl;
   }
 
-  std::set<std::string> builtins = {"echo", "type", "exit", "pwd", "cd", "history"};
-
-  // Track history offset for append operations
-  int history_offset = 0;
+  Shell shell;
 
   // Get history file path - priority: CLI arg > HISTFILE env > default
   std::string histfile;
@@ -77,147 +264,190 @@ int main(int argc, char **argv)
     }
   }
 
-  // Load history from file on startup (unless disabled)
+  // Scripts and piped input are read through the shared line reader so the
+  // read builtin and the command loop consume stdin from the same buffer
+  bool interactive = isatty(STDIN_FILENO);
+
+  // A server never reads commands from its own stdin; its workers must not
+  // touch the history file either
+  bool server = !server_socket.empty();
+  if (server)
+  {
+    interactive = false;
+    no_history = true;
+  }
+
+  // History is loaded lazily: interactive shells read the file on a
+  // background thread while the first prompt is shown, scripts only if the
+  // history builtin needs it
   if (!no_history)
   {
-    read_history(histfile.c_str());
-    history_offset = history_length;
-    
+    start_history(histfile, interactive);
+
     if (verbose)
-      std::cout << "Loaded " << history_length << " history entries from " << histfile << std::endl;
+      std::cout << "Loading history from " << histfile << std::endl;
+  }
+  mark_phase("history");
+
+  // Set up readline completion and the event loop (readline is not used
+  // for scripts)
+  if (interactive)
+  {
+    init_completion();
+    init_interactive_loop(!no_history);
+  }
+  mark_phase("readline");
+
+  // Interactive shells record the directories cd visits, for z
+  const char *home = getenv("HOME");
+  if (interactive)
+  {
+    set_frecency_database(std::string(home ? home : ".") + "/.shell_frecency", true);
+  }
+
+  // Run the config file: --config, or ~/.shellrc for interactive shells
+  // and servers
+  if (config_file.empty() && (interactive || server) && home)
+  {
+    std::string rc_path = std::string(home) + "/.shellrc";
+    if (access(rc_path.c_str(), R_OK) == 0)
+    {
+      config_file = rc_path;
+    }
+  }
+  if (!config_file.empty())
+  {
+    std::string snapshot_file;
+    if (use_snapshot)
+    {
+      snapshot_file = std::string(home ? home : ".") + "/.shell_snapshot";
+    }
+    bool restored = shell.load_config(config_file, snapshot_file);
+    if (verbose)
+      std::cout << (restored ? "Restored config state from " + snapshot_file : "Ran config file " + config_file) << std::endl;
+  }
+  mark_phase("config");
+
+  if (server)
+  {
+    return run_shell_server(server_socket, shell);
   }
 
-  // Set up readline completion
-  init_completion();
-  
   if (verbose)
     std::cout << "Shell initialized. Type 'exit' or press Ctrl+D to quit." << std::endl;
 
-  while (true)
+  // Input buffers live across iterations so their capacity is reused
+  std::string command;
+  std::string line;
+
+  while (!shell.exit_requested())
   {
-    // Build prompt with current directory
-    char cwd[1024];
-    std::string prompt = "$ ";
-    if (getcwd(cwd, sizeof(cwd)) != nullptr)
+    // Everything from the previous command line is dead - rewind the arena
+    reset_line_arena();
+
+    // Build prompts: PS1, by default the current directory
+    std::pmr::string prompt(line_arena());
+    std::pmr::string continuation_prompt(line_arena());
+    if (interactive)
     {
-      std::string cwd_str(cwd);
-      const char *home = getenv("HOME");
-      if (home && cwd_str.find(home) == 0)
+      std::string_view ps1 = peek_variable("PS1");
+      std::string_view ps2 = peek_variable("PS2");
+      expand_prompt(ps1.empty() ? "\\w $ " : ps1, prompt);
+      expand_prompt(ps2.empty() ? "> " : ps2, continuation_prompt);
+    }
+
+    if (startup_phase_count > 0)
+    {
+      mark_phase("first prompt");
+      if (startup_profile)
       {
-        // Replace home directory with ~
-        cwd_str = "~" + cwd_str.substr(strlen(home));
+        print_startup_profile();
       }
-      prompt = cwd_str + " $ ";
+      startup_phase_count = 0;
     }
 
-    char *input = readline(prompt.c_str());
+    // Read lines until they form a complete command (quotes and loops may
+    // span several lines)
+    command.clear();
+    ScriptNode root(line_arena());
+    std::string error;
+    ParseStatus status = ParseStatus::INCOMPLETE;
+    bool eof = false;
 
-    if (input == nullptr) // EOF (CTRL+D)
+    while (status == ParseStatus::INCOMPLETE)
     {
-      // Append new history entries before exiting (unless disabled)
-      if (!no_history)
+      if (interactive)
       {
-        int new_entries = history_length - history_offset;
-        if (new_entries > 0)
+        char *input = read_interactive_line(command.empty() ? prompt.c_str() : continuation_prompt.c_str());
+        if (input == nullptr) // EOF (CTRL+D)
         {
-          append_history(new_entries, histfile.c_str());
-          if (verbose)
-            std::cout << "\nSaved " << new_entries << " new history entries." << std::endl;
+          eof = true;
+          break;
         }
+        line = input;
+        free(input); // readline allocates memory, free it after use
+      }
+      else if (!line_reader_for(STDIN_FILENO).read_line(line) && line.empty())
+      {
+        eof = true;
+        break;
       }
-      break;
-    }
 
-    std::string command(input);
+      if (!command.empty())
+      {
+        command += '\n';
+      }
+      command += line;
+      status = Shell::parse(command, root, error);
+    }
 
     if (!command.empty() && !no_history)
     {
-      add_history(input); // Add to history for up/down arrow nav
+      add_history(command.c_str()); // Add to history for up/down arrow nav
     }
 
-    free(input); // readline allocates memory, free it after use
-
-    // Check for exit command
-    if (command == "exit")
+    if (eof)
     {
+      if (!command.empty())
+      {
+        std::cerr << "syntax error: unexpected end of file" << std::endl;
+        shell.set_last_status(2);
+      }
+
       // Append new history entries before exiting (unless disabled)
       if (!no_history)
       {
-        int new_entries = history_length - history_offset;
-        if (new_entries > 0)
-        {
-          append_history(new_entries, histfile.c_str());
-          if (verbose)
-            std::cout << "Saved " << new_entries << " new history entries." << std::endl;
-        }
+        int new_entries = save_history();
+        if (verbose && new_entries > 0)
+          std::cout << "\nSaved " << new_entries << " new history entries." << std::endl;
       }
       break;
     }
 
-    // Check if command contains a pipeline
-    if (command.find('|') != std::string::npos)
-    {
-      // Parse pipeline and execute
-      std::vector<std::string> pipeline_commands = parse_pipeline(command);
-      execute_pipeline(pipeline_commands, builtins);
-      continue;
-    }
-
-    // Parse for redirection
-    RedirectInfo redir = parse_redirect(command);
-    std::vector<std::string> args = parse_args(redir.command);
-
-    if (args.empty())
+    if (status == ParseStatus::ERROR)
     {
+      std::cerr << error << std::endl;
+      shell.set_last_status(2);
       continue;
     }
 
-    // Handle builtin commands
-    std::string cmd = args[0];
+    shell.execute(root);
 
-    if (cmd == "echo")
-    {
-      builtin_echo(args, redir.filename, redir.redirect_stderr, redir.append_mode);
-    }
-    else if (cmd == "pwd")
-    {
-      builtin_pwd();
-    }
-    else if (cmd == "cd")
-    {
-      std::string path;
-      if (args.size() > 1)
-      {
-        path = args[1];
-      }
-      builtin_cd(path);
-    }
-    else if (cmd == "type")
-    {
-      if (args.size() > 1)
-      {
-        builtin_type(args[1], builtins);
-      }
-    }
-    else if (cmd == "history")
-    {
-      builtin_history(args, history_offset);
-    }
-    else
+    // Check for exit command
+    if (shell.exit_requested())
     {
-      // Try to execute external command
-      std::string path = find_in_path(args[0]);
-
-      if (!path.empty())
-      {
-        execute_command(path, args, redir.filename, redir.redirect_stderr, redir.append_mode);
-      }
-      else
+      // Append new history entries before exiting (unless disabled)
+      if (!no_history)
       {
-        std::cout << args[0] << ": command not found" << std::endl;
+        int new_entries = save_history();
+        if (verbose && new_entries > 0)
+          std::cout << "Saved " << new_entries << " new history entries." << std::endl;
       }
+      break;
     }
   } // End of while loop
 
-  return 0;
+  spawn_server_stop();
+  // At end of input the shell exits with the last command's status
+  return shell.exit_requested() ? shell.exit_status() : shell.last_status();
 }
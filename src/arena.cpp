@@ -0,0 +1,132 @@
+#include "include/arena.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+// Initial arena block; typical command lines never need more than this, so
+// the steady-state REPL does not touch the heap. Longer lines spill over
+// into blocks from the default allocator until the arena is rewound.
+static const size_t ARENA_SIZE = 64 * 1024;
+
+alignas(std::max_align_t) static char arena_buffer[ARENA_SIZE];
+
+// Header at the start of each overflow block
+struct ArenaBlock
+{
+  ArenaBlock *previous; // Block that was in use before (nullptr: arena_buffer)
+  size_t size;          // Including this header
+};
+
+// Bump allocator over arena_buffer and a stack of overflow blocks. Unlike
+// std::pmr::monotonic_buffer_resource it can be rewound to a mark.
+class LineArena : public std::pmr::memory_resource
+{
+public:
+  ArenaMark mark() const { return ArenaMark{current_, position_}; }
+
+  void rewind(const ArenaMark &mark)
+  {
+    while (current_ != mark.block)
+    {
+      ArenaBlock *block = current_;
+      current_ = block->previous;
+      release(block);
+    }
+    position_ = mark.position;
+    end_ = current_ != nullptr ? reinterpret_cast<char *>(current_) + current_->size
+                               : arena_buffer + ARENA_SIZE;
+  }
+
+  void reset()
+  {
+    rewind(ArenaMark{nullptr, arena_buffer});
+    ::operator delete(spare_);
+    spare_ = nullptr;
+  }
+
+private:
+  void *do_allocate(size_t bytes, size_t alignment) override
+  {
+    size_t padding = (alignment - reinterpret_cast<uintptr_t>(position_) % alignment) % alignment;
+    if (padding + bytes > static_cast<size_t>(end_ - position_))
+    {
+      grow(bytes + alignment);
+      padding = (alignment - reinterpret_cast<uintptr_t>(position_) % alignment) % alignment;
+    }
+    char *result = position_ + padding;
+    position_ = result + bytes;
+    return result;
+  }
+
+  void do_deallocate(void *, size_t, size_t) override
+  {
+  }
+
+  bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+  {
+    return this == &other;
+  }
+
+  // Start a new block with room for at least bytes, twice the size of the
+  // one in use like the standard monotonic resource
+  void grow(size_t bytes)
+  {
+    size_t in_use = current_ != nullptr ? current_->size : ARENA_SIZE;
+    size_t size = std::max(2 * in_use, bytes + sizeof(ArenaBlock));
+
+    ArenaBlock *block;
+    if (spare_ != nullptr && spare_->size >= size)
+    {
+      block = spare_;
+      spare_ = nullptr;
+    }
+    else
+    {
+      block = static_cast<ArenaBlock *>(::operator new(size));
+      block->size = size;
+    }
+    block->previous = current_;
+    current_ = block;
+    position_ = reinterpret_cast<char *>(block + 1);
+    end_ = reinterpret_cast<char *>(block) + block->size;
+  }
+
+  // Keep the largest block given back, so a loop whose iterations overflow
+  // does not go to the heap every time
+  void release(ArenaBlock *block)
+  {
+    if (spare_ == nullptr || block->size > spare_->size)
+    {
+      std::swap(block, spare_);
+    }
+    ::operator delete(block);
+  }
+
+  ArenaBlock *current_ = nullptr;
+  ArenaBlock *spare_ = nullptr;
+  char *position_ = arena_buffer;
+  char *end_ = arena_buffer + ARENA_SIZE;
+};
+
+static LineArena arena;
+
+std::pmr::memory_resource *line_arena()
+{
+  return &arena;
+}
+
+void reset_line_arena()
+{
+  arena.reset(); // Frees overflow blocks and rewinds to arena_buffer
+}
+
+ArenaMark line_arena_mark()
+{
+  return arena.mark();
+}
+
+void rewind_line_arena(const ArenaMark &mark)
+{
+  arena.rewind(mark);
+}
@@ -0,0 +1,139 @@
+#include "include/builtin_registry.h"
+#include "include/builtins.h"
+#include "include/completion.h"
+#include "include/name_table.h"
+#include <array>
+#include <algorithm>
+
+// Core builtins. Adding a builtin is one line here; the perfect hash below
+// is recomputed by the compiler.
+static constexpr BuiltinInfo builtin_table[] = {
+    {"echo", builtin_echo, BUILTIN_PIPELINE_SAFE, nullptr},
+    {"pwd", builtin_pwd, BUILTIN_PIPELINE_SAFE, nullptr},
+    {"cd", builtin_cd, BUILTIN_RUNS_IN_PARENT, directory_generator},
+    {"type", builtin_type, BUILTIN_PIPELINE_SAFE, command_generator},
+    {"history", builtin_history, BUILTIN_PIPELINE_SAFE, nullptr},
+    {"exit", builtin_exit, BUILTIN_RUNS_IN_PARENT, nullptr},
+    {"return", builtin_return, BUILTIN_RUNS_IN_PARENT, nullptr},
+    {"exec", builtin_exec, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE | BUILTIN_KEEPS_REDIRECTIONS, command_generator},
+    {"read", builtin_read, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE, nullptr},
+    {"export", builtin_export, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE, nullptr},
+    {"alias", builtin_alias, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE, nullptr},
+    {"unalias", builtin_unalias, BUILTIN_RUNS_IN_PARENT, nullptr},
+    {"z", builtin_z, BUILTIN_RUNS_IN_PARENT, nullptr},
+    {"listdir", builtin_listdir, BUILTIN_PIPELINE_SAFE, directory_generator},
+    {"ulimit", builtin_ulimit, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE, nullptr},
+    {"limit", builtin_limit, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE, nullptr},
+    {"sched", builtin_sched, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE, command_generator},
+    {"true", builtin_true, BUILTIN_PIPELINE_SAFE, nullptr},
+    {"false", builtin_false, BUILTIN_PIPELINE_SAFE, nullptr},
+    {"test", builtin_test, BUILTIN_PIPELINE_SAFE, nullptr},
+    {"[", builtin_test, BUILTIN_PIPELINE_SAFE, nullptr},
+    {"printf", builtin_printf, BUILTIN_PIPELINE_SAFE, nullptr},
+    {"enable", builtin_enable, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE, nullptr},
+    {"set", builtin_set, BUILTIN_RUNS_IN_PARENT | BUILTIN_PIPELINE_SAFE, nullptr},
+    {"timeout", builtin_timeout, BUILTIN_PIPELINE_SAFE, command_generator},
+    {"profile", builtin_profile, BUILTIN_PIPELINE_SAFE, command_generator},
+};
+
+static constexpr size_t BUILTIN_COUNT = sizeof(builtin_table) / sizeof(builtin_table[0]);
+
+// Smallest power of two with at least four times as many slots as
+// builtins; sparser tables keep the compile-time seed search short
+static constexpr size_t slot_count()
+{
+  size_t slots = 1;
+  while (slots < 4 * BUILTIN_COUNT)
+  {
+    slots *= 2;
+  }
+  return slots;
+}
+static constexpr size_t SLOT_COUNT = slot_count();
+
+// Find a seed that maps every builtin name to a distinct slot
+static constexpr uint32_t find_seed()
+{
+  for (uint32_t seed = 0;; seed++)
+  {
+    bool used[SLOT_COUNT] = {};
+    bool collision = false;
+    for (size_t i = 0; i < BUILTIN_COUNT && !collision; i++)
+    {
+      size_t slot = name_hash(builtin_table[i].name, seed) & (SLOT_COUNT - 1);
+      collision = used[slot];
+      used[slot] = true;
+    }
+    if (!collision)
+    {
+      return seed;
+    }
+  }
+}
+static constexpr uint32_t HASH_SEED = find_seed();
+
+// Slot -> index into builtin_table, or -1 for an empty slot
+static constexpr std::array<int, SLOT_COUNT> build_slots()
+{
+  std::array<int, SLOT_COUNT> slots{};
+  for (size_t i = 0; i < SLOT_COUNT; i++)
+  {
+    slots[i] = -1;
+  }
+  for (size_t i = 0; i < BUILTIN_COUNT; i++)
+  {
+    slots[name_hash(builtin_table[i].name, HASH_SEED) & (SLOT_COUNT - 1)] = static_cast<int>(i);
+  }
+  return slots;
+}
+static constexpr std::array<int, SLOT_COUNT> builtin_slots = build_slots();
+
+// Builtins registered at runtime. Entry names have stable addresses, so the
+// entries' name pointers can refer to them.
+static NameTable<BuiltinInfo> extra_builtins;
+
+const BuiltinInfo *find_builtin(std::string_view name)
+{
+  int index = builtin_slots[name_hash(name, HASH_SEED) & (SLOT_COUNT - 1)];
+  if (index >= 0 && name == builtin_table[index].name)
+  {
+    return &builtin_table[index];
+  }
+
+  return extra_builtins.find(name);
+}
+
+bool is_builtin(std::string_view name)
+{
+  return find_builtin(name) != nullptr;
+}
+
+bool register_builtin(const BuiltinInfo &info)
+{
+  if (is_builtin(info.name))
+  {
+    return false;
+  }
+
+  auto &entry = extra_builtins.set(info.name, info);
+  entry.value.name = entry.name.c_str();
+  return true;
+}
+
+std::vector<const BuiltinInfo *> list_builtins()
+{
+  std::vector<const BuiltinInfo *> all;
+  for (const auto &info : builtin_table)
+  {
+    all.push_back(&info);
+  }
+  for (const auto *entry : extra_builtins.sorted())
+  {
+    all.push_back(&entry->value);
+  }
+
+  std::sort(all.begin(), all.end(),
+            [](const BuiltinInfo *a, const BuiltinInfo *b)
+            { return std::string_view(a->name) < b->name; });
+  return all;
+}
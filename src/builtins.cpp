@@ -1,81 +1,103 @@
 #include "include/builtins.h"
 #include "include/path_utils.h"
+#include "include/variables.h"
+#include "include/line_reader.h"
+#include "include/builtin_registry.h"
+#include "include/script.h"
+#include "include/functions.h"
+#include "include/shell_history.h"
+#include "include/frecency.h"
+#include "include/dir_reader.h"
+#include "include/job_limits.h"
+#include "include/plugins.h"
+#include "include/exec_image.h"
+#include "include/spawn_server.h"
+#include "include/arena.h"
+#include "include/command_executor.h"
+#include "include/command_index.h"
 #include <iostream>
 #include <iomanip>
+#include <sstream>
 #include <unistd.h>
 #include <fcntl.h>
 #include <cstring>
 #include <cerrno>
+#include <cstdlib>
+#include <csignal>
+#include <cctype>
 #include <readline/history.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include <ctime>
+#include <dirent.h>
+#include <sys/stat.h>
 
-void builtin_echo(const std::vector<std::string> &args,
-                  const std::string &redirect_file,
-                  bool redirect_stderr,
-                  bool append_mode)
+int builtin_echo(const ArgList &args, ShellContext &ctx)
 {
-  int saved_fd = -1;
-  if (!redirect_file.empty())
-  {
-    // Save original fd (stdout or stderr)
-    int fd_to_redirect = redirect_stderr ? STDERR_FILENO : STDOUT_FILENO;
-    saved_fd = dup(fd_to_redirect);
-
-    // Choose flags based on append mode
-    int flags = O_WRONLY | O_CREAT;
-    if (append_mode)
-    {
-      flags |= O_APPEND; // Append to end of file
-    }
-    else
-    {
-      flags |= O_TRUNC; // Truncate (overwrite) file
-    }
-
-    // Redirect to file
-    int fd = open(redirect_file.c_str(), flags, 0644);
-    if (fd < 0)
-    {
-      std::cerr << "Error: cannot open file for writing" << std::endl;
-      return;
-    }
-    dup2(fd, fd_to_redirect);
-    close(fd);
-  }
+  (void)ctx;
 
-  // Print all arguments except the first one (which is "echo")
+  // Print all arguments except the first one (which is "echo"). The line
+  // is built first: std::cout is unit-buffered, so it is a single write.
+  std::pmr::string line(line_arena());
   for (size_t i = 1; i < args.size(); i++)
   {
     if (i > 1)
-      std::cout << " "; // Add space between arguments
-    std::cout << args[i];
-  }
-  std::cout << std::endl;
-
-  if (!redirect_file.empty())
-  {
-    // Restore original fd
-    int fd_to_redirect = redirect_stderr ? STDERR_FILENO : STDOUT_FILENO;
-    dup2(saved_fd, fd_to_redirect);
-    close(saved_fd);
+      line += ' '; // Add space between arguments
+    line += args[i];
   }
+  line += '\n';
+  std::cout << line;
+  return 0;
 }
 
-void builtin_pwd()
+int builtin_pwd(const ArgList &args, ShellContext &ctx)
 {
+  (void)args;
+  (void)ctx;
+
   char cwd[1024]; // Buffer for current working directory
   if (getcwd(cwd, sizeof(cwd)) == nullptr)
   {
     std::cerr << "pwd: error retrieving current directory" << std::endl;
+    return 1;
   }
-  else
+  std::cout << cwd << std::endl;
+  return 0;
+}
+
+// Change directory and record the visit for z
+static int change_directory(const std::string &target_path, const char *name)
+{
+  if (chdir(target_path.c_str()) != 0)
   {
-    std::cout << cwd << std::endl;
+    std::cerr << name << ": " << target_path << ": No such file or directory" << std::endl;
+    return 1;
   }
+
+  char cwd[4096];
+  if (getcwd(cwd, sizeof(cwd)) != nullptr)
+  {
+    record_directory_visit(cwd);
+  }
+  return 0;
 }
 
-bool builtin_cd(const std::string &path)
+int builtin_cd(const ArgList &args, ShellContext &ctx)
 {
-  std::string target_path = path;
+  if (args.size() > 1 && std::string_view(args[1]) == "-j")
+  {
+    // cd -j terms: jump like z
+    ArgList z_args{"z"};
+    z_args.insert(z_args.end(), args.begin() + 2, args.end());
+    return builtin_z(z_args, ctx);
+  }
+
+  std::string target_path;
+  if (args.size() > 1)
+  {
+    target_path.assign(args[1]);
+  }
 
   if (target_path.empty())
   {
@@ -88,7 +110,7 @@ bool builtin_cd(const std::string &path)
     else
     {
       std::cerr << "cd: HOME not set" << std::endl;
-      return false;
+      return 1;
     }
   }
   else
@@ -111,24 +133,35 @@ bool builtin_cd(const std::string &path)
     }
   }
 
-  // Change directory
-  if (chdir(target_path.c_str()) != 0)
-  {
-    std::cerr << "cd: " << target_path << ": No such file or directory" << std::endl;
-    return false;
-  }
-  return true;
+  return change_directory(target_path, "cd");
 }
 
-void builtin_type(const std::string &arg, const std::set<std::string> &builtins)
+int builtin_type(const ArgList &args, ShellContext &ctx)
 {
-  if (builtins.count(arg) > 0)
-  {
-    std::cout << arg << " is a shell builtin" << std::endl;
-  }
-  else
+  (void)ctx;
+
+  int status = 0;
+  for (size_t i = 1; i < args.size(); i++)
   {
-    std::string path = find_in_path(arg);
+    const std::pmr::string &arg = args[i];
+    if (const std::string *alias = find_alias(arg))
+    {
+      std::cout << arg << " is aliased to `" << *alias << "'" << std::endl;
+      continue;
+    }
+    if (find_function(arg) != nullptr)
+    {
+      std::cout << arg << " is a function" << std::endl;
+      continue;
+    }
+    if (is_builtin(arg))
+    {
+      const std::string *plugin = plugin_for_builtin(std::string(arg));
+      std::cout << arg << " is a shell builtin" << (plugin ? " loaded from " + *plugin : "") << std::endl;
+      continue;
+    }
+
+    std::pmr::string path = find_in_path(arg);
     if (!path.empty())
     {
       std::cout << arg << " is " << path << std::endl;
@@ -136,19 +169,24 @@ void builtin_type(const std::string &arg, const std::set<std::string> &builtins)
     else
     {
       std::cout << arg << ": not found" << std::endl;
+      status = 1;
     }
   }
+  return status;
 }
 
-bool builtin_history(const std::vector<std::string> &args, int &history_offset)
+int builtin_history(const ArgList &args, ShellContext &ctx)
 {
+  (void)ctx;
+  wait_for_history();
+
   // Case 1: Just "history" - show all
   if (args.size() == 1)
   {
     HIST_ENTRY **hist_list = history_list();
     if (hist_list == nullptr || history_length == 0)
     {
-      return true;
+      return 0;
     }
 
     for (int i = 0; i < history_length; i++)
@@ -159,7 +197,7 @@ bool builtin_history(const std::vector<std::string> &args, int &history_offset)
   // Case 2: Flags (-w, -a, -r)
   else if (args.size() >= 2 && args[1][0] == '-')
   {
-    std::string flag = args[1];
+    std::string flag(args[1]);
     std::string filename;
 
     // Get filename if provided, otherwise use default
@@ -189,28 +227,29 @@ bool builtin_history(const std::vector<std::string> &args, int &history_offset)
       if (result != 0)
       {
         std::cerr << "history: write error: " << strerror(errno) << std::endl;
+        return 1;
       }
       else
       {
-        // Update offset to current history length
-        history_offset = history_length;
+        // Everything is in the file now
+        set_saved_history_entries(history_length);
       }
     }
     else if (flag == "-a")
     {
       // Append only NEW history entries to file
-      int new_entries = history_length - history_offset;
+      int new_entries = history_length - saved_history_entries();
       if (new_entries > 0)
       {
         int result = append_history(new_entries, filename.c_str());
         if (result != 0)
         {
           std::cerr << "history: append error: " << strerror(errno) << std::endl;
+          return 1;
         }
         else
         {
-          // Update offset to current history length
-          history_offset = history_length;
+          set_saved_history_entries(history_length);
         }
       }
     }
@@ -221,11 +260,13 @@ bool builtin_history(const std::vector<std::string> &args, int &history_offset)
       if (result != 0)
       {
         std::cerr << "history: read error: " << strerror(errno) << std::endl;
+        return 1;
       }
     }
     else
     {
       std::cerr << "history: " << flag << ": invalid option" << std::endl;
+      return 1;
     }
   }
   // Case 3: Number argument - show last N entries
@@ -234,23 +275,23 @@ bool builtin_history(const std::vector<std::string> &args, int &history_offset)
     int limit = -1;
     try
     {
-      limit = std::stoi(args[1]);
+      limit = std::stoi(std::string(args[1]));
     }
     catch (...)
     {
       std::cerr << "history: " << args[1] << ": numeric argument required" << std::endl;
-      return true;
+      return 1;
     }
 
     if (limit <= 0)
     {
-      return true; // Show nothing for 0 or negative
+      return 0; // Show nothing for 0 or negative
     }
 
     HIST_ENTRY **hist_list = history_list();
     if (hist_list == nullptr || history_length == 0)
     {
-      return true;
+      return 0;
     }
 
     int start_index = history_length - limit;
@@ -265,5 +306,1698 @@ bool builtin_history(const std::vector<std::string> &args, int &history_offset)
     }
   }
 
+  return 0;
+}
+
+int builtin_exit(const ArgList &args, ShellContext &ctx)
+{
+  ctx.exit_requested = true;
+  if (args.size() > 1)
+  {
+    try
+    {
+      ctx.exit_status = std::stoi(std::string(args[1]));
+    }
+    catch (...)
+    {
+      std::cerr << "exit: " << args[1] << ": numeric argument required" << std::endl;
+      ctx.exit_status = 2;
+    }
+  }
+  return ctx.exit_status;
+}
+
+int builtin_return(const ArgList &args, ShellContext &ctx)
+{
+  if (!in_function())
+  {
+    std::cerr << "return: can only `return' from a function" << std::endl;
+    return 1;
+  }
+  ctx.return_status = std::atoi(get_variable("?").c_str());
+  if (args.size() > 1)
+  {
+    try
+    {
+      ctx.return_status = std::stoi(std::string(args[1])) & 0xFF;
+    }
+    catch (...)
+    {
+      std::cerr << "return: " << args[1] << ": numeric argument required" << std::endl;
+      ctx.return_status = 2;
+    }
+  }
+  ctx.return_requested = true;
+  return ctx.return_status;
+}
+
+int builtin_exec(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  // The redirections were applied before the call and are not undone
+  if (args.size() < 2)
+  {
+    return 0;
+  }
+
+  std::pmr::string path = find_in_path(args[1], line_arena());
+  if (path.empty())
+  {
+    std::cerr << "exec: " << args[1] << ": not found" << std::endl;
+    return 127;
+  }
+  ArgList command(args.begin() + 1, args.end(), line_arena());
+  ExecImage image = build_exec_image(path, command, line_arena());
+
+  release_line_readers();
+  std::cout.flush();
+  spawn_server_stop();
+  exec_image(image);
+
+  std::cerr << "exec: " << args[1] << ": " << strerror(errno) << std::endl;
+  return 126;
+}
+
+int builtin_read(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  bool raw = false;
+  std::vector<std::string> names;
+
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    if (args[i] == "-r" && names.empty())
+    {
+      raw = true;
+    }
+    else if (is_valid_variable_name(args[i]))
+    {
+      names.emplace_back(args[i]);
+    }
+    else
+    {
+      std::cerr << "read: `" << args[i] << "': not a valid identifier" << std::endl;
+      return 1;
+    }
+  }
+
+  LineReader &reader = line_reader_for(STDIN_FILENO);
+  std::string line;
+  bool complete = reader.read_line(line);
+
+  if (!raw)
+  {
+    // Backslash escapes the next character; a trailing backslash joins lines
+    std::string unescaped;
+    for (size_t i = 0; i < line.length(); i++)
+    {
+      if (line[i] != '\\')
+      {
+        unescaped += line[i];
+      }
+      else if (i + 1 < line.length())
+      {
+        unescaped += line[++i];
+      }
+      else if (complete)
+      {
+        std::string next;
+        complete = reader.read_line(next);
+        line += next;
+      }
+    }
+    line = unescaped;
+  }
+
+  if (names.empty())
+  {
+    set_variable("REPLY", line);
+    return complete ? 0 : 1;
+  }
+
+  // Split on whitespace; the last variable gets the remainder of the line
+  const char *whitespace = " \t";
+  size_t pos = line.find_first_not_of(whitespace);
+  for (size_t n = 0; n < names.size(); n++)
+  {
+    if (pos == std::string::npos)
+    {
+      set_variable(names[n], "");
+      continue;
+    }
+
+    if (n == names.size() - 1)
+    {
+      size_t last = line.find_last_not_of(whitespace);
+      set_variable(names[n], line.substr(pos, last - pos + 1));
+      break;
+    }
+
+    size_t word_end = line.find_first_of(whitespace, pos);
+    if (word_end == std::string::npos)
+    {
+      set_variable(names[n], line.substr(pos));
+      pos = std::string::npos;
+    }
+    else
+    {
+      set_variable(names[n], line.substr(pos, word_end - pos));
+      pos = line.find_first_not_of(whitespace, word_end);
+    }
+  }
+
+  return complete ? 0 : 1;
+}
+
+int builtin_export(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  if (args.size() == 1)
+  {
+    extern char **environ;
+    for (char **env = environ; *env != nullptr; env++)
+    {
+      std::string entry(*env);
+      size_t eq = entry.find('=');
+      std::cout << "export " << entry.substr(0, eq) << "=\"" << entry.substr(eq + 1) << "\"" << std::endl;
+    }
+    return 0;
+  }
+
+  int status = 0;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    std::string_view arg(args[i]);
+    size_t eq = arg.find('=');
+    std::string name(arg.substr(0, eq));
+
+    if (!is_valid_variable_name(name))
+    {
+      std::cerr << "export: `" << arg << "': not a valid identifier" << std::endl;
+      status = 1;
+      continue;
+    }
+
+    if (eq != std::string_view::npos)
+    {
+      set_variable(name, std::string(arg.substr(eq + 1)));
+    }
+    export_variable(name);
+  }
+  return status;
+}
+
+int builtin_alias(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  if (args.size() == 1)
+  {
+    for (const auto &alias : list_aliases())
+    {
+      std::cout << "alias " << alias.first << "='" << alias.second << "'" << std::endl;
+    }
+    return 0;
+  }
+
+  int status = 0;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    std::string_view arg(args[i]);
+    size_t eq = arg.find('=');
+    if (eq != std::string_view::npos)
+    {
+      set_alias(arg.substr(0, eq), arg.substr(eq + 1));
+      continue;
+    }
+
+    const std::string *value = find_alias(arg);
+    if (value == nullptr)
+    {
+      std::cerr << "alias: " << arg << ": not found" << std::endl;
+      status = 1;
+      continue;
+    }
+    std::cout << "alias " << arg << "='" << *value << "'" << std::endl;
+  }
+  return status;
+}
+
+int builtin_unalias(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  if (args.size() == 1)
+  {
+    std::cerr << "unalias: usage: unalias name [name ...]" << std::endl;
+    return 2;
+  }
+
+  int status = 0;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    if (!unset_alias(args[i]))
+    {
+      std::cerr << "unalias: " << args[i] << ": not found" << std::endl;
+      status = 1;
+    }
+  }
+  return status;
+}
+
+int builtin_z(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  bool list = args.size() == 1;
+  std::vector<std::string> terms;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    if (std::string_view(args[i]) == "-l")
+    {
+      list = true;
+    }
+    else
+    {
+      terms.emplace_back(args[i]);
+    }
+  }
+
+  std::vector<FrecencyEntry> ranked = rank_directories(terms);
+  if (list)
+  {
+    // Best match last, next to the prompt
+    for (auto it = ranked.rbegin(); it != ranked.rend(); ++it)
+    {
+      // Formatted apart, so std::cout keeps its own flags and precision
+      std::ostringstream line;
+      line << std::left << std::setw(10) << std::fixed << std::setprecision(2) << it->score << it->path;
+      std::cout << line.str() << std::endl;
+    }
+    return ranked.empty() ? 1 : 0;
+  }
+
+  // Jumping to the current directory would do nothing; take the next best
+  char cwd[4096];
+  std::string current = getcwd(cwd, sizeof(cwd)) ? cwd : "";
+  for (const auto &entry : ranked)
+  {
+    if (entry.path != current)
+    {
+      return change_directory(entry.path, "z");
+    }
+  }
+  std::cerr << "z: no match found" << std::endl;
+  return 1;
+}
+
+// listdir writes its output in blocks of this size as entries stream in
+static const size_t LISTING_BLOCK = 64 * 1024;
+
+// Entries stat()ed together for listdir -l
+static const size_t STATX_BATCH = 4096;
+
+static bool write_listing(std::string &out)
+{
+  size_t done = 0;
+  while (done < out.size())
+  {
+    ssize_t n = write(STDOUT_FILENO, out.data() + done, out.size() - done);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false; // e.g. EPIPE from "listdir | head"
+    }
+    done += n;
+  }
+  out.clear();
   return true;
 }
+
+static char type_indicator(unsigned char type)
+{
+  switch (type)
+  {
+  case DT_DIR:
+    return '/';
+  case DT_LNK:
+    return '@';
+  case DT_FIFO:
+    return '|';
+  case DT_SOCK:
+    return '=';
+  default:
+    return '\0';
+  }
+}
+
+// Stat a batch of names with statx, spread over threads when the batch is
+// large; a failed entry gets stx_mask 0
+static void statx_batch(int dir_fd, const std::vector<std::string> &names, std::vector<struct statx> &results)
+{
+  results.resize(names.size());
+  auto stat_range = [&](size_t begin, size_t end)
+  {
+    for (size_t i = begin; i < end; i++)
+    {
+      if (statx(dir_fd, names[i].c_str(), AT_SYMLINK_NOFOLLOW,
+                STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, &results[i]) != 0)
+      {
+        results[i].stx_mask = 0;
+      }
+    }
+  };
+
+  unsigned threads = std::min<unsigned>(std::max(1u, std::thread::hardware_concurrency()), 8);
+  if (threads == 1 || names.size() < 256)
+  {
+    stat_range(0, names.size());
+    return;
+  }
+
+  size_t chunk = (names.size() + threads - 1) / threads;
+  std::vector<std::thread> workers;
+  for (unsigned t = 1; t < threads && t * chunk < names.size(); t++)
+  {
+    workers.emplace_back(stat_range, t * chunk, std::min(names.size(), (t + 1) * chunk));
+  }
+  stat_range(0, std::min(names.size(), chunk));
+  for (auto &worker : workers)
+  {
+    worker.join();
+  }
+}
+
+static void format_long_entry(std::string &out, const std::string &name, const struct statx &st)
+{
+  if (st.stx_mask == 0)
+  {
+    out += "?????????? ";
+    out += name;
+    out += '\n';
+    return;
+  }
+
+  char mode[11];
+  mode_t m = st.stx_mode;
+  mode[0] = S_ISDIR(m) ? 'd' : S_ISLNK(m) ? 'l' : S_ISFIFO(m) ? 'p' : S_ISSOCK(m) ? 's' : S_ISCHR(m) ? 'c' : S_ISBLK(m) ? 'b' : '-';
+  const char *bits = "rwxrwxrwx";
+  for (int i = 0; i < 9; i++)
+  {
+    mode[i + 1] = (m & (0400 >> i)) ? bits[i] : '-';
+  }
+  mode[10] = '\0';
+
+  time_t mtime = st.stx_mtime.tv_sec;
+  struct tm tm;
+  char when[32];
+  strftime(when, sizeof(when), "%Y-%m-%d %H:%M", localtime_r(&mtime, &tm));
+
+  char line[96];
+  snprintf(line, sizeof(line), "%s %12llu %s ", mode, static_cast<unsigned long long>(st.stx_size), when);
+  out += line;
+  out += name;
+  out += '\n';
+}
+
+// List one directory; entries are written unsorted as they are read
+static bool list_directory(const std::string &path, bool show_hidden, bool classify, bool long_format)
+{
+  int dir_fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (dir_fd < 0)
+  {
+    std::cerr << "listdir: " << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  std::string out;
+  out.reserve(LISTING_BLOCK + 4096);
+  std::vector<std::string> batch;
+  std::vector<struct statx> stats;
+  bool output_ok = true;
+
+  auto flush_batch = [&]()
+  {
+    statx_batch(dir_fd, batch, stats);
+    for (size_t i = 0; i < batch.size() && output_ok; i++)
+    {
+      format_long_entry(out, batch[i], stats[i]);
+      if (out.size() >= LISTING_BLOCK)
+      {
+        output_ok = write_listing(out);
+      }
+    }
+    batch.clear();
+  };
+
+  bool complete = read_directory(dir_fd, [&](std::string_view name, unsigned char type)
+                                 {
+    if (!show_hidden && name[0] == '.')
+    {
+      return true;
+    }
+    if (long_format)
+    {
+      batch.emplace_back(name);
+      if (batch.size() == STATX_BATCH)
+      {
+        flush_batch();
+      }
+      return output_ok;
+    }
+
+    out += name;
+    char indicator = classify ? type_indicator(type) : '\0';
+    if (indicator != '\0')
+    {
+      out += indicator;
+    }
+    out += '\n';
+    if (out.size() >= LISTING_BLOCK)
+    {
+      output_ok = write_listing(out);
+    }
+    return output_ok; });
+
+  if (output_ok && !batch.empty())
+  {
+    flush_batch();
+  }
+  if (output_ok)
+  {
+    output_ok = write_listing(out);
+  }
+  close(dir_fd);
+
+  if (!complete && output_ok)
+  {
+    std::cerr << "listdir: " << path << ": read error" << std::endl;
+    return false;
+  }
+  return true;
+}
+
+int builtin_listdir(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  bool show_hidden = false;
+  bool classify = false;
+  bool long_format = false;
+  std::vector<std::string> dirs;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    std::string_view arg(args[i]);
+    if (arg.size() > 1 && arg[0] == '-')
+    {
+      for (char flag : arg.substr(1))
+      {
+        if (flag == 'a')
+          show_hidden = true;
+        else if (flag == 'F')
+          classify = true;
+        else if (flag == 'l')
+          long_format = true;
+        else
+        {
+          std::cerr << "listdir: usage: listdir [-aFl] [dir ...]" << std::endl;
+          return 2;
+        }
+      }
+      continue;
+    }
+    dirs.emplace_back(arg);
+  }
+  if (dirs.empty())
+  {
+    dirs.push_back(".");
+  }
+
+  int status = 0;
+  for (size_t i = 0; i < dirs.size(); i++)
+  {
+    if (dirs.size() > 1)
+    {
+      std::cout << (i > 0 ? "\n" : "") << dirs[i] << ":" << std::endl;
+    }
+    if (!list_directory(dirs[i], show_hidden, classify, long_format))
+    {
+      status = 1;
+    }
+  }
+  return status;
+}
+
+// Limits ulimit knows: option, resource, unit in bytes (1 for counts and
+// seconds) and description for -a
+struct UlimitResource
+{
+  char option;
+  int resource;
+  rlim_t unit;
+  const char *description;
+};
+
+static const UlimitResource ulimit_resources[] = {
+    {'c', RLIMIT_CORE, 1024, "core file size (KiB)"},
+    {'d', RLIMIT_DATA, 1024, "data segment size (KiB)"},
+    {'f', RLIMIT_FSIZE, 1024, "file size (KiB)"},
+    {'m', RLIMIT_RSS, 1024, "resident set size (KiB)"},
+    {'n', RLIMIT_NOFILE, 1, "open files"},
+    {'s', RLIMIT_STACK, 1024, "stack size (KiB)"},
+    {'t', RLIMIT_CPU, 1, "cpu time (seconds)"},
+    {'u', RLIMIT_NPROC, 1, "processes"},
+    {'v', RLIMIT_AS, 1024, "virtual memory (KiB)"},
+};
+
+static void print_ulimit(const UlimitResource &limit, bool with_description)
+{
+  rlim_t value = get_job_rlimit(limit.resource);
+  // Formatted apart, so std::cout keeps its own flags
+  std::ostringstream line;
+  if (with_description)
+  {
+    line << std::left << std::setw(26) << limit.description << "(-" << limit.option << ") ";
+  }
+  if (value == RLIM_INFINITY)
+  {
+    line << "unlimited";
+  }
+  else
+  {
+    line << value / limit.unit;
+  }
+  std::cout << line.str() << std::endl;
+}
+
+int builtin_ulimit(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  const UlimitResource *selected = nullptr;
+  bool show_all = false;
+  size_t i = 1;
+  for (; i < args.size() && args[i].size() == 2 && args[i][0] == '-'; i++)
+  {
+    if (args[i][1] == 'a')
+    {
+      show_all = true;
+      continue;
+    }
+    selected = nullptr;
+    for (const auto &limit : ulimit_resources)
+    {
+      if (limit.option == args[i][1])
+      {
+        selected = &limit;
+      }
+    }
+    if (selected == nullptr)
+    {
+      std::cerr << "ulimit: usage: ulimit [-a] [-cdfmnstuv] [limit|unlimited]" << std::endl;
+      return 2;
+    }
+  }
+  if (selected == nullptr)
+  {
+    selected = &ulimit_resources[2]; // -f, as in POSIX
+  }
+
+  if (show_all)
+  {
+    for (const auto &limit : ulimit_resources)
+    {
+      print_ulimit(limit, true);
+    }
+    return 0;
+  }
+  if (i == args.size())
+  {
+    print_ulimit(*selected, false);
+    return 0;
+  }
+
+  rlim_t value = RLIM_INFINITY;
+  if (args[i] != "unlimited")
+  {
+    char *end;
+    errno = 0;
+    unsigned long long count = std::strtoull(args[i].c_str(), &end, 10);
+    if (args[i].empty() || *end != '\0' || args[i][0] == '-' || errno == ERANGE ||
+        count > (RLIM_INFINITY - 1) / selected->unit)
+    {
+      std::cerr << "ulimit: " << args[i] << ": invalid limit" << std::endl;
+      return 1;
+    }
+    value = count * selected->unit;
+  }
+  if (!set_job_rlimit(selected->resource, value))
+  {
+    std::cerr << "ulimit: " << args[i] << ": exceeds the hard limit" << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+// Parse "512M"-style sizes (K, M, G suffixes) or "max" for memory.max
+static bool parse_cgroup_size(const std::string &text, std::string &value)
+{
+  if (text == "max")
+  {
+    value = text;
+    return true;
+  }
+  char *end;
+  unsigned long long size = std::strtoull(text.c_str(), &end, 10);
+  if (end == text.c_str() || text[0] == '-')
+  {
+    return false;
+  }
+  std::string suffix(end);
+  const std::string suffixes = "KMG";
+  if (suffix.size() == 1 && suffixes.find(toupper(suffix[0])) != std::string::npos)
+  {
+    size <<= 10 * (suffixes.find(toupper(suffix[0])) + 1);
+  }
+  else if (!suffix.empty())
+  {
+    return false;
+  }
+  value = std::to_string(size);
+  return true;
+}
+
+// Parse "50%" (of one CPU), "1.5" (CPUs) or "max" into a cpu.max value
+static bool parse_cgroup_cpu(const std::string &text, std::string &value)
+{
+  const long period = 100000;
+  if (text == "max")
+  {
+    value = "max " + std::to_string(period);
+    return true;
+  }
+  char *end;
+  double amount = std::strtod(text.c_str(), &end);
+  if (end == text.c_str() || amount <= 0)
+  {
+    return false;
+  }
+  if (*end == '%' && end[1] == '\0')
+  {
+    amount /= 100;
+  }
+  else if (*end != '\0')
+  {
+    return false;
+  }
+  long quota = static_cast<long>(amount * period);
+  value = std::to_string(quota < 1000 ? 1000 : quota) + " " + std::to_string(period);
+  return true;
+}
+
+int builtin_limit(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  if (args.size() == 1)
+  {
+    std::cout << "cgroups: " << describe_job_cgroups() << std::endl;
+    return 0;
+  }
+  if (args.size() == 2 && args[1] == "off")
+  {
+    disable_job_cgroups();
+    return 0;
+  }
+
+  CgroupLimits limits;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    std::string arg(args[i]);
+    if (arg == "on" && args.size() == 2)
+    {
+      continue;
+    }
+    size_t equals = arg.find('=');
+    std::string key = arg.substr(0, equals);
+    std::string value = equals == std::string::npos ? "" : arg.substr(equals + 1);
+    bool ok = false;
+    if (key == "cpu")
+      ok = parse_cgroup_cpu(value, limits.cpu_max);
+    else if (key == "memory")
+      ok = parse_cgroup_size(value, limits.memory_max);
+    else if (key == "pids")
+      ok = !value.empty() && (value == "max" || value.find_first_not_of("0123456789") == std::string::npos);
+    if (key == "pids" && ok)
+      limits.pids_max = value;
+    if (!ok)
+    {
+      std::cerr << "limit: usage: limit [on|off] [cpu=N%|cpu=CPUS] [memory=SIZE] [pids=N]" << std::endl;
+      return 2;
+    }
+  }
+
+  std::string error;
+  if (!enable_job_cgroups(limits, error))
+  {
+    std::cerr << "limit: " << error << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int builtin_sched(const ArgList &args, ShellContext &ctx)
+{
+  if (args.size() == 1)
+  {
+    std::cout << "sched: " << describe_job_sched() << std::endl;
+    return 0;
+  }
+  if (args.size() == 2 && args[1] == "off")
+  {
+    set_job_sched(JobSched());
+    return 0;
+  }
+
+  JobSched sched = get_job_sched();
+  size_t i = 1;
+  for (; i < args.size(); i++)
+  {
+    if (args[i] == "--")
+    {
+      i++;
+      break;
+    }
+    if (args[i].find('=') == std::pmr::string::npos)
+    {
+      break; // Start of the command
+    }
+    std::string error;
+    if (!parse_job_sched(std::string(args[i]), sched, error))
+    {
+      std::cerr << "sched: " << error << std::endl;
+      return 2;
+    }
+  }
+
+  if (i >= args.size())
+  {
+    set_job_sched(sched);
+    return 0;
+  }
+
+  // Only this command (and what it starts) gets the settings
+  ArgList command(args.begin() + i, args.end(), line_arena());
+  JobSched saved = get_job_sched();
+  set_job_sched(sched);
+  int status;
+  std::shared_ptr<const FunctionDef> fn = find_function(command[0]);
+  const BuiltinInfo *builtin = find_builtin(command[0]);
+  if (fn != nullptr)
+  {
+    status = call_function(*fn, command, ctx);
+  }
+  else if (builtin != nullptr)
+  {
+    status = builtin->function(command, ctx);
+  }
+  else
+  {
+    std::pmr::string path = find_in_path(command[0], line_arena());
+    if (!path.empty())
+    {
+      status = execute_command(path, command);
+    }
+    else
+    {
+      report_command_not_found(command[0], std::cerr);
+      status = 127;
+    }
+  }
+  set_job_sched(saved);
+  return status;
+}
+
+int builtin_true(const ArgList &args, ShellContext &ctx)
+{
+  (void)args;
+  (void)ctx;
+  return 0;
+}
+
+int builtin_false(const ArgList &args, ShellContext &ctx)
+{
+  (void)args;
+  (void)ctx;
+  return 1;
+}
+
+// Evaluation state of test / [ over args[pos, end)
+struct TestState
+{
+  const ArgList &args;
+  size_t pos;
+  size_t end;
+  const char *name;
+  bool failed;
+};
+
+// Report a syntax or operand error once; the test then exits with 2
+static bool test_error(TestState &t, const std::string &message)
+{
+  if (!t.failed)
+  {
+    std::cerr << t.name << ": " << message << std::endl;
+    t.failed = true;
+  }
+  return false;
+}
+
+static bool is_unary_test(std::string_view op)
+{
+  return op.size() == 2 && op[0] == '-' && std::string_view("bcdefghkLnprSstuwxzOG").find(op[1]) != std::string_view::npos;
+}
+
+static bool is_binary_test(std::string_view op)
+{
+  static const std::string_view operators[] = {"=", "==", "!=", "<", ">", "-eq", "-ne", "-lt",
+                                               "-le", "-gt", "-ge", "-nt", "-ot", "-ef", "-a", "-o"};
+  return std::find(std::begin(operators), std::end(operators), op) != std::end(operators);
+}
+
+// Integers may have surrounding blanks and a sign, nothing else
+static bool test_integer(TestState &t, const std::pmr::string &text, long long &value)
+{
+  size_t digit = text.find_first_not_of(" \t");
+  if (digit != std::string::npos && (text[digit] == '+' || text[digit] == '-'))
+  {
+    digit++;
+  }
+  char *end;
+  errno = 0;
+  value = std::strtoll(text.c_str(), &end, 10);
+  while (*end == ' ' || *end == '\t')
+  {
+    end++;
+  }
+  if (digit >= text.size() || !std::isdigit(static_cast<unsigned char>(text[digit])) || *end != '\0' ||
+      errno == ERANGE)
+  {
+    return test_error(t, std::string(text) + ": integer expression expected");
+  }
+  return true;
+}
+
+static bool test_unary(std::string_view op, const std::pmr::string &operand)
+{
+  char flag = op[1];
+  if (flag == 'n')
+    return !operand.empty();
+  if (flag == 'z')
+    return operand.empty();
+  if (flag == 't')
+  {
+    char *end;
+    long fd = std::strtol(operand.c_str(), &end, 10);
+    return !operand.empty() && *end == '\0' && fd >= 0 && fd <= INT32_MAX && isatty(static_cast<int>(fd));
+  }
+  if (flag == 'r' || flag == 'w' || flag == 'x')
+  {
+    int mode = flag == 'r' ? R_OK : flag == 'w' ? W_OK : X_OK;
+    return faccessat(AT_FDCWD, operand.c_str(), mode, AT_EACCESS) == 0;
+  }
+
+  struct stat st;
+  if ((flag == 'h' || flag == 'L') ? lstat(operand.c_str(), &st) != 0 : stat(operand.c_str(), &st) != 0)
+  {
+    return false;
+  }
+  switch (flag)
+  {
+  case 'b':
+    return S_ISBLK(st.st_mode);
+  case 'c':
+    return S_ISCHR(st.st_mode);
+  case 'd':
+    return S_ISDIR(st.st_mode);
+  case 'f':
+    return S_ISREG(st.st_mode);
+  case 'h':
+  case 'L':
+    return S_ISLNK(st.st_mode);
+  case 'p':
+    return S_ISFIFO(st.st_mode);
+  case 'S':
+    return S_ISSOCK(st.st_mode);
+  case 's':
+    return st.st_size > 0;
+  case 'g':
+    return (st.st_mode & S_ISGID) != 0;
+  case 'u':
+    return (st.st_mode & S_ISUID) != 0;
+  case 'k':
+    return (st.st_mode & S_ISVTX) != 0;
+  case 'O':
+    return st.st_uid == geteuid();
+  case 'G':
+    return st.st_gid == getegid();
+  default: // -e
+    return true;
+  }
+}
+
+static bool test_binary(TestState &t, const std::pmr::string &left, std::string_view op,
+                        const std::pmr::string &right)
+{
+  if (op == "=" || op == "==")
+    return left == right;
+  if (op == "!=")
+    return left != right;
+  if (op == "<")
+    return left < right;
+  if (op == ">")
+    return left > right;
+  if (op == "-a")
+    return !left.empty() && !right.empty();
+  if (op == "-o")
+    return !left.empty() || !right.empty();
+
+  if (op == "-nt" || op == "-ot" || op == "-ef")
+  {
+    struct stat left_st, right_st;
+    bool left_ok = stat(left.c_str(), &left_st) == 0;
+    bool right_ok = stat(right.c_str(), &right_st) == 0;
+    if (op == "-ef")
+    {
+      return left_ok && right_ok && left_st.st_dev == right_st.st_dev && left_st.st_ino == right_st.st_ino;
+    }
+    // A missing file is older than any existing one
+    const struct stat &newer = op == "-nt" ? left_st : right_st;
+    const struct stat &older = op == "-nt" ? right_st : left_st;
+    bool newer_ok = op == "-nt" ? left_ok : right_ok;
+    bool older_ok = op == "-nt" ? right_ok : left_ok;
+    if (!newer_ok)
+    {
+      return false;
+    }
+    return !older_ok || newer.st_mtim.tv_sec > older.st_mtim.tv_sec ||
+           (newer.st_mtim.tv_sec == older.st_mtim.tv_sec && newer.st_mtim.tv_nsec > older.st_mtim.tv_nsec);
+  }
+
+  long long a, b;
+  if (!test_integer(t, left, a) || !test_integer(t, right, b))
+  {
+    return false;
+  }
+  if (op == "-eq")
+    return a == b;
+  if (op == "-ne")
+    return a != b;
+  if (op == "-lt")
+    return a < b;
+  if (op == "-le")
+    return a <= b;
+  if (op == "-gt")
+    return a > b;
+  return a >= b; // -ge
+}
+
+static bool test_or(TestState &t);
+
+// primary: ( expr ) | unary-op operand | operand binary-op operand | string
+static bool test_primary(TestState &t)
+{
+  if (t.pos >= t.end)
+  {
+    return test_error(t, "argument expected");
+  }
+  const ArgList &args = t.args;
+  if (args[t.pos] == "(")
+  {
+    t.pos++;
+    bool value = test_or(t);
+    if (t.pos >= t.end || args[t.pos] != ")")
+    {
+      return test_error(t, "`)' expected");
+    }
+    t.pos++;
+    return value;
+  }
+  if (t.pos + 2 < t.end && is_binary_test(args[t.pos + 1]) && args[t.pos + 1] != "-a" &&
+      args[t.pos + 1] != "-o")
+  {
+    t.pos += 3;
+    return test_binary(t, args[t.pos - 3], args[t.pos - 2], args[t.pos - 1]);
+  }
+  if (is_unary_test(args[t.pos]) && t.pos + 1 < t.end)
+  {
+    t.pos += 2;
+    return test_unary(args[t.pos - 2], args[t.pos - 1]);
+  }
+  return !args[t.pos++].empty();
+}
+
+static bool test_not(TestState &t)
+{
+  if (t.pos < t.end && t.args[t.pos] == "!")
+  {
+    t.pos++;
+    return !test_not(t);
+  }
+  return test_primary(t);
+}
+
+static bool test_and(TestState &t)
+{
+  bool value = test_not(t);
+  while (t.pos < t.end && t.args[t.pos] == "-a")
+  {
+    t.pos++;
+    bool right = test_not(t); // Always parsed, so syntax errors are found
+    value = value && right;
+  }
+  return value;
+}
+
+static bool test_or(TestState &t)
+{
+  bool value = test_and(t);
+  while (t.pos < t.end && t.args[t.pos] == "-o")
+  {
+    t.pos++;
+    bool right = test_and(t);
+    value = value || right;
+  }
+  return value;
+}
+
+// POSIX decides up to four arguments by their count; longer expressions
+// are parsed with -a binding tighter than -o
+static bool test_expression(TestState &t, size_t start, size_t count)
+{
+  const ArgList &args = t.args;
+  switch (count)
+  {
+  case 0:
+    return false;
+  case 1:
+    return !args[start].empty();
+  case 2:
+    if (args[start] == "!")
+      return !test_expression(t, start + 1, 1);
+    if (is_unary_test(args[start]))
+      return test_unary(args[start], args[start + 1]);
+    return test_error(t, std::string(args[start]) + ": unary operator expected");
+  case 3:
+    if (is_binary_test(args[start + 1]))
+      return test_binary(t, args[start], args[start + 1], args[start + 2]);
+    if (args[start] == "!")
+      return !test_expression(t, start + 1, 2);
+    if (args[start] == "(" && args[start + 2] == ")")
+      return test_expression(t, start + 1, 1);
+    return test_error(t, std::string(args[start + 1]) + ": binary operator expected");
+  case 4:
+    if (args[start] == "!")
+      return !test_expression(t, start + 1, 3);
+    if (args[start] == "(" && args[start + 3] == ")")
+      return test_expression(t, start + 1, 2);
+    break;
+  }
+
+  t.pos = start;
+  t.end = start + count;
+  bool value = test_or(t);
+  if (t.pos < t.end)
+  {
+    return test_error(t, "too many arguments");
+  }
+  return value;
+}
+
+int builtin_test(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  TestState t{args, 1, args.size(), args[0] == "[" ? "[" : "test", false};
+  if (args[0] == "[")
+  {
+    if (args.size() < 2 || args.back() != "]")
+    {
+      test_error(t, "missing `]'");
+      return 2;
+    }
+    t.end--;
+  }
+
+  bool value = test_expression(t, 1, t.end - 1);
+  if (t.failed)
+  {
+    return 2;
+  }
+  return value ? 0 : 1;
+}
+
+// Append the character a backslash escape at text[pos] (the backslash)
+// stands for. In %b arguments octal escapes are \0NNN and \c ends all
+// output. Returns the length of the escape.
+static size_t printf_escape(std::string_view text, size_t pos, bool in_argument, std::string &out, bool &stop)
+{
+  if (pos + 1 >= text.size())
+  {
+    out += '\\';
+    return 1;
+  }
+
+  char c = text[pos + 1];
+  static const std::string_view simple_from = "\\abfnrtv\"'?";
+  static const std::string_view simple_to = "\\\a\b\f\n\r\t\v\"'?";
+  size_t simple = simple_from.find(c);
+  if (simple != std::string_view::npos)
+  {
+    out += simple_to[simple];
+    return 2;
+  }
+  if (c == 'c' && in_argument)
+  {
+    stop = true;
+    return 2;
+  }
+
+  size_t start = pos + 1;
+  size_t max_digits = 3;
+  int base = 8;
+  if (c == 'x')
+  {
+    start++;
+    max_digits = 2;
+    base = 16;
+  }
+  else if (c == '0' && in_argument)
+  {
+    start++; // \0NNN
+  }
+  else if (c < '0' || c > '7')
+  {
+    out += '\\'; // Unknown escapes are kept as they are
+    out += c;
+    return 2;
+  }
+
+  size_t end = start;
+  int value = 0;
+  while (end < text.size() && end - start < max_digits &&
+         (base == 8 ? (text[end] >= '0' && text[end] <= '7') : std::isxdigit(static_cast<unsigned char>(text[end]))))
+  {
+    value = value * base + (std::isdigit(static_cast<unsigned char>(text[end])) ? text[end] - '0'
+                                                                               : (text[end] | 0x20) - 'a' + 10);
+    end++;
+  }
+  if (base == 16 && end == start)
+  {
+    out += "\\x";
+    return 2;
+  }
+  out += static_cast<char>(value);
+  return end - pos;
+}
+
+// Numeric printf arguments: C integer constants, or 'c / "c for the code
+// of character c. Invalid ones are reported and use what could be parsed.
+template <typename T, typename Parse>
+static T printf_number(const std::pmr::string &arg, Parse parse, bool &ok)
+{
+  if (!arg.empty() && (arg[0] == '\'' || arg[0] == '"'))
+  {
+    return arg.size() > 1 ? static_cast<unsigned char>(arg[1]) : 0;
+  }
+  char *end;
+  errno = 0;
+  T value = parse(arg.c_str(), &end);
+  if (arg.empty())
+  {
+    return 0;
+  }
+  if (end == arg.c_str() || *end != '\0')
+  {
+    std::cerr << "printf: " << arg << ": invalid number" << std::endl;
+    ok = false;
+  }
+  else if (errno == ERANGE)
+  {
+    std::cerr << "printf: " << arg << ": " << strerror(ERANGE) << std::endl;
+    ok = false;
+  }
+  return value;
+}
+
+// snprintf one converted value onto the output
+template <typename T>
+static void printf_append(std::string &out, const std::string &spec, T value)
+{
+  int length = snprintf(nullptr, 0, spec.c_str(), value);
+  if (length > 0)
+  {
+    size_t used = out.size();
+    out.resize(used + length + 1);
+    snprintf(&out[used], length + 1, spec.c_str(), value);
+    out.resize(used + length);
+  }
+}
+
+int builtin_printf(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  size_t first = 1;
+  if (first < args.size() && args[first] == "--")
+  {
+    first++;
+  }
+  if (first >= args.size())
+  {
+    std::cerr << "printf: usage: printf format [arguments]" << std::endl;
+    return 2;
+  }
+
+  std::string_view format(args[first]);
+  size_t next_arg = first + 1;
+  bool ok = true;
+  bool stop = false;
+  std::string out;
+
+  auto take_arg = [&]() -> const std::pmr::string *
+  {
+    return next_arg < args.size() ? &args[next_arg++] : nullptr;
+  };
+  static const std::pmr::string no_arg;
+  auto take_integer = [&]() -> long long
+  {
+    const std::pmr::string *arg = take_arg();
+    return printf_number<long long>(arg ? *arg : no_arg, [](const char *s, char **end)
+                                    { return std::strtoll(s, end, 0); }, ok);
+  };
+
+  // The format is reused until the arguments run out
+  do
+  {
+    size_t args_before = next_arg;
+    for (size_t i = 0; i < format.size() && !stop; i++)
+    {
+      if (format[i] == '\\')
+      {
+        i += printf_escape(format, i, false, out, stop) - 1;
+        continue;
+      }
+      if (format[i] != '%')
+      {
+        out += format[i];
+        continue;
+      }
+      if (i + 1 < format.size() && format[i + 1] == '%')
+      {
+        out += '%';
+        i++;
+        continue;
+      }
+
+      // %[flags][width][.precision][length]conversion; * takes an argument
+      std::string spec = "%";
+      size_t j = i + 1;
+      while (j < format.size() && std::string_view("-+ #0").find(format[j]) != std::string_view::npos)
+      {
+        spec += format[j++];
+      }
+      if (j < format.size() && format[j] == '*')
+      {
+        spec += std::to_string(take_integer());
+        j++;
+      }
+      while (j < format.size() && std::isdigit(static_cast<unsigned char>(format[j])))
+      {
+        spec += format[j++];
+      }
+      if (j < format.size() && format[j] == '.')
+      {
+        j++;
+        long long precision = 0;
+        if (j < format.size() && format[j] == '*')
+        {
+          precision = take_integer();
+          j++;
+        }
+        else
+        {
+          for (; j < format.size() && std::isdigit(static_cast<unsigned char>(format[j])); j++)
+          {
+            precision = precision * 10 + (format[j] - '0');
+          }
+        }
+        if (precision >= 0) // A negative precision counts as none
+        {
+          spec += "." + std::to_string(precision);
+        }
+      }
+      while (j < format.size() && std::string_view("hlLjzt").find(format[j]) != std::string_view::npos)
+      {
+        j++;
+      }
+      if (j >= format.size())
+      {
+        std::cerr << "printf: " << format.substr(i) << ": missing format character" << std::endl;
+        return 1;
+      }
+
+      char conversion = format[j];
+      i = j;
+      const std::pmr::string *arg;
+      switch (conversion)
+      {
+      case 'd':
+      case 'i':
+        printf_append(out, spec + "ll" + conversion, take_integer());
+        break;
+      case 'o':
+      case 'u':
+      case 'x':
+      case 'X':
+        printf_append(out, spec + "ll" + conversion, static_cast<unsigned long long>(take_integer()));
+        break;
+      case 'e':
+      case 'E':
+      case 'f':
+      case 'F':
+      case 'g':
+      case 'G':
+      case 'a':
+      case 'A':
+        arg = take_arg();
+        printf_append(out, spec + "L" + conversion,
+                      printf_number<long double>(arg ? *arg : no_arg, [](const char *s, char **end)
+                                                 { return std::strtold(s, end); }, ok));
+        break;
+      case 'c':
+        arg = take_arg();
+        printf_append(out, spec + "s", std::string(arg && !arg->empty() ? arg->substr(0, 1) : "").c_str());
+        break;
+      case 's':
+        arg = take_arg();
+        printf_append(out, spec + "s", arg ? arg->c_str() : "");
+        break;
+      case 'b':
+      {
+        arg = take_arg();
+        std::string expanded;
+        std::string_view text = arg ? std::string_view(*arg) : std::string_view();
+        for (size_t k = 0; k < text.size() && !stop; k++)
+        {
+          if (text[k] == '\\')
+          {
+            k += printf_escape(text, k, true, expanded, stop) - 1;
+          }
+          else
+          {
+            expanded += text[k];
+          }
+        }
+        printf_append(out, spec + "s", expanded.c_str());
+        break;
+      }
+      default:
+        std::cerr << "printf: `" << conversion << "': invalid format character" << std::endl;
+        std::cout << out << std::flush;
+        return 1;
+      }
+    }
+    if (next_arg == args_before)
+    {
+      break; // No conversion consumed an argument
+    }
+  } while (next_arg < args.size() && !stop);
+
+  std::cout << out << std::flush;
+  return ok ? 0 : 1;
+}
+
+int builtin_enable(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  if (args.size() == 1)
+  {
+    for (const BuiltinInfo *info : list_builtins())
+    {
+      const std::string *plugin = plugin_for_builtin(info->name);
+      std::cout << "enable " << info->name << (plugin ? " (" + *plugin + ")" : "") << std::endl;
+    }
+    return 0;
+  }
+  if (args[1] != "-f" || args.size() < 3)
+  {
+    std::cerr << "enable: usage: enable [-f plugin.so [name ...]]" << std::endl;
+    return 2;
+  }
+
+  std::vector<std::string> names(args.begin() + 3, args.end());
+  std::string error;
+  if (!load_plugin(std::string(args[2]), names, error))
+  {
+    std::cerr << "enable: " << error << std::endl;
+    return 1;
+  }
+  return 0;
+}
+
+int builtin_set(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  if (args.size() == 1 || (args.size() == 2 && (args[1] == "-o" || args[1] == "+o")))
+  {
+    for (const auto &option : list_shell_options())
+    {
+      if (args.size() == 2 && args[1] == "+o")
+      {
+        std::cout << "set " << (option.second ? "-o " : "+o ") << option.first << std::endl;
+      }
+      else
+      {
+        // Formatted apart, so std::cout keeps its own flags
+        std::ostringstream line;
+        line << std::left << std::setw(15) << option.first << (option.second ? "on" : "off");
+        std::cout << line.str() << std::endl;
+      }
+    }
+    return 0;
+  }
+
+  size_t i = 1;
+  for (; i < args.size(); i++)
+  {
+    if (args[i] == "--")
+    {
+      i++;
+      break;
+    }
+    if ((args[i] != "-o" && args[i] != "+o") || i + 1 >= args.size())
+    {
+      std::cerr << "set: usage: set [-o option] [+o option] [-- arg ...]" << std::endl;
+      return 2;
+    }
+    if (!set_shell_option(args[i + 1], args[i] == "-o"))
+    {
+      std::cerr << "set: " << args[i + 1] << ": invalid option name" << std::endl;
+      return 1;
+    }
+    i++;
+  }
+
+  // set -- a b c replaces the positional parameters
+  if (i > 1 && args[i - 1] == "--")
+  {
+    set_positional_parameters(std::vector<std::string>(args.begin() + i, args.end()));
+  }
+  return 0;
+}
+
+// Signals timeout can send, by name
+static const struct
+{
+  const char *name;
+  int number;
+} signal_names[] = {
+    {"HUP", SIGHUP}, {"INT", SIGINT}, {"QUIT", SIGQUIT}, {"KILL", SIGKILL}, {"USR1", SIGUSR1},
+    {"USR2", SIGUSR2}, {"PIPE", SIGPIPE}, {"ALRM", SIGALRM}, {"TERM", SIGTERM}, {"CONT", SIGCONT},
+    {"STOP", SIGSTOP}, {"TSTP", SIGTSTP},
+};
+
+// Parse TERM, SIGTERM or 15; returns -1 if unknown
+static int parse_signal(std::string_view text)
+{
+  if (!text.empty() && std::isdigit(static_cast<unsigned char>(text[0])))
+  {
+    char *end;
+    long number = std::strtol(std::string(text).c_str(), &end, 10);
+    return *end == '\0' && number > 0 && number < NSIG ? static_cast<int>(number) : -1;
+  }
+  if (text.substr(0, 3) == "SIG")
+  {
+    text.remove_prefix(3);
+  }
+  for (const auto &entry : signal_names)
+  {
+    if (text == entry.name)
+    {
+      return entry.number;
+    }
+  }
+  return -1;
+}
+
+// Parse a duration: a decimal number with an optional s, m, h or d suffix
+static bool parse_duration(const std::string &text, std::chrono::nanoseconds &duration)
+{
+  char *end;
+  double value = std::strtod(text.c_str(), &end);
+  if (end == text.c_str() || value < 0)
+  {
+    return false;
+  }
+  double scale = 1;
+  if (*end != '\0')
+  {
+    const char *units = "smhd";
+    const double scales[] = {1, 60, 3600, 86400};
+    const char *unit = std::strchr(units, *end);
+    if (unit == nullptr || end[1] != '\0')
+    {
+      return false;
+    }
+    scale = scales[unit - units];
+  }
+  duration = std::chrono::nanoseconds(static_cast<long long>(value * scale * 1e9));
+  return true;
+}
+
+int builtin_timeout(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  int signo = SIGTERM;
+  std::chrono::nanoseconds kill_after(0);
+  bool foreground = false;
+  size_t i = 1;
+  for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++)
+  {
+    if (args[i] == "--foreground")
+    {
+      foreground = true;
+    }
+    else if (args[i] == "-s" && i + 1 < args.size())
+    {
+      signo = parse_signal(args[++i]);
+      if (signo < 0)
+      {
+        std::cerr << "timeout: " << args[i] << ": invalid signal" << std::endl;
+        return 125;
+      }
+    }
+    else if (args[i] == "-k" && i + 1 < args.size())
+    {
+      if (!parse_duration(std::string(args[++i]), kill_after))
+      {
+        std::cerr << "timeout: " << args[i] << ": invalid time interval" << std::endl;
+        return 125;
+      }
+    }
+    else if (args[i] == "--")
+    {
+      i++;
+      break;
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  std::chrono::nanoseconds duration;
+  if (i + 1 >= args.size())
+  {
+    std::cerr << "timeout: usage: timeout [-s signal] [-k duration] [--foreground] duration command [arg ...]"
+              << std::endl;
+    return 125;
+  }
+  if (!parse_duration(std::string(args[i]), duration))
+  {
+    std::cerr << "timeout: " << args[i] << ": invalid time interval" << std::endl;
+    return 125;
+  }
+
+  ArgList command(args.begin() + i + 1, args.end(), line_arena());
+  return execute_with_timeout(command, duration, signo, kill_after, foreground);
+}
+
+int builtin_profile(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  std::string output;
+  ProfileFormat format = ProfileFormat::CHROME;
+  size_t i = 1;
+  for (; i < args.size() && args[i].size() > 1 && args[i][0] == '-'; i++)
+  {
+    if ((args[i] == "-o" || args[i] == "-f") && i + 1 == args.size())
+    {
+      i = args.size(); // Option without its value: usage
+      break;
+    }
+    if (args[i] == "-o")
+    {
+      output = std::string(args[++i]);
+    }
+    else if (args[i] == "-f")
+    {
+      if (args[++i] == "chrome")
+      {
+        format = ProfileFormat::CHROME;
+      }
+      else if (args[i] == "folded")
+      {
+        format = ProfileFormat::FOLDED;
+      }
+      else
+      {
+        std::cerr << "profile: " << args[i] << ": unknown format (chrome or folded)" << std::endl;
+        return 125;
+      }
+    }
+    else if (args[i] == "--")
+    {
+      i++;
+      break;
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  if (i >= args.size())
+  {
+    std::cerr << "profile: usage: profile [-o file] [-f chrome|folded] command [arg ...]" << std::endl;
+    return 125;
+  }
+  if (output.empty())
+  {
+    output = format == ProfileFormat::CHROME ? "profile.json" : "profile.folded";
+  }
+
+  ArgList command(args.begin() + i, args.end(), line_arena());
+  return execute_profiled(command, output, format);
+}
@@ -0,0 +1,102 @@
+#include "include/child_process.h"
+#include <cerrno>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+ChildProcess track_child(pid_t pid)
+{
+  int pidfd = -1;
+#ifdef SYS_pidfd_open
+  pidfd = static_cast<int>(syscall(SYS_pidfd_open, pid, 0)); // Linux 5.3+
+#endif
+  return ChildProcess{pid, pidfd, false, 0};
+}
+
+void release_child(ChildProcess &child)
+{
+  if (child.pidfd >= 0)
+  {
+    close(child.pidfd);
+    child.pidfd = -1;
+  }
+}
+
+// Reap one child that has exited (or block until it does)
+static void reap(ChildProcess &child)
+{
+  while (waitpid(child.pid, &child.status, 0) < 0)
+  {
+    if (errno != EINTR)
+    {
+      child.status = 0; // Already reaped elsewhere
+      break;
+    }
+  }
+  child.exited = true;
+}
+
+bool wait_children(ChildProcess *children, size_t count,
+                   const std::chrono::steady_clock::time_point *deadline)
+{
+  std::vector<struct pollfd> fds;
+  std::vector<size_t> fd_child; // fds[i] -> index into children
+  for (;;)
+  {
+    fds.clear();
+    fd_child.clear();
+    for (size_t i = 0; i < count; i++)
+    {
+      if (children[i].exited)
+      {
+        continue;
+      }
+      if (children[i].pidfd < 0)
+      {
+        reap(children[i]); // No pidfd: nothing to poll
+        continue;
+      }
+      fds.push_back(pollfd{children[i].pidfd, POLLIN, 0});
+      fd_child.push_back(i);
+    }
+    if (fds.empty())
+    {
+      return true;
+    }
+
+    // A pidfd becomes readable when its process exits
+    struct timespec timeout;
+    struct timespec *limit = nullptr;
+    if (deadline != nullptr)
+    {
+      auto remaining = *deadline - std::chrono::steady_clock::now();
+      if (remaining <= remaining.zero())
+      {
+        return false;
+      }
+      auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(remaining).count();
+      timeout.tv_sec = ns / 1000000000;
+      timeout.tv_nsec = ns % 1000000000;
+      limit = &timeout;
+    }
+    int ready = ppoll(fds.data(), fds.size(), limit, nullptr);
+    if (ready < 0 && errno != EINTR)
+    {
+      // Fall back to blocking waits
+      for (size_t index : fd_child)
+      {
+        release_child(children[index]);
+      }
+      continue;
+    }
+    for (size_t i = 0; ready > 0 && i < fds.size(); i++)
+    {
+      if (fds[i].revents != 0)
+      {
+        reap(children[fd_child[i]]);
+      }
+    }
+  }
+}
@@ -1,271 +1,739 @@
 #include "include/command_executor.h"
 #include "include/command_parser.h"
 #include "include/path_utils.h"
+#include "include/builtin_registry.h"
+#include "include/spawn_server.h"
+#include "include/line_reader.h"
+#include "include/script.h"
+#include "include/arena.h"
+#include "include/exec_image.h"
+#include "include/command_index.h"
+#include "include/functions.h"
+#include "include/variables.h"
+#include "include/job_limits.h"
+#include "include/redirection.h"
+#include "include/child_process.h"
+#include "include/text_filters.h"
 #include <iostream>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <sys/mman.h>
 #include <fcntl.h>
 #include <vector>
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <csignal>
+#include <termios.h>
+#include <sys/prctl.h>
 
-void execute_command(const std::string &path,
-                     const std::vector<std::string> &args,
-                     const std::string &redirect_file,
-                     bool redirect_stderr,
-                     bool append_mode)
+// Convert a waitpid status into a shell exit status
+static int decode_status(int status)
 {
-  pid_t pid = fork(); // Create child process
-
-  if (pid == 0)
+  if (WIFEXITED(status))
   {
-    // CHILD PROCESS - runs the command
+    return WEXITSTATUS(status);
+  }
+  if (WIFSIGNALED(status))
+  {
+    return 128 + WTERMSIG(status);
+  }
+  return 1;
+}
 
-    // Handle output redirection
-    if (!redirect_file.empty())
-    {
-      // Choose flags based on append mode
-      int flags = O_WRONLY | O_CREAT;
-      if (append_mode)
-      {
-        flags |= O_APPEND; // Append to end of file
-      }
-      else
-      {
-        flags |= O_TRUNC; // Truncate (overwrite) file
-      }
+int execute_command(const std::pmr::string &path,
+                    const ArgList &args,
+                    const std::pmr::vector<Redirection> &redirections)
+{
+  // Give buffered stdin back so the command sees it
+  release_line_readers();
 
-      int fd = open(redirect_file.c_str(), flags, 0644);
-      if (fd < 0)
-      {
-        std::cerr << "Error: cannot open file for writing" << std::endl;
-        exit(1);
-      }
+  // Build argv/envp before forking so the child does no allocation
+  ExecImage image = build_exec_image(path, args, line_arena());
 
-      // Redirect either stdout or stderr based on redirect type
-      if (redirect_stderr)
-      {
-        dup2(fd, STDERR_FILENO); // Redirect stderr (fd 2)
-      }
-      else
-      {
-        dup2(fd, STDOUT_FILENO); // Redirect stdout (fd 1)
-      }
-      close(fd);
+  // Hand the command to the spawn server when it is running, so the fork
+  // happens in the helper's small address space instead of ours. Limited
+  // jobs are forked here: the helper cannot set them up, and it only passes
+  // on stdin, stdout and stderr.
+  if (spawn_server_active() && !job_limits_active() && !needs_extra_descriptors(redirections))
+  {
+    // Point our own 0-2 at the targets for the duration of the request
+    SavedDescriptors saved;
+    if (!apply_redirections(redirections, &saved))
+    {
+      restore_redirections(saved);
+      return 1;
     }
+    int fds[3] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    int status = spawn_server_run(image, fds);
+    restore_redirections(saved);
+    if (status != -1)
+    {
+      return decode_status(status);
+    }
+    // Helper unavailable - fall through to a direct fork
+  }
+
+  JobCgroup job;
+  if (!start_job_cgroup(job))
+  {
+    return 1;
+  }
+
+  pid_t pid = fork(); // Create child process
+
+  if (pid == 0)
+  {
+    // CHILD PROCESS - runs the command
+    enter_job_cgroup(job);
 
-    // Convert args to char* array (exec requires this format)
-    std::vector<char *> c_args;
-    for (const auto &arg : args)
+    if (!apply_redirections(redirections, nullptr))
     {
-      c_args.push_back(const_cast<char *>(arg.c_str()));
+      exit(1);
     }
-    c_args.push_back(nullptr); // Null-terminate the array
 
-    execv(path.c_str(), c_args.data());
+    exec_image(image);
 
-    // If execv returns, it failed
-    std::cerr << "Failed to execute " << path << std::endl;
-    exit(1);
+    // If exec_image returns, it failed: 127 if the file is gone, else 126
+    int error = errno;
+    std::cerr << "Failed to execute " << path << ": " << strerror(error) << std::endl;
+    _exit(error == ENOENT ? 127 : 126);
   }
   else if (pid > 0)
   {
     // PARENT PROCESS - wait for child to finish
     int status;
     waitpid(pid, &status, 0);
+    finish_job_cgroup(job);
+    return decode_status(status);
   }
   else
   {
     // Fork failed
+    finish_job_cgroup(job);
     std::cerr << "Failed to create process for " << path << std::endl;
+    return 1;
   }
 }
 
-void execute_pipeline(const std::vector<std::string> &commands, const std::set<std::string> &builtins)
+// Run a parsed command in a forked child like a subshell: a function, a
+// builtin (if it makes sense outside the shell process) or a program
+// resolved by the parent. Never returns.
+[[noreturn]] static void run_in_child(const ArgList &args, const ExecImage &image, const char *where)
+{
+  std::shared_ptr<const FunctionDef> fn = find_function(args[0]);
+  if (fn != nullptr)
+  {
+    ShellContext ctx;
+    exit(call_function(*fn, args, ctx));
+  }
+
+  const BuiltinInfo *builtin = find_builtin(args[0]);
+  if (builtin != nullptr)
+  {
+    if (!(builtin->flags & BUILTIN_PIPELINE_SAFE))
+    {
+      // cd, exit, ... would only change this child
+      std::cerr << args[0] << ": cannot be used " << where << std::endl;
+      exit(1);
+    }
+    ShellContext ctx;
+    exit(builtin->function(args, ctx));
+  }
+
+  if (image.path == nullptr)
+  {
+    report_command_not_found(args[0], std::cerr);
+    exit(127);
+  }
+  exec_image(image);
+  int error = errno;
+  std::cerr << "execve failed: " << strerror(error) << std::endl;
+  _exit(error == ENOENT ? 127 : 126);
+}
+
+// Check that every redirection of a stage is "< file" (fd 0) or "> file" /
+// ">> file" (fd 1), the ones a fused run of filters can take at its ends
+static bool redirects_only(const std::pmr::vector<Redirection> &redirections, int fd)
+{
+  for (const auto &redirection : redirections)
+  {
+    bool file = fd == STDIN_FILENO ? redirection.kind == Redirection::READ
+                                   : redirection.kind == Redirection::WRITE || redirection.kind == Redirection::APPEND;
+    if (!file || redirection.fd != fd)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Capacity of a pipe between two stages, which a fused run of filters
+// needs to tell whether a stage would have been cut off by SIGPIPE
+static size_t pipe_capacity(long pipe_size)
+{
+  int fds[2];
+  if (pipe(fds) < 0)
+  {
+    return 64 * 1024; // The Linux default
+  }
+  if (pipe_size > 0)
+  {
+    fcntl(fds[1], F_SETPIPE_SZ, static_cast<int>(pipe_size));
+  }
+  int capacity = fcntl(fds[1], F_GETPIPE_SZ);
+  close(fds[0]);
+  close(fds[1]);
+  return capacity > 0 ? capacity : 64 * 1024;
+}
+
+int execute_pipeline(const std::vector<std::string> &commands, std::vector<int> *stage_statuses)
 {
   int num_commands = commands.size();
 
   if (num_commands == 0)
-    return;
+    return 0;
+
+  release_line_readers();
 
-  // Create pipes: we need (n-1) pipes for n commands
-  int pipes[num_commands - 1][2];
-  for (int i = 0; i < num_commands - 1; i++)
+  // Parse every stage and build its exec image before forking, so the
+  // children only index into memory they already have
+  std::pmr::vector<RedirectInfo> redirs(line_arena());
+  std::pmr::vector<ArgList> stage_args(line_arena());
+  std::pmr::vector<ExecImage> images(line_arena());
+  for (const auto &cmd : commands)
+  {
+    ExecImage image{nullptr, nullptr, nullptr};
+    if (is_compound_command(cmd))
+    {
+      redirs.emplace_back(line_arena());
+      stage_args.emplace_back();
+    }
+    else
+    {
+      redirs.push_back(parse_redirect(cmd, line_arena()));
+      if (!redirs.back().error.empty())
+      {
+        std::cerr << redirs.back().error << std::endl;
+        return 2;
+      }
+      stage_args.push_back(parse_args(redirs.back().command, line_arena(), true));
+
+      const ArgList &args = stage_args.back();
+      if (!args.empty() && !is_builtin(args[0]) && find_function(args[0]) == nullptr)
+      {
+        std::pmr::string path = find_in_path(args[0], line_arena());
+        if (!path.empty())
+        {
+          image = build_exec_image(path, args, line_arena());
+        }
+      }
+    }
+    images.push_back(image);
+  }
+
+  // With the fusefilters option each run of grep/head/wc/cut stages is one
+  // process that filters in memory (see text_filters.h)
+  struct StageGroup
+  {
+    int first;
+    int last;
+    bool fused;
+    bool writes_file; // The last stage's output goes to a file: the run ends here
+  };
+  std::vector<StageGroup> groups;
+  std::vector<TextFilter> filters(num_commands);
+  bool fuse = shell_option("fusefilters");
+  for (int i = 0; i < num_commands; i++)
+  {
+    // Input from a file can start a run and output to a file can end it
+    const auto &redirections = redirs[i].redirections;
+    bool reads_file = !redirections.empty() && redirects_only(redirections, STDIN_FILENO);
+    bool writes_file = !redirections.empty() && redirects_only(redirections, STDOUT_FILENO);
+    bool fusable = fuse && images[i].path != nullptr && (redirections.empty() || reads_file || writes_file) &&
+                   parse_text_filter(stage_args[i], filters[i]);
+    if (fusable && !reads_file && !groups.empty() && groups.back().fused && !groups.back().writes_file)
+    {
+      groups.back().last = i;
+      groups.back().writes_file = writes_file;
+    }
+    else
+    {
+      groups.push_back(StageGroup{i, i, fusable, writes_file});
+    }
+  }
+  int num_groups = groups.size();
+
+  // A fused process reports the status of each of its stages here
+  int *fused_statuses = nullptr;
+  size_t fused_size = num_commands * sizeof(int);
+  for (const StageGroup &group : groups)
+  {
+    if (group.fused && fused_statuses == nullptr)
+    {
+      void *shared = mmap(nullptr, fused_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+      fused_statuses = shared != MAP_FAILED ? static_cast<int *>(shared) : nullptr;
+      if (fused_statuses == nullptr)
+      {
+        std::cerr << "mmap failed" << std::endl;
+        return 1;
+      }
+    }
+  }
+
+  // Create pipes: we need (n-1) pipes for n processes
+  // SHELL_PIPE_SIZE (bytes) enlarges the pipe buffers for bulk pipelines
+  long pipe_size = std::strtol(get_variable("SHELL_PIPE_SIZE").c_str(), nullptr, 10);
+  size_t capacity = fused_statuses != nullptr ? pipe_capacity(pipe_size) : 0;
+  int pipes[num_groups - 1][2];
+  for (int i = 0; i < num_groups - 1; i++)
   {
     if (pipe(pipes[i]) < 0)
     {
       std::cerr << "pipe failed" << std::endl;
-      return;
+      return 1;
+    }
+    if (pipe_size > 0)
+    {
+      fcntl(pipes[i][1], F_SETPIPE_SZ, static_cast<int>(pipe_size)); // Best effort
     }
   }
 
-  // Fork a process for each command
-  for (int i = 0; i < num_commands; i++)
+  // All stages share one cgroup
+  JobCgroup job;
+  if (!start_job_cgroup(job))
+  {
+    for (int i = 0; i < num_groups - 1; i++)
+    {
+      close(pipes[i][0]);
+      close(pipes[i][1]);
+    }
+    return 1;
+  }
+
+  // CPU for each process when sched spread is on
+  std::vector<int> stage_cpus(num_groups);
+  plan_pipeline_cpus(num_groups, stage_cpus.data());
+
+  // Fork a process for each command; each is tracked through a pidfd
+  std::vector<ChildProcess> children;
+  for (int g = 0; g < num_groups; g++)
   {
     pid_t pid = fork();
 
     if (pid < 0)
     {
       std::cerr << "fork failed" << std::endl;
-      return;
+      break;
     }
 
     if (pid == 0)
     {
       // CHILD PROCESS
+      enter_job_cgroup(job);
+      enter_pipeline_stage(stage_cpus[g]);
 
       // Redirect stdin from previous pipe (if not first command)
-      if (i > 0)
+      if (g > 0)
       {
-        dup2(pipes[i - 1][0], STDIN_FILENO);
+        dup2(pipes[g - 1][0], STDIN_FILENO);
       }
 
       // Redirect stdout to next pipe (if not last command)
-      if (i < num_commands - 1)
+      if (g < num_groups - 1)
       {
-        dup2(pipes[i][1], STDOUT_FILENO);
+        dup2(pipes[g][1], STDOUT_FILENO);
       }
 
       // Close all pipe file descriptors in child
-      for (int j = 0; j < num_commands - 1; j++)
+      for (int j = 0; j < num_groups - 1; j++)
       {
         close(pipes[j][0]);
         close(pipes[j][1]);
       }
 
-      // Parse and execute this command
-      std::string cmd = commands[i];
-      RedirectInfo redir = parse_redirect(cmd);
-      std::vector<std::string> args = parse_args(redir.command);
-
-      if (args.empty())
-      {
-        exit(1);
-      }
+      // stdin may have changed - buffered input belongs to the parent
+      reset_line_readers();
 
-      // Handle redirection if present
-      if (redir.has_redirect)
+      int i = groups[g].first;
+      if (groups[g].fused)
       {
-        int flags = O_WRONLY | O_CREAT;
-        if (redir.append_mode)
-        {
-          flags |= O_APPEND;
-        }
-        else
-        {
-          flags |= O_TRUNC;
-        }
-
-        int fd = open(redir.filename.c_str(), flags, 0644);
-        if (fd < 0)
+        int last = groups[g].last;
+        if (!apply_redirections(redirs[i].redirections, nullptr) ||
+            (last != i && !apply_redirections(redirs[last].redirections, nullptr)))
         {
-          std::cerr << "Error: cannot open file" << std::endl;
           exit(1);
         }
+        exit(run_text_filters(&filters[i], last - i + 1, capacity, fused_statuses + i));
+      }
 
-        if (redir.redirect_stderr)
-        {
-          dup2(fd, STDERR_FILENO);
-        }
-        else
-        {
-          dup2(fd, STDOUT_FILENO);
-        }
-        close(fd);
+      // Compound commands (while loops) run through the script executor
+      if (is_compound_command(commands[i]))
+      {
+        ShellContext ctx;
+        exit(execute_script(commands[i], ctx));
       }
+      const RedirectInfo &redir = redirs[i];
+      const ArgList &args = stage_args[i];
 
-      // Check if it's a builtin - builtins in pipelines must run in child process
-      if (args[0] == "echo")
+      if (args.empty())
       {
-        // Execute echo in child
-        for (size_t j = 1; j < args.size(); j++)
-        {
-          if (j > 1)
-            std::cout << " ";
-          std::cout << args[j];
-        }
-        std::cout << std::endl;
-        exit(0);
+        exit(1);
       }
-      else if (args[0] == "pwd")
+
+      if (!apply_redirections(redir.redirections, nullptr))
       {
-        char cwd[1024];
-        if (getcwd(cwd, sizeof(cwd)) != nullptr)
-        {
-          std::cout << cwd << std::endl;
-        }
-        exit(0);
+        exit(1);
       }
-      else if (args[0] == "type")
+
+      run_in_child(args, images[i], "in a pipeline");
+    }
+    children.push_back(track_child(pid));
+  }
+
+  // PARENT PROCESS
+  // Close all pipe file descriptors in parent
+  for (int i = 0; i < num_groups - 1; i++)
+  {
+    close(pipes[i][0]);
+    close(pipes[i][1]);
+  }
+
+  // Wait for exactly these children; other children of the shell are not
+  // reaped here
+  wait_children(children.data(), children.size());
+  finish_job_cgroup(job);
+
+  std::vector<int> statuses(num_commands, 1); // Stages that never started failed
+  for (size_t g = 0; g < children.size(); g++)
+  {
+    const StageGroup &group = groups[g];
+    for (int i = group.first; i <= group.last; i++)
+    {
+      // A fused process that was killed (e.g. SIGPIPE) ends all its stages
+      bool reported = group.fused && WIFEXITED(children[g].status);
+      statuses[i] = reported ? fused_statuses[i] : decode_status(children[g].status);
+    }
+    release_child(children[g]);
+  }
+  if (fused_statuses != nullptr)
+  {
+    munmap(fused_statuses, fused_size);
+  }
+  if (stage_statuses != nullptr)
+  {
+    *stage_statuses = statuses;
+  }
+
+  // With pipefail the rightmost failing stage decides
+  if (shell_option("pipefail"))
+  {
+    for (int i = num_commands - 1; i >= 0; i--)
+    {
+      if (statuses[i] != 0)
       {
-        // Execute type in child
-        if (args.size() > 1)
-        {
-          std::string arg = args[1];
-          if (builtins.count(arg) > 0)
-          {
-            std::cout << arg << " is a shell builtin" << std::endl;
-          }
-          else
-          {
-            std::string path = find_in_path(arg);
-            if (!path.empty())
-            {
-              std::cout << arg << " is " << path << std::endl;
-            }
-            else
-            {
-              std::cout << arg << ": not found" << std::endl;
-            }
-          }
-        }
-        exit(0);
+        return statuses[i];
       }
-      else if (args[0] == "cd")
+    }
+    return 0;
+  }
+  return statuses.back();
+}
+
+// Make a process group the terminal's foreground group, so it can read
+// from the terminal and gets Ctrl+C. SIGTTOU is blocked: the caller may be
+// in a background group (a child that has just left the shell's group, or
+// the shell taking the terminal back).
+static void give_terminal_to(pid_t group)
+{
+  sigset_t ttou, old;
+  sigemptyset(&ttou);
+  sigaddset(&ttou, SIGTTOU);
+  sigprocmask(SIG_BLOCK, &ttou, &old);
+  tcsetpgrp(STDIN_FILENO, group);
+  sigprocmask(SIG_SETMASK, &old, nullptr);
+}
+
+int execute_with_timeout(const ArgList &args, std::chrono::nanoseconds duration, int signo,
+                         std::chrono::nanoseconds kill_after, bool foreground)
+{
+  release_line_readers();
+  std::cout.flush();
+
+  ExecImage image{nullptr, nullptr, nullptr};
+  if (!is_builtin(args[0]) && find_function(args[0]) == nullptr)
+  {
+    std::pmr::string path = find_in_path(args[0], line_arena());
+    if (path.empty())
+    {
+      report_command_not_found(args[0], std::cerr);
+      return 127;
+    }
+    image = build_exec_image(path, args, line_arena());
+  }
+
+  JobCgroup job;
+  if (!start_job_cgroup(job))
+  {
+    return 125;
+  }
+
+  bool owns_terminal = !foreground && isatty(STDIN_FILENO) && tcgetpgrp(STDIN_FILENO) == getpgrp();
+  pid_t pid = fork();
+  if (pid == 0)
+  {
+    // CHILD PROCESS - both sides set the group and terminal, whichever
+    // runs first
+    enter_job_cgroup(job);
+    if (!foreground)
+    {
+      setpgid(0, 0);
+      if (owns_terminal)
       {
-        // cd in pipeline doesn't make sense but handle it anyway
-        std::cerr << "cd: cannot change directory in pipeline" << std::endl;
-        exit(1);
+        give_terminal_to(getpid());
       }
-      else if (args[0] == "exit")
+    }
+    run_in_child(args, image, "with timeout");
+  }
+  if (pid < 0)
+  {
+    finish_job_cgroup(job);
+    std::cerr << "timeout: fork failed" << std::endl;
+    return 125;
+  }
+
+  pid_t target = pid;
+  if (!foreground)
+  {
+    setpgid(pid, pid);
+    target = -pid; // The whole group
+    if (owns_terminal)
+    {
+      give_terminal_to(pid);
+    }
+  }
+
+  ChildProcess child = track_child(pid);
+  bool timed_out = false;
+  bool killed = false;
+  auto deadline = std::chrono::steady_clock::now() + duration;
+  if (duration.count() > 0 && !wait_children(&child, 1, &deadline))
+  {
+    timed_out = true;
+    kill(target, signo);
+    kill(target, SIGCONT); // A stopped command only acts on the signal once continued
+
+    auto kill_deadline = std::chrono::steady_clock::now() + kill_after;
+    if (kill_after.count() > 0 && !wait_children(&child, 1, &kill_deadline))
+    {
+      kill(target, SIGKILL);
+      killed = true;
+    }
+  }
+  wait_children(&child, 1);
+  release_child(child);
+  finish_job_cgroup(job);
+
+  if (owns_terminal)
+  {
+    give_terminal_to(getpgrp());
+  }
+  if (killed)
+  {
+    return 128 + SIGKILL;
+  }
+  return timed_out ? 124 : decode_status(child.status);
+}
+
+int execute_profiled(const ArgList &args, const std::string &output, ProfileFormat format)
+{
+  release_line_readers();
+  std::cout.flush();
+
+  ExecImage image{nullptr, nullptr, nullptr};
+  if (!is_builtin(args[0]) && find_function(args[0]) == nullptr)
+  {
+    std::pmr::string path = find_in_path(args[0], line_arena());
+    if (path.empty())
+    {
+      report_command_not_found(args[0], std::cerr);
+      return 127;
+    }
+    image = build_exec_image(path, args, line_arena());
+  }
+
+  JobCgroup job;
+  if (!start_job_cgroup(job))
+  {
+    return 125;
+  }
+
+  pid_t profiler = fork();
+  if (profiler == 0)
+  {
+    // PROFILER PROCESS - Ctrl+C and exits are collected by sigtimedwait,
+    // and orphaned descendants are reparented here instead of to init
+    sigset_t wake, old_mask;
+    sigemptyset(&wake);
+    sigaddset(&wake, SIGCHLD);
+    sigaddset(&wake, SIGINT);
+    sigaddset(&wake, SIGQUIT);
+    sigprocmask(SIG_BLOCK, &wake, &old_mask);
+    if (prctl(PR_SET_CHILD_SUBREAPER, 1) < 0)
+    {
+      std::cerr << "profile: cannot become a subreaper" << std::endl;
+      exit(125);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      // CHILD PROCESS - the command
+      sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+      enter_job_cgroup(job);
+      run_in_child(args, image, "under profile");
+    }
+    if (pid < 0)
+    {
+      std::cerr << "profile: fork failed" << std::endl;
+      exit(125);
+    }
+
+    std::vector<ProfiledProcess> processes;
+    int status = profile_descendants(pid, processes);
+    print_profile_summary(std::cerr, processes, 5);
+    if (!write_profile(output, format, processes))
+    {
+      std::cerr << "profile: cannot write " << output << std::endl;
+      exit(125);
+    }
+    std::cerr << "profile: wrote " << output << std::endl;
+    exit(decode_status(status));
+  }
+  if (profiler < 0)
+  {
+    finish_job_cgroup(job);
+    std::cerr << "profile: fork failed" << std::endl;
+    return 125;
+  }
+
+  ChildProcess child = track_child(profiler);
+  wait_children(&child, 1);
+  release_child(child);
+  finish_job_cgroup(job);
+  return decode_status(child.status);
+}
+
+// Bytes requested per read() of captured output
+static const size_t CAPTURE_CHUNK = 64 * 1024;
+
+int capture_output(const std::vector<std::string> &commands, std::vector<std::string> &outputs)
+{
+  outputs.assign(commands.size(), std::string());
+  release_line_readers();
+  std::cout.flush(); // Otherwise the children would repeat buffered output
+
+  // Start every command before reading any output
+  std::vector<pid_t> pids(commands.size(), -1);
+  std::vector<struct pollfd> fds;
+  std::vector<size_t> fd_output; // fds[i] -> index into outputs
+  for (size_t i = 0; i < commands.size(); i++)
+  {
+    int pipefd[2];
+    if (pipe2(pipefd, O_CLOEXEC) < 0)
+    {
+      std::cerr << "pipe failed" << std::endl;
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      // CHILD PROCESS - a subshell writing to the pipe
+      dup2(pipefd[1], STDOUT_FILENO);
+      close(pipefd[0]);
+      close(pipefd[1]);
+      for (const auto &other : fds)
       {
-        // exit in pipeline shouldn't exit the shell
-        std::cerr << "exit: cannot exit from pipeline" << std::endl;
-        exit(1);
+        close(other.fd); // Siblings' pipes; they must see EOF without us
       }
-      else
+      reset_line_readers();
+
+      ShellContext ctx;
+      exit(execute_script(commands[i], ctx));
+    }
+
+    close(pipefd[1]);
+    if (pid < 0)
+    {
+      std::cerr << "fork failed" << std::endl;
+      close(pipefd[0]);
+      continue;
+    }
+    pids[i] = pid;
+    fds.push_back(pollfd{pipefd[0], POLLIN, 0});
+    fd_output.push_back(i);
+  }
+
+  // Read whichever pipe has data until all are at EOF, so no command blocks
+  // on a full pipe while we wait for another
+  size_t open_fds = fds.size();
+  while (open_fds > 0)
+  {
+    if (poll(fds.data(), fds.size(), -1) < 0)
+    {
+      if (errno == EINTR)
       {
-        // External command
-        std::string path = find_in_path(args[0]);
-        if (path.empty())
-        {
-          std::cerr << args[0] << ": command not found" << std::endl;
-          exit(1);
-        }
+        continue;
+      }
+      break;
+    }
 
-        std::vector<char *> c_args;
-        for (const auto &arg : args)
-        {
-          c_args.push_back(const_cast<char *>(arg.c_str()));
-        }
-        c_args.push_back(nullptr);
+    for (size_t i = 0; i < fds.size(); i++)
+    {
+      if (fds[i].fd < 0 || fds[i].revents == 0)
+      {
+        continue;
+      }
 
-        execv(path.c_str(), c_args.data());
-        std::cerr << "execv failed" << std::endl;
-        exit(1);
+      // Read straight into the output's spare capacity
+      std::string &out = outputs[fd_output[i]];
+      size_t used = out.size();
+      out.resize(used + CAPTURE_CHUNK);
+      ssize_t n = read(fds[i].fd, &out[used], CAPTURE_CHUNK);
+      out.resize(used + (n > 0 ? n : 0));
+      if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN))
+      {
+        close(fds[i].fd);
+        fds[i].fd = -1; // poll() ignores negative descriptors
+        open_fds--;
       }
     }
   }
-
-  // PARENT PROCESS
-  // Close all pipe file descriptors in parent
-  for (int i = 0; i < num_commands - 1; i++)
+  for (auto &fd : fds)
   {
-    close(pipes[i][0]);
-    close(pipes[i][1]);
+    if (fd.fd >= 0)
+    {
+      close(fd.fd);
+    }
   }
 
-  // Wait for all children
-  for (int i = 0; i < num_commands; i++)
+  int last_status = 1;
+  for (size_t i = 0; i < commands.size(); i++)
   {
-    wait(nullptr);
+    int status;
+    if (pids[i] > 0 && waitpid(pids[i], &status, 0) == pids[i])
+    {
+      last_status = decode_status(status);
+    }
+    else
+    {
+      last_status = 1;
+    }
+
+    std::string &out = outputs[i];
+    out.erase(out.find_last_not_of('\n') + 1); // npos + 1 == 0 clears all-newline output
   }
+  return last_status;
 }
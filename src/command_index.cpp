@@ -0,0 +1,414 @@
+#include "include/command_index.h"
+#include "include/path_utils.h"
+#include "include/builtin_registry.h"
+#include <algorithm>
+#include <numeric>
+#include <tuple>
+#include <iostream>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// BK-tree node: children are keyed by their edit distance to this word
+struct BKNode
+{
+  int word; // Index into index_names
+  std::vector<std::pair<int, int>> children; // (distance, node index)
+};
+
+static std::string index_path_env;
+static std::vector<IndexedDir> index_dirs;
+static std::vector<std::string> index_names;
+static std::vector<BKNode> bk_nodes;
+static bool index_built = false;
+static bool bk_built = false;
+
+// Read the modification time of a directory (zero if it is missing)
+static struct timespec dir_mtime(const std::string &dir)
+{
+  struct stat st;
+  if (stat(dir.c_str(), &st) != 0)
+  {
+    return timespec{0, 0};
+  }
+  return st.st_mtim;
+}
+
+static bool index_is_current(const char *path_env)
+{
+  if (!index_built || index_path_env != path_env)
+  {
+    return false;
+  }
+
+  for (const auto &dir : index_dirs)
+  {
+    struct timespec mtime = dir_mtime(dir.path);
+    if (mtime.tv_sec != dir.mtime.tv_sec || mtime.tv_nsec != dir.mtime.tv_nsec)
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static void bk_insert(int word)
+{
+  if (bk_nodes.empty())
+  {
+    bk_nodes.push_back(BKNode{word, {}});
+    return;
+  }
+
+  size_t node = 0;
+  while (true)
+  {
+    int d = edit_distance(index_names[word], index_names[bk_nodes[node].word]);
+    if (d == 0)
+    {
+      return; // Duplicate name
+    }
+
+    auto &children = bk_nodes[node].children;
+    auto it = std::find_if(children.begin(), children.end(),
+                           [d](const std::pair<int, int> &child)
+                           { return child.first == d; });
+    if (it == children.end())
+    {
+      children.emplace_back(d, static_cast<int>(bk_nodes.size()));
+      bk_nodes.push_back(BKNode{word, {}});
+      return;
+    }
+    node = it->second;
+  }
+}
+
+static void build_index(const char *path_env)
+{
+  index_path_env = path_env;
+  index_dirs.clear();
+  index_names.clear();
+  bk_nodes.clear();
+  bk_built = false;
+
+  for (std::string_view dir_view : split_path(path_env))
+  {
+    std::string dir(dir_view);
+    index_dirs.push_back(IndexedDir{dir, dir_mtime(dir)});
+
+    DIR *dp = opendir(dir.c_str());
+    if (!dp)
+    {
+      continue;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dp)) != nullptr)
+    {
+      if (entry->d_name[0] == '.')
+      {
+        continue;
+      }
+      std::string full_path = dir + "/" + entry->d_name;
+      if (access(full_path.c_str(), X_OK) == 0)
+      {
+        index_names.emplace_back(entry->d_name);
+      }
+    }
+    closedir(dp);
+  }
+
+  std::sort(index_names.begin(), index_names.end());
+  index_names.erase(std::unique(index_names.begin(), index_names.end()), index_names.end());
+  index_built = true;
+}
+
+// The BK-tree is only needed for suggestions, so it is built on first use
+static void build_bk_tree()
+{
+  bk_nodes.clear();
+
+  // Insert in a scrambled order; sorted input would degenerate the tree
+  bk_nodes.reserve(index_names.size());
+  size_t n = index_names.size();
+  size_t step = 7919; // Prime, coprime with almost any n
+  while (n > 0 && std::gcd(step, n) != 1)
+  {
+    step += 2;
+  }
+  for (size_t i = 0, k = 0; i < n; i++, k = (k + step) % n)
+  {
+    bk_insert(static_cast<int>(k));
+  }
+
+  bk_built = true;
+}
+
+const std::vector<std::string> &executable_names()
+{
+  const char *path_env = std::getenv("PATH");
+  if (path_env == nullptr)
+  {
+    path_env = "";
+  }
+
+  if (!index_is_current(path_env))
+  {
+    build_index(path_env);
+  }
+  return index_names;
+}
+
+const std::vector<IndexedDir> &indexed_directories()
+{
+  return index_dirs;
+}
+
+const std::string &indexed_path()
+{
+  return index_path_env;
+}
+
+void restore_command_index(const std::string &path_env, std::vector<IndexedDir> dirs,
+                           std::vector<std::string> names)
+{
+  index_path_env = path_env;
+  index_dirs = std::move(dirs);
+  index_names = std::move(names);
+  bk_nodes.clear();
+  bk_built = false;
+  index_built = true;
+}
+
+// Classic two-row dynamic programming, used for long strings
+static int edit_distance_dp(std::string_view a, std::string_view b)
+{
+  std::vector<int> prev(b.length() + 1), cur(b.length() + 1);
+  for (size_t j = 0; j <= b.length(); j++)
+  {
+    prev[j] = j;
+  }
+
+  for (size_t i = 1; i <= a.length(); i++)
+  {
+    cur[0] = i;
+    for (size_t j = 1; j <= b.length(); j++)
+    {
+      int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+      cur[j] = std::min({prev[j] + 1, cur[j - 1] + 1, prev[j - 1] + cost});
+    }
+    std::swap(prev, cur);
+  }
+  return prev[b.length()];
+}
+
+// Optimal string alignment distance (Levenshtein plus adjacent
+// transpositions). Only used to rank the few candidates the BK-tree returns,
+// so typos like "gti" for "git" rank above unrelated one-letter edits.
+static int transposition_distance(std::string_view a, std::string_view b)
+{
+  std::vector<std::vector<int>> d(a.length() + 1, std::vector<int>(b.length() + 1));
+  for (size_t i = 0; i <= a.length(); i++)
+  {
+    d[i][0] = i;
+  }
+  for (size_t j = 0; j <= b.length(); j++)
+  {
+    d[0][j] = j;
+  }
+
+  for (size_t i = 1; i <= a.length(); i++)
+  {
+    for (size_t j = 1; j <= b.length(); j++)
+    {
+      int cost = a[i - 1] == b[j - 1] ? 0 : 1;
+      d[i][j] = std::min({d[i - 1][j] + 1, d[i][j - 1] + 1, d[i - 1][j - 1] + cost});
+      if (i > 1 && j > 1 && a[i - 1] == b[j - 2] && a[i - 2] == b[j - 1])
+      {
+        d[i][j] = std::min(d[i][j], d[i - 2][j - 2] + 1);
+      }
+    }
+  }
+  return d[a.length()][b.length()];
+}
+
+// Match table for the bit-parallel algorithm: bit i of peq[c] is set when
+// pattern[i] == c
+struct DistancePattern
+{
+  uint64_t peq[256];
+  size_t length;
+};
+
+static void build_pattern(std::string_view a, DistancePattern &pattern)
+{
+  memset(pattern.peq, 0, sizeof(pattern.peq));
+  pattern.length = a.length();
+  for (size_t i = 0; i < a.length(); i++)
+  {
+    pattern.peq[static_cast<unsigned char>(a[i])] |= uint64_t(1) << i;
+  }
+}
+
+// Myers/Hyyro bit-parallel algorithm: each bit of the vertical delta vectors
+// is one row of the DP column, so a whole column costs a handful of word
+// operations instead of |a| cell updates. Requires 1 <= length <= 64.
+static int bit_parallel_distance(const DistancePattern &pattern, std::string_view b)
+{
+  uint64_t pv = ~uint64_t(0);
+  uint64_t mv = 0;
+  uint64_t last = uint64_t(1) << (pattern.length - 1);
+  int score = pattern.length;
+
+  for (char c : b)
+  {
+    uint64_t eq = pattern.peq[static_cast<unsigned char>(c)];
+    uint64_t xv = eq | mv;
+    uint64_t xh = (((eq & pv) + pv) ^ pv) | eq;
+    uint64_t ph = mv | ~(xh | pv);
+    uint64_t mh = pv & xh;
+
+    if (ph & last)
+    {
+      score++;
+    }
+    else if (mh & last)
+    {
+      score--;
+    }
+
+    ph = (ph << 1) | 1; // Row 0 grows by one per column
+    mh <<= 1;
+    pv = mh | ~(xv | ph);
+    mv = ph & xv;
+  }
+  return score;
+}
+
+int edit_distance(std::string_view a, std::string_view b)
+{
+  if (a.empty())
+  {
+    return b.length();
+  }
+  if (a.length() > 64)
+  {
+    return edit_distance_dp(a, b);
+  }
+
+  DistancePattern pattern;
+  build_pattern(a, pattern);
+  return bit_parallel_distance(pattern, b);
+}
+
+std::vector<std::string> suggest_commands(std::string_view name,
+                                          size_t max_suggestions)
+{
+  // Allow one edit for very short names, two otherwise
+  int max_distance = name.length() <= 2 ? 1 : 2;
+  std::vector<std::pair<int, std::string>> found;
+
+  for (const BuiltinInfo *builtin : list_builtins())
+  {
+    int d = edit_distance(name, builtin->name);
+    if (d <= max_distance)
+    {
+      found.emplace_back(d, builtin->name);
+    }
+  }
+
+  executable_names(); // Make sure the index is current
+  if (!bk_built)
+  {
+    build_bk_tree();
+  }
+
+  // The query is the same for every node, so build its match table once
+  DistancePattern pattern;
+  bool bit_parallel = !name.empty() && name.length() <= 64;
+  if (bit_parallel)
+  {
+    build_pattern(name, pattern);
+  }
+
+  // BK-tree search: by the triangle inequality only children whose edge
+  // distance is within max_distance of d(name, node) can hold matches
+  std::vector<int> pending;
+  if (!bk_nodes.empty())
+  {
+    pending.push_back(0);
+  }
+  while (!pending.empty())
+  {
+    const BKNode &node = bk_nodes[pending.back()];
+    pending.pop_back();
+
+    const std::string &word = index_names[node.word];
+    int d = bit_parallel ? bit_parallel_distance(pattern, word) : edit_distance(name, word);
+    if (d <= max_distance)
+    {
+      found.emplace_back(d, word);
+    }
+
+    for (const auto &child : node.children)
+    {
+      if (child.first >= d - max_distance && child.first <= d + max_distance)
+      {
+        pending.push_back(child.second);
+      }
+    }
+  }
+
+  // Rank: transposition-aware distance, then same first letter, then
+  // closest length, then name
+  auto rank = [name](const std::pair<int, std::string> &match)
+  {
+    const std::string &word = match.second;
+    int length_diff = static_cast<int>(word.length()) - static_cast<int>(name.length());
+    return std::make_tuple(transposition_distance(name, word),
+                           word[0] != name[0],
+                           std::abs(length_diff),
+                           word);
+  };
+  std::vector<std::pair<decltype(rank(found[0])), std::string>> ranked;
+  for (const auto &match : found)
+  {
+    ranked.emplace_back(rank(match), match.second);
+  }
+  std::sort(ranked.begin(), ranked.end());
+
+  std::vector<std::string> suggestions;
+  for (const auto &match : ranked)
+  {
+    if (suggestions.size() >= max_suggestions)
+    {
+      break;
+    }
+    if (std::find(suggestions.begin(), suggestions.end(), match.second) == suggestions.end())
+    {
+      suggestions.push_back(match.second);
+    }
+  }
+  return suggestions;
+}
+
+void report_command_not_found(std::string_view name, std::ostream &out)
+{
+  out << name << ": command not found" << std::endl;
+
+  std::vector<std::string> suggestions = suggest_commands(name);
+  if (suggestions.empty())
+  {
+    return;
+  }
+
+  out << "Did you mean: ";
+  for (size_t i = 0; i < suggestions.size(); i++)
+  {
+    out << (i > 0 ? ", " : "") << suggestions[i];
+  }
+  out << "?" << std::endl;
+}
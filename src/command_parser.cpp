@@ -1,10 +1,300 @@
 #include "include/command_parser.h"
+#include "include/variables.h"
+#include "include/functions.h"
+#include "include/command_executor.h"
+#include "include/line_scan.h"
 #include <iostream>
+#include <algorithm>
+#include <cctype>
+#include <unistd.h>
+
+// Values of the aliases being expanded; an alias is not expanded again
+// inside its own value (alias ls='ls -F')
+static std::vector<const std::string *> active_aliases;
+
+// Replace an alias in command position by the words of its value.
+// The value is tokenized in place, so expansion is a single pass over the
+// line; only the first word of the value is itself checked for an alias.
+static bool expand_alias(std::string_view word, ArgList &args, std::pmr::memory_resource *mem,
+                         int *substitution_status)
+{
+  const std::string *value = find_alias(word);
+  if (value == nullptr ||
+      std::find(active_aliases.begin(), active_aliases.end(), value) != active_aliases.end())
+  {
+    return false;
+  }
+
+  active_aliases.push_back(value);
+  ArgList words = parse_args(*value, mem, true, substitution_status);
+  active_aliases.pop_back();
+
+  for (auto &w : words)
+  {
+    args.push_back(std::move(w));
+  }
+  return true;
+}
+
+// Expand a $NAME, ${NAME}, $? or positional ($1, $#, $@) reference starting at command[i] (the '$').
+// Returns the number of characters consumed, or 0 if this is a literal '$'.
+static size_t expand_parameter(std::string_view command, size_t i, std::string &value)
+{
+  size_t j = i + 1;
+  if (j >= command.length())
+  {
+    return 0;
+  }
+
+  if (command[j] == '?' || command[j] == '#' || command[j] == '@' || command[j] == '*' ||
+      std::isdigit(static_cast<unsigned char>(command[j])))
+  {
+    value = get_variable(std::string(1, command[j]));
+    return 2;
+  }
+
+  if (command[j] == '{')
+  {
+    size_t close = command.find('}', j + 1);
+    if (close == std::string_view::npos)
+    {
+      return 0;
+    }
+    std::string name(command.substr(j + 1, close - j - 1));
+    bool positional = !name.empty() && name.find_first_not_of("0123456789") == std::string::npos;
+    if (!positional && !is_valid_variable_name(name))
+    {
+      return 0;
+    }
+    value = get_variable(name);
+    return close - i + 1;
+  }
+
+  // Plain $NAME - take the longest run of name characters
+  size_t end = j;
+  while (end < command.length() &&
+         (std::isalnum(static_cast<unsigned char>(command[end])) || command[end] == '_'))
+  {
+    end++;
+  }
+  if (end == j)
+  {
+    return 0;
+  }
+  value = get_variable(std::string(command.substr(j, end - j)));
+  return end - i;
+}
+
+static bool starts_substitution(std::string_view command, size_t i)
+{
+  return command[i] == '`' || (command[i] == '$' && i + 1 < command.length() && command[i + 1] == '(');
+}
+
+size_t substitution_length(std::string_view text, size_t pos)
+{
+  if (text[pos] == '`')
+  {
+    for (size_t j = pos + 1; j < text.length(); j++)
+    {
+      if (text[j] == '\\')
+      {
+        j++;
+      }
+      else if (text[j] == '`')
+      {
+        return j - pos + 1;
+      }
+    }
+    return 0;
+  }
+
+  // $( ... ): track parentheses, quotes and nested substitutions
+  int depth = 0;
+  bool in_single_quote = false;
+  bool in_double_quote = false;
+  for (size_t j = pos + 1; j < text.length(); j++)
+  {
+    char c = text[j];
+    if (in_single_quote)
+    {
+      in_single_quote = c != '\'';
+      continue;
+    }
+    if (c == '\\')
+    {
+      j++;
+      continue;
+    }
+    if (starts_substitution(text, j))
+    {
+      size_t nested = substitution_length(text, j);
+      if (nested == 0)
+      {
+        return 0;
+      }
+      j += nested - 1;
+      continue;
+    }
+    if (c == '"')
+    {
+      in_double_quote = !in_double_quote;
+    }
+    else if (in_double_quote)
+    {
+      continue;
+    }
+    else if (c == '\'')
+    {
+      in_single_quote = true;
+    }
+    else if (c == '(')
+    {
+      depth++;
+    }
+    else if (c == ')' && --depth == 0)
+    {
+      return j - pos + 1;
+    }
+  }
+  return 0;
+}
 
-std::vector<std::string> parse_args(const std::string &command)
+// The command inside a substitution; backquotes keep \`, \\ and \$ escaped
+static std::string substitution_command(std::string_view substitution)
 {
-  std::vector<std::string> args;
-  std::string crr_arg;
+  if (substitution[0] == '$')
+  {
+    return std::string(substitution.substr(2, substitution.length() - 3));
+  }
+
+  std::string command;
+  for (size_t i = 1; i + 1 < substitution.length(); i++)
+  {
+    char next = substitution[i + 1];
+    if (substitution[i] == '\\' && (next == '`' || next == '\\' || next == '$'))
+    {
+      i++;
+    }
+    command += substitution[i];
+  }
+  return command;
+}
+
+// Collect the substitutions parse_args() will meet, in order, so they can
+// all be started before any output is needed
+static std::vector<std::string> find_substitutions(std::string_view command)
+{
+  std::vector<std::string> commands;
+  bool in_single_quote = false;
+  bool in_double_quote = false;
+  for (size_t i = 0; i < command.length(); i++)
+  {
+    char c = command[i];
+    if (in_single_quote)
+    {
+      in_single_quote = c != '\'';
+    }
+    else if (c == '\\')
+    {
+      i++;
+    }
+    else if (c == '\'' && !in_double_quote)
+    {
+      in_single_quote = true;
+    }
+    else if (c == '"')
+    {
+      in_double_quote = !in_double_quote;
+    }
+    else if (starts_substitution(command, i))
+    {
+      size_t length = substitution_length(command, i);
+      if (length > 0)
+      {
+        commands.push_back(substitution_command(command.substr(i, length)));
+        i += length - 1;
+      }
+    }
+  }
+  return commands;
+}
+
+// NAME=value; expansions in assignments are not split into words
+static bool is_assignment_word(std::string_view word)
+{
+  size_t eq = word.find('=');
+  return eq != std::string_view::npos && is_valid_variable_name(word.substr(0, eq));
+}
+
+ArgList parse_args(std::string_view command, std::pmr::memory_resource *mem, bool expand_aliases,
+                   int *substitution_status)
+{
+  ArgList args(mem);
+  std::pmr::string crr_arg(mem);
+  bool plain_word = true;   // Current word has no quotes, escapes or expansions
+  bool quoted_word = false; // Current word has quotes, so "" is kept as an empty word
+
+  // Run every substitution up front so independent ones run concurrently
+  std::vector<std::string> substitutions;
+  std::vector<std::string> outputs;
+  size_t next_output = 0;
+  if (command.find('$') != std::string_view::npos || command.find('`') != std::string_view::npos)
+  {
+    substitutions = find_substitutions(command);
+  }
+  if (!substitutions.empty())
+  {
+    // $? still expands to the status of the previous command; a line of
+    // only assignments takes this status (see execute_simple())
+    int status = capture_output(substitutions, outputs);
+    if (substitution_status != nullptr)
+    {
+      *substitution_status = status;
+    }
+  }
+
+  auto finish_word = [&]()
+  {
+    if (!crr_arg.empty() || quoted_word)
+    {
+      if (!(expand_aliases && plain_word && args.empty() &&
+            expand_alias(crr_arg, args, mem, substitution_status)))
+      {
+        args.push_back(crr_arg);
+      }
+      crr_arg.clear();
+    }
+    plain_word = true;
+    quoted_word = false;
+  };
+
+  // The assignments that start a command take expansions whole
+  auto in_assignment = [&]()
+  {
+    return is_assignment_word(crr_arg) &&
+           std::all_of(args.begin(), args.end(), [](const std::pmr::string &arg)
+                       { return is_assignment_word(arg); });
+  };
+
+  // Unquoted expansion is split into words on whitespace, except in the
+  // assignments that start a command
+  auto append_unquoted = [&](std::string_view value)
+  {
+    bool split = !in_assignment();
+    for (char v : value)
+    {
+      plain_word = false;
+      if (split && (v == ' ' || v == '\t' || v == '\n'))
+      {
+        finish_word();
+      }
+      else
+      {
+        crr_arg += v;
+      }
+    }
+    plain_word = false;
+  };
 
   enum State
   {
@@ -16,8 +306,43 @@ std::vector<std::string> parse_args(const std::string &command)
   State state = NORMAL;
   State prev_state = NORMAL; // Track previous state before ESCAPED
 
-  // Loop through each character
-  for (size_t i = 0; i < command.length(); i++)
+  // Fast path: the words before the first metacharacter are cut at the
+  // spaces of the block masks; only the rest of the line (none, for most
+  // lines) goes through the state machine below
+  size_t start = 0;
+  bool plain = true;
+  for (size_t block = 0; plain && block < command.length(); block += CHAR_CLASS_BLOCK)
+  {
+    CharClassMasks masks = classify_block(command.data() + block, command.length() - block);
+    uint64_t blanks = masks.blank;
+    if (masks.special != 0)
+    {
+      blanks &= (uint64_t(1) << __builtin_ctzll(masks.special)) - 1;
+      plain = false;
+    }
+    for (; blanks != 0; blanks &= blanks - 1)
+    {
+      size_t space = block + __builtin_ctzll(blanks);
+      if (space > start && !args.empty())
+      {
+        args.emplace_back(command.substr(start, space - start));
+      }
+      else if (space > start)
+      {
+        crr_arg.assign(command.substr(start, space - start));
+        finish_word(); // The command word may be an alias
+      }
+      start = space + 1;
+    }
+  }
+  if (plain)
+  {
+    crr_arg.assign(command.substr(start));
+    start = command.length();
+  }
+
+  // Loop through each remaining character
+  for (size_t i = start; i < command.length(); i++)
   {
     char c = command[i];
 
@@ -26,24 +351,59 @@ std::vector<std::string> parse_args(const std::string &command)
     case NORMAL:
       if (c == ' ')
       {
-        if (!crr_arg.empty())
-        {
-          args.push_back(crr_arg);
-          crr_arg.clear();
-        }
+        finish_word();
       }
       else if (c == '\'')
       {
         state = IN_SINGLE_QUOTE;
+        plain_word = false;
+        quoted_word = true;
       }
       else if (c == '"')
       {
         state = IN_DOUBLE_QUOTE;
+        plain_word = false;
+        quoted_word = true;
       }
       else if (c == '\\')
       {
         prev_state = NORMAL; // Remember we came from NORMAL
         state = ESCAPED;
+        plain_word = false;
+      }
+      else if (starts_substitution(command, i) && next_output < outputs.size() &&
+               substitution_length(command, i) > 0)
+      {
+        i += substitution_length(command, i) - 1;
+        append_unquoted(outputs[next_output++]);
+      }
+      else if (c == '$' && i + 1 < command.length() && command[i + 1] == '@' && !in_assignment())
+      {
+        // Each parameter is split on its own; the boundaries between them
+        // always end a word
+        const std::vector<std::string> &params = get_positional_parameters();
+        for (size_t p = 0; p < params.size(); p++)
+        {
+          if (p > 0)
+          {
+            finish_word();
+          }
+          append_unquoted(params[p]);
+        }
+        plain_word = false;
+        i++;
+      }
+      else if (c == '$')
+      {
+        std::string value;
+        size_t consumed = expand_parameter(command, i, value);
+        if (consumed == 0)
+        {
+          crr_arg += c;
+          break;
+        }
+        i += consumed - 1;
+        append_unquoted(value);
       }
       else
       {
@@ -91,6 +451,46 @@ std::vector<std::string> parse_args(const std::string &command)
           crr_arg += c;
         }
       }
+      else if (starts_substitution(command, i) && next_output < outputs.size() &&
+               substitution_length(command, i) > 0)
+      {
+        i += substitution_length(command, i) - 1;
+        crr_arg += outputs[next_output++]; // Quoted substitution stays one word
+      }
+      else if (c == '$' && i + 1 < command.length() && command[i + 1] == '@' && !in_assignment())
+      {
+        // "$@" is one word per parameter: text before it joins the first,
+        // text after it the last, and with no parameters "$@" is no word
+        const std::vector<std::string> &params = get_positional_parameters();
+        if (params.empty() && crr_arg.empty())
+        {
+          quoted_word = false;
+        }
+        for (size_t p = 0; p < params.size(); p++)
+        {
+          crr_arg += params[p];
+          if (p + 1 < params.size())
+          {
+            args.push_back(crr_arg);
+            crr_arg.clear();
+          }
+        }
+        i++;
+      }
+      else if (c == '$')
+      {
+        std::string value;
+        size_t consumed = expand_parameter(command, i, value);
+        if (consumed == 0)
+        {
+          crr_arg += c;
+        }
+        else
+        {
+          crr_arg += value; // Quoted expansion stays one word
+          i += consumed - 1;
+        }
+      }
       else
       {
         crr_arg += c;
@@ -105,10 +505,7 @@ std::vector<std::string> parse_args(const std::string &command)
   }
 
   // Add the last argument if not empty
-  if (!crr_arg.empty())
-  {
-    args.push_back(crr_arg);
-  }
+  finish_word();
 
   // Error checking - unmatched quotes
   if (state == IN_SINGLE_QUOTE || state == IN_DOUBLE_QUOTE)
@@ -119,29 +516,75 @@ std::vector<std::string> parse_args(const std::string &command)
   return args;
 }
 
-RedirectInfo parse_redirect(const std::string &full_command)
+// End of the shell word starting at pos: the first unquoted blank or
+// operator character, with quotes and substitutions kept whole
+static size_t word_end(std::string_view text, size_t pos)
 {
-  RedirectInfo info; // Initialize with defaults assuming no redirection
-  info.has_redirect = false;
-  info.command = full_command;
-  info.redirect_stderr = false;
-  info.append_mode = false;
+  bool in_single_quote = false;
+  bool in_double_quote = false;
+  for (size_t i = pos; i < text.length(); i++)
+  {
+    char c = text[i];
+    if (in_single_quote)
+    {
+      in_single_quote = c != '\'';
+    }
+    else if (c == '\\')
+    {
+      i++;
+    }
+    else if (c == '"')
+    {
+      in_double_quote = !in_double_quote;
+    }
+    else if (starts_substitution(text, i) && substitution_length(text, i) > 0)
+    {
+      i += substitution_length(text, i) - 1;
+    }
+    else if (in_double_quote)
+    {
+      continue;
+    }
+    else if (c == '\'')
+    {
+      in_single_quote = true;
+    }
+    else if (c == ' ' || c == '\t' || c == '<' || c == '>' || c == '&' || c == ';' || c == '|')
+    {
+      return i;
+    }
+  }
+  return text.length();
+}
+
+RedirectInfo parse_redirect(std::string_view full_command, std::pmr::memory_resource *mem)
+{
+  RedirectInfo info(mem); // Initialize with defaults assuming no redirection
+  info.command.clear();
 
-  // Find > outside of quotes
+  // Find > and < outside of quotes
   bool in_single_quote = false;
   bool in_double_quote = false;
   bool escaped = false;
+  size_t copied = 0; // Text before this is already in info.command
 
+  MetacharacterScanner scanner(full_command);
   for (size_t i = 0; i < full_command.length(); i++)
   {
-    char c = full_command[i];
-
     if (escaped)
     {
       escaped = false;
       continue;
     }
 
+    // Only metacharacters matter; skip the text between them
+    i = scanner.next(i);
+    if (i == std::string_view::npos)
+    {
+      break;
+    }
+    char c = full_command[i];
+
     if (c == '\\' && !in_single_quote)
     {
       escaped = true;
@@ -160,63 +603,100 @@ RedirectInfo parse_redirect(const std::string &full_command)
       continue;
     }
 
-    // Found > outside quotes
-    if (c == '>' && !in_single_quote && !in_double_quote)
+    // Skip command substitutions, whose > belongs to their command
+    if (!in_single_quote && starts_substitution(full_command, i))
     {
-      // Save the position of the first >
-      size_t redirect_start = i;
-
-      // Check if it's >> (append mode)
-      if (i + 1 < full_command.length() && full_command[i + 1] == '>')
+      size_t length = substitution_length(full_command, i);
+      if (length > 0)
       {
-        info.append_mode = true;
-        i++; // Skip the second >
-      }
-
-      // Check if it's 1> or 2> or 1>> or 2>>
-      if (redirect_start > 0 && (full_command[redirect_start - 1] == '1' || full_command[redirect_start - 1] == '2'))
-      {
-        redirect_start = redirect_start - 1;
-        // Make sure the number is not part of a word
-        if (redirect_start > 0 && full_command[redirect_start - 1] != ' ')
-        {
-          continue; // Not a redirect, part of a word
-        }
-
-        // Check if it's 2> or 2>>
-        if (full_command[redirect_start] == '2')
-        {
-          info.redirect_stderr = true;
-        }
+        i += length - 1;
+        continue;
       }
+    }
 
-      info.has_redirect = true;
-      info.command = full_command.substr(0, redirect_start);
+    if ((c != '>' && c != '<') || in_single_quote || in_double_quote)
+    {
+      continue;
+    }
 
-      // Trim trailing spaces from command
-      while (!info.command.empty() && info.command.back() == ' ')
-      {
-        info.command.pop_back();
-      }
+    // A digit right before the operator names the descriptor, unless it
+    // ends a longer word (echo a2>f writes "a2" to f)
+    size_t redirect_start = i;
+    int fd = c == '>' ? STDOUT_FILENO : STDIN_FILENO;
+    if (i > copied && std::isdigit(static_cast<unsigned char>(full_command[i - 1])) &&
+        (i - 1 == 0 || full_command[i - 2] == ' ' || full_command[i - 2] == '\t'))
+    {
+      redirect_start = i - 1;
+      fd = full_command[i - 1] - '0';
+    }
 
-      // Extract filename after > or >>
-      std::string after_redirect = full_command.substr(i + 1);
+    Redirection redirection(c == '>' ? Redirection::WRITE : Redirection::READ, fd, mem);
+    size_t pos = i + 1;
+    if (c == '>' && pos < full_command.length() && full_command[pos] == '>')
+    {
+      redirection.kind = Redirection::APPEND;
+      pos++;
+    }
+    bool duplicate = redirection.kind != Redirection::APPEND && pos < full_command.length() &&
+                     full_command[pos] == '&';
+    if (duplicate)
+    {
+      pos++;
+    }
 
-      // Trim leading spaces
-      size_t first_non_space = after_redirect.find_first_not_of(" \t");
-      if (first_non_space != std::string::npos)
-      {
-        after_redirect = after_redirect.substr(first_non_space);
-      }
+    // Target word
+    while (pos < full_command.length() && (full_command[pos] == ' ' || full_command[pos] == '\t'))
+    {
+      pos++;
+    }
+    size_t target_end = word_end(full_command, pos);
+    if (target_end == pos)
+    {
+      info.error = "syntax error near unexpected token `";
+      info.error += pos < full_command.length() ? full_command.substr(pos, 1) : "newline";
+      info.error += "'";
+      break;
+    }
+    ArgList target = parse_args(full_command.substr(pos, target_end - pos), mem);
+    if (target.size() != 1)
+    {
+      info.error = std::string(full_command.substr(pos, target_end - pos)) + ": ambiguous redirect";
+      break;
+    }
 
-      // Parse the filename (might have quotes)
-      std::vector<std::string> redirect_args = parse_args(after_redirect);
-      if (!redirect_args.empty())
-      {
-        info.filename = redirect_args[0];
-      }
+    if (!duplicate)
+    {
+      redirection.filename = target[0];
+    }
+    else if (target[0] == "-")
+    {
+      redirection.kind = Redirection::CLOSE;
+    }
+    else if (target[0].length() == 1 && std::isdigit(static_cast<unsigned char>(target[0][0])))
+    {
+      redirection.kind = Redirection::DUPLICATE;
+      redirection.source_fd = target[0][0] - '0';
+    }
+    else
+    {
+      info.error = std::string(target[0]) + ": ambiguous redirect";
       break;
     }
+
+    // Keep the command text around the redirection
+    info.command.append(full_command.substr(copied, redirect_start - copied));
+    info.command += ' ';
+    copied = target_end;
+    info.redirections.push_back(std::move(redirection));
+    info.has_redirect = true;
+    i = target_end - 1;
+  }
+  info.command.append(full_command.substr(copied));
+
+  // Trim trailing spaces from command
+  while (!info.command.empty() && (info.command.back() == ' ' || info.command.back() == '\t'))
+  {
+    info.command.pop_back();
   }
 
   return info;
@@ -264,6 +744,18 @@ std::vector<std::string> parse_pipeline(const std::string &command)
       continue;
     }
 
+    // Keep command substitutions whole, including their pipes
+    if (!in_single_quote && starts_substitution(command, i))
+    {
+      size_t length = substitution_length(command, i);
+      if (length > 0)
+      {
+        current_segment.append(command, i, length);
+        i += length - 1;
+        continue;
+      }
+    }
+
     // Found | outside quotes - this is a pipe!
     if (c == '|' && !in_single_quote && !in_double_quote)
     {
@@ -1,28 +1,193 @@
 #include "include/completion.h"
 #include "include/path_utils.h"
+#include "include/command_index.h"
+#include "include/builtin_registry.h"
+#include "include/functions.h"
+#include "include/variables.h"
+#include "include/dir_walker.h"
+#include "include/fuzzy_match.h"
+#include "include/dir_reader.h"
 #include <vector>
+#include <deque>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <algorithm>
 #include <string>
-#include <dirent.h>
-#include <sys/stat.h>
+#include <fcntl.h>
 #include <cstring>
 #include <unistd.h>
 #include <cstdlib>
 
-// List of builtin commands for completion
-static std::vector<std::string> builtin_commands = {
-    "echo",
-    "type",
-    "exit",
-    "pwd",
-    "cd",
-    "history",
-};
-
 static std::vector<std::string> completion_matches;
 static int completion_index = 0;
 
+// Time limit for scanning a directory, from SHELL_COMPLETION_TIMEOUT in
+// milliseconds (unset or 0 means no limit), so a huge or slow (network)
+// directory cannot freeze the prompt
+static std::chrono::steady_clock::time_point completion_deadline()
+{
+  long timeout_ms = std::strtol(get_variable("SHELL_COMPLETION_TIMEOUT").c_str(), nullptr, 10);
+  if (timeout_ms <= 0)
+  {
+    return std::chrono::steady_clock::time_point::max();
+  }
+  return std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+}
+
+// Fuzzy cd completion (SHELL_FUZZY_CD=1): a background walk of the tree
+// below the typed directory feeds scored candidates to the generator as
+// they are found, so readline receives them while the walk goes on
+struct FuzzySearch
+{
+  std::mutex lock;
+  std::condition_variable ready;
+  std::deque<std::pair<std::string, int>> found; // (completion, score)
+  bool done = false;
+  std::atomic<bool> cancelled{false};
+  std::thread walker;
+  std::chrono::steady_clock::time_point deadline;
+};
+
+static const size_t FUZZY_MATCH_LIMIT = 100;
+static FuzzySearch *fuzzy_search = nullptr;
+static std::unordered_map<std::string, int> fuzzy_scores; // Scores of the matches handed out
+static bool fuzzy_active = false;
+
+static void start_fuzzy_search(const std::string &text)
+{
+  // "src/comp" searches below src/ for "comp"
+  size_t slash = text.find_last_of('/');
+  std::string display_prefix = slash == std::string::npos ? "" : text.substr(0, slash + 1);
+  std::string query = text.substr(display_prefix.length());
+  std::string root = display_prefix.empty() ? "." : display_prefix;
+  const char *home = getenv("HOME");
+  if (root[0] == '~' && home)
+  {
+    root = home + root.substr(1);
+  }
+
+  fuzzy_scores.clear();
+  fuzzy_search = new FuzzySearch;
+  fuzzy_search->deadline = completion_deadline();
+  FuzzySearch *search = fuzzy_search;
+  search->walker = std::thread([search, root, query, display_prefix]()
+                               {
+    walk_directories(root, [&](std::string_view path)
+                     {
+      if (search->cancelled)
+      {
+        return false;
+      }
+      int score = fuzzy_score(query, path);
+      if (score >= 0)
+      {
+        std::lock_guard<std::mutex> guard(search->lock);
+        search->found.emplace_back(display_prefix + std::string(path), score);
+        search->ready.notify_one();
+      }
+      return true; });
+
+    std::lock_guard<std::mutex> guard(search->lock);
+    search->done = true;
+    search->ready.notify_one(); });
+}
+
+static char *next_fuzzy_match()
+{
+  FuzzySearch &search = *fuzzy_search;
+  std::unique_lock<std::mutex> guard(search.lock);
+  auto has_result = [&]()
+  { return !search.found.empty() || search.done; };
+  if (search.deadline == std::chrono::steady_clock::time_point::max())
+  {
+    search.ready.wait(guard, has_result);
+  }
+  else
+  {
+    search.ready.wait_until(guard, search.deadline, has_result);
+  }
+
+  if (!search.found.empty())
+  {
+    std::pair<std::string, int> match = std::move(search.found.front());
+    search.found.pop_front();
+    guard.unlock();
+    fuzzy_scores[match.first] = match.second;
+    return strdup(match.first.c_str());
+  }
+
+  // Walk finished or out of time
+  guard.unlock();
+  search.cancelled = true;
+  search.walker.join();
+  delete fuzzy_search;
+  fuzzy_search = nullptr;
+  return nullptr;
+}
+
+// Order fuzzy matches best first and keep the top FUZZY_MATCH_LIMIT
+static void rank_fuzzy_matches(char **matches, const char *text)
+{
+  if (matches == nullptr || matches[1] == nullptr)
+  {
+    return;
+  }
+
+  size_t count = 1;
+  while (matches[count] != nullptr)
+  {
+    count++;
+  }
+  std::sort(matches + 1, matches + count, [](const char *a, const char *b)
+            {
+    int score_a = fuzzy_scores[a];
+    int score_b = fuzzy_scores[b];
+    if (score_a != score_b)
+    {
+      return score_a > score_b;
+    }
+    size_t len_a = strlen(a);
+    size_t len_b = strlen(b);
+    return len_a != len_b ? len_a < len_b : strcmp(a, b) < 0; });
+
+  for (size_t i = FUZZY_MATCH_LIMIT + 1; i < count; i++)
+  {
+    free(matches[i]);
+    matches[i] = nullptr;
+  }
+
+  // The common prefix of the matches replaces the typed text; keep the
+  // text unless that prefix still matches the whole query
+  std::string_view typed(text);
+  size_t slash = typed.find_last_of('/');
+  std::string_view query = slash == std::string_view::npos ? typed : typed.substr(slash + 1);
+  if (strlen(matches[0]) < typed.length() || fuzzy_score(query, matches[0]) < 0)
+  {
+    free(matches[0]);
+    matches[0] = strdup(text);
+  }
+}
+
 char *directory_generator(const char *text, int state)
 {
+  if (state == 0)
+  {
+    std::string_view fuzzy = peek_variable("SHELL_FUZZY_CD");
+    fuzzy_active = !fuzzy.empty() && fuzzy != "0" && *text != '\0' && text[strlen(text) - 1] != '/';
+    if (fuzzy_active)
+    {
+      start_fuzzy_search(text);
+    }
+  }
+  if (fuzzy_active)
+  {
+    return fuzzy_search ? next_fuzzy_match() : nullptr;
+  }
+
   // state = 0 means this is a new word to complete
   if (state == 0)
   {
@@ -70,50 +235,52 @@ char *directory_generator(const char *text, int state)
       search_prefix = prefix.substr(last_slash + 1);
     }
 
-    // List directories
-    DIR *dp = opendir(search_dir.c_str());
-    if (dp)
+    // List directories; d_type says which entries are directories, so only
+    // symlinks (and filesystems without d_type) need a stat
+    int dir_fd = open(search_dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dir_fd >= 0)
     {
-      struct dirent *entry;
-      while ((entry = readdir(dp)) != nullptr)
-      {
-        std::string name(entry->d_name);
-        if (name == "." || name == "..") // Skip . and ..
-          continue;
+      auto deadline = completion_deadline();
+      size_t scanned = 0;
+      const char *home = getenv("HOME");
+      read_directory(dir_fd, [&](std::string_view name, unsigned char type)
+                     {
+        if (++scanned % 64 == 0 && std::chrono::steady_clock::now() > deadline)
+        {
+          return false; // Offer what was found so far
+        }
 
-        if (name.substr(0, search_prefix.length()) == search_prefix)
+        if (name.substr(0, search_prefix.length()) != search_prefix ||
+            !entry_is_directory(dir_fd, name, type, true))
         {
-          std::string full_path = search_dir + "/" + name;
-          struct stat st;
-          if (stat(full_path.c_str(), &st) == 0 && S_ISDIR(st.st_mode))
+          return true;
+        }
+
+        // Build the completion string
+        std::string full_path = search_dir + "/" + std::string(name);
+        std::string completion;
+        if (prefix[0] == '~' && home && search_dir.find(home) == 0)
+        {
+          if (full_path.substr(0, strlen(home)) == home)
           {
-            // Build the completion string
-            std::string completion;
-            const char *home = getenv("HOME");
-            if (prefix[0] == '~' && home && search_dir.find(home) == 0)
-            {
-              if (full_path.substr(0, strlen(home)) == home)
-              {
-                completion = "~" + full_path.substr(strlen(home));
-              }
-              else
-              {
-                completion = name;
-              }
-            }
-            else if (search_dir != ".")
-            {
-              completion = search_dir + "/" + name;
-            }
-            else
-            {
-              completion = name;
-            }
-            completion_matches.push_back(completion);
+            completion = "~" + full_path.substr(strlen(home));
+          }
+          else
+          {
+            completion = name;
           }
         }
-      }
-      closedir(dp);
+        else if (search_dir != ".")
+        {
+          completion = full_path;
+        }
+        else
+        {
+          completion = name;
+        }
+        completion_matches.push_back(completion);
+        return true; });
+      close(dir_fd);
     }
   }
 
@@ -137,41 +304,38 @@ char *command_generator(const char *text, int state)
     std::string prefix(text);
 
     // Find builtins that match
-    for (const auto &cmd : builtin_commands)
+    for (const BuiltinInfo *builtin : list_builtins())
     {
-      if (cmd.substr(0, prefix.length()) == prefix)
+      if (std::string_view(builtin->name).substr(0, prefix.length()) == prefix)
       {
-        completion_matches.push_back(cmd);
+        completion_matches.push_back(builtin->name);
       }
     }
 
-    // Find executables in PATH that match
-    const char *path_env = std::getenv("PATH");
-    if (path_env)
+    // Functions and aliases
+    for (const auto &name : list_functions())
     {
-      std::vector<std::string> paths = split_path(path_env);
-      for (const auto &dir : paths)
+      if (name.compare(0, prefix.length(), prefix) == 0)
       {
-        DIR *dp = opendir(dir.c_str());
-        if (dp)
-        {
-          struct dirent *entry;
-          while ((entry = readdir(dp)) != nullptr)
-          {
-            std::string name(entry->d_name);
-            if (name.substr(0, prefix.length()) == prefix)
-            {
-              std::string full_path = dir + "/" + name;
-              if (access(full_path.c_str(), X_OK) == 0)
-              {
-                completion_matches.push_back(name);
-              }
-            }
-          }
-          closedir(dp);
-        }
+        completion_matches.push_back(name);
+      }
+    }
+    for (const auto &alias : list_aliases())
+    {
+      if (alias.first.compare(0, prefix.length(), prefix) == 0)
+      {
+        completion_matches.push_back(alias.first);
       }
     }
+
+    // Find executables in PATH that match (the index is sorted, so the
+    // matches form one contiguous range)
+    const std::vector<std::string> &names = executable_names();
+    auto it = std::lower_bound(names.begin(), names.end(), prefix);
+    for (; it != names.end() && it->compare(0, prefix.length(), prefix) == 0; ++it)
+    {
+      completion_matches.push_back(*it);
+    }
   }
 
   // Return next match
@@ -186,23 +350,31 @@ char *command_generator(const char *text, int state)
 char **command_completion(const char *text, int start, int end)
 {
   (void)end; // Unused parameter
-  
+  rl_sort_completion_matches = 1;
+  fuzzy_active = false;
+
   // First word - complete command names
   if (start == 0)
   {
     return rl_completion_matches(text, command_generator);
   }
 
-  // Check if the command is "cd" - then complete directories only
+  // Builtins may provide their own argument completion (cd completes
+  // directories only)
   std::string line(rl_line_buffer);
   size_t first_space = line.find(' ');
   if (first_space != std::string::npos)
   {
-    std::string cmd = line.substr(0, first_space);
-    if (cmd == "cd")
+    const BuiltinInfo *builtin = find_builtin(std::string_view(line).substr(0, first_space));
+    if (builtin != nullptr && builtin->completer != nullptr)
     {
-      // Complete directories only for cd command
-      return rl_completion_matches(text, directory_generator);
+      char **matches = rl_completion_matches(text, builtin->completer);
+      if (fuzzy_active)
+      {
+        rank_fuzzy_matches(matches, text);
+        rl_sort_completion_matches = 0; // Keep the ranking
+      }
+      return matches;
     }
   }
 
@@ -0,0 +1,97 @@
+#include "include/dir_reader.h"
+#include <cstring>
+#include <memory>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// getdents64 batch size: one call returns thousands of entries
+static const size_t DIRENT_BUFFER_SIZE = 256 * 1024;
+
+// One buffer per thread, reused across calls (the walker reads many small
+// directories); a nested call gets its own
+static thread_local std::unique_ptr<char[]> thread_buffer;
+static thread_local bool thread_buffer_busy = false;
+
+bool read_directory(int dir_fd, const DirEntryVisitor &visit)
+{
+  std::unique_ptr<char[]> own_buffer;
+  char *buffer;
+  bool using_thread_buffer = !thread_buffer_busy;
+  if (using_thread_buffer)
+  {
+    if (!thread_buffer)
+    {
+      thread_buffer.reset(new char[DIRENT_BUFFER_SIZE]);
+    }
+    buffer = thread_buffer.get();
+    thread_buffer_busy = true;
+  }
+  else
+  {
+    own_buffer.reset(new char[DIRENT_BUFFER_SIZE]);
+    buffer = own_buffer.get();
+  }
+
+  bool complete = true;
+  ssize_t n;
+  while (complete && (n = getdents64(dir_fd, buffer, DIRENT_BUFFER_SIZE)) > 0)
+  {
+    for (ssize_t pos = 0; pos < n;)
+    {
+      const struct dirent64 *entry = reinterpret_cast<const struct dirent64 *>(buffer + pos);
+      pos += entry->d_reclen;
+
+      const char *name = entry->d_name;
+      if (name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+      {
+        continue;
+      }
+      if (!visit(std::string_view(name, strlen(name)), entry->d_type))
+      {
+        complete = false;
+        break;
+      }
+    }
+  }
+  if (n < 0)
+  {
+    complete = false;
+  }
+
+  if (using_thread_buffer)
+  {
+    thread_buffer_busy = false;
+  }
+  return complete;
+}
+
+bool read_directory(const std::string &path, const DirEntryVisitor &visit)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  bool complete = read_directory(fd, visit);
+  close(fd);
+  return complete;
+}
+
+bool entry_is_directory(int dir_fd, std::string_view name, unsigned char type, bool follow_links)
+{
+  if (type == DT_DIR)
+  {
+    return true;
+  }
+  if (type != DT_UNKNOWN && !(type == DT_LNK && follow_links))
+  {
+    return false;
+  }
+
+  std::string path(name);
+  struct stat st;
+  return fstatat(dir_fd, path.c_str(), &st, follow_links ? 0 : AT_SYMLINK_NOFOLLOW) == 0 &&
+         S_ISDIR(st.st_mode);
+}
@@ -0,0 +1,395 @@
+#include "include/dir_walker.h"
+#include "include/dir_reader.h"
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstdlib>
+#include <climits>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Patterns from one .gitignore file, applied to paths below its directory.
+// Rules form a chain from the deepest .gitignore up to the root.
+struct IgnoreRules
+{
+  std::shared_ptr<const IgnoreRules> parent;
+  std::string base; // Directory of the .gitignore, relative to the root
+  std::vector<std::string> patterns;
+};
+
+struct WalkItem
+{
+  std::string path; // Relative to the root ("" for the root itself)
+  std::shared_ptr<const IgnoreRules> rules;
+};
+
+// One worker's queue: the owner pushes and pops at the back, idle workers
+// steal from the front
+struct WorkQueue
+{
+  std::mutex lock;
+  std::deque<WalkItem> items;
+};
+
+struct ScannedDir
+{
+  std::string path;
+  struct timespec mtime;
+};
+
+// Result of a completed walk
+struct WalkCache
+{
+  std::vector<ScannedDir> dirs; // Every directory scanned, including the root
+};
+
+static std::mutex cache_lock;
+static std::map<std::string, std::shared_ptr<const WalkCache>> walk_cache;
+
+static unsigned worker_count()
+{
+  unsigned n = std::thread::hardware_concurrency();
+  return n == 0 ? 2 : (n > 8 ? 8 : n);
+}
+
+static std::string full_path(const std::string &root, std::string_view path)
+{
+  return path.empty() ? root : root + "/" + std::string(path);
+}
+
+static std::shared_ptr<const IgnoreRules> read_gitignore(int dir_fd, const std::string &path,
+                                                         std::shared_ptr<const IgnoreRules> parent)
+{
+  int fd = openat(dir_fd, ".gitignore", O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return parent;
+  }
+
+  std::string data;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    data.append(buffer, n);
+  }
+  close(fd);
+
+  auto rules = std::make_shared<IgnoreRules>();
+  rules->parent = std::move(parent);
+  rules->base = path;
+
+  size_t start = 0;
+  while (start < data.size())
+  {
+    size_t end = data.find('\n', start);
+    if (end == std::string::npos)
+    {
+      end = data.size();
+    }
+    std::string line = data.substr(start, end - start);
+    start = end + 1;
+
+    while (!line.empty() && (line.back() == ' ' || line.back() == '\r'))
+    {
+      line.pop_back();
+    }
+    if (!line.empty() && line[0] != '#')
+    {
+      rules->patterns.push_back(line);
+    }
+  }
+  return rules;
+}
+
+// Check one directory against the .gitignore chain. Files are applied from
+// the root down and the last matching pattern wins, as in git.
+static bool is_ignored(const IgnoreRules *rules, const std::string &path, const char *name)
+{
+  if (rules == nullptr)
+  {
+    return false;
+  }
+
+  bool ignored = is_ignored(rules->parent.get(), path, name);
+  const char *relative = rules->base.empty() ? path.c_str() : path.c_str() + rules->base.size() + 1;
+  for (const auto &raw : rules->patterns)
+  {
+    std::string pattern = raw;
+    bool negate = pattern[0] == '!';
+    if (negate)
+    {
+      pattern.erase(0, 1);
+    }
+    if (!pattern.empty() && pattern.back() == '/')
+    {
+      pattern.pop_back(); // Directory-only pattern; only directories get here
+    }
+    if (pattern.empty())
+    {
+      continue;
+    }
+
+    bool matched;
+    if (pattern.find('/') != std::string::npos)
+    {
+      // Anchored to the directory of the .gitignore
+      if (pattern[0] == '/')
+      {
+        pattern.erase(0, 1);
+      }
+      matched = fnmatch(pattern.c_str(), relative, FNM_PATHNAME) == 0;
+    }
+    else
+    {
+      matched = fnmatch(pattern.c_str(), name, 0) == 0;
+    }
+    if (matched)
+    {
+      ignored = !negate;
+    }
+  }
+  return ignored;
+}
+
+struct Walk
+{
+  std::string root;
+  const DirectoryVisitor &visit;
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::atomic<size_t> pending{0}; // Items queued or being scanned
+  std::atomic<size_t> queued{0};  // Items queued (changed under a queue's lock)
+  std::atomic<bool> stopped{false};
+  std::mutex idle_lock;               // Idle workers sleep on work_ready
+  std::condition_variable work_ready; // Work queued, or the walk is over
+  std::atomic<unsigned> idle{0};      // Workers waiting on work_ready
+  std::mutex scanned_lock;
+  std::vector<ScannedDir> scanned;
+
+  Walk(const std::string &root, const DirectoryVisitor &visit) : root(root), visit(visit) {}
+};
+
+static bool next_item(Walk &walk, unsigned self, WalkItem &item)
+{
+  {
+    WorkQueue &own = *walk.queues[self];
+    std::lock_guard<std::mutex> guard(own.lock);
+    if (!own.items.empty())
+    {
+      item = std::move(own.items.back());
+      own.items.pop_back();
+      walk.queued--;
+      return true;
+    }
+  }
+
+  for (unsigned i = 1; i < walk.queues.size(); i++)
+  {
+    WorkQueue &victim = *walk.queues[(self + i) % walk.queues.size()];
+    std::lock_guard<std::mutex> guard(victim.lock);
+    if (!victim.items.empty())
+    {
+      item = std::move(victim.items.front());
+      victim.items.pop_front();
+      walk.queued--;
+      return true;
+    }
+  }
+  return false;
+}
+
+static void scan_directory(Walk &walk, unsigned self, const WalkItem &item,
+                           std::vector<ScannedDir> &scanned)
+{
+  std::string dir_path = full_path(walk.root, item.path);
+  int fd = open(dir_path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return;
+  }
+
+  struct stat st;
+  if (fstat(fd, &st) == 0)
+  {
+    scanned.push_back(ScannedDir{item.path, st.st_mtim});
+  }
+  std::shared_ptr<const IgnoreRules> rules = read_gitignore(fd, item.path, item.rules);
+
+  read_directory(fd, [&](std::string_view name, unsigned char type)
+                 {
+    if (walk.stopped)
+    {
+      return false;
+    }
+    if (name[0] == '.' || !entry_is_directory(fd, name, type, false))
+    {
+      return true; // Hidden directories (including .git) and non-directories
+    }
+
+    std::string child_name(name);
+    std::string child_path = item.path.empty() ? child_name : item.path + "/" + child_name;
+    if (is_ignored(rules.get(), child_path, child_name.c_str()))
+    {
+      return true;
+    }
+
+    if (!walk.visit(child_path))
+    {
+      walk.stopped = true;
+      return false;
+    }
+
+    walk.pending++;
+    bool surplus;
+    {
+      WorkQueue &own = *walk.queues[self];
+      std::lock_guard<std::mutex> guard(own.lock);
+      own.items.push_back(WalkItem{std::move(child_path), rules});
+      walk.queued++;
+      surplus = own.items.size() > 1;
+    }
+    // This worker takes its next directory itself; only wake a sleeper
+    // for the ones beyond that, so a narrow tree is walked by one thread
+    if (surplus && walk.idle > 0)
+    {
+      std::lock_guard<std::mutex> guard(walk.idle_lock);
+      walk.work_ready.notify_one();
+    }
+    return true; });
+  close(fd);
+}
+
+static void walk_worker(Walk &walk, unsigned self)
+{
+  std::vector<ScannedDir> scanned;
+  WalkItem item;
+  while (!walk.stopped)
+  {
+    if (next_item(walk, self, item))
+    {
+      scan_directory(walk, self, item, scanned);
+      if (--walk.pending == 0 || walk.stopped)
+      {
+        // The walk is over: wake everyone so they can leave
+        std::lock_guard<std::mutex> guard(walk.idle_lock);
+        walk.work_ready.notify_all();
+      }
+    }
+    else if (walk.pending == 0)
+    {
+      break;
+    }
+    else
+    {
+      // Others are still scanning; sleep until they queue work or finish.
+      // idle is raised before the check, so a worker that queues work
+      // after it will see it and notify.
+      std::unique_lock<std::mutex> lock(walk.idle_lock);
+      walk.idle++;
+      walk.work_ready.wait(lock, [&walk]()
+                           { return walk.queued > 0 || walk.pending == 0 || walk.stopped; });
+      walk.idle--;
+    }
+  }
+
+  std::lock_guard<std::mutex> guard(walk.scanned_lock);
+  walk.scanned.insert(walk.scanned.end(), std::make_move_iterator(scanned.begin()),
+                      std::make_move_iterator(scanned.end()));
+}
+
+// Check a cached walk against the current directory mtimes, in parallel
+static bool cache_is_current(const std::string &root, const WalkCache &cache)
+{
+  std::atomic<bool> current{true};
+  unsigned n = worker_count();
+  size_t chunk = (cache.dirs.size() + n - 1) / n;
+
+  std::vector<std::thread> threads;
+  for (unsigned t = 0; t < n; t++)
+  {
+    threads.emplace_back([&, t]()
+                         {
+      size_t end = std::min(cache.dirs.size(), (t + 1) * chunk);
+      for (size_t i = t * chunk; i < end && current; i++)
+      {
+        struct stat st;
+        const ScannedDir &dir = cache.dirs[i];
+        if (stat(full_path(root, dir.path).c_str(), &st) != 0 ||
+            st.st_mtim.tv_sec != dir.mtime.tv_sec || st.st_mtim.tv_nsec != dir.mtime.tv_nsec)
+        {
+          current = false;
+        }
+      } });
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+  return current;
+}
+
+bool walk_directories(const std::string &root, const DirectoryVisitor &visit)
+{
+  char resolved[PATH_MAX];
+  std::string key = realpath(root.c_str(), resolved) ? resolved : root;
+
+  std::shared_ptr<const WalkCache> cached;
+  {
+    std::lock_guard<std::mutex> guard(cache_lock);
+    auto it = walk_cache.find(key);
+    if (it != walk_cache.end())
+    {
+      cached = it->second;
+    }
+  }
+  if (cached && cache_is_current(root, *cached))
+  {
+    for (const auto &dir : cached->dirs)
+    {
+      if (!dir.path.empty() && !visit(dir.path))
+      {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  Walk walk(root, visit);
+  unsigned n = worker_count();
+  for (unsigned i = 0; i < n; i++)
+  {
+    walk.queues.push_back(std::make_unique<WorkQueue>());
+  }
+  walk.pending = 1;
+  walk.queued = 1;
+  walk.queues[0]->items.push_back(WalkItem{"", nullptr});
+
+  std::vector<std::thread> threads;
+  for (unsigned i = 0; i < n; i++)
+  {
+    threads.emplace_back(walk_worker, std::ref(walk), i);
+  }
+  for (auto &thread : threads)
+  {
+    thread.join();
+  }
+
+  if (walk.stopped)
+  {
+    return false;
+  }
+
+  auto cache = std::make_shared<WalkCache>();
+  cache->dirs = std::move(walk.scanned);
+  std::lock_guard<std::mutex> guard(cache_lock);
+  walk_cache[key] = std::move(cache);
+  return true;
+}
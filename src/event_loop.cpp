@@ -0,0 +1,183 @@
+#include "include/event_loop.h"
+#include <cerrno>
+#include <csignal>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+
+static int epoll_fd = -1;
+static std::unordered_map<int, EventCallback> input_watchers;
+
+// Signals: one signalfd for every watched signal
+static int signal_fd = -1;
+static sigset_t watched_signals;
+static std::map<int, EventCallback> signal_watchers;
+
+// Callbacks posted by other threads; the eventfd wakes the loop
+static std::mutex posted_lock;
+static std::vector<EventCallback> posted;
+static int wake_fd = -1;
+
+static void register_fd(int fd)
+{
+  struct epoll_event event = {};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0 && errno == EEXIST)
+  {
+    epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &event);
+  }
+}
+
+static void run_posted()
+{
+  uint64_t count;
+  while (read(wake_fd, &count, sizeof(count)) > 0)
+  {
+  }
+
+  std::vector<EventCallback> callbacks;
+  {
+    std::lock_guard<std::mutex> guard(posted_lock);
+    callbacks.swap(posted);
+  }
+  for (auto &callback : callbacks)
+  {
+    callback();
+  }
+}
+
+static void dispatch_signals()
+{
+  struct signalfd_siginfo info;
+  while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+  {
+    auto it = signal_watchers.find(info.ssi_signo);
+    if (it != signal_watchers.end())
+    {
+      EventCallback callback = it->second;
+      callback();
+    }
+  }
+}
+
+bool init_event_loop()
+{
+  if (epoll_fd >= 0)
+  {
+    return true;
+  }
+  epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0)
+  {
+    return false;
+  }
+  sigemptyset(&watched_signals);
+
+  std::lock_guard<std::mutex> guard(posted_lock);
+  wake_fd = eventfd(posted.empty() ? 0 : 1, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (wake_fd >= 0)
+  {
+    input_watchers[wake_fd] = run_posted;
+    register_fd(wake_fd);
+  }
+  return true;
+}
+
+void watch_input(int fd, EventCallback on_readable)
+{
+  input_watchers[fd] = std::move(on_readable);
+  register_fd(fd);
+}
+
+void unwatch_input(int fd)
+{
+  input_watchers.erase(fd);
+  epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+}
+
+void watch_signal(int signo, EventCallback on_signal)
+{
+  signal_watchers[signo] = std::move(on_signal);
+  sigaddset(&watched_signals, signo);
+  sigprocmask(SIG_BLOCK, &watched_signals, nullptr);
+
+  // signalfd() with an existing descriptor just updates its mask
+  int fd = signalfd(signal_fd, &watched_signals, SFD_CLOEXEC | SFD_NONBLOCK);
+  if (fd >= 0 && signal_fd < 0)
+  {
+    signal_fd = fd;
+    watch_input(signal_fd, dispatch_signals);
+  }
+}
+
+void add_timer(std::chrono::milliseconds interval, EventCallback on_expire)
+{
+  int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+  if (fd < 0)
+  {
+    return;
+  }
+
+  struct itimerspec spec = {};
+  spec.it_interval.tv_sec = interval.count() / 1000;
+  spec.it_interval.tv_nsec = (interval.count() % 1000) * 1000000;
+  spec.it_value = spec.it_interval;
+  timerfd_settime(fd, 0, &spec, nullptr);
+
+  watch_input(fd, [fd, on_expire]()
+              {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) > 0)
+    {
+      on_expire();
+    } });
+}
+
+void post_event(EventCallback callback)
+{
+  std::lock_guard<std::mutex> guard(posted_lock);
+  posted.push_back(std::move(callback));
+  if (wake_fd >= 0)
+  {
+    // A failed write means the counter is saturated; the loop wakes anyway
+    uint64_t one = 1;
+    ssize_t written = write(wake_fd, &one, sizeof(one));
+    (void)written;
+  }
+}
+
+void run_event_loop(const bool &stop)
+{
+  struct epoll_event events[16];
+  while (!stop)
+  {
+    int n = epoll_wait(epoll_fd, events, 16, -1);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return;
+    }
+
+    for (int i = 0; i < n; i++)
+    {
+      // Copied: the callback may unwatch its own descriptor
+      auto it = input_watchers.find(events[i].data.fd);
+      if (it != input_watchers.end())
+      {
+        EventCallback callback = it->second;
+        callback();
+      }
+    }
+  }
+}
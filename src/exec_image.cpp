@@ -0,0 +1,110 @@
+#include "include/exec_image.h"
+#include "include/variables.h"
+#include "include/job_limits.h"
+#include <cstring>
+#include <cerrno>
+#include <vector>
+#include <unistd.h>
+#include <csignal>
+
+extern char **environ;
+
+// Cached copy of the environment: all strings in one block plus the pointer
+// array, rebuilt when environment_generation() moves on
+static std::vector<char> env_strings;
+static std::vector<char *> env_pointers;
+static unsigned long env_cached_generation = 0;
+static bool env_cached = false;
+
+char **exec_environment()
+{
+  if (env_cached && env_cached_generation == environment_generation())
+  {
+    return env_pointers.data();
+  }
+
+  size_t total = 0;
+  size_t count = 0;
+  for (char **env = environ; *env != nullptr; env++)
+  {
+    total += strlen(*env) + 1;
+    count++;
+  }
+
+  env_strings.resize(total);
+  env_pointers.resize(count + 1);
+
+  char *p = env_strings.data();
+  for (size_t i = 0; i < count; i++)
+  {
+    size_t len = strlen(environ[i]) + 1;
+    memcpy(p, environ[i], len);
+    env_pointers[i] = p;
+    p += len;
+  }
+  env_pointers[count] = nullptr;
+
+  env_cached_generation = environment_generation();
+  env_cached = true;
+  return env_pointers.data();
+}
+
+ExecImage build_exec_image(const std::pmr::string &path,
+                           const ArgList &args,
+                           std::pmr::memory_resource *mem)
+{
+  size_t total = path.size() + 1;
+  for (const auto &arg : args)
+  {
+    total += arg.size() + 1;
+  }
+
+  // Slot 0 is spare for the ENOEXEC fallback, then argv, then the terminator
+  char **slots = static_cast<char **>(mem->allocate((args.size() + 2) * sizeof(char *), alignof(char *)));
+  char *strings = static_cast<char *>(mem->allocate(total, 1));
+
+  ExecImage image;
+  memcpy(strings, path.c_str(), path.size() + 1);
+  image.path = strings;
+  strings += path.size() + 1;
+
+  slots[0] = nullptr;
+  for (size_t i = 0; i < args.size(); i++)
+  {
+    memcpy(strings, args[i].c_str(), args[i].size() + 1);
+    slots[i + 1] = strings;
+    strings += args[i].size() + 1;
+  }
+  slots[args.size() + 1] = nullptr;
+
+  image.argv = slots + 1;
+  image.envp = exec_environment();
+  return image;
+}
+
+void exec_image(const ExecImage &image)
+{
+  // The interactive shell blocks the signals its event loop reads from a
+  // signalfd; programs must start with them deliverable
+  sigset_t loop_signals;
+  sigemptyset(&loop_signals);
+  sigaddset(&loop_signals, SIGCHLD);
+  sigaddset(&loop_signals, SIGWINCH);
+  sigprocmask(SIG_UNBLOCK, &loop_signals, nullptr);
+
+  // ulimit and sched apply to programs, not the shell
+  apply_job_rlimits();
+  apply_job_sched();
+
+  execve(image.path, image.argv, image.envp);
+
+  if (errno == ENOEXEC)
+  {
+    // Not a binary and no #! line: run it as a script. The spare slot in
+    // front of argv becomes "sh" and argv[0] becomes the resolved path.
+    char **argv = image.argv - 1;
+    argv[0] = const_cast<char *>("sh");
+    argv[1] = const_cast<char *>(image.path);
+    execve("/bin/sh", argv, image.envp);
+  }
+}
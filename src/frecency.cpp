@@ -0,0 +1,342 @@
+#include "include/frecency.h"
+#include "include/name_table.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string_view>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+// Database layout: a sequence of 8-byte aligned records, each a
+// RecordHeader followed by the path and zero padding. A visit appends a
+// record with count 1; compaction merges the records of each path.
+struct RecordHeader
+{
+  uint16_t magic;
+  uint16_t length; // Path length
+  uint32_t count;  // Visits
+  int64_t time;    // Last visit (seconds since the epoch)
+};
+
+static const uint16_t RECORD_MAGIC = 0xF7EC;
+static const size_t RECORD_ALIGN = 8;
+
+// Compact once the log reaches this size; it keeps ranking in the
+// microsecond range
+static const off_t COMPACT_SIZE = 64 * 1024;
+
+// Total visit count above which compaction ages every entry
+static const uint64_t MAX_TOTAL_COUNT = 10000;
+
+struct Aggregate
+{
+  uint64_t count;
+  int64_t time;
+};
+
+static std::string database_path;
+static bool recording = false;
+
+static const std::string &frecency_path()
+{
+  if (database_path.empty())
+  {
+    const char *home = getenv("HOME");
+    database_path = std::string(home ? home : ".") + "/.shell_frecency";
+  }
+  return database_path;
+}
+
+static size_t record_size(size_t path_length)
+{
+  size_t size = sizeof(RecordHeader) + path_length;
+  return (size + RECORD_ALIGN - 1) / RECORD_ALIGN * RECORD_ALIGN;
+}
+
+// Encode a record; the caller writes it with a single write() so that
+// concurrent appends never interleave
+static std::string encode_record(const std::string &path, uint32_t count, int64_t time)
+{
+  RecordHeader header{RECORD_MAGIC, static_cast<uint16_t>(path.length()), count, time};
+  std::string record(record_size(path.length()), '\0');
+  memcpy(&record[0], &header, sizeof(header));
+  memcpy(&record[sizeof(header)], path.data(), path.length());
+  return record;
+}
+
+// One directory in a mapped database
+struct Entry
+{
+  std::string_view path; // Points into the mapping; empty for a free slot
+  Aggregate visits;
+};
+
+// A mapped database with its records merged per path in an open-addressed
+// table, so reading allocates once and copies no paths
+struct Database
+{
+  void *map = MAP_FAILED;
+  size_t size = 0;
+  std::vector<Entry> slots;
+
+  ~Database()
+  {
+    if (map != MAP_FAILED)
+    {
+      munmap(map, size);
+    }
+  }
+};
+
+static void read_database(int fd, Database &db)
+{
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    return;
+  }
+  db.size = st.st_size;
+  db.map = mmap(nullptr, db.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  if (db.map == MAP_FAILED)
+  {
+    return;
+  }
+
+  // Records are visited twice: once to size the table, once to fill it
+  const char *data = static_cast<const char *>(db.map);
+  size_t size = db.size;
+  auto for_each_record = [&](auto visit)
+  {
+    size_t pos = 0;
+    while (size - pos >= sizeof(RecordHeader))
+    {
+      RecordHeader header;
+      memcpy(&header, data + pos, sizeof(header));
+      if (header.magic != RECORD_MAGIC || header.length == 0 ||
+          record_size(header.length) > size - pos)
+      {
+        pos += RECORD_ALIGN; // Damaged record (e.g. a crash mid-write); resynchronize
+        continue;
+      }
+      visit(header, std::string_view(data + pos + sizeof(header), header.length));
+      pos += record_size(header.length);
+    }
+  };
+
+  size_t records = 0;
+  for_each_record([&](const RecordHeader &, std::string_view)
+                  { records++; });
+  size_t slot_count = 16;
+  while (slot_count < 2 * records)
+  {
+    slot_count *= 2;
+  }
+  db.slots.assign(slot_count, Entry{});
+
+  for_each_record([&](const RecordHeader &header, std::string_view path)
+                  {
+    size_t slot = name_hash(path) & (slot_count - 1);
+    while (!db.slots[slot].path.empty() && db.slots[slot].path != path)
+    {
+      slot = (slot + 1) & (slot_count - 1);
+    }
+    Entry &entry = db.slots[slot];
+    entry.path = path;
+    entry.visits.count += header.count;
+    entry.visits.time = std::max(entry.visits.time, header.time); });
+}
+
+// Rewrite the log with one record per existing directory. Appends that
+// race with the rewrite may be lost; the database is never corrupted.
+static void compact_database()
+{
+  const std::string &path = frecency_path();
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return;
+  }
+
+  // One compactor at a time; the others just keep appending
+  struct stat st;
+  if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0 || st.st_size < COMPACT_SIZE)
+  {
+    close(fd); // Also releases the lock
+    return;
+  }
+
+  Database db;
+  read_database(fd, db);
+
+  uint64_t total = 0;
+  for (const auto &entry : db.slots)
+  {
+    total += entry.visits.count;
+  }
+
+  std::string out;
+  for (const auto &entry : db.slots)
+  {
+    if (entry.path.empty())
+    {
+      continue;
+    }
+    std::string dir_path(entry.path);
+    uint64_t count = entry.visits.count;
+    if (total > MAX_TOTAL_COUNT)
+    {
+      count = count * 9 / 10; // Age everything so old favourites fade
+    }
+    struct stat dir;
+    if (count == 0 || stat(dir_path.c_str(), &dir) != 0 || !S_ISDIR(dir.st_mode))
+    {
+      continue;
+    }
+    out += encode_record(dir_path, static_cast<uint32_t>(std::min<uint64_t>(count, UINT32_MAX)),
+                         entry.visits.time);
+  }
+
+  std::string tmp_path = path + ".tmp." + std::to_string(getpid());
+  int out_fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (out_fd >= 0)
+  {
+    bool ok = write(out_fd, out.data(), out.size()) == static_cast<ssize_t>(out.size());
+    close(out_fd);
+    if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0)
+    {
+      unlink(tmp_path.c_str());
+    }
+  }
+  close(fd);
+}
+
+void set_frecency_database(const std::string &path, bool record_visits)
+{
+  database_path = path;
+  recording = record_visits;
+}
+
+void record_directory_visit(const std::string &dir)
+{
+  if (!recording || dir.empty() || dir.length() > UINT16_MAX)
+  {
+    return;
+  }
+
+  // Opened per visit so appends follow a compacted file that replaced the
+  // old one
+  int fd = open(frecency_path().c_str(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+  if (fd < 0)
+  {
+    return;
+  }
+  std::string record = encode_record(dir, 1, time(nullptr));
+  bool written = write(fd, record.data(), record.size()) == static_cast<ssize_t>(record.size());
+  struct stat st;
+  bool needs_compaction = written && fstat(fd, &st) == 0 && st.st_size >= COMPACT_SIZE;
+  close(fd);
+
+  if (needs_compaction)
+  {
+    compact_database();
+  }
+}
+
+// Weight a visit count by how long ago the last visit was
+static double frecency(const Aggregate &entry, int64_t now)
+{
+  int64_t age = now - entry.time;
+  double weight = age < 3600 ? 4.0 : age < 86400 ? 2.0 : age < 7 * 86400 ? 0.5 : 0.25;
+  return entry.count * weight;
+}
+
+static char fold_case(char c)
+{
+  return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+// Find term in path at or after pos; with ignore_case the term is already
+// lowercase and path characters are folded as they are compared
+static size_t find_term(std::string_view path, const std::string &term, size_t pos, bool ignore_case)
+{
+  if (!ignore_case)
+  {
+    return path.find(term, pos);
+  }
+  for (; pos + term.size() <= path.size(); pos++)
+  {
+    size_t i = 0;
+    while (i < term.size() && fold_case(path[pos + i]) == term[i])
+    {
+      i++;
+    }
+    if (i == term.size())
+    {
+      return pos;
+    }
+  }
+  return std::string_view::npos;
+}
+
+// Terms must appear in order; the last one within the last path component
+static bool matches_terms(std::string_view path, const std::vector<std::string> &terms, bool ignore_case)
+{
+  size_t pos = 0;
+  for (size_t i = 0; i < terms.size(); i++)
+  {
+    if (i + 1 == terms.size())
+    {
+      pos = std::max(pos, path.find_last_of('/') + 1);
+    }
+    size_t found = find_term(path, terms[i], pos, ignore_case);
+    if (found == std::string_view::npos)
+    {
+      return false;
+    }
+    pos = found + terms[i].length();
+  }
+  return true;
+}
+
+std::vector<FrecencyEntry> rank_directories(const std::vector<std::string> &terms)
+{
+  std::vector<FrecencyEntry> ranked;
+  int fd = open(frecency_path().c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return ranked;
+  }
+  Database db;
+  read_database(fd, db);
+  close(fd);
+
+  // Smart case: case-insensitive unless a term has an uppercase letter
+  bool ignore_case = std::none_of(terms.begin(), terms.end(), [](const std::string &term)
+                                  { return std::any_of(term.begin(), term.end(), [](char c)
+                                                       { return c >= 'A' && c <= 'Z'; }); });
+
+  int64_t now = time(nullptr);
+  for (const auto &entry : db.slots)
+  {
+    if (!entry.path.empty() && matches_terms(entry.path, terms, ignore_case))
+    {
+      ranked.push_back(FrecencyEntry{std::string(entry.path), frecency(entry.visits, now)});
+    }
+  }
+
+  std::sort(ranked.begin(), ranked.end(), [](const FrecencyEntry &a, const FrecencyEntry &b)
+            { return a.score != b.score ? a.score > b.score : a.path < b.path; });
+
+  // Directories may have been removed since they were recorded
+  ranked.erase(std::remove_if(ranked.begin(), ranked.end(), [](const FrecencyEntry &entry)
+                              {
+                                struct stat st;
+                                return stat(entry.path.c_str(), &st) != 0 || !S_ISDIR(st.st_mode); }),
+               ranked.end());
+  return ranked;
+}
@@ -0,0 +1,157 @@
+#include "include/functions.h"
+#include "include/arena.h"
+#include "include/name_table.h"
+#include "include/variables.h"
+#include <algorithm>
+#include <iostream>
+
+// Deep recursion would overflow the C++ stack; fail the call instead
+static const int MAX_FUNCTION_DEPTH = 1000;
+
+static NameTable<std::shared_ptr<const FunctionDef>> functions;
+static NameTable<std::string> aliases;
+static int function_depth = 0;
+
+// Point every node's text at the same offset in a copy of the source
+static void rebase_text(ScriptNode &node, std::string_view old_source, const std::string &new_source)
+{
+  if (!node.text.empty())
+  {
+    size_t offset = node.text.data() - old_source.data();
+    node.text = std::string_view(new_source).substr(offset, node.text.length());
+  }
+  for (auto &child : node.children)
+  {
+    rebase_text(child, old_source, new_source);
+  }
+}
+
+// Tokenize the simple commands of a function body once (see PreparedCommand)
+static void prepare_commands(ScriptNode &node, FunctionDef &fn)
+{
+  if (node.type == ScriptNode::FUNCTION)
+  {
+    return; // A nested definition is prepared when it runs
+  }
+  if (node.type != ScriptNode::SIMPLE)
+  {
+    for (auto &child : node.children)
+    {
+      prepare_commands(child, fn);
+    }
+    return;
+  }
+
+  // Redirection targets are expanded while they are parsed, which must not
+  // run a command substitution now
+  std::string_view text = node.text;
+  if (text.find('`') != std::string_view::npos || text.find("$(") != std::string_view::npos)
+  {
+    return;
+  }
+  auto prepared = std::make_unique<PreparedCommand>();
+  prepared->redirect = parse_redirect(text);
+  if (!prepared->redirect.error.empty() ||
+      std::count(text.begin(), text.end(), '$') !=
+          std::count(prepared->redirect.command.begin(), prepared->redirect.command.end(), '$'))
+  {
+    return; // Reported, or a target with a variable: parsed on each call
+  }
+  if (prepared->redirect.command.find('$') == std::pmr::string::npos)
+  {
+    prepared->args = parse_args(prepared->redirect.command);
+    // An alias in the command word is still replaced on each call
+    prepared->fixed_args = prepared->args.empty() || find_alias(prepared->args[0]) == nullptr;
+  }
+  node.prepared = prepared.get();
+  fn.prepared.push_back(std::move(prepared));
+}
+
+void define_function(std::string_view name, const ScriptNode &body)
+{
+  // The body's text covers the text of all its descendants
+  auto fn = std::make_shared<FunctionDef>(FunctionDef{std::string(body.text), ScriptNode(body), {}});
+  rebase_text(fn->body, body.text, fn->source);
+  prepare_commands(fn->body, *fn);
+  functions.set(name, std::move(fn));
+}
+
+std::shared_ptr<const FunctionDef> find_function(std::string_view name)
+{
+  auto *fn = functions.find(name);
+  return fn ? *fn : nullptr;
+}
+
+int call_function(const FunctionDef &fn, const ArgList &args, ShellContext &ctx)
+{
+  if (function_depth >= MAX_FUNCTION_DEPTH)
+  {
+    std::cerr << args[0] << ": maximum function nesting level exceeded" << std::endl;
+    return 1;
+  }
+
+  std::vector<std::string> params(args.begin() + 1, args.end());
+  std::vector<std::string> saved = set_positional_parameters(std::move(params));
+
+  function_depth++;
+  int status;
+  {
+    ArenaScope call;
+    status = execute_node(fn.body, ctx);
+  }
+  function_depth--;
+  if (ctx.return_requested)
+  {
+    ctx.return_requested = false;
+    status = ctx.return_status;
+  }
+
+  set_positional_parameters(std::move(saved));
+  return status;
+}
+
+bool in_function()
+{
+  return function_depth > 0;
+}
+
+std::vector<std::string> list_functions()
+{
+  std::vector<std::string> names;
+  for (const auto *entry : functions.sorted())
+  {
+    names.push_back(entry->name);
+  }
+  return names;
+}
+
+void set_alias(std::string_view name, std::string_view value)
+{
+  aliases.set(name, std::string(value));
+}
+
+const std::string *find_alias(std::string_view name)
+{
+  return aliases.find(name);
+}
+
+bool unset_alias(std::string_view name)
+{
+  return aliases.erase(name);
+}
+
+std::vector<std::pair<std::string, std::string>> list_aliases()
+{
+  std::vector<std::pair<std::string, std::string>> all;
+  for (const auto *entry : aliases.sorted())
+  {
+    all.emplace_back(entry->name, entry->value);
+  }
+  return all;
+}
+
+void swap_function_scope(FunctionScope &scope)
+{
+  std::swap(functions, scope.functions);
+  std::swap(aliases, scope.aliases);
+}
@@ -0,0 +1,110 @@
+#include "include/fuzzy_match.h"
+#include <algorithm>
+#include <cctype>
+
+static const int SCORE_MATCH = 16;
+static const int SCORE_GAP_START = -3;
+static const int SCORE_GAP_EXTENSION = -1;
+static const int BONUS_PATH_SEPARATOR = 9;
+static const int BONUS_BOUNDARY = 8;
+static const int BONUS_CAMEL = 7;
+static const int BONUS_CONSECUTIVE = 4;
+static const int FIRST_CHAR_MULTIPLIER = 2;
+
+// Bonus for a match at candidate[i], from the character before it
+static int position_bonus(std::string_view candidate, size_t i)
+{
+  if (i == 0)
+  {
+    return BONUS_PATH_SEPARATOR;
+  }
+  unsigned char prev = candidate[i - 1];
+  unsigned char cur = candidate[i];
+  if (prev == '/')
+  {
+    return BONUS_PATH_SEPARATOR;
+  }
+  if (!std::isalnum(prev) && std::isalnum(cur))
+  {
+    return BONUS_BOUNDARY;
+  }
+  if (std::islower(prev) && std::isupper(cur))
+  {
+    return BONUS_CAMEL;
+  }
+  return 0;
+}
+
+int fuzzy_score(std::string_view pattern, std::string_view candidate)
+{
+  if (pattern.empty())
+  {
+    return 0;
+  }
+
+  bool case_sensitive = std::any_of(pattern.begin(), pattern.end(),
+                                    [](char c)
+                                    { return std::isupper(static_cast<unsigned char>(c)); });
+  auto equal = [case_sensitive](char a, char b)
+  {
+    return case_sensitive ? a == b
+                          : std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+  };
+
+  // Forward pass: earliest position where the whole pattern has matched
+  size_t pi = 0;
+  size_t end = 0;
+  for (size_t i = 0; i < candidate.length() && pi < pattern.length(); i++)
+  {
+    if (equal(candidate[i], pattern[pi]))
+    {
+      pi++;
+      end = i + 1;
+    }
+  }
+  if (pi < pattern.length())
+  {
+    return -1;
+  }
+
+  // Backward pass: latest start, giving the shortest window ending there
+  size_t start = end;
+  pi = pattern.length();
+  while (pi > 0)
+  {
+    start--;
+    if (equal(candidate[start], pattern[pi - 1]))
+    {
+      pi--;
+    }
+  }
+
+  // Score the window greedily
+  int score = 0;
+  int consecutive_bonus = 0;
+  bool in_gap = false;
+  pi = 0;
+  for (size_t i = start; i < end; i++)
+  {
+    if (pi < pattern.length() && equal(candidate[i], pattern[pi]))
+    {
+      int bonus = position_bonus(candidate, i);
+      if (consecutive_bonus > 0)
+      {
+        // Inside a run, keep the bonus of the run's first character
+        bonus = std::max({bonus, consecutive_bonus, BONUS_CONSECUTIVE});
+      }
+      consecutive_bonus = bonus;
+      score += SCORE_MATCH + bonus * (pi == 0 ? FIRST_CHAR_MULTIPLIER : 1);
+      in_gap = false;
+      pi++;
+    }
+    else
+    {
+      score += in_gap ? SCORE_GAP_EXTENSION : SCORE_GAP_START;
+      consecutive_bonus = 0;
+      in_gap = true;
+    }
+  }
+  return score;
+}
@@ -0,0 +1,638 @@
+#include "include/job_limits.h"
+#include "include/variables.h"
+#include <iostream>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sstream>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+
+// Limits set with ulimit, applied in children before exec
+struct JobRlimit
+{
+  bool set;
+  rlim_t value;
+};
+static JobRlimit job_rlimits[RLIM_NLIMITS];
+
+static bool cgroups_on = false;
+static std::string cgroup_parent;
+static CgroupLimits cgroup_limits;
+static unsigned job_counter = 0;
+
+// Set in a job's children: commands they start stay in the job's cgroup
+static bool inside_job = false;
+
+bool set_job_rlimit(int resource, rlim_t value)
+{
+  struct rlimit current;
+  if (resource < 0 || resource >= RLIM_NLIMITS || getrlimit(resource, &current) != 0 ||
+      value > current.rlim_max)
+  {
+    return false;
+  }
+  job_rlimits[resource] = JobRlimit{true, value};
+  return true;
+}
+
+rlim_t get_job_rlimit(int resource)
+{
+  if (resource >= 0 && resource < RLIM_NLIMITS && job_rlimits[resource].set)
+  {
+    return job_rlimits[resource].value;
+  }
+  struct rlimit current;
+  return getrlimit(resource, &current) == 0 ? current.rlim_cur : RLIM_INFINITY;
+}
+
+void apply_job_rlimits()
+{
+  for (int resource = 0; resource < RLIM_NLIMITS; resource++)
+  {
+    if (job_rlimits[resource].set)
+    {
+      struct rlimit limit = {job_rlimits[resource].value, job_rlimits[resource].value};
+      setrlimit(resource, &limit);
+    }
+  }
+}
+
+static std::string read_file(const std::string &path)
+{
+  std::string data;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return data;
+  }
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    data.append(buffer, n);
+  }
+  close(fd);
+  return data;
+}
+
+static bool write_file(const std::string &path, const std::string &value)
+{
+  int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  bool ok = write(fd, value.data(), value.size()) == static_cast<ssize_t>(value.size());
+  close(fd);
+  return ok;
+}
+
+// Mount point of the cgroup v2 hierarchy (also found in hybrid setups)
+static std::string cgroup2_mount()
+{
+  std::istringstream mounts(read_file("/proc/self/mountinfo"));
+  std::string line;
+  while (std::getline(mounts, line))
+  {
+    // ID PARENT MAJ:MIN ROOT MOUNT-POINT OPTIONS... - FSTYPE SOURCE OPTIONS
+    size_t separator = line.find(" - ");
+    if (separator == std::string::npos || line.compare(separator + 3, 8, "cgroup2 ") != 0)
+    {
+      continue;
+    }
+    std::istringstream fields(line.substr(0, separator));
+    std::string field, mount_point;
+    for (int i = 0; i < 5 && fields >> field; i++)
+    {
+      mount_point = field;
+    }
+    return mount_point;
+  }
+  return "";
+}
+
+// The shell's own cgroup v2 path, relative to the mount
+static std::string own_cgroup()
+{
+  std::istringstream groups(read_file("/proc/self/cgroup"));
+  std::string line;
+  while (std::getline(groups, line))
+  {
+    if (line.compare(0, 3, "0::") == 0)
+    {
+      return line.substr(3);
+    }
+  }
+  return "";
+}
+
+static bool has_word(const std::string &list, const std::string &word)
+{
+  std::istringstream words(list);
+  std::string w;
+  while (words >> w)
+  {
+    if (w == word)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool enable_job_cgroups(const CgroupLimits &limits, std::string &error)
+{
+  std::string parent(peek_variable("SHELL_CGROUP"));
+  if (parent.empty())
+  {
+    std::string mount = cgroup2_mount();
+    if (mount.empty())
+    {
+      error = "no cgroup v2 hierarchy is mounted";
+      return false;
+    }
+    std::string own = own_cgroup();
+    parent = mount + (own == "/" ? "" : own);
+  }
+  if (access((parent + "/cgroup.subtree_control").c_str(), W_OK) != 0)
+  {
+    error = "cannot create cgroups under " + parent + " (set SHELL_CGROUP to a delegated cgroup)";
+    return false;
+  }
+
+  // The controllers a limit needs must be enabled for the job cgroups
+  const std::pair<const std::string *, const char *> needed[] = {
+      {&limits.cpu_max, "cpu"}, {&limits.memory_max, "memory"}, {&limits.pids_max, "pids"}};
+  for (const auto &controller : needed)
+  {
+    if (controller.first->empty() ||
+        has_word(read_file(parent + "/cgroup.subtree_control"), controller.second))
+    {
+      continue;
+    }
+    if (!has_word(read_file(parent + "/cgroup.controllers"), controller.second) ||
+        !write_file(parent + "/cgroup.subtree_control", std::string("+") + controller.second))
+    {
+      error = std::string("the ") + controller.second + " controller is not available in " + parent;
+      return false;
+    }
+  }
+
+  cgroup_parent = parent;
+  cgroup_limits = limits;
+  cgroups_on = true;
+  return true;
+}
+
+void disable_job_cgroups()
+{
+  cgroups_on = false;
+}
+
+std::string describe_job_cgroups()
+{
+  if (!cgroups_on)
+  {
+    return "off";
+  }
+  std::string description = "on in " + cgroup_parent;
+  if (!cgroup_limits.cpu_max.empty())
+    description += ", cpu.max " + cgroup_limits.cpu_max;
+  if (!cgroup_limits.memory_max.empty())
+    description += ", memory.max " + cgroup_limits.memory_max;
+  if (!cgroup_limits.pids_max.empty())
+    description += ", pids.max " + cgroup_limits.pids_max;
+  return description;
+}
+
+static bool job_sched_active();
+
+bool job_limits_active()
+{
+  if (cgroups_on || job_sched_active())
+  {
+    return true;
+  }
+  for (const auto &limit : job_rlimits)
+  {
+    if (limit.set)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool start_job_cgroup(JobCgroup &job)
+{
+  job.path.clear();
+  job.procs_fd = -1;
+  if (!cgroups_on || inside_job)
+  {
+    return true;
+  }
+
+  std::string path = cgroup_parent + "/shell-" + std::to_string(getpid()) + "-" + std::to_string(++job_counter);
+  if (mkdir(path.c_str(), 0755) != 0)
+  {
+    std::cerr << "limit: cannot create cgroup " << path << ": " << strerror(errno) << std::endl;
+    return false;
+  }
+
+  const std::pair<const char *, const std::string *> limits[] = {
+      {"/cpu.max", &cgroup_limits.cpu_max},
+      {"/memory.max", &cgroup_limits.memory_max},
+      {"/pids.max", &cgroup_limits.pids_max}};
+  for (const auto &limit : limits)
+  {
+    if (!limit.second->empty() && !write_file(path + limit.first, *limit.second))
+    {
+      std::cerr << "limit: cannot set " << path << limit.first << ": " << strerror(errno) << std::endl;
+      rmdir(path.c_str());
+      return false;
+    }
+  }
+
+  job.procs_fd = open((path + "/cgroup.procs").c_str(), O_WRONLY | O_CLOEXEC);
+  if (job.procs_fd < 0)
+  {
+    std::cerr << "limit: cannot open " << path << "/cgroup.procs: " << strerror(errno) << std::endl;
+    rmdir(path.c_str());
+    return false;
+  }
+  job.path = path;
+  return true;
+}
+
+void enter_job_cgroup(const JobCgroup &job)
+{
+  if (job.procs_fd < 0)
+  {
+    return;
+  }
+  // "0" moves the writing process
+  if (write(job.procs_fd, "0", 1) != 1)
+  {
+    static const char message[] = "limit: cannot join job cgroup\n";
+    ssize_t ignored = write(STDERR_FILENO, message, sizeof(message) - 1);
+    (void)ignored;
+    _exit(126); // Never run a limited job unconfined
+  }
+  inside_job = true;
+}
+
+// Value of a "key value" line in a cgroup stat file, or -1
+static long long stat_field(const std::string &stats, const std::string &key)
+{
+  std::istringstream lines(stats);
+  std::string name;
+  long long value;
+  while (lines >> name >> value)
+  {
+    if (name == key)
+    {
+      return value;
+    }
+  }
+  return -1;
+}
+
+static std::string format_bytes(long long bytes)
+{
+  static const char units[] = "BKMGT";
+  double value = bytes;
+  int unit = 0;
+  while (value >= 1024 && unit < 4)
+  {
+    value /= 1024;
+    unit++;
+  }
+  char text[32];
+  snprintf(text, sizeof(text), unit == 0 ? "%.0f%c" : "%.1f%c", value, units[unit]);
+  return text;
+}
+
+void finish_job_cgroup(JobCgroup &job)
+{
+  if (job.path.empty())
+  {
+    return;
+  }
+  close(job.procs_fd);
+  job.procs_fd = -1;
+
+  std::string cpu = read_file(job.path + "/cpu.stat");
+  std::string memory_peak = read_file(job.path + "/memory.peak");
+  std::string pids_peak = read_file(job.path + "/pids.peak");
+
+  char line[160];
+  snprintf(line, sizeof(line), "[job] cpu %.3fs (user %.3fs, system %.3fs)",
+           stat_field(cpu, "usage_usec") / 1e6, stat_field(cpu, "user_usec") / 1e6,
+           stat_field(cpu, "system_usec") / 1e6);
+  std::string report = line;
+  if (!memory_peak.empty())
+  {
+    report += ", memory peak " + format_bytes(std::atoll(memory_peak.c_str()));
+  }
+  if (!pids_peak.empty())
+  {
+    report += ", pids peak " + std::to_string(std::atoll(pids_peak.c_str()));
+  }
+  std::cerr << report << std::endl;
+
+  // Background processes the job left behind would keep the cgroup alive
+  if (stat_field(read_file(job.path + "/cgroup.events"), "populated") == 1)
+  {
+    write_file(job.path + "/cgroup.kill", "1");
+  }
+  for (int attempt = 0; attempt < 100 && rmdir(job.path.c_str()) != 0 && errno == EBUSY; attempt++)
+  {
+    usleep(1000);
+  }
+  job.path.clear();
+}
+
+// Scheduling settings for children (sched builtin)
+static JobSched job_sched;
+
+// Allowed CPUs in spread order (one per physical core first); built on
+// first use after the CPU set changes
+static std::vector<int> spread_order;
+
+// Set in a pipeline stage's child once enter_pipeline_stage() has applied
+// the settings, so exec does not undo its CPU placement
+static bool sched_applied = false;
+
+// ioprio_set(2) encoding (linux/ioprio.h)
+static const int IOPRIO_WHO_PROCESS_ID = 1;
+static const int IOPRIO_CLASS_SHIFT_BITS = 13;
+static const char *const ioprio_classes[] = {"none", "rt", "be", "idle"};
+
+static bool parse_cpu_list(const std::string &list, cpu_set_t &cpus, std::string &error)
+{
+  cpu_set_t allowed;
+  CPU_ZERO(&allowed);
+  sched_getaffinity(0, sizeof(allowed), &allowed);
+
+  CPU_ZERO(&cpus);
+  std::istringstream ranges(list);
+  std::string range;
+  while (std::getline(ranges, range, ','))
+  {
+    char *end;
+    long first = std::strtol(range.c_str(), &end, 10);
+    long last = first;
+    if (*end == '-')
+    {
+      last = std::strtol(end + 1, &end, 10);
+    }
+    if (range.empty() || *end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE)
+    {
+      error = "invalid CPU list: " + list;
+      return false;
+    }
+    for (long cpu = first; cpu <= last; cpu++)
+    {
+      if (!CPU_ISSET(cpu, &allowed))
+      {
+        error = "CPU " + std::to_string(cpu) + " is not available to the shell";
+        return false;
+      }
+      CPU_SET(cpu, &cpus);
+    }
+  }
+  if (CPU_COUNT(&cpus) == 0)
+  {
+    error = "invalid CPU list: " + list;
+    return false;
+  }
+  return true;
+}
+
+bool parse_job_sched(const std::string &word, JobSched &sched, std::string &error)
+{
+  size_t equals = word.find('=');
+  std::string key = word.substr(0, equals);
+  std::string value = equals == std::string::npos ? "" : word.substr(equals + 1);
+  char *end;
+
+  if (key == "cpus")
+  {
+    if (!parse_cpu_list(value, sched.cpus, error))
+    {
+      return false;
+    }
+    sched.has_cpus = true;
+    return true;
+  }
+  if (key == "nice")
+  {
+    long nice = std::strtol(value.c_str(), &end, 10);
+    if (value.empty() || *end != '\0' || nice < -20 || nice > 19)
+    {
+      error = "nice must be a number from -20 to 19";
+      return false;
+    }
+    sched.has_nice = true;
+    sched.nice = static_cast<int>(nice);
+    return true;
+  }
+  if (key == "io")
+  {
+    std::string name = value.substr(0, value.find(':'));
+    int io_class = 0;
+    for (int c = 1; c < 4; c++)
+    {
+      if (name == ioprio_classes[c])
+      {
+        io_class = c;
+      }
+    }
+    long level = 4; // The kernel's default best-effort level
+    if (value.size() > name.size())
+    {
+      level = std::strtol(value.c_str() + name.size() + 1, &end, 10);
+      if (*end != '\0' || value.size() == name.size() + 1)
+      {
+        level = -1;
+      }
+    }
+    if (io_class == 0 || level < 0 || level > 7 || (io_class == 3 && value != "idle"))
+    {
+      error = "io must be idle, be[:0-7] or rt[:0-7]";
+      return false;
+    }
+    sched.has_ioprio = true;
+    sched.ioprio = (io_class << IOPRIO_CLASS_SHIFT_BITS) | (io_class == 3 ? 0 : static_cast<int>(level));
+    return true;
+  }
+  if (key == "spread" && (value == "on" || value == "off"))
+  {
+    sched.spread = value == "on";
+    return true;
+  }
+  error = "unknown setting: " + word;
+  return false;
+}
+
+const JobSched &get_job_sched()
+{
+  return job_sched;
+}
+
+void set_job_sched(const JobSched &sched)
+{
+  if (sched.has_cpus != job_sched.has_cpus ||
+      (sched.has_cpus && !CPU_EQUAL(&sched.cpus, &job_sched.cpus)))
+  {
+    spread_order.clear();
+  }
+  job_sched = sched;
+  sched_applied = false; // A stage's builtin may start programs with new settings
+}
+
+std::string describe_job_sched()
+{
+  std::string description;
+  if (job_sched.has_cpus)
+  {
+    description += " cpus=";
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+      if (!CPU_ISSET(cpu, &job_sched.cpus))
+      {
+        continue;
+      }
+      int last = cpu;
+      while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &job_sched.cpus))
+      {
+        last++;
+      }
+      description += (description.back() == '=' ? "" : ",") + std::to_string(cpu);
+      if (last > cpu)
+      {
+        description += "-" + std::to_string(last);
+      }
+      cpu = last;
+    }
+  }
+  if (job_sched.has_nice)
+  {
+    description += " nice=" + std::to_string(job_sched.nice);
+  }
+  if (job_sched.has_ioprio)
+  {
+    int io_class = job_sched.ioprio >> IOPRIO_CLASS_SHIFT_BITS;
+    description += std::string(" io=") + ioprio_classes[io_class];
+    if (io_class != 3)
+    {
+      description += ":" + std::to_string(job_sched.ioprio & ((1 << IOPRIO_CLASS_SHIFT_BITS) - 1));
+    }
+  }
+  if (job_sched.spread)
+  {
+    description += " spread=on";
+  }
+  return description.empty() ? "default" : description.substr(1);
+}
+
+static bool job_sched_active()
+{
+  return job_sched.has_cpus || job_sched.has_nice || job_sched.has_ioprio || job_sched.spread;
+}
+
+void apply_job_sched()
+{
+  if (sched_applied)
+  {
+    return;
+  }
+  if (job_sched.has_cpus)
+  {
+    sched_setaffinity(0, sizeof(job_sched.cpus), &job_sched.cpus);
+  }
+  if (job_sched.has_nice)
+  {
+    setpriority(PRIO_PROCESS, 0, job_sched.nice);
+  }
+  if (job_sched.has_ioprio)
+  {
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS_ID, 0, job_sched.ioprio);
+  }
+}
+
+// Order the allowed CPUs so that consecutive entries are on different
+// physical cores while there are cores left
+static void build_spread_order()
+{
+  cpu_set_t allowed;
+  if (job_sched.has_cpus)
+  {
+    allowed = job_sched.cpus;
+  }
+  else if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+  {
+    return;
+  }
+
+  std::vector<std::string> cores_seen;
+  std::vector<int> siblings;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+  {
+    if (!CPU_ISSET(cpu, &allowed))
+    {
+      continue;
+    }
+    std::string topology = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/topology/";
+    std::string core = read_file(topology + "physical_package_id") + ":" + read_file(topology + "core_id");
+    if (std::find(cores_seen.begin(), cores_seen.end(), core) == cores_seen.end() || core == ":")
+    {
+      cores_seen.push_back(core);
+      spread_order.push_back(cpu);
+    }
+    else
+    {
+      siblings.push_back(cpu);
+    }
+  }
+  spread_order.insert(spread_order.end(), siblings.begin(), siblings.end());
+}
+
+void plan_pipeline_cpus(int count, int *cpus)
+{
+  for (int i = 0; i < count; i++)
+  {
+    cpus[i] = -1;
+  }
+  if (!job_sched.spread || count < 2)
+  {
+    return;
+  }
+  if (spread_order.empty())
+  {
+    build_spread_order();
+  }
+  for (int i = 0; i < count && !spread_order.empty(); i++)
+  {
+    cpus[i] = spread_order[i % spread_order.size()];
+  }
+}
+
+void enter_pipeline_stage(int cpu)
+{
+  apply_job_sched();
+  if (cpu >= 0)
+  {
+    cpu_set_t one;
+    CPU_ZERO(&one);
+    CPU_SET(cpu, &one);
+    sched_setaffinity(0, sizeof(one), &one);
+  }
+  sched_applied = true;
+}
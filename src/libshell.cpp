@@ -0,0 +1,259 @@
+#include "include/libshell.h"
+#include "include/arena.h"
+#include "include/rc_file.h"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cerrno>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+extern char **environ;
+
+// Instance whose state is in the interpreter's modules, if any
+static Shell *live_shell = nullptr;
+
+static std::string current_directory()
+{
+  char *dir = getcwd(nullptr, 0);
+  std::string result = dir ? dir : "";
+  free(dir);
+  return result;
+}
+
+Shell::Shell()
+{
+  // Start from the process's own state, which the live instance (if any)
+  // is keeping while it runs
+  if (live_shell != nullptr)
+  {
+    variables_.environment = live_shell->variables_.environment;
+    directory_ = live_shell->directory_;
+  }
+  else
+  {
+    for (char **env = environ; *env != nullptr; env++)
+    {
+      variables_.environment.emplace_back(*env);
+    }
+    directory_ = current_directory();
+  }
+}
+
+Shell::~Shell()
+{
+  if (live_shell == this)
+  {
+    swap_state();
+    live_shell = nullptr;
+  }
+}
+
+void Shell::swap_state()
+{
+  swap_variable_scope(variables_);
+  swap_function_scope(functions_);
+
+  std::string previous = current_directory();
+  if (!directory_.empty() && chdir(directory_.c_str()) != 0)
+  {
+    std::cerr << "shell: cannot return to " << directory_ << std::endl;
+  }
+  directory_.swap(previous);
+}
+
+void Shell::activate()
+{
+  if (live_shell == this)
+  {
+    return;
+  }
+  if (live_shell != nullptr)
+  {
+    live_shell->swap_state();
+  }
+  swap_state();
+  live_shell = this;
+}
+
+ParseStatus Shell::parse(std::string_view source, ScriptNode &root, std::string &error)
+{
+  return parse_script(source, root, error);
+}
+
+int Shell::execute(std::string_view source)
+{
+  activate();
+  reset_line_arena(); // Nothing from an earlier call is alive
+
+  ScriptNode root(line_arena());
+  std::string error;
+  ParseStatus result = parse_script(source, root, error);
+  if (result != ParseStatus::OK)
+  {
+    std::cerr << (result == ParseStatus::INCOMPLETE ? "syntax error: unexpected end of file" : error) << std::endl;
+    set_last_status(2);
+    return 2;
+  }
+  return execute(root);
+}
+
+int Shell::execute(const ScriptNode &root)
+{
+  activate();
+  ctx_.exit_requested = false;
+
+  // Builtins write through std::cout and std::cerr while forked commands
+  // write to the descriptors directly; keep them in order like bin/shell
+  std::ios::fmtflags out_flags = std::cout.flags();
+  std::ios::fmtflags err_flags = std::cerr.flags();
+  std::cout << std::unitbuf;
+  std::cerr << std::unitbuf;
+  int status = execute_node(root, ctx_);
+  std::cout.flags(out_flags);
+  std::cerr.flags(err_flags);
+
+  return ctx_.exit_requested ? ctx_.exit_status : status;
+}
+
+// Read everything written to an anonymous file
+static void read_back(int fd, std::string &data)
+{
+  data.clear();
+  off_t size = lseek(fd, 0, SEEK_END);
+  if (size <= 0)
+  {
+    return;
+  }
+  data.resize(size);
+  size_t done = 0;
+  while (done < data.size())
+  {
+    ssize_t n = pread(fd, &data[done], data.size() - done, done);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      break;
+    }
+    done += n;
+  }
+  data.resize(done);
+}
+
+int Shell::capture(std::string_view source, std::string &out, std::string *err)
+{
+  // Output buffered in this process must land where it was written
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(nullptr);
+
+  // Anonymous files rather than pipes: the shell runs the command itself,
+  // so nothing could drain a full pipe. Saved descriptors stay above 9,
+  // clear of exec redirections.
+  int targets = err != nullptr ? 2 : 1;
+  int files[2] = {-1, -1};
+  int saved[2] = {-1, -1};
+  for (int i = 0; i < targets; i++)
+  {
+    files[i] = memfd_create(i == 0 ? "shell-stdout" : "shell-stderr", MFD_CLOEXEC);
+    saved[i] = fcntl(STDOUT_FILENO + i, F_DUPFD_CLOEXEC, 10);
+    if (files[i] < 0 || dup2(files[i], STDOUT_FILENO + i) < 0)
+    {
+      std::cerr << "shell: cannot capture output" << std::endl;
+    }
+  }
+
+  int status = execute(source);
+
+  std::cout.flush();
+  std::cerr.flush();
+  fflush(nullptr);
+  for (int i = 0; i < targets; i++)
+  {
+    if (saved[i] >= 0)
+    {
+      dup2(saved[i], STDOUT_FILENO + i);
+      close(saved[i]);
+    }
+    else
+    {
+      close(STDOUT_FILENO + i); // Was closed before
+    }
+    if (files[i] >= 0)
+    {
+      read_back(files[i], i == 0 ? out : *err);
+      close(files[i]);
+    }
+  }
+  return status;
+}
+
+bool Shell::load_config(const std::string &path, const std::string &snapshot_path)
+{
+  activate();
+  return ::load_config(path, snapshot_path, ctx_);
+}
+
+int Shell::last_status()
+{
+  activate();
+  return std::atoi(get_variable("?").c_str());
+}
+
+void Shell::set_last_status(int status)
+{
+  activate();
+  ::set_last_status(status);
+}
+
+std::vector<int> Shell::pipe_status()
+{
+  activate();
+  std::vector<int> statuses;
+  std::string value = get_variable("PIPESTATUS");
+  const char *p = value.c_str();
+  while (*p != '\0')
+  {
+    char *end;
+    long status = std::strtol(p, &end, 10);
+    if (end == p)
+    {
+      break;
+    }
+    statuses.push_back(static_cast<int>(status));
+    p = end;
+  }
+  return statuses;
+}
+
+std::string Shell::variable(const std::string &name)
+{
+  activate();
+  return get_variable(name);
+}
+
+void Shell::set_variable(const std::string &name, const std::string &value, bool exported)
+{
+  activate();
+  ::set_variable(name, value);
+  if (exported)
+  {
+    export_variable(name);
+  }
+}
+
+std::string Shell::cwd()
+{
+  activate();
+  return current_directory();
+}
+
+bool Shell::change_directory(const std::string &path)
+{
+  activate();
+  return chdir(path.c_str()) == 0;
+}
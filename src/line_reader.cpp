@@ -0,0 +1,116 @@
+#include "include/line_reader.h"
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <map>
+
+// Initial buffer size; grows when a single line does not fit
+static const size_t READ_CHUNK = 64 * 1024;
+
+LineReader::LineReader(int fd) : fd_(fd), buffer_(READ_CHUNK), start_(0), end_(0), eof_(false)
+{
+}
+
+bool LineReader::read_line(std::string &line)
+{
+  size_t scan_from = start_;
+
+  while (true)
+  {
+    // Look for the end of the line in what is already buffered
+    const char *base = buffer_.data();
+    const void *nl = memchr(base + scan_from, '\n', end_ - scan_from);
+    if (nl != nullptr)
+    {
+      size_t nl_pos = static_cast<const char *>(nl) - base;
+      line.assign(base + start_, nl_pos - start_);
+      start_ = nl_pos + 1;
+      return true;
+    }
+
+    if (eof_)
+    {
+      // Hand out whatever is left as a final unterminated line
+      line.assign(base + start_, end_ - start_);
+      start_ = end_ = 0;
+      eof_ = false; // A terminal may deliver more input after Ctrl+D
+      return false;
+    }
+
+    // Move the partial line to the front, growing if it fills the buffer
+    if (start_ > 0)
+    {
+      memmove(buffer_.data(), buffer_.data() + start_, end_ - start_);
+      end_ -= start_;
+      start_ = 0;
+    }
+    if (end_ == buffer_.size())
+    {
+      buffer_.resize(buffer_.size() * 2);
+    }
+    scan_from = end_;
+
+    ssize_t n = read(fd_, buffer_.data() + end_, buffer_.size() - end_);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n <= 0)
+    {
+      eof_ = true;
+      continue;
+    }
+    end_ += n;
+  }
+}
+
+void LineReader::release()
+{
+  if (end_ == start_)
+  {
+    start_ = end_ = 0;
+    return;
+  }
+
+  off_t unread = static_cast<off_t>(end_ - start_);
+  if (lseek(fd_, -unread, SEEK_CUR) >= 0)
+  {
+    start_ = end_ = 0;
+    eof_ = false;
+  }
+}
+
+void LineReader::reset()
+{
+  start_ = end_ = 0;
+  eof_ = false;
+}
+
+// Shared readers, one per descriptor
+static std::map<int, LineReader> readers;
+
+LineReader &line_reader_for(int fd)
+{
+  auto it = readers.find(fd);
+  if (it == readers.end())
+  {
+    it = readers.emplace(fd, LineReader(fd)).first;
+  }
+  return it->second;
+}
+
+void release_line_readers()
+{
+  for (auto &entry : readers)
+  {
+    entry.second.release();
+  }
+}
+
+void reset_line_readers()
+{
+  for (auto &entry : readers)
+  {
+    entry.second.reset();
+  }
+}
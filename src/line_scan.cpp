@@ -0,0 +1,140 @@
+#include "include/line_scan.h"
+#include <cstring>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+// SSE2 is part of x86-64: compare each 16-byte chunk with every special
+// character
+static CharClassMasks classify_sse2(const char *text)
+{
+  CharClassMasks masks = {0, 0};
+  for (size_t offset = 0; offset < CHAR_CLASS_BLOCK; offset += 16)
+  {
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text + offset));
+    __m128i special = _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n'));
+    for (char c : {'\'', '"', '\\', '|', '<', '>', '&', ';', '$', '`'})
+    {
+      special = _mm_or_si128(special, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(c)));
+    }
+    __m128i blank = _mm_cmpeq_epi8(chunk, _mm_set1_epi8(' '));
+    masks.special |= static_cast<uint64_t>(_mm_movemask_epi8(special)) << offset;
+    masks.blank |= static_cast<uint64_t>(_mm_movemask_epi8(blank)) << offset;
+  }
+  return masks;
+}
+
+// AVX2: look both nibbles of each byte up in 16-entry tables and AND the
+// results; a byte is in a class when both nibbles agree on its bit. Bits
+// 0-5 are the special characters grouped by high nibble (0x0_, 0x2_, 0x3_,
+// 0x5_, 0x6_, 0x7_), bit 6 is the space.
+__attribute__((target("avx2"))) static CharClassMasks classify_avx2(const char *text)
+{
+  const __m256i low_table = _mm256_setr_epi8(
+      80, 0, 2, 0, 2, 0, 2, 2, 0, 0, 1, 4, 44, 0, 4, 0,
+      80, 0, 2, 0, 2, 0, 2, 2, 0, 0, 1, 4, 44, 0, 4, 0);
+  const __m256i high_table = _mm256_setr_epi8(
+      1, 0, 66, 4, 0, 8, 16, 32, 0, 0, 0, 0, 0, 0, 0, 0,
+      1, 0, 66, 4, 0, 8, 16, 32, 0, 0, 0, 0, 0, 0, 0, 0);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i special_bits = _mm256_set1_epi8(63);
+  const __m256i blank_bit = _mm256_set1_epi8(64);
+
+  CharClassMasks masks = {0, 0};
+  for (size_t offset = 0; offset < CHAR_CLASS_BLOCK; offset += 32)
+  {
+    __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(text + offset));
+    __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(chunk, nibble));
+    __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(chunk, 4), nibble));
+    __m256i classes = _mm256_and_si256(low, high);
+
+    uint32_t plain = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(classes, special_bits), _mm256_setzero_si256()));
+    uint32_t blank = _mm256_movemask_epi8(
+        _mm256_cmpeq_epi8(_mm256_and_si256(classes, blank_bit), blank_bit));
+    masks.special |= static_cast<uint64_t>(~plain) << offset;
+    masks.blank |= static_cast<uint64_t>(blank) << offset;
+  }
+  return masks;
+}
+
+static CharClassMasks (*select_classifier())(const char *)
+{
+  __builtin_cpu_init(); // Runs during static initialization
+  return __builtin_cpu_supports("avx2") ? classify_avx2 : classify_sse2;
+}
+
+#else
+
+// Class bits of each byte for the scalar classifier
+static const unsigned char CLASS_SPECIAL = 1;
+static const unsigned char CLASS_BLANK = 2;
+
+struct ClassTable
+{
+  unsigned char classes[256] = {};
+
+  constexpr ClassTable()
+  {
+    for (unsigned char c : std::string_view("'\"\\|<>&;$`\n"))
+    {
+      classes[c] = CLASS_SPECIAL;
+    }
+    classes[static_cast<unsigned char>(' ')] = CLASS_BLANK;
+  }
+};
+static constexpr ClassTable class_table;
+
+static CharClassMasks classify_scalar(const char *text)
+{
+  CharClassMasks masks = {0, 0};
+  for (size_t i = 0; i < CHAR_CLASS_BLOCK; i++)
+  {
+    unsigned char classes = class_table.classes[static_cast<unsigned char>(text[i])];
+    masks.special |= static_cast<uint64_t>(classes & CLASS_SPECIAL) << i;
+    masks.blank |= static_cast<uint64_t>((classes & CLASS_BLANK) >> 1) << i;
+  }
+  return masks;
+}
+
+static CharClassMasks (*select_classifier())(const char *)
+{
+  return classify_scalar;
+}
+
+#endif
+
+static CharClassMasks (*const classify_full_block)(const char *) = select_classifier();
+
+CharClassMasks classify_block(const char *text, size_t length)
+{
+  if (length >= CHAR_CLASS_BLOCK)
+  {
+    return classify_full_block(text);
+  }
+
+  // Short tail: classify a zero-padded copy (NUL is in no class)
+  char padded[CHAR_CLASS_BLOCK] = {};
+  memcpy(padded, text, length);
+  return classify_full_block(padded);
+}
+
+size_t MetacharacterScanner::next(size_t pos)
+{
+  while (pos < text_.length())
+  {
+    if (block_start_ == std::string_view::npos || pos < block_start_ ||
+        pos >= block_start_ + CHAR_CLASS_BLOCK)
+    {
+      block_start_ = pos;
+      special_ = classify_block(text_.data() + pos, text_.length() - pos).special;
+    }
+    uint64_t ahead = special_ >> (pos - block_start_);
+    if (ahead != 0)
+    {
+      return pos + __builtin_ctzll(ahead);
+    }
+    pos = block_start_ + CHAR_CLASS_BLOCK;
+  }
+  return std::string_view::npos;
+}
@@ -1,46 +1,65 @@
 #include "include/path_utils.h"
-#include <sstream>
+#include <cstdlib>
 #include <unistd.h>
 
-std::vector<std::string> split_path(const std::string &path_env)
+std::pmr::vector<std::string_view> split_path(std::string_view path_env, std::pmr::memory_resource *mem)
 {
-  std::vector<std::string> paths;
-  std::stringstream ss(path_env);
-  std::string dir;
+  std::pmr::vector<std::string_view> paths(mem);
 
-  while (std::getline(ss, dir, ':'))
+  size_t start = 0;
+  while (start <= path_env.length())
   { // Split by ':' on Linux
-    if (!dir.empty())
+    size_t end = path_env.find(':', start);
+    if (end == std::string_view::npos)
     {
-      paths.push_back(dir);
+      end = path_env.length();
     }
+    if (end > start)
+    {
+      paths.push_back(path_env.substr(start, end - start));
+    }
+    start = end + 1;
   }
   return paths;
 }
 
-bool is_executable(const std::string &filepath)
+bool is_executable(const char *filepath)
 {
-  return access(filepath.c_str(), X_OK) == 0;
+  return access(filepath, X_OK) == 0;
 }
 
-std::string find_in_path(const std::string &program)
+std::pmr::string find_in_path(std::string_view program, std::pmr::memory_resource *mem)
 {
+  // Names containing a slash are paths, not PATH lookups
+  if (program.find('/') != std::string_view::npos)
+  {
+    std::pmr::string full_path(program, mem);
+    if (is_executable(full_path.c_str()))
+    {
+      return full_path;
+    }
+    return std::pmr::string(mem);
+  }
+
   const char *path_env = std::getenv("PATH");
   if (path_env == nullptr)
   {
-    return "";
+    return std::pmr::string(mem);
   }
 
-  std::vector<std::string> paths = split_path(path_env);
+  std::pmr::vector<std::string_view> paths = split_path(path_env, mem);
 
-  for (const std::string &dir : paths)
+  std::pmr::string full_path(mem);
+  for (std::string_view dir : paths)
   {
-    std::string full_path = dir + "/" + program;
-    if (is_executable(full_path))
+    full_path.assign(dir);
+    full_path += '/';
+    full_path += program;
+    if (is_executable(full_path.c_str()))
     {
       return full_path;
     }
   }
 
-  return ""; // Not found
+  return std::pmr::string(mem); // Not found
 }
@@ -0,0 +1,194 @@
+#include "include/plugins.h"
+#include "include/shell_plugin.h"
+#include "include/builtin_registry.h"
+#include "include/line_reader.h"
+#include "include/variables.h"
+#include <iostream>
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <unordered_map>
+#include <dlfcn.h>
+#include <unistd.h>
+
+struct PluginBuiltin
+{
+  shell_builtin_fn run;
+  std::string plugin; // Path it was loaded from
+};
+
+// Loaded builtins by name; all of them share one registry entry point
+static std::unordered_map<std::string, PluginBuiltin> plugin_builtins;
+
+// Plugins already opened, by path, so loading one twice registers from the
+// same handle
+static std::unordered_map<std::string, const shell_plugin_info *> loaded_plugins;
+
+static const char *host_get_variable(const char *name)
+{
+  static std::string value;
+  value = get_variable(name);
+  return value.c_str();
+}
+
+static int host_set_variable(const char *name, const char *value)
+{
+  if (!is_valid_variable_name(name))
+  {
+    return -1;
+  }
+  set_variable(name, value);
+  return 0;
+}
+
+static const shell_plugin_host plugin_host = {
+    SHELL_PLUGIN_ABI_VERSION,
+    sizeof(shell_plugin_host),
+    host_get_variable,
+    host_set_variable,
+};
+
+// Registry entry point of every plugin builtin: dispatch on the name
+static int run_plugin_builtin(const ArgList &args, ShellContext &ctx)
+{
+  (void)ctx;
+
+  auto it = plugin_builtins.find(std::string(args[0]));
+  if (it == plugin_builtins.end())
+  {
+    return 127;
+  }
+
+  std::vector<char *> argv;
+  for (const auto &arg : args)
+  {
+    argv.push_back(const_cast<char *>(arg.c_str()));
+  }
+  argv.push_back(nullptr);
+
+  // The plugin reads and writes the descriptors directly
+  release_line_readers();
+  std::cout.flush();
+  std::cerr.flush();
+  return it->second.run(static_cast<int>(args.size()), argv.data(), STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO);
+}
+
+// Resolve a plugin name through $SHELL_PLUGIN_PATH
+static std::string find_plugin(const std::string &path)
+{
+  if (path.find('/') != std::string::npos)
+  {
+    return path;
+  }
+
+  std::string dirs(peek_variable("SHELL_PLUGIN_PATH"));
+  size_t start = 0;
+  while (start <= dirs.size() && !dirs.empty())
+  {
+    size_t end = dirs.find(':', start);
+    std::string dir = dirs.substr(start, end == std::string::npos ? std::string::npos : end - start);
+    std::string candidate = (dir.empty() ? "." : dir) + "/" + path;
+    if (access(candidate.c_str(), R_OK) == 0)
+    {
+      return candidate;
+    }
+    if (end == std::string::npos)
+    {
+      break;
+    }
+    start = end + 1;
+  }
+  return path; // Let dlopen() search its default paths
+}
+
+bool load_plugin(const std::string &path, const std::vector<std::string> &names, std::string &error)
+{
+  std::string resolved = find_plugin(path);
+  const shell_plugin_info *info;
+
+  auto loaded = loaded_plugins.find(resolved);
+  if (loaded != loaded_plugins.end())
+  {
+    info = loaded->second;
+  }
+  else
+  {
+    // RTLD_LOCAL: plugins cannot clash with each other's symbols. The handle
+    // is never closed; registered builtins point into it.
+    void *handle = dlopen(resolved.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr)
+    {
+      error = dlerror();
+      return false;
+    }
+    using InitFunction = const shell_plugin_info *(*)(const shell_plugin_host *);
+    auto init = reinterpret_cast<InitFunction>(dlsym(handle, "shell_plugin_init"));
+    if (init == nullptr)
+    {
+      error = resolved + ": not a shell plugin (no shell_plugin_init)";
+      dlclose(handle);
+      return false;
+    }
+    info = init(&plugin_host);
+    if (info == nullptr || info->abi_version != SHELL_PLUGIN_ABI_VERSION || info->builtins == nullptr ||
+        info->builtin_def_size < offsetof(shell_builtin_def, complete))
+    {
+      error = resolved + ": incompatible plugin ABI version";
+      dlclose(handle);
+      return false;
+    }
+    loaded_plugins[resolved] = info;
+  }
+
+  // Register the requested builtins; the rest of the plugin stays unused
+  std::vector<std::string> missing = names;
+  bool any = false;
+  // Entries are builtin_def_size bytes apart: a plugin built against an
+  // older or newer header has fewer or more fields than ours
+  const char *entry_data = reinterpret_cast<const char *>(info->builtins);
+  for (;; entry_data += info->builtin_def_size)
+  {
+    shell_builtin_def def = {};
+    memcpy(&def, entry_data, std::min<size_t>(info->builtin_def_size, sizeof(def)));
+    if (def.name == nullptr)
+    {
+      break;
+    }
+    auto request = std::find(missing.begin(), missing.end(), def.name);
+    if (def.run == nullptr || (!names.empty() && request == missing.end()))
+    {
+      continue;
+    }
+    if (request != missing.end())
+    {
+      missing.erase(request);
+    }
+
+    BuiltinInfo entry = {def.name, run_plugin_builtin,
+                         (def.flags & SHELL_BUILTIN_NOT_IN_PIPELINE) ? 0u : unsigned(BUILTIN_PIPELINE_SAFE),
+                         def.complete};
+    if (!register_builtin(entry))
+    {
+      error += std::string(error.empty() ? "" : "; ") + def.name + ": a builtin with that name already exists";
+      continue;
+    }
+    plugin_builtins[def.name] = PluginBuiltin{def.run, resolved};
+    any = true;
+  }
+
+  for (const auto &name : missing)
+  {
+    error += (error.empty() ? "" : "; ") + name + ": not defined by " + resolved;
+  }
+  if (!any && error.empty())
+  {
+    error = resolved + ": defines no builtins";
+  }
+  return error.empty();
+}
+
+const std::string *plugin_for_builtin(const std::string &name)
+{
+  auto it = plugin_builtins.find(name);
+  return it == plugin_builtins.end() ? nullptr : &it->second.plugin;
+}
@@ -0,0 +1,601 @@
+#include "include/process_profile.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <unordered_map>
+#include <unordered_set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+// Descendants the profiler did not reap are looked at this often. Start
+// times in /proc have clock tick (usually 10 ms) resolution anyway.
+static const long SAMPLE_INTERVAL_NS = 10 * 1000 * 1000;
+
+// Microseconds on the clock /proc start times are measured against
+static long long boot_clock_us()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_BOOTTIME, &ts);
+  return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static long long timeval_us(const struct timeval &tv)
+{
+  return tv.tv_sec * 1000000LL + tv.tv_usec;
+}
+
+// Read a small /proc file in one go
+static bool read_proc_file(const char *path, std::string &data)
+{
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  data.clear();
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0 || (n < 0 && errno == EINTR))
+  {
+    if (n > 0)
+    {
+      data.append(buffer, n);
+    }
+  }
+  close(fd);
+  return n == 0;
+}
+
+// Fields of /proc/PID/stat the profiler uses
+struct ProcStat
+{
+  std::string comm;
+  char state;
+  pid_t ppid;
+  unsigned long long utime, stime;   // Clock ticks, the process itself
+  unsigned long long cutime, cstime; // Clock ticks, its waited-for children
+  long threads;
+  unsigned long long starttime; // Clock ticks after boot
+};
+
+static bool read_stat(pid_t pid, ProcStat &st)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+  std::string data;
+  if (!read_proc_file(path, data))
+  {
+    return false;
+  }
+
+  // comm may contain spaces and parentheses: it ends at the last ')'
+  size_t open_paren = data.find('(');
+  size_t close_paren = data.rfind(')');
+  if (open_paren == std::string::npos || close_paren == std::string::npos || close_paren < open_paren)
+  {
+    return false;
+  }
+  st.comm = data.substr(open_paren + 1, close_paren - open_paren - 1);
+
+  // Fields 3 onwards: state ppid pgrp session tty_nr tpgid flags minflt
+  // cminflt majflt cmajflt utime stime cutime cstime priority nice
+  // num_threads itrealvalue starttime
+  int ppid;
+  if (sscanf(data.c_str() + close_paren + 1,
+             " %c %d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %llu %llu %*d %*d %ld %*d %llu",
+             &st.state, &ppid, &st.utime, &st.stime, &st.cutime, &st.cstime, &st.threads,
+             &st.starttime) != 8)
+  {
+    return false;
+  }
+  st.ppid = ppid;
+  return true;
+}
+
+// Command line with the NUL separators turned into spaces
+static std::string read_cmdline(pid_t pid)
+{
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/cmdline", pid);
+  std::string data;
+  read_proc_file(path, data);
+  while (!data.empty() && data.back() == '\0')
+  {
+    data.pop_back();
+  }
+  std::replace(data.begin(), data.end(), '\0', ' ');
+  return data;
+}
+
+// Append the children of every thread of pid
+static void read_children(pid_t pid, long threads, std::vector<pid_t> &children)
+{
+  std::vector<pid_t> tids;
+  if (threads <= 1)
+  {
+    tids.push_back(pid);
+  }
+  else
+  {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task", pid);
+    DIR *dir = opendir(path);
+    if (dir == nullptr)
+    {
+      return;
+    }
+    while (struct dirent *entry = readdir(dir))
+    {
+      if (entry->d_name[0] != '.')
+      {
+        tids.push_back(static_cast<pid_t>(atoi(entry->d_name)));
+      }
+    }
+    closedir(dir);
+  }
+
+  std::string data;
+  for (pid_t tid : tids)
+  {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/task/%d/children", pid, tid);
+    if (!read_proc_file(path, data))
+    {
+      continue;
+    }
+    const char *p = data.c_str();
+    char *end;
+    for (long child = strtol(p, &end, 10); end != p; child = strtol(p, &end, 10))
+    {
+      children.push_back(static_cast<pid_t>(child));
+      p = end;
+    }
+  }
+}
+
+// A process that has been seen alive and not yet reaped or gone
+struct LiveProcess
+{
+  size_t index;                  // Into the process list
+  unsigned long long starttime;  // Tells a reused PID apart
+  long long children_user;       // Waited-for children's CPU at the last
+  long long children_system;     // sample, to get self time from wait4
+};
+
+// State of one profile_descendants() run
+class DescendantTracker
+{
+public:
+  explicit DescendantTracker(std::vector<ProfiledProcess> &processes)
+      : processes_(processes), origin_(boot_clock_us()), tick_us_(1000000 / sysconf(_SC_CLK_TCK))
+  {
+  }
+
+  long long elapsed() const { return boot_clock_us() - origin_; }
+
+  // Record the command as soon as it is forked, at time 0
+  void add_command(pid_t pid)
+  {
+    ProcStat st;
+    bool known = read_stat(pid, st);
+    ProfiledProcess process;
+    process.pid = pid;
+    process.ppid = getpid();
+    process.name = known ? st.comm : "?";
+    process.command = known ? read_cmdline(pid) : "";
+    live_.emplace(pid, LiveProcess{processes_.size(), known ? st.starttime : 0, 0, 0});
+    processes_.push_back(process);
+  }
+
+  // Reap every child that has exited. Returns false once there are none
+  // left at all.
+  bool reap(pid_t command, int &command_status, bool &command_done)
+  {
+    for (;;)
+    {
+      // Look at the exited child before reaping it: its zombie still has
+      // its own CPU times, which wait4 only reports added to its children's
+      siginfo_t info;
+      info.si_pid = 0;
+      if (waitid(P_ALL, 0, &info, WEXITED | WNOHANG | WNOWAIT) < 0)
+      {
+        if (errno == EINTR)
+        {
+          continue;
+        }
+        return false;
+      }
+      if (info.si_pid == 0)
+      {
+        return true;
+      }
+      pid_t pid = info.si_pid;
+      ProcStat st;
+      bool known = read_stat(pid, st);
+
+      int status;
+      struct rusage usage;
+      if (wait4(pid, &status, 0, &usage) < 0)
+      {
+        continue;
+      }
+
+      long long now = elapsed();
+      auto it = live_.find(pid);
+      LiveProcess seen{0, 0, 0, 0};
+      if (it != live_.end())
+      {
+        seen = it->second;
+        live_.erase(it);
+      }
+      else
+      {
+        // Orphan that started and exited between samples
+        ProfiledProcess process;
+        process.pid = pid;
+        process.ppid = 0;
+        process.name = known ? st.comm : "?";
+        process.start = std::min(last_sample_, now);
+        seen.index = processes_.size();
+        processes_.push_back(process);
+      }
+
+      ProfiledProcess &process = processes_[seen.index];
+      process.end = now;
+      process.status = status;
+      process.reaped = true;
+      if (known)
+      {
+        process.user = st.utime * tick_us_;
+        process.system = st.stime * tick_us_;
+      }
+      else
+      {
+        // wait4 counts the process and its waited-for children together
+        process.user = std::max(process.user, timeval_us(usage.ru_utime) - seen.children_user);
+        process.system = std::max(process.system, timeval_us(usage.ru_stime) - seen.children_system);
+      }
+      process.max_rss = usage.ru_maxrss;
+      if (pid == command)
+      {
+        command_status = status;
+        command_done = true;
+      }
+    }
+  }
+
+  // Walk the process tree below us through /proc
+  void sample()
+  {
+    long long now = elapsed();
+    std::unordered_set<pid_t> seen;
+    std::vector<pid_t> queue;
+    read_children(getpid(), 1, queue);
+    while (!queue.empty())
+    {
+      pid_t pid = queue.back();
+      queue.pop_back();
+      ProcStat st;
+      if (!seen.insert(pid).second || !read_stat(pid, st))
+      {
+        continue;
+      }
+
+      auto it = live_.find(pid);
+      if (it != live_.end() && it->second.starttime != st.starttime)
+      {
+        finish(it->second, now); // The PID was reused
+        live_.erase(it);
+        it = live_.end();
+      }
+      if (it == live_.end())
+      {
+        it = live_.emplace(pid, LiveProcess{processes_.size(), st.starttime, 0, 0}).first;
+        processes_.push_back(new_process(pid, st, now));
+      }
+      else if (processes_[it->second.index].name != st.comm)
+      {
+        processes_[it->second.index].name = st.comm; // It ran exec
+        processes_[it->second.index].command = read_cmdline(pid);
+      }
+
+      ProfiledProcess &process = processes_[it->second.index];
+      process.user = st.utime * tick_us_;
+      process.system = st.stime * tick_us_;
+      it->second.children_user = st.cutime * tick_us_;
+      it->second.children_system = st.cstime * tick_us_;
+      if (st.state == 'Z')
+      {
+        if (process.end < 0)
+        {
+          process.end = now; // Exited; its parent has not reaped it yet
+        }
+        continue;
+      }
+      read_children(pid, st.threads, queue);
+    }
+
+    // Processes that are gone were reaped by their parents
+    for (auto it = live_.begin(); it != live_.end();)
+    {
+      if (seen.count(it->first) == 0)
+      {
+        finish(it->second, now);
+        it = live_.erase(it);
+      }
+      else
+      {
+        ++it;
+      }
+    }
+    last_sample_ = now;
+  }
+
+private:
+  ProfiledProcess new_process(pid_t pid, const ProcStat &st, long long now)
+  {
+    ProfiledProcess process;
+    process.pid = pid;
+    process.ppid = st.ppid;
+    process.name = st.comm;
+    process.command = read_cmdline(pid);
+
+    // The start time has clock tick resolution: keep it between the
+    // parent's start and the moment we first saw the process
+    long long started = static_cast<long long>(st.starttime) * tick_us_ - origin_;
+    auto parent = live_.find(st.ppid);
+    long long earliest = parent != live_.end() ? processes_[parent->second.index].start : 0;
+    process.start = std::max(earliest, std::min(started, now));
+    return process;
+  }
+
+  void finish(const LiveProcess &seen, long long now)
+  {
+    ProfiledProcess &process = processes_[seen.index];
+    if (process.end < 0)
+    {
+      process.end = now;
+    }
+  }
+
+  std::vector<ProfiledProcess> &processes_;
+  std::unordered_map<pid_t, LiveProcess> live_;
+  long long origin_;  // Boot clock at the start, in microseconds
+  long long tick_us_; // Length of a clock tick
+  long long last_sample_ = 0;
+};
+
+int profile_descendants(pid_t child, std::vector<ProfiledProcess> &processes)
+{
+  DescendantTracker tracker(processes);
+  tracker.add_command(child);
+
+  sigset_t wake;
+  sigemptyset(&wake);
+  sigaddset(&wake, SIGCHLD);
+  sigaddset(&wake, SIGINT);
+  sigaddset(&wake, SIGQUIT);
+
+  int status = 0;
+  bool command_done = false;
+  bool interrupted = false;
+  while (tracker.reap(child, status, command_done) && !(interrupted && command_done))
+  {
+    tracker.sample();
+    struct timespec interval = {0, SAMPLE_INTERVAL_NS};
+    int signo = sigtimedwait(&wake, nullptr, &interval);
+    if (signo == SIGINT || signo == SIGQUIT)
+    {
+      interrupted = true;
+    }
+  }
+
+  // Descendants that exited since the last sample
+  tracker.sample();
+  return status;
+}
+
+// For each process, the index of its parent's record (or -1): the latest
+// earlier record with the parent's PID
+static std::vector<long> parent_indexes(const std::vector<ProfiledProcess> &processes)
+{
+  std::vector<long> parents(processes.size(), -1);
+  std::unordered_map<pid_t, long> latest;
+  for (size_t i = 0; i < processes.size(); i++)
+  {
+    auto it = latest.find(processes[i].ppid);
+    if (it != latest.end())
+    {
+      parents[i] = it->second;
+    }
+    latest[processes[i].pid] = static_cast<long>(i);
+  }
+  return parents;
+}
+
+static void write_json_string(std::ostream &out, const std::string &text)
+{
+  out << '"';
+  for (unsigned char c : text)
+  {
+    if (c == '"' || c == '\\')
+    {
+      out << '\\' << c;
+    }
+    else if (c < 0x20)
+    {
+      char escaped[8];
+      snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+      out << escaped;
+    }
+    else
+    {
+      out << c;
+    }
+  }
+  out << '"';
+}
+
+static long long profile_end(const std::vector<ProfiledProcess> &processes)
+{
+  long long end = 0;
+  for (const auto &process : processes)
+  {
+    end = std::max({end, process.start, process.end});
+  }
+  return end;
+}
+
+// One track per process, ordered like the process tree
+static void write_chrome_trace(std::ostream &out, const std::vector<ProfiledProcess> &processes)
+{
+  std::vector<long> parents = parent_indexes(processes);
+  std::vector<std::vector<size_t>> children(processes.size());
+  std::vector<size_t> order;
+  std::vector<size_t> stack;
+  for (size_t i = processes.size(); i-- > 0;)
+  {
+    if (parents[i] >= 0)
+    {
+      children[parents[i]].push_back(i);
+    }
+    else
+    {
+      stack.push_back(i);
+    }
+  }
+  while (!stack.empty())
+  {
+    size_t i = stack.back();
+    stack.pop_back();
+    order.push_back(i);
+    stack.insert(stack.end(), children[i].begin(), children[i].end());
+  }
+
+  long long end = profile_end(processes);
+  out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+  out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":";
+  write_json_string(out, "profile: " + (processes.empty() ? std::string() : processes[0].command));
+  out << "}}";
+  for (size_t rank = 0; rank < order.size(); rank++)
+  {
+    const ProfiledProcess &p = processes[order[rank]];
+    out << ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << p.pid << ",\"args\":{\"name\":";
+    write_json_string(out, std::to_string(p.pid) + " " + p.name);
+    out << "}}";
+    out << ",\n{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":1,\"tid\":" << p.pid
+        << ",\"args\":{\"sort_index\":" << rank << "}}";
+    out << ",\n{\"name\":";
+    write_json_string(out, p.name);
+    out << ",\"cat\":\"process\",\"ph\":\"X\",\"pid\":1,\"tid\":" << p.pid << ",\"ts\":" << p.start
+        << ",\"dur\":" << (p.end >= 0 ? p.end : end) - p.start << ",\"args\":{\"command\":";
+    write_json_string(out, p.command);
+    out << ",\"ppid\":" << p.ppid << ",\"user_ms\":" << p.user / 1000.0 << ",\"system_ms\":" << p.system / 1000.0;
+    if (p.reaped)
+    {
+      out << ",\"max_rss_kb\":" << p.max_rss << ",\"exit\":"
+          << (WIFSIGNALED(p.status) ? 128 + WTERMSIG(p.status) : WEXITSTATUS(p.status));
+    }
+    if (p.end < 0)
+    {
+      out << ",\"running\":true";
+    }
+    out << "}}";
+  }
+  out << "\n]}\n";
+}
+
+// "root;child;grandchild CPU-microseconds" for every process that used CPU
+static void write_folded(std::ostream &out, const std::vector<ProfiledProcess> &processes)
+{
+  std::vector<long> parents = parent_indexes(processes);
+  for (size_t i = 0; i < processes.size(); i++)
+  {
+    long long cpu = processes[i].user + processes[i].system;
+    if (cpu <= 0)
+    {
+      continue;
+    }
+    std::vector<std::string> frames;
+    for (long j = static_cast<long>(i); j >= 0; j = parents[j])
+    {
+      std::string name = processes[j].name;
+      std::replace(name.begin(), name.end(), ';', '_');
+      std::replace(name.begin(), name.end(), ' ', '_');
+      frames.push_back(name);
+    }
+    for (size_t f = frames.size(); f-- > 0;)
+    {
+      out << frames[f] << (f > 0 ? ";" : " ");
+    }
+    out << cpu << '\n';
+  }
+}
+
+bool write_profile(const std::string &path, ProfileFormat format,
+                   const std::vector<ProfiledProcess> &processes)
+{
+  std::ofstream out(path, std::ios::trunc);
+  if (!out)
+  {
+    return false;
+  }
+  if (format == ProfileFormat::CHROME)
+  {
+    write_chrome_trace(out, processes);
+  }
+  else
+  {
+    write_folded(out, processes);
+  }
+  out.close();
+  return !out.fail();
+}
+
+void print_profile_summary(std::ostream &out, const std::vector<ProfiledProcess> &processes, size_t top)
+{
+  long long end = profile_end(processes);
+  long long cpu = 0;
+  for (const auto &process : processes)
+  {
+    cpu += process.user + process.system;
+  }
+  out << "profile: " << processes.size() << (processes.size() == 1 ? " process, " : " processes, ") << std::fixed << std::setprecision(1)
+      << end / 1000.0 << " ms wall, " << cpu / 1000.0 << " ms CPU" << std::endl;
+
+  std::vector<const ProfiledProcess *> longest;
+  for (const auto &process : processes)
+  {
+    longest.push_back(&process);
+  }
+  auto duration = [end](const ProfiledProcess *p)
+  { return (p->end >= 0 ? p->end : end) - p->start; };
+  std::stable_sort(longest.begin(), longest.end(),
+                   [&](const ProfiledProcess *a, const ProfiledProcess *b)
+                   { return duration(a) > duration(b); });
+  if (longest.size() > top)
+  {
+    longest.resize(top);
+  }
+
+  out << "  " << std::setw(10) << "wall ms" << std::setw(10) << "cpu ms" << std::setw(8) << "pid" << "  command" << std::endl;
+  for (const ProfiledProcess *p : longest)
+  {
+    std::string command = p->command.empty() ? p->name : p->command;
+    if (command.size() > 60)
+    {
+      command = command.substr(0, 57) + "...";
+    }
+    out << "  " << std::setw(10) << duration(p) / 1000.0 << std::setw(10) << (p->user + p->system) / 1000.0
+        << std::setw(8) << p->pid << "  " << command << std::endl;
+  }
+  out << std::defaultfloat;
+}
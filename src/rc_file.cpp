@@ -0,0 +1,392 @@
+#include "include/rc_file.h"
+#include "include/variables.h"
+#include "include/functions.h"
+#include "include/command_index.h"
+#include "include/builtin_registry.h"
+#include "include/job_limits.h"
+#include "include/plugins.h"
+#include <iostream>
+#include <cstring>
+#include <cstdint>
+#include <cstdlib>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+extern char **environ;
+
+// Snapshot layout: a SnapshotHeader followed by records of the form
+// { uint8 type, uint32 length, bytes, uint32 length, bytes }
+static const char SNAPSHOT_MAGIC[8] = {'S', 'H', 'S', 'N', 'A', 'P', '0', '1'};
+
+struct SnapshotHeader
+{
+  char magic[8];
+  uint64_t key;          // Hash of the config path and inherited environment
+  int64_t rc_mtime_sec;  // Config file identity
+  int64_t rc_mtime_nsec;
+  uint64_t rc_size;
+  uint64_t rc_inode;
+};
+
+enum RecordType : uint8_t
+{
+  RECORD_VARIABLE,   // name, value
+  RECORD_EXPORT,     // name, value
+  RECORD_UNSET,      // name, ""
+  RECORD_ALIAS,      // name, value
+  RECORD_FUNCTION,   // name, body source
+  RECORD_INDEX_PATH, // "", PATH the index was built from
+  RECORD_INDEX_DIR,  // directory, struct timespec
+  RECORD_INDEX_NAME, // executable name, ""
+  RECORD_OPTION      // option name, "on" or "off"
+};
+
+struct Record
+{
+  RecordType type;
+  std::string_view first;
+  std::string_view second;
+};
+
+// Variables that differ between otherwise identical launches; they do not
+// invalidate the snapshot
+static bool is_volatile_variable(std::string_view entry)
+{
+  std::string_view name = entry.substr(0, entry.find('='));
+  return name == "PWD" || name == "OLDPWD" || name == "SHLVL" || name == "_";
+}
+
+static uint64_t fnv1a_64(uint64_t hash, std::string_view data)
+{
+  for (char c : data)
+  {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+static uint64_t snapshot_key(const std::string &path)
+{
+  uint64_t hash = fnv1a_64(14695981039346656037ull, path);
+  for (char **env = environ; *env != nullptr; env++)
+  {
+    if (!is_volatile_variable(*env))
+    {
+      hash = fnv1a_64(hash, *env);
+      hash = fnv1a_64(hash, std::string_view("\0", 1));
+    }
+  }
+  return hash;
+}
+
+static void fill_file_identity(SnapshotHeader &header, const struct stat &st)
+{
+  header.rc_mtime_sec = st.st_mtim.tv_sec;
+  header.rc_mtime_nsec = st.st_mtim.tv_nsec;
+  header.rc_size = st.st_size;
+  header.rc_inode = st.st_ino;
+}
+
+// Parse the mapped snapshot; fails on any mismatch or truncation
+static bool parse_snapshot(const char *data, size_t size, const SnapshotHeader &expected,
+                           std::vector<Record> &records)
+{
+  if (size < sizeof(SnapshotHeader))
+  {
+    return false;
+  }
+  SnapshotHeader header;
+  memcpy(&header, data, sizeof(header));
+  if (memcmp(&header, &expected, sizeof(header)) != 0)
+  {
+    return false;
+  }
+
+  size_t pos = sizeof(SnapshotHeader);
+  auto read_field = [&](std::string_view &field)
+  {
+    uint32_t length;
+    if (size - pos < sizeof(length))
+    {
+      return false;
+    }
+    memcpy(&length, data + pos, sizeof(length));
+    pos += sizeof(length);
+    if (size - pos < length)
+    {
+      return false;
+    }
+    field = std::string_view(data + pos, length);
+    pos += length;
+    return true;
+  };
+
+  while (pos < size)
+  {
+    Record record;
+    uint8_t type = static_cast<uint8_t>(data[pos++]);
+    if (type > RECORD_OPTION || !read_field(record.first) || !read_field(record.second))
+    {
+      return false;
+    }
+    record.type = static_cast<RecordType>(type);
+    records.push_back(record);
+  }
+  return true;
+}
+
+static bool restore_snapshot(const std::string &snapshot_path, const SnapshotHeader &expected,
+                             ShellContext &ctx)
+{
+  int fd = open(snapshot_path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+  size_t size = st.st_size;
+  void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+  {
+    return false;
+  }
+
+  // Validate everything before changing any state
+  std::vector<Record> records;
+  if (!parse_snapshot(static_cast<const char *>(map), size, expected, records))
+  {
+    munmap(map, size);
+    return false;
+  }
+
+  std::string index_path;
+  std::vector<IndexedDir> index_dirs;
+  std::vector<std::string> index_names;
+  for (const Record &record : records)
+  {
+    std::string name(record.first);
+    switch (record.type)
+    {
+    case RECORD_VARIABLE:
+      set_variable(name, std::string(record.second));
+      break;
+    case RECORD_EXPORT:
+      set_variable(name, std::string(record.second));
+      export_variable(name);
+      break;
+    case RECORD_UNSET:
+      unset_variable(name);
+      break;
+    case RECORD_ALIAS:
+      set_alias(name, record.second);
+      break;
+    case RECORD_FUNCTION:
+      // ASTs point into their source text, so bodies are stored as text
+      // and parsed once here
+      execute_script(name + "() {\n" + std::string(record.second) + "\n}", ctx);
+      break;
+    case RECORD_INDEX_PATH:
+      index_path = record.second;
+      break;
+    case RECORD_INDEX_DIR:
+    {
+      IndexedDir dir{name, {0, 0}};
+      if (record.second.size() == sizeof(dir.mtime))
+      {
+        memcpy(&dir.mtime, record.second.data(), sizeof(dir.mtime));
+      }
+      index_dirs.push_back(dir);
+      break;
+    }
+    case RECORD_INDEX_NAME:
+      index_names.push_back(name);
+      break;
+    case RECORD_OPTION:
+      set_shell_option(name, record.second == "on");
+      break;
+    }
+  }
+  munmap(map, size);
+
+  if (!index_names.empty())
+  {
+    restore_command_index(index_path, std::move(index_dirs), std::move(index_names));
+  }
+  return true;
+}
+
+// State the snapshot has no records for: job limits and scheduling settings
+// (ulimit, limit, sched) and loaded plugins (enable -f)
+static bool has_unrecorded_state()
+{
+  if (job_limits_active())
+  {
+    return true;
+  }
+  for (const BuiltinInfo *info : list_builtins())
+  {
+    if (plugin_for_builtin(info->name) != nullptr)
+    {
+      return true;
+    }
+  }
+  return false;
+}
+
+static void add_record(std::string &out, RecordType type, std::string_view first, std::string_view second)
+{
+  out += static_cast<char>(type);
+  for (std::string_view field : {first, second})
+  {
+    uint32_t length = field.size();
+    out.append(reinterpret_cast<const char *>(&length), sizeof(length));
+    out.append(field.data(), field.size());
+  }
+}
+
+static void write_snapshot(const std::string &snapshot_path, const SnapshotHeader &header,
+                           const std::vector<std::string> &initial_environment)
+{
+  std::string out(reinterpret_cast<const char *>(&header), sizeof(header));
+
+  // Exported variables: record what the config file changed
+  std::unordered_set<std::string_view> initial(initial_environment.begin(), initial_environment.end());
+  std::unordered_set<std::string_view> current_names;
+  for (char **env = environ; *env != nullptr; env++)
+  {
+    std::string_view entry(*env);
+    size_t eq = entry.find('=');
+    current_names.insert(entry.substr(0, eq));
+    if (initial.count(entry) == 0 && eq != std::string_view::npos)
+    {
+      add_record(out, RECORD_EXPORT, entry.substr(0, eq), entry.substr(eq + 1));
+    }
+  }
+  for (std::string_view entry : initial_environment)
+  {
+    std::string_view name = entry.substr(0, entry.find('='));
+    if (current_names.count(name) == 0)
+    {
+      add_record(out, RECORD_UNSET, name, "");
+    }
+  }
+
+  for (const auto &variable : list_shell_variables())
+  {
+    add_record(out, RECORD_VARIABLE, variable.first, variable.second);
+  }
+  for (const auto &alias : list_aliases())
+  {
+    add_record(out, RECORD_ALIAS, alias.first, alias.second);
+  }
+  for (const auto &option : list_shell_options())
+  {
+    add_record(out, RECORD_OPTION, option.first, option.second ? "on" : "off");
+  }
+  for (const auto &name : list_functions())
+  {
+    add_record(out, RECORD_FUNCTION, name, find_function(name)->source);
+  }
+
+  // Scanning PATH is the slowest part of a cold start; save the result
+  const std::vector<std::string> &names = executable_names();
+  add_record(out, RECORD_INDEX_PATH, "", indexed_path());
+  for (const auto &dir : indexed_directories())
+  {
+    add_record(out, RECORD_INDEX_DIR, dir.path,
+               std::string_view(reinterpret_cast<const char *>(&dir.mtime), sizeof(dir.mtime)));
+  }
+  for (const auto &name : names)
+  {
+    add_record(out, RECORD_INDEX_NAME, name, "");
+  }
+
+  // Write a temporary file and rename it, so readers never see a partial
+  // snapshot
+  std::string tmp_path = snapshot_path + ".tmp." + std::to_string(getpid());
+  int fd = open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0)
+  {
+    return;
+  }
+  bool ok = write(fd, out.data(), out.size()) == static_cast<ssize_t>(out.size());
+  close(fd);
+  if (!ok || rename(tmp_path.c_str(), snapshot_path.c_str()) != 0)
+  {
+    unlink(tmp_path.c_str());
+  }
+}
+
+bool load_config(const std::string &path, const std::string &snapshot_path, ShellContext &ctx)
+{
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  struct stat st;
+  if (fd < 0 || fstat(fd, &st) != 0)
+  {
+    std::cerr << "Warning: cannot read config file " << path << std::endl;
+    if (fd >= 0)
+    {
+      close(fd);
+    }
+    return false;
+  }
+
+  SnapshotHeader header;
+  memset(&header, 0, sizeof(header));
+  if (!snapshot_path.empty())
+  {
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.key = snapshot_key(path);
+    fill_file_identity(header, st);
+
+    if (restore_snapshot(snapshot_path, header, ctx))
+    {
+      close(fd);
+      return true;
+    }
+  }
+
+  std::string source;
+  char buffer[4096];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    source.append(buffer, n);
+  }
+  close(fd);
+
+  std::vector<std::string> initial_environment;
+  if (!snapshot_path.empty())
+  {
+    for (char **env = environ; *env != nullptr; env++)
+    {
+      initial_environment.emplace_back(*env);
+    }
+  }
+
+  execute_script(source, ctx);
+
+  if (!snapshot_path.empty() && !ctx.exit_requested)
+  {
+    if (has_unrecorded_state())
+    {
+      unlink(snapshot_path.c_str()); // Restoring it would lose that state
+    }
+    else
+    {
+      write_snapshot(snapshot_path, header, initial_environment);
+    }
+  }
+  return false;
+}
@@ -0,0 +1,179 @@
+#include "include/redirection.h"
+#include "include/line_reader.h"
+#include <iostream>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Descriptors 3-9 that exec left open in the shell (bit N for descriptor N)
+static unsigned kept_descriptors = 0;
+
+SavedDescriptors::SavedDescriptors() = default;
+SavedDescriptors::~SavedDescriptors() = default;
+
+// Remember descriptor fd before it is first replaced; the copy lives above
+// 9 so later redirections of the same command cannot clobber it
+static void save_descriptor(SavedDescriptors &saved, int fd)
+{
+  if (saved.saved & (1u << fd))
+  {
+    return;
+  }
+  if (fd == STDIN_FILENO)
+  {
+    // Buffered input belongs to the old stdin: set it aside
+    release_line_readers();
+    LineReader &reader = line_reader_for(STDIN_FILENO);
+    saved.input = std::make_unique<LineReader>(reader);
+    reader.reset();
+  }
+  if (fd == STDOUT_FILENO)
+  {
+    std::cout.flush();
+  }
+  saved.copies[fd] = fcntl(fd, F_DUPFD_CLOEXEC, 10); // -1 if fd is closed
+  saved.saved |= 1u << fd;
+}
+
+static int open_target(const Redirection &redirection)
+{
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+  if (redirection.kind == Redirection::READ)
+  {
+    flags = O_RDONLY;
+  }
+  else if (redirection.kind == Redirection::APPEND)
+  {
+    flags = O_WRONLY | O_CREAT | O_APPEND;
+  }
+  return open(redirection.filename.c_str(), flags | O_CLOEXEC, 0644);
+}
+
+bool apply_redirections(const std::pmr::vector<Redirection> &redirections, SavedDescriptors *saved)
+{
+  for (const auto &redirection : redirections)
+  {
+    int fd = redirection.fd;
+    if (redirection.kind == Redirection::DUPLICATE && fcntl(redirection.source_fd, F_GETFD) < 0)
+    {
+      std::cerr << redirection.source_fd << ": Bad file descriptor" << std::endl;
+      return false;
+    }
+
+    int source = redirection.source_fd;
+    if (redirection.kind != Redirection::DUPLICATE && redirection.kind != Redirection::CLOSE)
+    {
+      source = open_target(redirection);
+      if (source < 0)
+      {
+        std::cerr << redirection.filename << ": " << strerror(errno) << std::endl;
+        return false;
+      }
+    }
+
+    if (saved != nullptr)
+    {
+      save_descriptor(*saved, fd);
+    }
+    else if (fd == STDIN_FILENO)
+    {
+      release_line_readers();
+      line_reader_for(STDIN_FILENO).reset();
+    }
+    else if (fd == STDOUT_FILENO)
+    {
+      std::cout.flush();
+    }
+
+    if (redirection.kind == Redirection::CLOSE)
+    {
+      close(fd);
+      continue;
+    }
+    if (source != fd)
+    {
+      dup2(source, fd); // The copy is inherited: dup2 clears FD_CLOEXEC
+    }
+    else
+    {
+      fcntl(fd, F_SETFD, 0); // N>&N keeps N open across exec
+    }
+    if (redirection.kind != Redirection::DUPLICATE && source != fd)
+    {
+      close(source);
+    }
+  }
+  return true;
+}
+
+void restore_redirections(SavedDescriptors &saved)
+{
+  if (saved.saved & (1u << STDOUT_FILENO))
+  {
+    std::cout.flush();
+  }
+  if (saved.input != nullptr)
+  {
+    // Hand unread input back to the redirect target (it may share its
+    // offset with another descriptor, as with exec 4<file; read x <&4)
+    LineReader &reader = line_reader_for(STDIN_FILENO);
+    reader.release();
+    reader.reset();
+  }
+  for (int fd = 0; fd < 10; fd++)
+  {
+    if (!(saved.saved & (1u << fd)))
+    {
+      continue;
+    }
+    if (saved.copies[fd] < 0)
+    {
+      close(fd);
+      continue;
+    }
+    dup2(saved.copies[fd], fd);
+    close(saved.copies[fd]);
+  }
+  if (saved.input != nullptr)
+  {
+    line_reader_for(STDIN_FILENO) = *saved.input;
+    saved.input.reset();
+  }
+  saved.saved = 0;
+}
+
+void keep_redirections(const std::pmr::vector<Redirection> &redirections)
+{
+  for (const auto &redirection : redirections)
+  {
+    if (redirection.fd <= STDERR_FILENO)
+    {
+      continue;
+    }
+    if (redirection.kind == Redirection::CLOSE)
+    {
+      kept_descriptors &= ~(1u << redirection.fd);
+    }
+    else
+    {
+      kept_descriptors |= 1u << redirection.fd;
+    }
+  }
+}
+
+bool needs_extra_descriptors(const std::pmr::vector<Redirection> &redirections)
+{
+  if (kept_descriptors != 0)
+  {
+    return true;
+  }
+  for (const auto &redirection : redirections)
+  {
+    if (redirection.fd > STDERR_FILENO)
+    {
+      return true;
+    }
+  }
+  return false;
+}
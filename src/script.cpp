@@ -0,0 +1,516 @@
+#include "include/script.h"
+#include "include/command_parser.h"
+#include "include/command_executor.h"
+#include "include/builtins.h"
+#include "include/path_utils.h"
+#include "include/variables.h"
+#include "include/arena.h"
+#include "include/command_index.h"
+#include "include/builtin_registry.h"
+#include "include/functions.h"
+#include "include/line_scan.h"
+#include "include/redirection.h"
+#include <iostream>
+#include <unistd.h>
+#include <fcntl.h>
+#include <algorithm>
+#include <cctype>
+
+// Recursive descent parser state
+struct Parser
+{
+  std::string_view src;
+  ScriptNode::allocator_type alloc;
+  size_t pos;
+  ParseStatus status;
+  std::string error;
+};
+
+static bool is_separator(char c)
+{
+  return c == ';' || c == '\n' || c == '|';
+}
+
+static void skip_blanks(Parser &p)
+{
+  while (p.pos < p.src.length() && (p.src[p.pos] == ' ' || p.src[p.pos] == '\t'))
+  {
+    p.pos++;
+  }
+}
+
+// Return the word at the current position without consuming it
+static std::string_view peek_word(const Parser &p)
+{
+  size_t end = p.pos;
+  while (end < p.src.length() && p.src[end] != ' ' && p.src[end] != '\t' && !is_separator(p.src[end]))
+  {
+    end++;
+  }
+  return p.src.substr(p.pos, end - p.pos);
+}
+
+static void fail(Parser &p, ParseStatus status, const std::string &error = "")
+{
+  if (p.status == ParseStatus::OK)
+  {
+    p.status = status;
+    p.error = error;
+  }
+}
+
+static ScriptNode parse_list(Parser &p, std::initializer_list<std::string_view> terminators);
+
+// Length of a "name()" or "name ()" function header starting at pos, or 0
+static size_t function_header_length(std::string_view src, size_t pos)
+{
+  size_t end = pos;
+  while (end < src.length() &&
+         (std::isalnum(static_cast<unsigned char>(src[end])) || src[end] == '_' || src[end] == '-'))
+  {
+    end++;
+  }
+  if (end == pos)
+  {
+    return 0;
+  }
+
+  while (end < src.length() && (src[end] == ' ' || src[end] == '\t'))
+  {
+    end++;
+  }
+  if (src.compare(end, 2, "()") != 0)
+  {
+    return 0;
+  }
+  return end + 2 - pos;
+}
+
+// Scan a simple command up to the next unquoted separator
+static ScriptNode parse_simple(Parser &p)
+{
+  ScriptNode node(p.alloc);
+  node.type = ScriptNode::SIMPLE;
+
+  size_t start = p.pos;
+  bool in_single_quote = false;
+  bool in_double_quote = false;
+  bool escaped = false;
+  bool unterminated = false; // Command substitution without its closing delimiter
+
+  MetacharacterScanner scanner(p.src);
+  for (; p.pos < p.src.length(); p.pos++)
+  {
+    if (escaped)
+    {
+      escaped = false;
+      continue;
+    }
+
+    // Only metacharacters change the state; skip the text between them
+    p.pos = scanner.next(p.pos);
+    if (p.pos == std::string_view::npos)
+    {
+      p.pos = p.src.length();
+      break;
+    }
+    char c = p.src[p.pos];
+
+    if (c == '\\' && !in_single_quote)
+    {
+      escaped = true;
+      continue;
+    }
+    if (c == '\'' && !in_double_quote)
+    {
+      in_single_quote = !in_single_quote;
+      continue;
+    }
+    if (c == '"' && !in_single_quote)
+    {
+      in_double_quote = !in_double_quote;
+      continue;
+    }
+    if (!in_single_quote && (c == '`' || p.src.compare(p.pos, 2, "$(") == 0))
+    {
+      // Separators inside a command substitution belong to it
+      size_t length = substitution_length(p.src, p.pos);
+      if (length == 0)
+      {
+        unterminated = true;
+        p.pos = p.src.length();
+        break;
+      }
+      p.pos += length - 1;
+      continue;
+    }
+    if (!in_single_quote && !in_double_quote && is_separator(c))
+    {
+      break;
+    }
+  }
+
+  if (in_single_quote || in_double_quote || escaped || unterminated)
+  {
+    fail(p, ParseStatus::INCOMPLETE);
+  }
+
+  node.text = p.src.substr(start, p.pos - start);
+  size_t last = node.text.find_last_not_of(" \t");
+  node.text = node.text.substr(0, last == std::string_view::npos ? 0 : last + 1);
+  return node;
+}
+
+// Consume an expected keyword, reporting a syntax error otherwise
+static void expect_keyword(Parser &p, std::string_view keyword)
+{
+  if (p.status != ParseStatus::OK)
+  {
+    return;
+  }
+  if (p.pos >= p.src.length())
+  {
+    fail(p, ParseStatus::INCOMPLETE);
+    return;
+  }
+  if (peek_word(p) != keyword)
+  {
+    fail(p, ParseStatus::ERROR, "syntax error: expected `" + std::string(keyword) + "'");
+    return;
+  }
+  p.pos += keyword.length();
+}
+
+static ScriptNode parse_command(Parser &p)
+{
+  skip_blanks(p);
+  size_t start = p.pos;
+  std::string_view word = peek_word(p);
+
+  if (word == "while")
+  {
+    ScriptNode node(p.alloc);
+    node.type = ScriptNode::WHILE;
+    p.pos += word.length();
+    node.children.push_back(parse_list(p, {"do"}));
+    expect_keyword(p, "do");
+    node.children.push_back(parse_list(p, {"done"}));
+    expect_keyword(p, "done");
+    node.text = p.src.substr(start, p.pos - start);
+    return node;
+  }
+
+  size_t header = function_header_length(p.src, p.pos);
+  if (header > 0)
+  {
+    ScriptNode node(p.alloc);
+    node.type = ScriptNode::FUNCTION;
+    p.pos += header;
+    while (p.pos < p.src.length() && (p.src[p.pos] == ' ' || p.src[p.pos] == '\t' || p.src[p.pos] == '\n'))
+    {
+      p.pos++;
+    }
+    expect_keyword(p, "{");
+    node.children.push_back(parse_list(p, {"}"}));
+    expect_keyword(p, "}");
+    node.text = p.src.substr(start, p.pos - start);
+    return node;
+  }
+
+  if (word == "do" || word == "done" || word == "}")
+  {
+    fail(p, ParseStatus::ERROR, "syntax error near unexpected token `" + std::string(word) + "'");
+    return ScriptNode(p.alloc);
+  }
+
+  ScriptNode node = parse_simple(p);
+  if (node.text.empty() && p.status == ParseStatus::OK)
+  {
+    std::string token = p.pos < p.src.length() ? std::string(1, p.src[p.pos]) : "newline";
+    fail(p, ParseStatus::ERROR, "syntax error near unexpected token `" + token + "'");
+  }
+  return node;
+}
+
+static ScriptNode parse_pipeline_node(Parser &p)
+{
+  ScriptNode node(p.alloc);
+  node.type = ScriptNode::PIPELINE;
+  size_t start = p.pos;
+
+  node.children.push_back(parse_command(p));
+  skip_blanks(p);
+
+  while (p.status == ParseStatus::OK && p.pos < p.src.length() && p.src[p.pos] == '|')
+  {
+    p.pos++;
+    // A line may end right after a pipe; the next stage follows on the next line
+    while (p.pos < p.src.length() && (p.src[p.pos] == ' ' || p.src[p.pos] == '\t' || p.src[p.pos] == '\n'))
+    {
+      p.pos++;
+    }
+    if (p.pos >= p.src.length())
+    {
+      fail(p, ParseStatus::INCOMPLETE);
+      break;
+    }
+    node.children.push_back(parse_command(p));
+    skip_blanks(p);
+  }
+
+  node.text = p.src.substr(start, p.pos - start);
+  return node;
+}
+
+static ScriptNode parse_list(Parser &p, std::initializer_list<std::string_view> terminators)
+{
+  ScriptNode node(p.alloc);
+  node.type = ScriptNode::LIST;
+  size_t start = p.pos;
+
+  while (p.status == ParseStatus::OK)
+  {
+    // Skip blanks and command separators
+    while (p.pos < p.src.length() &&
+           (p.src[p.pos] == ' ' || p.src[p.pos] == '\t' || p.src[p.pos] == '\n' || p.src[p.pos] == ';'))
+    {
+      p.pos++;
+    }
+
+    if (p.pos >= p.src.length())
+    {
+      if (terminators.size() > 0)
+      {
+        fail(p, ParseStatus::INCOMPLETE);
+      }
+      break;
+    }
+
+    if (std::find(terminators.begin(), terminators.end(), peek_word(p)) != terminators.end())
+    {
+      break;
+    }
+
+    node.children.push_back(parse_pipeline_node(p));
+
+    if (p.status == ParseStatus::OK && p.pos < p.src.length() &&
+        p.src[p.pos] != ';' && p.src[p.pos] != '\n')
+    {
+      fail(p, ParseStatus::ERROR, "syntax error near `" + std::string(peek_word(p)) + "'");
+    }
+  }
+
+  node.text = p.src.substr(start, p.pos - start);
+  return node;
+}
+
+ParseStatus parse_script(std::string_view source, ScriptNode &root, std::string &error)
+{
+  Parser p{source, root.children.get_allocator(), 0, ParseStatus::OK, ""};
+  root = parse_list(p, {});
+  error = p.error;
+  return p.status;
+}
+
+bool is_compound_command(std::string_view command)
+{
+  size_t start = command.find_first_not_of(" \t");
+  if (start == std::string_view::npos)
+  {
+    return false;
+  }
+  if (function_header_length(command, start) > 0)
+  {
+    return true;
+  }
+  return command.compare(start, 5, "while") == 0 &&
+         (command.length() == start + 5 || command[start + 5] == ' ' || command[start + 5] == '\t');
+}
+
+// Run a builtin or function in the shell process with its redirections
+// applied, restoring the shell's descriptors afterwards unless keep is set
+template <typename Run>
+static int run_redirected(const RedirectInfo &redir, bool keep, Run run)
+{
+  if (redir.redirections.empty())
+  {
+    return run();
+  }
+
+  if (keep)
+  {
+    if (!apply_redirections(redir.redirections, nullptr))
+    {
+      return 1;
+    }
+    keep_redirections(redir.redirections);
+    return run();
+  }
+
+  SavedDescriptors saved;
+  int status = apply_redirections(redir.redirections, &saved) ? run() : 1;
+  restore_redirections(saved);
+  return status;
+}
+
+// Run a single command: variable assignments, builtins or an external program
+static int execute_simple(const ScriptNode &node, ShellContext &ctx)
+{
+  // Parse for redirection, unless the function definition already did
+  const PreparedCommand *prepared = node.prepared;
+  RedirectInfo parsed_redir(line_arena());
+  if (prepared == nullptr)
+  {
+    parsed_redir = parse_redirect(node.text, line_arena());
+    if (!parsed_redir.error.empty())
+    {
+      std::cerr << parsed_redir.error << std::endl;
+      return 2;
+    }
+  }
+  const RedirectInfo &redir = prepared != nullptr ? prepared->redirect : parsed_redir;
+  int substitution_status = 0;
+  ArgList parsed_args(line_arena());
+  if (prepared == nullptr || !prepared->fixed_args)
+  {
+    parsed_args = parse_args(redir.command, line_arena(), true, &substitution_status);
+  }
+  const ArgList &args = prepared != nullptr && prepared->fixed_args ? prepared->args : parsed_args;
+
+  if (args.empty())
+  {
+    // A bare "> file" creates or truncates the file
+    return run_redirected(redir, false, []()
+                          { return 0; });
+  }
+
+  // NAME=value words on their own assign shell variables
+  bool all_assignments = true;
+  for (const auto &arg : args)
+  {
+    size_t eq = arg.find('=');
+    if (eq == std::pmr::string::npos || !is_valid_variable_name(std::string_view(arg).substr(0, eq)))
+    {
+      all_assignments = false;
+      break;
+    }
+  }
+  if (all_assignments)
+  {
+    for (const auto &arg : args)
+    {
+      std::string_view assignment(arg);
+      size_t eq = assignment.find('=');
+      set_variable(std::string(assignment.substr(0, eq)), std::string(assignment.substr(eq + 1)));
+    }
+    return substitution_status; // x=$(false) fails like the command
+  }
+
+  // Functions come first, so they can wrap builtins and programs
+  std::shared_ptr<const FunctionDef> fn = find_function(args[0]);
+  if (fn != nullptr)
+  {
+    return run_redirected(redir, false, [&]()
+                          { return call_function(*fn, args, ctx); });
+  }
+
+  // Handle builtin commands
+  const BuiltinInfo *builtin = find_builtin(args[0]);
+  if (builtin != nullptr)
+  {
+    return run_redirected(redir, builtin->flags & BUILTIN_KEEPS_REDIRECTIONS, [&]()
+                          { return builtin->function(args, ctx); });
+  }
+
+  // Try to execute external command
+  std::pmr::string path = find_in_path(args[0], line_arena());
+
+  if (!path.empty())
+  {
+    return execute_command(path, args, redir.redirections);
+  }
+
+  report_command_not_found(args[0], std::cout);
+  return 127;
+}
+
+int execute_node(const ScriptNode &node, ShellContext &ctx)
+{
+  int status = 0;
+
+  switch (node.type)
+  {
+  case ScriptNode::SIMPLE:
+    status = execute_simple(node, ctx);
+    break;
+
+  case ScriptNode::PIPELINE:
+    if (node.children.size() == 1)
+    {
+      status = execute_node(node.children[0], ctx);
+      set_pipe_status(&status, 1);
+    }
+    else
+    {
+      std::vector<std::string> stages;
+      for (const auto &child : node.children)
+      {
+        stages.emplace_back(child.text);
+      }
+      std::vector<int> stage_statuses;
+      status = execute_pipeline(stages, &stage_statuses);
+      set_pipe_status(stage_statuses.data(), stage_statuses.size());
+    }
+    set_last_status(status);
+    break;
+
+  case ScriptNode::LIST:
+    for (const auto &child : node.children)
+    {
+      status = execute_node(child, ctx);
+      if (ctx.exit_requested || ctx.return_requested)
+      {
+        break;
+      }
+    }
+    break;
+
+  case ScriptNode::FUNCTION:
+    define_function(node.text.substr(0, node.text.find_first_of(" \t(")), node.children[0]);
+    break;
+
+  case ScriptNode::WHILE:
+    while (!ctx.exit_requested && !ctx.return_requested)
+    {
+      ArenaScope iteration; // Each pass parses its commands afresh
+      if (execute_node(node.children[0], ctx) != 0)
+      {
+        break;
+      }
+      status = execute_node(node.children[1], ctx);
+    }
+    break;
+  }
+
+  return status;
+}
+
+int execute_script(std::string_view source, ShellContext &ctx)
+{
+  ScriptNode root(line_arena());
+  std::string error;
+  ParseStatus result = parse_script(source, root, error);
+
+  if (result == ParseStatus::INCOMPLETE)
+  {
+    std::cerr << "syntax error: unexpected end of file" << std::endl;
+    return 2;
+  }
+  if (result == ParseStatus::ERROR)
+  {
+    std::cerr << error << std::endl;
+    return 2;
+  }
+
+  return execute_node(root, ctx);
+}
@@ -0,0 +1,159 @@
+#include "include/shell_history.h"
+#include "include/event_loop.h"
+#include <readline/readline.h>
+#include <readline/history.h>
+#include <thread>
+#include <vector>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+
+static std::string history_path;
+static bool history_loaded = true; // Nothing pending until start_history()
+static int saved_entries = 0;
+
+// Background loader. Deliberately never destroyed: forked children exit
+// with the pointer still set, and a joinable std::thread destructor would
+// abort them.
+static std::thread *loader = nullptr;
+static pid_t loader_pid = 0;
+static std::vector<std::string> loader_lines;
+
+// Read the history file and split it into entries. Does not touch
+// readline, so it can run on the loader thread.
+static std::vector<std::string> read_history_lines(const std::string &path)
+{
+  std::vector<std::string> lines;
+  int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if (fd < 0)
+  {
+    return lines;
+  }
+
+  std::string data;
+  char buffer[65536];
+  ssize_t n;
+  while ((n = read(fd, buffer, sizeof(buffer))) > 0)
+  {
+    data.append(buffer, n);
+  }
+  close(fd);
+
+  // Same rules as read_history(): one entry per line, empty lines skipped
+  const char *p = data.data();
+  const char *end = p + data.size();
+  while (p < end)
+  {
+    const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+    const char *line_end = newline ? newline : end;
+    if (line_end > p)
+    {
+      lines.emplace_back(p, line_end);
+    }
+    p = line_end + 1;
+  }
+  return lines;
+}
+
+// Readline fetches keys through this until the history is loaded: the
+// history list is first needed once the user starts typing
+static int history_getc(FILE *stream)
+{
+  wait_for_history();
+  return rl_getc(stream);
+}
+
+void start_history(const std::string &path, bool background)
+{
+  history_path = path;
+  history_loaded = false;
+
+  if (background)
+  {
+    loader_pid = getpid();
+    loader = new std::thread([]()
+                             {
+      loader_lines = read_history_lines(history_path);
+      post_event(wait_for_history); });
+    rl_getc_function = history_getc;
+  }
+}
+
+void wait_for_history()
+{
+  if (history_loaded)
+  {
+    return;
+  }
+  history_loaded = true;
+
+  std::vector<std::string> lines;
+  if (loader != nullptr && loader_pid == getpid())
+  {
+    loader->join();
+    delete loader;
+    loader = nullptr;
+    lines.swap(loader_lines);
+  }
+  else
+  {
+    // No loader, or a forked child whose copy of the loader's state may be
+    // half-written - read the file directly
+    lines = read_history_lines(history_path);
+  }
+
+  if (rl_getc_function == history_getc)
+  {
+    rl_getc_function = rl_getc;
+  }
+
+  // Loaded entries go in front of anything added in the meantime
+  std::vector<std::string> added;
+  HIST_ENTRY **list = history_list();
+  for (int i = 0; list != nullptr && i < history_length; i++)
+  {
+    added.emplace_back(list[i]->line);
+  }
+  clear_history();
+
+  for (const auto &line : lines)
+  {
+    add_history(line.c_str());
+  }
+  for (const auto &line : added)
+  {
+    add_history(line.c_str());
+  }
+  saved_entries += lines.size();
+  using_history(); // Readline may already be browsing; restart at the end
+}
+
+int saved_history_entries()
+{
+  return saved_entries;
+}
+
+void set_saved_history_entries(int count)
+{
+  saved_entries = count;
+}
+
+int save_history()
+{
+  if (loader != nullptr)
+  {
+    wait_for_history(); // Do not exit with the loader still running
+  }
+
+  int new_entries = history_length - saved_entries;
+  if (new_entries <= 0 || history_path.empty())
+  {
+    return 0;
+  }
+  if (append_history(new_entries, history_path.c_str()) != 0)
+  {
+    return 0;
+  }
+  saved_entries = history_length;
+  return new_entries;
+}
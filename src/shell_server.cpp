@@ -0,0 +1,306 @@
+#include "include/shell_server.h"
+#include "include/shell_server_protocol.h"
+#include "include/command_index.h"
+#include "include/line_reader.h"
+#include "include/variables.h"
+#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <poll.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int)
+{
+  stop_requested = 1;
+}
+
+// SIGCHLD only needs to interrupt ppoll so finished workers get reaped
+static void ignore_signal(int)
+{
+}
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = static_cast<const char *>(buf);
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+  char *p = static_cast<char *>(buf);
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Receive a request header and the client's stdin, stdout and stderr
+static bool recv_request(int sock, shell_server_request &req, int fds[3])
+{
+  struct iovec iov;
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+
+  alignas(struct cmsghdr) char control[CMSG_SPACE(3 * sizeof(int))];
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n;
+  do
+  {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC | MSG_WAITALL);
+  } while (n < 0 && errno == EINTR);
+  if (n != static_cast<ssize_t>(sizeof(req)))
+    return false;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(3 * sizeof(int)))
+    return false;
+  memcpy(fds, CMSG_DATA(cmsg), 3 * sizeof(int));
+  return true;
+}
+
+// Bind and listen on path. A socket file nobody listens on any more is
+// replaced; anything else at that path is left alone.
+static int open_listener(const std::string &path)
+{
+  struct sockaddr_un addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  if (path.empty() || path.size() >= sizeof(addr.sun_path))
+  {
+    std::cerr << "shell: socket path too long: " << path << std::endl;
+    return -1;
+  }
+  memcpy(addr.sun_path, path.data(), path.size());
+
+  int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  if (fd < 0)
+  {
+    std::cerr << "shell: socket: " << strerror(errno) << std::endl;
+    return -1;
+  }
+
+  struct stat st;
+  if (lstat(path.c_str(), &st) == 0)
+  {
+    int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    bool in_use = S_ISSOCK(st.st_mode) && probe >= 0 &&
+                  connect(probe, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr)) == 0;
+    if (probe >= 0)
+      close(probe);
+    if (!S_ISSOCK(st.st_mode) || in_use)
+    {
+      std::cerr << "shell: " << path << (in_use ? ": server already running" : ": file exists") << std::endl;
+      close(fd);
+      return -1;
+    }
+    unlink(path.c_str());
+  }
+
+  // Anyone who can connect can run commands: owner only
+  mode_t old_mask = umask(0077);
+  int bound = bind(fd, reinterpret_cast<struct sockaddr *>(&addr), sizeof(addr));
+  umask(old_mask);
+  if (bound < 0 || listen(fd, SOMAXCONN) < 0)
+  {
+    std::cerr << "shell: " << path << ": " << strerror(errno) << std::endl;
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+// Check that the client runs as our user (the socket mode is not enough
+// if the directory is shared)
+static bool trusted_peer(int conn)
+{
+  struct ucred cred;
+  socklen_t len = sizeof(cred);
+  return getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 &&
+         cred.uid == geteuid();
+}
+
+// Export the client's environment entries over the server's
+static void apply_environment(const std::string &env, Shell &shell)
+{
+  size_t start = 0;
+  while (start < env.size())
+  {
+    size_t end = env.find('\0', start);
+    if (end == std::string::npos)
+      end = env.size();
+    std::string entry = env.substr(start, end - start);
+    size_t equals = entry.find('=');
+    if (equals != std::string::npos && is_valid_variable_name(std::string_view(entry).substr(0, equals)))
+      shell.set_variable(entry.substr(0, equals), entry.substr(equals + 1), true);
+    start = end + 1;
+  }
+}
+
+// Body of a worker process: take over the client's descriptors, directory
+// and environment, run the command, report its status. Never returns.
+static void serve_request(int conn, Shell &shell)
+{
+  shell_server_request req;
+  int fds[3];
+  if (!recv_request(conn, req, fds))
+    _exit(1);
+  if (req.magic != SHELL_SERVER_MAGIC || req.cwd_len > SHELL_SERVER_MAX_TEXT ||
+      req.command_len > SHELL_SERVER_MAX_TEXT || req.env_len > SHELL_SERVER_MAX_TEXT)
+    _exit(1);
+
+  std::string cwd(req.cwd_len, '\0');
+  std::string command(req.command_len, '\0');
+  std::string env(req.env_len, '\0');
+  if (!read_all(conn, cwd.data(), cwd.size()) ||
+      !read_all(conn, command.data(), command.size()) ||
+      !read_all(conn, env.data(), env.size()))
+    _exit(1);
+
+  // Received descriptors may have landed on 0-2 if the server's own were
+  // closed; move them out of the way before installing them
+  for (int i = 0; i < 3; i++)
+  {
+    if (fds[i] < 3)
+      fds[i] = fcntl(fds[i], F_DUPFD_CLOEXEC, 3);
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    if (fds[i] < 0 || dup2(fds[i], i) < 0)
+      _exit(1);
+  }
+  for (int i = 0; i < 3; i++)
+    close(fds[i]);
+  reset_line_readers();
+
+  // The client signals this group to interrupt the command
+  setpgid(0, 0);
+  int32_t reply = getpid();
+  if (!write_all(conn, &reply, sizeof(reply)))
+    _exit(1);
+
+  int status;
+  if (!shell.change_directory(cwd))
+  {
+    std::cerr << "shell: " << cwd << ": " << strerror(errno) << std::endl;
+    status = 1;
+  }
+  else
+  {
+    apply_environment(env, shell);
+    status = shell.execute(command);
+  }
+
+  fflush(nullptr);
+  reply = status;
+  write_all(conn, &reply, sizeof(reply));
+  _exit(status);
+}
+
+int run_shell_server(const std::string &socket_path, Shell &shell)
+{
+  int listener = open_listener(socket_path);
+  if (listener < 0)
+    return 1;
+
+  // Build the executable index now so workers inherit it
+  executable_names();
+
+  // Signals are only delivered while waiting in ppoll, so none is lost
+  // between checking stop_requested and going to sleep
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  sigemptyset(&action.sa_mask);
+  struct sigaction old_int, old_term, old_chld;
+  action.sa_handler = request_stop;
+  sigaction(SIGINT, &action, &old_int);
+  sigaction(SIGTERM, &action, &old_term);
+  action.sa_handler = ignore_signal;
+  sigaction(SIGCHLD, &action, &old_chld);
+
+  sigset_t blocked, old_mask;
+  sigemptyset(&blocked);
+  sigaddset(&blocked, SIGINT);
+  sigaddset(&blocked, SIGTERM);
+  sigaddset(&blocked, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &blocked, &old_mask);
+
+  while (!stop_requested)
+  {
+    while (waitpid(-1, nullptr, WNOHANG) > 0)
+    {
+    }
+
+    struct pollfd pfd = {listener, POLLIN, 0};
+    if (ppoll(&pfd, 1, nullptr, &old_mask) <= 0)
+      continue; // Signal
+
+    int conn = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn < 0)
+      continue; // Client gave up, or EAGAIN after a spurious wakeup
+    if (!trusted_peer(conn))
+    {
+      close(conn);
+      continue;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      // WORKER PROCESS - never returns
+      close(listener);
+      sigaction(SIGINT, &old_int, nullptr);
+      sigaction(SIGTERM, &old_term, nullptr);
+      sigaction(SIGCHLD, &old_chld, nullptr);
+      sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+      serve_request(conn, shell);
+    }
+    if (pid < 0)
+      std::cerr << "shell: fork: " << strerror(errno) << std::endl;
+    close(conn);
+  }
+
+  // Running workers finish on their own
+  close(listener);
+  unlink(socket_path.c_str());
+  sigprocmask(SIG_SETMASK, &old_mask, nullptr);
+  sigaction(SIGINT, &old_int, nullptr);
+  sigaction(SIGTERM, &old_term, nullptr);
+  sigaction(SIGCHLD, &old_chld, nullptr);
+  return 0;
+}
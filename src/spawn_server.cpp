@@ -0,0 +1,345 @@
+#include "include/spawn_server.h"
+#include "include/arena.h"
+#include <cstring>
+#include <cstdint>
+#include <cerrno>
+#include <csignal>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+// Fixed-size header sent with every spawn request. The strings (path, argv
+// and envp, each NUL-terminated) follow as a single payload. The shell's
+// stdin, stdout, stderr and working directory travel as SCM_RIGHTS fds.
+struct SpawnRequest
+{
+  uint32_t argc;
+  uint32_t envc;
+  uint32_t payload_len;
+  uint32_t umask;
+};
+
+// stdin, stdout, stderr and an O_PATH descriptor of the working directory
+static const int REQUEST_FDS = 4;
+
+static int server_socket = -1; // Shell's end of the socketpair
+static pid_t server_pid = -1;  // PID of the helper process
+
+static bool write_all(int fd, const void *buf, size_t len)
+{
+  const char *p = static_cast<const char *>(buf);
+  while (len > 0)
+  {
+    ssize_t n = write(fd, p, len);
+    if (n < 0)
+    {
+      if (errno == EINTR)
+        continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+static bool read_all(int fd, void *buf, size_t len)
+{
+  char *p = static_cast<char *>(buf);
+  while (len > 0)
+  {
+    ssize_t n = read(fd, p, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return false;
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+// Send the request header together with the request's fds
+static bool send_header(int sock, const SpawnRequest &req, const int fds[REQUEST_FDS])
+{
+  struct iovec iov;
+  iov.iov_base = const_cast<SpawnRequest *>(&req);
+  iov.iov_len = sizeof(req);
+
+  alignas(struct cmsghdr) char control[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+  memset(control, 0, sizeof(control));
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(REQUEST_FDS * sizeof(int));
+  memcpy(CMSG_DATA(cmsg), fds, REQUEST_FDS * sizeof(int));
+
+  ssize_t n;
+  do
+  {
+    n = sendmsg(sock, &msg, 0);
+  } while (n < 0 && errno == EINTR);
+  return n == static_cast<ssize_t>(sizeof(req));
+}
+
+// Receive a request header and the fds attached to it
+static bool recv_header(int sock, SpawnRequest &req, int fds[REQUEST_FDS])
+{
+  struct iovec iov;
+  iov.iov_base = &req;
+  iov.iov_len = sizeof(req);
+
+  alignas(struct cmsghdr) char control[CMSG_SPACE(REQUEST_FDS * sizeof(int))];
+
+  struct msghdr msg;
+  memset(&msg, 0, sizeof(msg));
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control;
+  msg.msg_controllen = sizeof(control);
+
+  ssize_t n;
+  do
+  {
+    n = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+  } while (n < 0 && errno == EINTR);
+  if (n != static_cast<ssize_t>(sizeof(req)))
+    return false;
+
+  struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+  if (cmsg == nullptr || cmsg->cmsg_type != SCM_RIGHTS ||
+      cmsg->cmsg_len != CMSG_LEN(REQUEST_FDS * sizeof(int)))
+    return false;
+  memcpy(fds, CMSG_DATA(cmsg), REQUEST_FDS * sizeof(int));
+  return true;
+}
+
+// Main loop of the helper process: one request at a time, fork + execve,
+// report the PID immediately and the wait status once the child exits
+static void serve(int sock)
+{
+  while (true)
+  {
+    SpawnRequest req;
+    int fds[REQUEST_FDS];
+    if (!recv_header(sock, req, fds))
+      _exit(0); // Shell went away
+
+    char *payload = new char[req.payload_len];
+    if (!read_all(sock, payload, req.payload_len))
+      _exit(0);
+
+    // Build argv/envp by pointing into the payload. argv keeps a spare
+    // leading slot for exec_image's ENOEXEC fallback.
+    char **slots = new char *[req.argc + 2];
+    char **argv = slots + 1;
+    char **envp = new char *[req.envc + 1];
+    char *p = payload;
+    char *path = p;
+    p += strlen(p) + 1;
+    for (uint32_t i = 0; i < req.argc; i++)
+    {
+      argv[i] = p;
+      p += strlen(p) + 1;
+    }
+    argv[req.argc] = nullptr;
+    for (uint32_t i = 0; i < req.envc; i++)
+    {
+      envp[i] = p;
+      p += strlen(p) + 1;
+    }
+    envp[req.envc] = nullptr;
+
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+      // CHILD PROCESS - take on the shell's stdio, directory, umask and
+      // signal state, then run the command. Ignored signals would stay
+      // ignored across execve.
+      for (int i = 0; i < 3; i++)
+      {
+        dup2(fds[i], i); // dup2 clears FD_CLOEXEC on the target
+      }
+      if (fchdir(fds[3]) < 0)
+      {
+        const char msg[] = "cannot enter working directory\n";
+        write_all(STDERR_FILENO, msg, sizeof(msg) - 1);
+        _exit(126);
+      }
+      umask(req.umask);
+      signal(SIGINT, SIG_DFL);
+      signal(SIGQUIT, SIG_DFL);
+      signal(SIGPIPE, SIG_DFL);
+      sigset_t none;
+      sigemptyset(&none);
+      sigprocmask(SIG_SETMASK, &none, nullptr);
+      exec_image(ExecImage{path, argv, envp});
+
+      int error = errno;
+      const char msg[] = "Failed to execute ";
+      write_all(STDERR_FILENO, msg, sizeof(msg) - 1);
+      write_all(STDERR_FILENO, path, strlen(path));
+      write_all(STDERR_FILENO, "\n", 1);
+      _exit(error == ENOENT ? 127 : 126);
+    }
+
+    for (int i = 0; i < REQUEST_FDS; i++)
+    {
+      close(fds[i]);
+    }
+    delete[] slots;
+    delete[] envp;
+    delete[] payload;
+
+    int reply[2] = {pid, -1};
+    if (pid < 0)
+    {
+      write_all(sock, reply, sizeof(reply));
+      continue;
+    }
+    if (!write_all(sock, reply, sizeof(int)))
+      _exit(0);
+
+    while (waitpid(pid, &reply[1], 0) < 0 && errno == EINTR)
+    {
+    }
+    if (!write_all(sock, &reply[1], sizeof(int)))
+      _exit(0);
+  }
+}
+
+bool spawn_server_start()
+{
+  if (server_socket >= 0)
+    return true;
+
+  int sv[2];
+  if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, sv) < 0)
+    return false;
+
+  pid_t pid = fork();
+  if (pid < 0)
+  {
+    close(sv[0]);
+    close(sv[1]);
+    return false;
+  }
+
+  if (pid == 0)
+  {
+    // HELPER PROCESS - never returns
+    close(sv[0]);
+    signal(SIGINT, SIG_IGN); // Ctrl+C belongs to the foreground command
+    serve(sv[1]);
+    _exit(0);
+  }
+
+  close(sv[1]);
+  // Keep descriptors 0-9 free for redirections (exec 3>file)
+  server_socket = fcntl(sv[0], F_DUPFD_CLOEXEC, 10);
+  close(sv[0]);
+  if (server_socket < 0)
+  {
+    waitpid(pid, nullptr, 0); // Helper exits on EOF
+    return false;
+  }
+  server_pid = pid;
+  return true;
+}
+
+bool spawn_server_active()
+{
+  return server_socket >= 0;
+}
+
+void spawn_server_stop()
+{
+  if (server_socket < 0)
+    return;
+
+  close(server_socket); // Helper exits on EOF
+  waitpid(server_pid, nullptr, 0);
+  server_socket = -1;
+  server_pid = -1;
+}
+
+void spawn_server_reap()
+{
+  if (server_socket >= 0 && waitpid(server_pid, nullptr, WNOHANG) == server_pid)
+  {
+    close(server_socket);
+    server_socket = -1;
+    server_pid = -1;
+  }
+}
+
+int spawn_server_run(const ExecImage &image, const int fds[3])
+{
+  if (server_socket < 0)
+    return -1;
+
+  // Serialize path, argv and envp into one NUL-separated payload
+  std::pmr::string payload(image.path, line_arena());
+  payload.push_back('\0');
+  uint32_t argc = 0;
+  for (char **arg = image.argv; *arg != nullptr; arg++)
+  {
+    payload += *arg;
+    payload.push_back('\0');
+    argc++;
+  }
+  uint32_t envc = 0;
+  for (char **env = image.envp; *env != nullptr; env++)
+  {
+    payload += *env;
+    payload.push_back('\0');
+    envc++;
+  }
+
+  // The helper has its own working directory and umask: send the shell's
+  int request_fds[REQUEST_FDS] = {fds[0], fds[1], fds[2], open(".", O_PATH | O_DIRECTORY | O_CLOEXEC)};
+  if (request_fds[3] < 0)
+  {
+    return -1; // Run it with fork, which reports the problem
+  }
+  mode_t mask = umask(0);
+  umask(mask);
+
+  SpawnRequest req;
+  req.argc = argc;
+  req.envc = envc;
+  req.payload_len = payload.size();
+  req.umask = mask;
+
+  int reply[2];
+  bool sent = send_header(server_socket, req, request_fds);
+  close(request_fds[3]);
+  if (!sent ||
+      !write_all(server_socket, payload.data(), payload.size()) ||
+      !read_all(server_socket, &reply[0], sizeof(int)))
+  {
+    // Helper died - stop using it so callers fall back to fork
+    spawn_server_stop();
+    return -1;
+  }
+
+  if (reply[0] < 0)
+    return -1; // Helper could not fork
+
+  if (!read_all(server_socket, &reply[1], sizeof(int)))
+  {
+    spawn_server_stop();
+    return -1;
+  }
+  return reply[1];
+}
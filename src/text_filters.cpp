@@ -0,0 +1,1162 @@
+#include "include/text_filters.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <langinfo.h>
+#include <locale.h>
+#include <unistd.h>
+
+// Bytes read at a time: the size of GNU grep's buffer, so a NUL byte turns
+// grep binary at the same place it would in the real tool
+static constexpr size_t READ_SIZE = 96 * 1024;
+
+// The tools write to a pipe through stdio, one block of this size at a time
+static constexpr unsigned long long STDIO_BLOCK = 4096;
+
+static const char BINARY_MESSAGE[] = "grep: (standard input): binary file matches\n";
+
+enum class Ctype
+{
+  C,    // Single-byte ASCII (C, POSIX or a locale that is not installed)
+  UTF8, // UTF-8
+  OTHER // Anything else: left to the real tools
+};
+
+// Character type of the locale the tools would run in
+static Ctype environment_ctype()
+{
+  const char *name = nullptr;
+  for (const char *variable : {"LC_ALL", "LC_CTYPE", "LANG"})
+  {
+    const char *value = getenv(variable);
+    if (value != nullptr && *value != '\0')
+    {
+      name = value;
+      break;
+    }
+  }
+  if (name == nullptr || strcmp(name, "C") == 0 || strcmp(name, "POSIX") == 0)
+  {
+    return Ctype::C;
+  }
+
+  static std::string cached_name;
+  static Ctype cached = Ctype::C;
+  if (cached_name == name)
+  {
+    return cached;
+  }
+  // Programs stay in the C locale when the named one is not installed
+  Ctype ctype = Ctype::C;
+  locale_t locale = newlocale(LC_CTYPE_MASK, name, static_cast<locale_t>(0));
+  if (locale != static_cast<locale_t>(0))
+  {
+    const char *codeset = nl_langinfo_l(CODESET, locale);
+    if (strcmp(codeset, "UTF-8") == 0)
+    {
+      ctype = Ctype::UTF8;
+    }
+    else if (strcmp(codeset, "ANSI_X3.4-1968") != 0)
+    {
+      ctype = Ctype::OTHER;
+    }
+    freelocale(locale);
+  }
+  cached_name = name;
+  cached = ctype;
+  return ctype;
+}
+
+// Parse a decimal count without sign or suffix
+static bool parse_number(std::string_view text, unsigned long long &value)
+{
+  if (text.empty() || text.size() > 18)
+  {
+    return false;
+  }
+  value = 0;
+  for (char c : text)
+  {
+    if (c < '0' || c > '9')
+    {
+      return false;
+    }
+    value = value * 10 + (c - '0');
+  }
+  return true;
+}
+
+static bool parse_grep(const ArgList &args, TextFilter &filter)
+{
+  if (getenv("POSIXLY_CORRECT") != nullptr)
+  {
+    return false; // Options after the pattern would be file names
+  }
+  char syntax = 'G';
+  std::vector<std::string_view> operands;
+  std::vector<std::string_view> patterns; // From -e
+  bool options_done = false;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    std::string_view arg = args[i];
+    if (!options_done && arg == "--")
+    {
+      options_done = true;
+      continue;
+    }
+    if (options_done || arg.size() < 2 || arg[0] != '-')
+    {
+      operands.push_back(arg); // GNU grep permutes options and operands
+      continue;
+    }
+    if (arg[1] == '-')
+    {
+      return false; // Long options are not recognized
+    }
+    for (size_t j = 1; j < arg.size(); j++)
+    {
+      switch (arg[j])
+      {
+      case 'v':
+        filter.invert = true;
+        break;
+      case 'c':
+        filter.count = true;
+        break;
+      case 'i':
+        filter.ignore_case = true;
+        break;
+      case 'F':
+      case 'G':
+      case 'E':
+        syntax = arg[j];
+        break;
+      case 'e':
+        if (j + 1 < arg.size())
+        {
+          patterns.push_back(arg.substr(j + 1));
+        }
+        else if (i + 1 < args.size())
+        {
+          patterns.push_back(args[++i]);
+        }
+        else
+        {
+          return false;
+        }
+        j = arg.size();
+        break;
+      default:
+        return false;
+      }
+    }
+  }
+
+  // Exactly one pattern and no files
+  if (patterns.size() + operands.size() != 1)
+  {
+    return false;
+  }
+  std::string_view pattern = patterns.empty() ? operands[0] : patterns[0];
+  if (pattern.find('\n') != std::string_view::npos)
+  {
+    return false; // Several patterns
+  }
+  // Only patterns that match themselves literally
+  if ((syntax == 'G' && pattern.find_first_of("\\.[*^$") != std::string_view::npos) ||
+      (syntax == 'E' && pattern.find_first_of("\\.[]()*+?{}|^$") != std::string_view::npos))
+  {
+    return false;
+  }
+
+  Ctype ctype = environment_ctype();
+  if (ctype == Ctype::OTHER)
+  {
+    return false;
+  }
+  if (ctype == Ctype::UTF8)
+  {
+    // Case folding and non-ASCII patterns depend on the locale's tables
+    if (filter.ignore_case)
+    {
+      return false;
+    }
+    for (char c : pattern)
+    {
+      if (static_cast<unsigned char>(c) >= 0x80)
+      {
+        return false;
+      }
+    }
+    filter.utf8 = true;
+  }
+
+  filter.pattern.assign(pattern);
+  if (filter.ignore_case)
+  {
+    for (char &c : filter.pattern)
+    {
+      if (c >= 'A' && c <= 'Z')
+      {
+        c += 'a' - 'A';
+      }
+    }
+  }
+  return true;
+}
+
+static bool parse_head(const ArgList &args, TextFilter &filter)
+{
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    std::string_view arg = args[i];
+    if (arg == "-n" && i + 1 < args.size())
+    {
+      arg = args[++i];
+    }
+    else if (arg.size() > 2 && arg.substr(0, 2) == "-n")
+    {
+      arg.remove_prefix(2);
+    }
+    else if (i == 1 && arg.size() > 1 && arg[0] == '-')
+    {
+      arg.remove_prefix(1); // head -20
+    }
+    else if (arg == "--" && i + 1 == args.size())
+    {
+      break;
+    }
+    else
+    {
+      return false;
+    }
+    // Signs (all but the last N lines) and size suffixes go to head itself
+    if (!parse_number(arg, filter.lines))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool parse_wc(const ArgList &args, TextFilter &filter)
+{
+  char unit = 0;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    std::string_view arg = args[i];
+    if (arg == "--" && i + 1 == args.size())
+    {
+      break;
+    }
+    if (arg.size() < 2 || arg[0] != '-')
+    {
+      return false;
+    }
+    for (char c : arg.substr(1))
+    {
+      // One count only: with several, wc pads them into columns
+      if ((c != 'l' && c != 'c' && c != 'w') || (unit != 0 && unit != c))
+      {
+        return false;
+      }
+      unit = c;
+    }
+  }
+  // Word boundaries follow the locale's notion of white space
+  if (unit == 0 || (unit == 'w' && environment_ctype() != Ctype::C))
+  {
+    return false;
+  }
+  filter.unit = unit;
+  return true;
+}
+
+// Parse a cut list ("1,3-5,7-") into sorted, merged ranges
+static bool parse_cut_list(std::string_view list, std::vector<std::pair<size_t, size_t>> &ranges)
+{
+  while (!list.empty())
+  {
+    size_t comma = list.find(',');
+    std::string_view item = list.substr(0, comma);
+    list = comma == std::string_view::npos ? std::string_view() : list.substr(comma + 1);
+
+    unsigned long long first = 1;
+    unsigned long long last = SIZE_MAX;
+    size_t dash = item.find('-');
+    if (dash == std::string_view::npos)
+    {
+      if (!parse_number(item, first))
+      {
+        return false;
+      }
+      last = first;
+    }
+    else
+    {
+      std::string_view low = item.substr(0, dash);
+      std::string_view high = item.substr(dash + 1);
+      if ((low.empty() && high.empty()) ||
+          (!low.empty() && !parse_number(low, first)) ||
+          (!high.empty() && !parse_number(high, last)))
+      {
+        return false;
+      }
+    }
+    if (first == 0 || last < first)
+    {
+      return false;
+    }
+    ranges.emplace_back(first, last);
+  }
+  if (ranges.empty())
+  {
+    return false;
+  }
+
+  std::sort(ranges.begin(), ranges.end());
+  size_t merged = 0;
+  for (size_t i = 1; i < ranges.size(); i++)
+  {
+    if (ranges[i].first <= ranges[merged].second + 1 || ranges[merged].second == SIZE_MAX)
+    {
+      ranges[merged].second = std::max(ranges[merged].second, ranges[i].second);
+    }
+    else
+    {
+      ranges[++merged] = ranges[i];
+    }
+  }
+  ranges.resize(merged + 1);
+  return true;
+}
+
+static bool parse_cut(const ArgList &args, TextFilter &filter)
+{
+  char list_kind = 0;
+  bool have_delimiter = false;
+  for (size_t i = 1; i < args.size(); i++)
+  {
+    std::string_view arg = args[i];
+    if (arg == "--" && i + 1 == args.size())
+    {
+      break;
+    }
+    if (arg.size() < 2 || arg[0] != '-' || arg[1] == '-')
+    {
+      return false;
+    }
+    for (size_t j = 1; j < arg.size(); j++)
+    {
+      char option = arg[j];
+      if (option == 's')
+      {
+        filter.only_delimited = true;
+        continue;
+      }
+      if (option == 'n')
+      {
+        continue; // Ignored by GNU cut
+      }
+      if (option != 'b' && option != 'c' && option != 'f' && option != 'd')
+      {
+        return false;
+      }
+
+      std::string_view value;
+      if (j + 1 < arg.size())
+      {
+        value = arg.substr(j + 1);
+      }
+      else if (i + 1 < args.size())
+      {
+        value = args[++i];
+      }
+      else
+      {
+        return false;
+      }
+      j = arg.size();
+
+      if (option == 'd')
+      {
+        if (value.size() != 1)
+        {
+          return false;
+        }
+        filter.delimiter = value[0];
+        have_delimiter = true;
+        continue;
+      }
+      if (list_kind != 0)
+      {
+        return false; // Only one type of list
+      }
+      list_kind = option;
+      if (!parse_cut_list(value, filter.ranges))
+      {
+        return false;
+      }
+    }
+  }
+  // cut -c counts bytes in GNU coreutils; -d and -s only make sense with -f
+  filter.fields = list_kind == 'f';
+  return list_kind != 0 && (filter.fields || (!have_delimiter && !filter.only_delimited));
+}
+
+bool parse_text_filter(const ArgList &args, TextFilter &filter)
+{
+  if (args.empty())
+  {
+    return false;
+  }
+  std::string_view name = args[0];
+  size_t slash = name.rfind('/');
+  if (slash != std::string_view::npos)
+  {
+    name.remove_prefix(slash + 1);
+  }
+
+  filter = TextFilter();
+  if (name == "grep")
+  {
+    filter.kind = TextFilter::GREP;
+    return parse_grep(args, filter);
+  }
+  if (name == "head")
+  {
+    filter.kind = TextFilter::HEAD;
+    return parse_head(args, filter);
+  }
+  if (name == "wc")
+  {
+    filter.kind = TextFilter::WC;
+    return parse_wc(args, filter);
+  }
+  if (name == "cut")
+  {
+    filter.kind = TextFilter::CUT;
+    return parse_cut(args, filter);
+  }
+  return false;
+}
+
+// Running state of one stage
+struct FilterState
+{
+  const TextFilter *filter = nullptr;
+  unsigned long long count = 0; // grep: lines selected; head: lines left; wc: total
+  bool binary = false;          // grep: a NUL byte was seen
+  bool binary_match = false;    // grep: left out a selected line of binary data
+  bool in_word = false;         // wc -w: the last byte was part of a word
+  std::string folded;           // grep -i: lowercase copy of the chunk
+  size_t guard = 0;             // grep: index of the pattern byte to scan for
+  bool done = false;            // Wants no more input
+  size_t consumed = 0;          // head: bytes of the last chunk it used
+  unsigned long long written = 0; // Output so far
+  size_t last_output = 0;         // Output of the last chunk it was given
+};
+
+static const char *tool_name(TextFilter::Kind kind)
+{
+  static const char *const names[] = {"grep", "head", "wc", "cut"};
+  return names[kind];
+}
+
+static size_t count_newlines(const char *p, const char *end)
+{
+  size_t lines = 0;
+  while (p < end && (p = static_cast<const char *>(memchr(p, '\n', end - p))) != nullptr)
+  {
+    lines++;
+    p++;
+  }
+  return lines;
+}
+
+// First byte of [p, end) that does not start a valid UTF-8 character, or end
+static const char *find_invalid_utf8(const char *p, const char *end)
+{
+  const unsigned char *s = reinterpret_cast<const unsigned char *>(p);
+  const unsigned char *limit = reinterpret_cast<const unsigned char *>(end);
+  while (s < limit)
+  {
+    // Skip ASCII eight bytes at a time
+    uint64_t word;
+    if (limit - s >= 8 && (memcpy(&word, s, 8), (word & 0x8080808080808080ULL) == 0))
+    {
+      s += 8;
+      continue;
+    }
+    unsigned char c = *s;
+    if (c < 0x80)
+    {
+      s++;
+      continue;
+    }
+    size_t length;
+    unsigned char low = 0x80;
+    unsigned char high = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF)
+    {
+      length = 2;
+    }
+    else if (c >= 0xE0 && c <= 0xEF)
+    {
+      length = 3;
+      low = c == 0xE0 ? 0xA0 : 0x80;  // Overlong
+      high = c == 0xED ? 0x9F : 0xBF; // Surrogates
+    }
+    else if (c >= 0xF0 && c <= 0xF4)
+    {
+      length = 4;
+      low = c == 0xF0 ? 0x90 : 0x80;
+      high = c == 0xF4 ? 0x8F : 0xBF; // Above U+10FFFF
+    }
+    else
+    {
+      return reinterpret_cast<const char *>(s);
+    }
+    if (static_cast<size_t>(limit - s) < length || s[1] < low || s[1] > high)
+    {
+      return reinterpret_cast<const char *>(s);
+    }
+    for (size_t i = 2; i < length; i++)
+    {
+      if ((s[i] & 0xC0) != 0x80)
+      {
+        return reinterpret_cast<const char *>(s);
+      }
+    }
+    s += length;
+  }
+  return end;
+}
+
+static void fold_case(const char *p, size_t size, std::string &folded)
+{
+  folded.resize(size);
+  for (size_t i = 0; i < size; i++)
+  {
+    char c = p[i];
+    folded[i] = c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+  }
+}
+
+static void report_binary_match()
+{
+  ssize_t written = write(STDERR_FILENO, BINARY_MESSAGE, sizeof(BINARY_MESSAGE) - 1);
+  (void)written;
+}
+
+// Pass selected lines [line, end) to the output. In a UTF-8 locale grep
+// treats a line with an encoding error as binary data and leaves it out.
+static void grep_select(FilterState &state, const char *line, const char *end, std::string &out)
+{
+  const TextFilter &filter = *state.filter;
+  if (filter.count)
+  {
+    state.count += count_newlines(line, end) + (end[-1] != '\n');
+    return;
+  }
+  state.count++;
+  while (filter.utf8)
+  {
+    const char *bad = find_invalid_utf8(line, end);
+    if (bad == end)
+    {
+      break;
+    }
+    const char *newline = static_cast<const char *>(memrchr(line, '\n', bad - line));
+    out.append(line, newline != nullptr ? newline + 1 - line : 0);
+    state.binary_match = true;
+    newline = static_cast<const char *>(memchr(bad, '\n', end - bad));
+    line = newline != nullptr ? newline + 1 : end;
+  }
+  if (line == end)
+  {
+    return;
+  }
+  out.append(line, end - line);
+  if (end[-1] != '\n')
+  {
+    out.push_back('\n'); // grep terminates the last line
+  }
+}
+
+// Index of the pattern byte least likely to appear in text, by a fixed
+// ranking of common bytes (anything not listed counts as rare)
+static size_t rare_byte_index(const std::string &pattern)
+{
+  static const char common[] =
+      " etaoinsrhldcumfpgwybvkxjqz0123456789ETAOINSRHLDCUMFPGWYBVKXJQZ.,:/-_=\t";
+  size_t best = 0;
+  size_t best_rank = 0;
+  for (size_t i = 0; i < pattern.size(); i++)
+  {
+    const char *found = static_cast<const char *>(memchr(common, pattern[i], sizeof(common) - 1));
+    size_t rank = found != nullptr ? found - common : sizeof(common);
+    if (rank > best_rank || i == 0)
+    {
+      best = i;
+      best_rank = rank;
+    }
+  }
+  return best;
+}
+
+// Find the pattern in [p, end): memchr (vectorized in glibc) for its rarest
+// byte, checking each candidate with memcmp. When candidates keep failing
+// the rest goes to memmem (Two-Way), which does not degrade on them.
+static const char *find_pattern(const FilterState &state, const char *p, const char *end)
+{
+  const std::string &pattern = state.filter->pattern;
+  size_t length = pattern.size();
+  if (static_cast<size_t>(end - p) < length)
+  {
+    return nullptr;
+  }
+  if (length == 0)
+  {
+    return p;
+  }
+  size_t guard = state.guard;
+  const char *scan = p + guard;
+  const char *scan_end = end - length + guard + 1; // Past the last candidate
+  size_t misses = 0;
+  while (scan < scan_end)
+  {
+    scan = static_cast<const char *>(memchr(scan, pattern[guard], scan_end - scan));
+    if (scan == nullptr)
+    {
+      return nullptr;
+    }
+    const char *start = scan - guard;
+    if (memcmp(start, pattern.data(), length) == 0)
+    {
+      return start;
+    }
+    scan++;
+    if (++misses > 8 + static_cast<size_t>(scan - p) / 16)
+    {
+      return static_cast<const char *>(memmem(start + 1, end - start - 1, pattern.data(), length));
+    }
+  }
+  return nullptr;
+}
+
+static bool contains_pattern(FilterState &state, const char *p, size_t size)
+{
+  const std::string &pattern = state.filter->pattern;
+  if (state.filter->ignore_case)
+  {
+    fold_case(p, size, state.folded);
+    p = state.folded.data();
+  }
+  return memmem(p, size, pattern.data(), pattern.size()) != nullptr;
+}
+
+// Once grep has seen a NUL byte it prints nothing more, NULs end lines, and
+// the first selected line ends the search (unless it is counting)
+static bool grep_binary_chunk(FilterState &state, const char *data, size_t size)
+{
+  const TextFilter &filter = *state.filter;
+  const char *end = data + size;
+  for (const char *p = data; p < end;)
+  {
+    const char *line_end = p;
+    while (line_end < end && *line_end != '\n' && *line_end != '\0')
+    {
+      line_end++;
+    }
+    if (contains_pattern(state, p, line_end - p) != filter.invert)
+    {
+      state.count++;
+      if (!filter.count)
+      {
+        state.binary_match = true;
+        report_binary_match();
+        return false;
+      }
+    }
+    p = line_end < end ? line_end + 1 : end;
+  }
+  return true;
+}
+
+static bool grep_chunk(FilterState &state, const char *data, size_t size, std::string &out)
+{
+  const TextFilter &filter = *state.filter;
+  // GNU grep checks each buffer it reads for NUL bytes
+  if (!state.binary && memchr(data, '\0', size) != nullptr)
+  {
+    state.binary = true;
+  }
+  if (state.binary)
+  {
+    return grep_binary_chunk(state, data, size);
+  }
+
+  const char *haystack = data;
+  if (filter.ignore_case)
+  {
+    fold_case(data, size, state.folded);
+    haystack = state.folded.data();
+  }
+
+  // Search the whole chunk at once, then widen each match to its line
+  const char *end = data + size;
+  const char *p = data; // Start of the first line not yet examined
+  while (p < end)
+  {
+    const char *match = find_pattern(state, haystack + (p - data), haystack + size);
+    const char *line = end;
+    const char *line_end = end;
+    if (match != nullptr)
+    {
+      match = data + (match - haystack);
+      const char *newline = static_cast<const char *>(memrchr(p, '\n', match - p));
+      line = newline != nullptr ? newline + 1 : p;
+      newline = static_cast<const char *>(memchr(match, '\n', end - match));
+      line_end = newline != nullptr ? newline + 1 : end;
+    }
+
+    if (filter.invert)
+    {
+      // Every line before the match is selected
+      if (line > p)
+      {
+        grep_select(state, p, line, out);
+      }
+    }
+    else if (match == nullptr)
+    {
+      break;
+    }
+    else
+    {
+      grep_select(state, line, line_end, out);
+    }
+    p = line_end;
+  }
+  return true;
+}
+
+static bool head_chunk(FilterState &state, const char *data, size_t size, std::string &out)
+{
+  const char *end = data + size;
+  const char *p = data;
+  while (state.count > 0 && p < end)
+  {
+    const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+    p = newline != nullptr ? newline + 1 : end;
+    state.count--;
+  }
+  out.append(data, p - data);
+  state.consumed = p - data;
+  return state.count > 0;
+}
+
+static void wc_chunk(FilterState &state, const char *data, size_t size)
+{
+  switch (state.filter->unit)
+  {
+  case 'c':
+    state.count += size;
+    break;
+  case 'l':
+    state.count += count_newlines(data, data + size);
+    break;
+  default:
+    // Words are runs of printable bytes between white space; other control
+    // bytes neither start nor end a word (as in GNU wc)
+    for (size_t i = 0; i < size; i++)
+    {
+      unsigned char c = data[i];
+      if (c == ' ' || (c >= '\t' && c <= '\r'))
+      {
+        state.in_word = false;
+      }
+      else if (c > ' ' && c < 0x7F && !state.in_word)
+      {
+        state.in_word = true;
+        state.count++;
+      }
+    }
+    break;
+  }
+}
+
+static void cut_line(const TextFilter &filter, const char *line, const char *end, std::string &out)
+{
+  const auto &ranges = filter.ranges;
+  size_t length = end - line;
+  if (!filter.fields)
+  {
+    for (const auto &range : ranges)
+    {
+      if (range.first > length)
+      {
+        break;
+      }
+      out.append(line + range.first - 1, std::min(range.second, length) - range.first + 1);
+    }
+    out.push_back('\n');
+    return;
+  }
+
+  char delimiter = filter.delimiter;
+  if (memchr(line, delimiter, length) == nullptr)
+  {
+    // Lines without a delimiter are passed whole (or dropped with -s)
+    if (!filter.only_delimited)
+    {
+      out.append(line, length);
+      out.push_back('\n');
+    }
+    return;
+  }
+  size_t field = 1;
+  size_t range = 0;
+  bool first = true;
+  for (const char *p = line;; field++)
+  {
+    const char *next = static_cast<const char *>(memchr(p, delimiter, end - p));
+    const char *field_end = next != nullptr ? next : end;
+    while (range < ranges.size() && ranges[range].second < field)
+    {
+      range++;
+    }
+    if (range == ranges.size())
+    {
+      break;
+    }
+    if (field >= ranges[range].first)
+    {
+      if (!first)
+      {
+        out.push_back(delimiter);
+      }
+      out.append(p, field_end - p);
+      first = false;
+    }
+    if (next == nullptr)
+    {
+      break;
+    }
+    p = next + 1;
+  }
+  out.push_back('\n');
+}
+
+static void cut_chunk(FilterState &state, const char *data, size_t size, std::string &out)
+{
+  const char *end = data + size;
+  for (const char *p = data; p < end;)
+  {
+    const char *newline = static_cast<const char *>(memchr(p, '\n', end - p));
+    const char *line_end = newline != nullptr ? newline : end;
+    cut_line(*state.filter, p, line_end, out);
+    p = newline != nullptr ? newline + 1 : end;
+  }
+}
+
+// Run one chunk of whole lines through a stage, appending its output.
+// Returns false once the stage wants no more input.
+static bool filter_chunk(FilterState &state, const char *data, size_t size, std::string &out)
+{
+  switch (state.filter->kind)
+  {
+  case TextFilter::GREP:
+    return grep_chunk(state, data, size, out);
+  case TextFilter::HEAD:
+    return head_chunk(state, data, size, out);
+  case TextFilter::WC:
+    wc_chunk(state, data, size);
+    return true;
+  case TextFilter::CUT:
+    cut_chunk(state, data, size, out);
+    return true;
+  }
+  return true;
+}
+
+// Output a stage produces at end of input
+static void finish_filter(const FilterState &state, std::string &out)
+{
+  if (state.binary_match)
+  {
+    report_binary_match();
+  }
+  if (state.filter->kind == TextFilter::WC ||
+      (state.filter->kind == TextFilter::GREP && state.filter->count))
+  {
+    out += std::to_string(state.count);
+    out.push_back('\n');
+  }
+}
+
+static int filter_status(const FilterState &state)
+{
+  if (state.filter->kind == TextFilter::GREP)
+  {
+    return state.count > 0 ? 0 : 1;
+  }
+  return 0;
+}
+
+static bool write_all(int fd, const std::string &data)
+{
+  for (size_t done = 0; done < data.size();)
+  {
+    ssize_t written = write(fd, data.data() + done, data.size() - done);
+    if (written < 0)
+    {
+      if (errno == EINTR)
+      {
+        continue;
+      }
+      return false;
+    }
+    done += written;
+  }
+  return true;
+}
+
+static unsigned long long round_up_to_block(unsigned long long size)
+{
+  return (size + STDIO_BLOCK - 1) / STDIO_BLOCK * STDIO_BLOCK;
+}
+
+// Stages that stop before reading anything: head -n 0, and grep -v with an
+// empty pattern (which GNU grep knows can select nothing)
+static bool needs_no_input(const TextFilter &filter)
+{
+  return (filter.kind == TextFilter::HEAD && filter.lines == 0) ||
+         (filter.kind == TextFilter::GREP && filter.invert && filter.pattern.empty());
+}
+
+// State of run_text_filters()
+struct FilterRun
+{
+  std::vector<FilterState> states;
+  std::vector<std::string> outputs; // Each stage's output for the current chunk
+  std::vector<bool> killed;         // Died writing to a stage that had exited
+  size_t active = 0;                // Stages [0, active) still take input
+  bool reader_gone = false;         // Stage `active` has exited
+  bool reader_read = true;          // It had read before it exited
+  unsigned long long taken = 0;     // Output of stage active-1 that it had read
+  unsigned long long pipe_capacity = 0; // Bytes a pipe between two stages holds
+  bool write_failed = false;
+};
+
+static void write_output(FilterRun &run, const std::string &data)
+{
+  if (run.active != run.states.size() || run.write_failed || write_all(STDOUT_FILENO, data))
+  {
+    return;
+  }
+  const char *name = tool_name(run.states.back().filter->kind);
+  std::string message = std::string(name) + ": write error: " + strerror(errno) + "\n";
+  write_all(STDERR_FILENO, message);
+  run.write_failed = true;
+}
+
+// A stage writing to one that has exited gets SIGPIPE on its next write.
+// Until then it can fill the pipe: the tools write through stdio, so that
+// happens once its output goes past the block the exited stage read last
+// plus the pipe capacity (or at once if that stage never read). A stage
+// whose output all fits finishes with its own status. The stage before a
+// cut off one is then cut off the same way.
+static void cut_off_writers(FilterRun &run)
+{
+  while (run.reader_gone && run.active > 0)
+  {
+    const FilterState &writer = run.states[run.active - 1];
+    unsigned long long room = round_up_to_block(run.taken) + (run.reader_read ? run.pipe_capacity : 0);
+    if (writer.written <= room)
+    {
+      break;
+    }
+    run.active--;
+    run.killed[run.active] = true;
+    run.reader_read = true;
+    run.taken = 0;
+    if (run.active > 0)
+    {
+      // It died at the write that went past room, having read about the
+      // same share of its last chunk of input as it had written of its output
+      unsigned long long before = writer.written - writer.last_output;
+      double share = room > before ? static_cast<double>(room - before) / writer.last_output : 0;
+      const FilterState &input = run.states[run.active - 1];
+      run.taken = input.written - input.last_output + static_cast<unsigned long long>(share * input.last_output);
+    }
+  }
+}
+
+// Give stages [first, last) end of input. What each prints then passes
+// through the stages after it; returns what the last one prints.
+static std::string finish_stages(FilterRun &run, size_t first, size_t last)
+{
+  std::string carried;
+  std::string out;
+  for (size_t i = first; i < last; i++)
+  {
+    out.clear();
+    if (!carried.empty())
+    {
+      filter_chunk(run.states[i], carried.data(), carried.size(), out);
+    }
+    finish_filter(run.states[i], out);
+    run.states[i].written += out.size();
+    run.states[i].last_output = out.size();
+    carried.swap(out);
+  }
+  return carried;
+}
+
+// Handle stages that want no more input, last one first: the stages after
+// each see end of input. head exits and cuts off the stages before it; grep
+// keeps reading and discarding its input, so they finish normally.
+static void stop_finished_stages(FilterRun &run)
+{
+  for (size_t i = run.active; i-- > 0;)
+  {
+    if (i >= run.active || !run.states[i].done)
+    {
+      continue;
+    }
+    write_output(run, finish_stages(run, i + 1, run.active));
+    cut_off_writers(run);
+
+    const FilterState &state = run.states[i];
+    run.reader_gone = !(state.filter->kind == TextFilter::GREP && state.binary);
+    run.reader_read = !needs_no_input(*state.filter);
+    run.active = i;
+    if (i > 0)
+    {
+      run.taken = run.states[i - 1].written - run.outputs[i - 1].size() + state.consumed;
+    }
+    cut_off_writers(run);
+  }
+}
+
+int run_text_filters(const TextFilter *filters, size_t count, size_t pipe_capacity, int *statuses)
+{
+  FilterRun run;
+  run.pipe_capacity = pipe_capacity;
+  run.states.resize(count);
+  run.outputs.resize(count);
+  run.killed.resize(count);
+  run.active = count;
+  for (size_t i = 0; i < count; i++)
+  {
+    run.states[i].filter = &filters[i];
+    if (filters[i].kind == TextFilter::HEAD)
+    {
+      run.states[i].count = filters[i].lines;
+    }
+    run.states[i].guard = rare_byte_index(filters[i].pattern);
+    run.states[i].done = needs_no_input(filters[i]);
+  }
+  stop_finished_stages(run);
+
+  int read_status = 0;
+  bool at_end = false;
+  std::vector<char> buffer(READ_SIZE);
+  size_t pending = 0; // Incomplete last line carried over from the last read
+  while (!(run.active == 0 && run.reader_gone) && !at_end && !run.write_failed)
+  {
+    if (buffer.size() < pending + READ_SIZE)
+    {
+      buffer.resize(pending + READ_SIZE); // A very long line
+    }
+    ssize_t n = read(STDIN_FILENO, buffer.data() + pending, READ_SIZE);
+    if (n < 0 && errno == EINTR)
+    {
+      continue;
+    }
+    if (n < 0)
+    {
+      std::string message = std::string(tool_name(filters[0].kind)) + ": (standard input): " + strerror(errno) + "\n";
+      write_all(STDERR_FILENO, message);
+      read_status = filters[0].kind == TextFilter::GREP ? 2 : 1;
+      n = 0;
+    }
+    at_end = n == 0;
+    size_t filled = pending + n;
+
+    // grep looks for NUL bytes in everything it has buffered, including a
+    // partial last line
+    if (run.active > 0 && filters[0].kind == TextFilter::GREP && memchr(buffer.data(), '\0', filled) != nullptr)
+    {
+      run.states[0].binary = true;
+    }
+
+    // Process whole lines now; the rest waits for the next read
+    size_t chunk = filled;
+    if (!at_end)
+    {
+      const char *newline = static_cast<const char *>(memrchr(buffer.data() + pending, '\n', n));
+      if (newline == nullptr)
+      {
+        pending = filled;
+        continue;
+      }
+      chunk = newline + 1 - buffer.data();
+    }
+
+    const char *data = buffer.data();
+    size_t size = chunk;
+    for (size_t i = 0; i < run.active; i++)
+    {
+      FilterState &state = run.states[i];
+      run.outputs[i].clear();
+      if (size > 0 && !filter_chunk(state, data, size, run.outputs[i]))
+      {
+        state.done = true;
+      }
+      state.written += run.outputs[i].size();
+      state.last_output = run.outputs[i].size();
+      data = run.outputs[i].data();
+      size = run.outputs[i].size();
+    }
+    write_output(run, run.outputs.back());
+    cut_off_writers(run);
+    stop_finished_stages(run);
+
+    memmove(buffer.data(), buffer.data() + chunk, filled - chunk);
+    pending = filled - chunk;
+  }
+
+  if (at_end && run.active > 0)
+  {
+    write_output(run, finish_stages(run, 0, run.active));
+    cut_off_writers(run);
+  }
+  else if (!at_end)
+  {
+    close(STDIN_FILENO); // Our writer gets SIGPIPE
+  }
+
+  for (size_t i = 0; i < count; i++)
+  {
+    statuses[i] = run.killed[i] ? 141 : filter_status(run.states[i]);
+  }
+  if (read_status != 0)
+  {
+    statuses[0] = read_status;
+  }
+  if (run.write_failed)
+  {
+    // The stages before the last one lose their reader
+    for (size_t i = 0; i + 1 < count; i++)
+    {
+      statuses[i] = 141;
+    }
+    statuses[count - 1] = filters[count - 1].kind == TextFilter::GREP ? 2 : 1;
+  }
+  return statuses[count - 1];
+}
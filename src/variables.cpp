@@ -0,0 +1,240 @@
+#include "include/variables.h"
+#include <unordered_map>
+#include <cstdlib>
+#include <cctype>
+
+extern char **environ;
+
+// Shell variables that are not exported. Exported variables (including
+// everything inherited from the parent) live in the process environment.
+static std::unordered_map<std::string, std::string> shell_variables;
+
+// $1, $2, ... of the running function (empty at top level)
+static std::vector<std::string> positional_parameters;
+
+// Options changed with set -o / set +o
+struct ShellOption
+{
+  const char *name;
+  bool on;
+};
+static ShellOption shell_options[] = {
+    {"pipefail", false},    // A pipeline fails if any stage fails
+    {"fusefilters", false}, // Run grep/head/wc/cut pipeline stages in one process
+};
+
+// Bumped on every change to the environment so cached envp blocks can be
+// rebuilt lazily (see exec_image.h)
+static unsigned long env_generation = 0;
+
+std::string get_variable(const std::string &name)
+{
+  if (!name.empty() && std::isdigit(static_cast<unsigned char>(name[0])))
+  {
+    size_t index = std::strtoul(name.c_str(), nullptr, 10);
+    return index >= 1 && index <= positional_parameters.size() ? positional_parameters[index - 1] : "";
+  }
+  if (name == "#")
+  {
+    return std::to_string(positional_parameters.size());
+  }
+  if (name == "@" || name == "*")
+  {
+    std::string joined;
+    for (size_t i = 0; i < positional_parameters.size(); i++)
+    {
+      joined += (i > 0 ? " " : "") + positional_parameters[i];
+    }
+    return joined;
+  }
+
+  auto it = shell_variables.find(name);
+  if (it != shell_variables.end())
+  {
+    return it->second;
+  }
+
+  const char *env = std::getenv(name.c_str());
+  return env ? env : "";
+}
+
+std::string_view peek_variable(const std::string &name)
+{
+  auto it = shell_variables.find(name);
+  if (it != shell_variables.end())
+  {
+    return it->second;
+  }
+
+  const char *env = std::getenv(name.c_str());
+  return env ? env : "";
+}
+
+void set_variable(const std::string &name, const std::string &value)
+{
+  if (std::getenv(name.c_str()) != nullptr)
+  {
+    setenv(name.c_str(), value.c_str(), 1);
+    env_generation++;
+    return;
+  }
+  shell_variables[name] = value;
+}
+
+void export_variable(const std::string &name)
+{
+  if (std::getenv(name.c_str()) != nullptr)
+  {
+    return; // Already exported
+  }
+
+  auto it = shell_variables.find(name);
+  std::string value = it != shell_variables.end() ? it->second : "";
+  if (it != shell_variables.end())
+  {
+    shell_variables.erase(it);
+  }
+  setenv(name.c_str(), value.c_str(), 1);
+  env_generation++;
+}
+
+unsigned long environment_generation()
+{
+  return env_generation;
+}
+
+void unset_variable(const std::string &name)
+{
+  shell_variables.erase(name);
+  if (std::getenv(name.c_str()) != nullptr)
+  {
+    unsetenv(name.c_str());
+    env_generation++;
+  }
+}
+
+bool is_valid_variable_name(std::string_view name)
+{
+  if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0])))
+  {
+    return false;
+  }
+
+  for (char c : name)
+  {
+    if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_')
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+void set_last_status(int status)
+{
+  shell_variables["?"] = std::to_string(status);
+}
+
+void set_pipe_status(const int *statuses, size_t count)
+{
+  std::string &value = shell_variables["PIPESTATUS"];
+  value.clear();
+  for (size_t i = 0; i < count; i++)
+  {
+    if (i > 0)
+    {
+      value += ' ';
+    }
+    value += std::to_string(statuses[i]);
+  }
+}
+
+bool set_shell_option(std::string_view name, bool on)
+{
+  for (auto &option : shell_options)
+  {
+    if (name == option.name)
+    {
+      option.on = on;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool shell_option(std::string_view name)
+{
+  for (const auto &option : shell_options)
+  {
+    if (name == option.name)
+    {
+      return option.on;
+    }
+  }
+  return false;
+}
+
+std::vector<std::pair<std::string, bool>> list_shell_options()
+{
+  std::vector<std::pair<std::string, bool>> all;
+  for (const auto &option : shell_options)
+  {
+    all.emplace_back(option.name, option.on);
+  }
+  return all;
+}
+
+std::vector<std::pair<std::string, std::string>> list_shell_variables()
+{
+  std::vector<std::pair<std::string, std::string>> all;
+  for (const auto &variable : shell_variables)
+  {
+    if (is_valid_variable_name(variable.first))
+    {
+      all.push_back(variable);
+    }
+  }
+  return all;
+}
+
+std::vector<std::string> set_positional_parameters(std::vector<std::string> params)
+{
+  positional_parameters.swap(params);
+  return params;
+}
+
+const std::vector<std::string> &get_positional_parameters()
+{
+  return positional_parameters;
+}
+
+void swap_variable_scope(VariableScope &scope)
+{
+  shell_variables.swap(scope.variables);
+  positional_parameters.swap(scope.positional);
+
+  std::vector<std::string> environment;
+  for (char **env = environ; *env != nullptr; env++)
+  {
+    environment.emplace_back(*env);
+  }
+  clearenv();
+  for (const auto &entry : scope.environment)
+  {
+    size_t equals = entry.find('=');
+    if (equals != std::string::npos)
+    {
+      setenv(entry.substr(0, equals).c_str(), entry.c_str() + equals + 1, 1);
+    }
+  }
+  scope.environment.swap(environment);
+  env_generation++;
+
+  std::vector<bool> options;
+  for (size_t i = 0; i < sizeof(shell_options) / sizeof(shell_options[0]); i++)
+  {
+    options.push_back(shell_options[i].on);
+    shell_options[i].on = i < scope.options.size() && scope.options[i];
+  }
+  scope.options.swap(options);
+}
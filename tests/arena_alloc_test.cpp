@@ -0,0 +1,158 @@
+// Allocation-counting check for the per-line arena (include/arena.h).
+// Replaces the global operator new to count heap allocations and track
+// live bytes, then runs commands through the Shell API:
+//  - simple commands in steady state must not touch the heap;
+//  - loops and function calls must not grow memory with the iteration
+//    count, since each iteration and call gives back its arena memory.
+// Build and run with: make check
+
+#include "include/libshell.h"
+#include "include/line_reader.h"
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <malloc.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+static size_t allocations = 0;
+static size_t live_bytes = 0;
+static size_t peak_bytes = 0;
+
+static void *counted(void *p)
+{
+  if (p == nullptr)
+  {
+    throw std::bad_alloc();
+  }
+  allocations++;
+  live_bytes += malloc_usable_size(p);
+  if (live_bytes > peak_bytes)
+  {
+    peak_bytes = live_bytes;
+  }
+  return p;
+}
+
+static void uncounted(void *p)
+{
+  if (p != nullptr)
+  {
+    live_bytes -= malloc_usable_size(p);
+    free(p);
+  }
+}
+
+// Memory resources may ask for aligned blocks, so count those too
+void *operator new(size_t size)
+{
+  return counted(malloc(size == 0 ? 1 : size));
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+  size_t align = static_cast<size_t>(alignment);
+  return counted(aligned_alloc(align, (size + align - 1) / align * align));
+}
+
+void operator delete(void *p) noexcept
+{
+  uncounted(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  uncounted(p);
+}
+
+void operator delete(void *p, std::align_val_t) noexcept
+{
+  uncounted(p);
+}
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept
+{
+  uncounted(p);
+}
+
+static int failures = 0;
+
+static void check(bool ok, const char *what, size_t value)
+{
+  fprintf(stderr, "%s %s (%zu)\n", ok ? "ok  " : "FAIL", what, value);
+  if (!ok)
+  {
+    failures++;
+  }
+}
+
+// Heap allocations made by running source 100 times, after warming up
+static size_t allocations_in_runs(Shell &shell, const std::string &source)
+{
+  for (int i = 0; i < 3; i++)
+  {
+    shell.execute(source);
+  }
+  const int runs = 100;
+  size_t before = allocations;
+  for (int i = 0; i < runs; i++)
+  {
+    shell.execute(source);
+  }
+  return allocations - before;
+}
+
+// Growth of peak heap use while source runs with lines lines on stdin
+static size_t peak_growth_with_input(Shell &shell, const std::string &source, int lines)
+{
+  char path[] = "/tmp/arena_alloc_test.XXXXXX";
+  int fd = mkstemp(path);
+  std::string text;
+  for (int i = 0; i < lines; i++)
+  {
+    text += "input line number " + std::to_string(i) + "\n";
+  }
+  if (fd < 0 || write(fd, text.data(), text.size()) != static_cast<ssize_t>(text.size()))
+  {
+    perror("arena_alloc_test: temporary file");
+    exit(1);
+  }
+  text = std::string();
+  lseek(fd, 0, SEEK_SET);
+  unlink(path);
+  dup2(fd, STDIN_FILENO);
+  close(fd);
+  reset_line_readers();
+
+  size_t before = live_bytes;
+  peak_bytes = live_bytes;
+  shell.execute(source);
+  return peak_bytes - before;
+}
+
+int main()
+{
+  int null_fd = open("/dev/null", O_WRONLY);
+  dup2(null_fd, STDOUT_FILENO);
+
+  Shell shell;
+  shell.execute("f() { echo \"called with $1\" > /dev/null; }");
+
+  // Builtins write to stdout; keep the report on stderr
+  size_t count = allocations_in_runs(shell, "echo \"quoted  arg\" plain > /dev/null");
+  check(count == 0, "echo with a redirect: heap allocations in 100 runs", count);
+  count = allocations_in_runs(shell, "/bin/true \"quoted  arg\" plain > /dev/null");
+  check(count == 0, "external command with a redirect: heap allocations in 100 runs", count);
+
+  // Each iteration used to leave a few hundred bytes in the arena
+  const int lines = 50000;
+  const size_t limit = 256 * 1024;
+  size_t growth = peak_growth_with_input(shell, "while read l; do echo \"line $l\" > /dev/null; done", lines);
+  check(growth < limit, "while loop over 50000 lines: peak heap growth in bytes", growth);
+  growth = peak_growth_with_input(shell, "while read l; do f $l; done", lines);
+  check(growth < limit, "function called from a loop 50000 times: peak heap growth in bytes", growth);
+
+  fprintf(stderr, "%s\n", failures == 0 ? "arena_alloc_test: passed" : "arena_alloc_test: FAILED");
+  return failures == 0 ? 0 : 1;
+}
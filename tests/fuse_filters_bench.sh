@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# Throughput benchmark for the fusefilters option: times filter pipelines
+# over a generated log with the option off (the real tools) and on, best
+# of 5 runs each.
+# Usage: tests/fuse_filters_bench.sh [lines]    (after make; default 2500000
+# lines, about 190 MB)
+
+SHELL_BIN="$(dirname "$0")/../bin/shell"
+LINES=${1:-2500000}
+LOG=$(mktemp /tmp/fuse_filters_bench.XXXXXX)
+trap 'rm -f "$LOG"' EXIT
+
+if [ ! -x "$SHELL_BIN" ]; then
+    echo "Build the shell first: make"
+    exit 1
+fi
+
+awk -v lines="$LINES" 'BEGIN {
+    srand(1)
+    split("DEBUG INFO INFO WARN ERROR", levels, " ")
+    for (i = 0; i < lines; i++)
+        printf "2026-10-18T%02d:%02d:%02d %s svc%d: request %d took %dms path=/api/v%d/items\n",
+            int(i / 3600) % 24, int(i / 60) % 60, i % 60, levels[int(rand() * 5) + 1],
+            i % 5, i, int(rand() * 1000), i % 3
+}' > "$LOG"
+
+PIPELINES=(
+    'grep ERROR | head -n 20 | wc -l'
+    'grep -v DEBUG | wc -l'
+    'grep svc3: | cut -d" " -f4 | wc -c'
+    'grep -c WARN'
+    'grep zzz | head -n 20 | wc -l'
+)
+
+# Best wall-clock time of a command line, in nanoseconds
+best_time()
+{
+    local best=""
+    for run in 1 2 3 4 5; do
+        local start=$(date +%s%N)
+        printf '%s\n' "$1" | "$SHELL_BIN" --no-history > /dev/null
+        local elapsed=$(( $(date +%s%N) - start ))
+        if [ -z "$best" ] || [ "$elapsed" -lt "$best" ]; then
+            best=$elapsed
+        fi
+    done
+    echo "$best"
+}
+
+echo "$LINES lines, $(( $(stat -c %s "$LOG") / 1000000 )) MB, cat log | ..."
+for pipeline in "${PIPELINES[@]}"; do
+    off=$(best_time "cat $LOG | $pipeline")
+    on=$(best_time "set -o fusefilters
+cat $LOG | $pipeline")
+    awk -v name="$pipeline" -v off="$off" -v on="$on" \
+        'BEGIN { printf "  %-38s %.3fs -> %.3fs  x%.2f\n", name, off / 1e9, on / 1e9, off / on }'
+done
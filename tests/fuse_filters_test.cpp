@@ -0,0 +1,428 @@
+// Differential check for the fusefilters option (include/text_filters.h).
+// Runs filter pipelines over generated data with the option off (the real
+// grep, head, wc and cut) and on, in the C and C.UTF-8 locales, reading
+// through a pipe and from a file, and compares standard output, error
+// messages and $PIPESTATUS:
+//  - fixed cases: every pipeline below over every data file;
+//  - randomized chains of grep, head, wc and cut stages;
+//  - statuses of stages cut off by head, which the real tools only report
+//    most of the time, checked against what a fused run must report.
+// Some results of the real tools depend on timing (a stage racing one that
+// exits early, interleaved error messages), so when a case differs the
+// real tools are run again until they agree with the first fused run. Whether a stage writing to another
+// process is cut off by SIGPIPE depends on which of them runs first, so
+// 0 and 141 count as the same status there; inside a fused run of stages
+// statuses must match exactly.
+// Build and run with: make check
+
+#include "include/libshell.h"
+#include "include/text_filters.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+static std::mt19937 rng(20261018);
+
+static size_t pick(size_t n)
+{
+  return rng() % n;
+}
+
+static std::string data_dir;
+
+static void write_file(const std::string &name, const std::string &data)
+{
+  std::string path = data_dir + "/" + name;
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == nullptr || fwrite(data.data(), 1, data.size(), file) != data.size() || fclose(file) != 0)
+  {
+    perror(("fuse_filters_test: " + path).c_str());
+    exit(1);
+  }
+}
+
+// A line of words the pipelines look for, with tabs, colons and spaces for cut
+static std::string random_line()
+{
+  static const char *const words[] = {"ERROR", "error", "Error", "warn", "alpha", "beta", "abc", "ab",
+                                      "x", "a\tb\tc", "foo:bar:baz", "a:b", "  spaced  out "};
+  static const char *const separators[] = {"", " ", "\t", ":"};
+  std::string line;
+  for (size_t n = 1 + pick(3); n > 0; n--)
+  {
+    line += words[pick(sizeof(words) / sizeof(words[0]))];
+    if (n > 1)
+    {
+      line += separators[pick(4)];
+    }
+  }
+  return line + "\n";
+}
+
+static std::string random_text(size_t lines)
+{
+  std::string text;
+  for (size_t i = 0; i < lines; i++)
+  {
+    text += random_line();
+  }
+  return text;
+}
+
+// Bytes from a small alphabet of NUL, control, UTF-8 lead and text bytes
+static std::string random_bytes(size_t size, const std::string &alphabet)
+{
+  std::string data(size, '\0');
+  for (char &c : data)
+  {
+    c = alphabet.empty() ? static_cast<char>(rng()) : alphabet[pick(alphabet.size())];
+  }
+  return data;
+}
+
+static const char *const data_files[] = {
+    "small.txt", "medium.txt", "big.txt", "long.txt", "nonl.txt", "nul_early.txt", "nul_late.txt", "utf8.txt",
+    "badutf8.txt", "crlf.txt", "ctrl.txt", "blank.txt", "empty.txt", "mixed.bin", "random.bin"};
+
+static void make_data_files()
+{
+  write_file("small.txt", random_text(30));
+  // Output of grep fits in a pipe: a head after it does not cut it off
+  write_file("medium.txt", random_text(3800)); // About 52 KB
+  write_file("big.txt", random_text(200000)); // Many 96 KiB reads
+  std::string long_line;
+  while (long_line.size() < 220000)
+  {
+    long_line += "error ";
+  }
+  write_file("long.txt", long_line + "\n" + long_line + "alpha\n" + long_line + "\n");
+  std::string text = random_text(10);
+  write_file("nonl.txt", text.substr(0, text.size() - 1));
+  write_file("nul_early.txt", "abc\nx" + std::string(1, '\0') + "y abc\n" + random_text(12));
+  // Past the first few reads, so grep has printed lines before it sees it
+  write_file("nul_late.txt", random_text(50000) + "bin" + std::string(1, '\0') + "ary error\n" + random_text(100));
+  write_file("utf8.txt", "caf\xc3\xa9 error\n\xc3\xbc" "ber alpha\nplain error\n");
+  write_file("badutf8.txt", "good error\nbad \xc3( error\nafter error\n\xed\xa0\x80 \x80 error\n");
+  write_file("crlf.txt", "error\r\nalpha\r\n");
+  write_file("ctrl.txt", "a\x01" "b \x02\x03 c\rd\ve\ff\n\x7f\x80\xff word\n");
+  write_file("blank.txt", "\n\n\n");
+  write_file("empty.txt", "");
+  write_file("mixed.bin", random_bytes(200000, std::string("ab e:\t\n\xc3\xa9\x01", 11) + std::string(1, '\0')));
+  write_file("random.bin", random_bytes(300000, ""));
+}
+
+// Pipelines run over every data file
+static const char *const pipelines[] = {
+    "grep error",
+    "grep -v error",
+    "grep -c error",
+    "grep -vc error",
+    "grep -i error",
+    "grep -ic ERROR",
+    "grep -F \"a:b\"",
+    "grep -e alpha",
+    "grep -- -x",
+    "grep \"\"",
+    "grep -v \"\"",
+    "grep -E ab",
+    "head",
+    "head -n 3",
+    "head -5",
+    "head -n0",
+    "head -n 1000000",
+    "head -n 100000",
+    "wc -l",
+    "wc -c",
+    "wc -w",
+    "wc -ll",
+    "cut -d: -f2",
+    "cut -d: -f1,3",
+    "cut -d: -f2-",
+    "cut -d: -f-2",
+    "cut -s -d: -f1",
+    "cut -f2",
+    "cut -c2-4",
+    "cut -b1,3,5-7",
+    "cut -c5-",
+    "cut -d\" \" -f3,1",
+    "cut -d: -f5",
+    "grep error | head -n 5",
+    "grep error | head -n 20 | wc -l",
+    "grep -i error | head -n 3",
+    "grep a | cut -d: -f1 | head -n 5",
+    "head -n 100 | grep -v alpha | wc -w",
+    "grep -c error | head -n 1",
+    "cut -d: -f1 | grep -v x | wc -c",
+    "head -n 0 | wc -l",
+    "grep x | head -n 2 | grep x | wc -l",
+    "head -n 50000 | grep error | wc -l",
+    "grep error | head -n 3 | grep -c error",
+    "grep error | sort | head -n 2",
+    "grep error | head -n 2 | tr a-z A-Z",
+};
+
+// A chain of 1 to 4 stages for the randomized cases
+static std::string random_pipeline()
+{
+  static const char *const patterns[] = {"error", "ERROR", "a", "x", "ab", "a:b", "\"\"", "\"a b\"", "warn"};
+  std::string pipeline;
+  for (size_t n = 1 + pick(4); n > 0; n--)
+  {
+    std::string stage;
+    switch (pick(4))
+    {
+    case 0:
+    {
+      static const char *const options[] = {"", "-v ", "-c ", "-i ", "-F ", "-vc ", "-vi "};
+      stage = std::string("grep ") + options[pick(7)] + patterns[pick(9)];
+      break;
+    }
+    case 1:
+    {
+      static const char *const counts[] = {"0", "1", "2", "5", "100", "2000", "100000"};
+      stage = std::string("head -n ") + counts[pick(7)];
+      break;
+    }
+    case 2:
+    {
+      static const char *const units[] = {"-l", "-c", "-w"};
+      stage = std::string("wc ") + units[pick(3)];
+      break;
+    }
+    default:
+    {
+      static const char *const lists[] = {"-d: -f1", "-d: -f2-", "-f1,3", "-s -d: -f2", "-c1-3", "-b2,4-"};
+      stage = std::string("cut ") + lists[pick(6)];
+      break;
+    }
+    }
+    pipeline += pipeline.empty() ? stage : " | " + stage;
+  }
+  return pipeline;
+}
+
+// What one run of a case printed
+struct Outcome
+{
+  std::string out;
+  std::vector<std::string> errors; // Sorted: stages write them concurrently
+  std::vector<int> statuses;
+
+};
+
+static Outcome run_case(Shell &shell, bool fuse, const std::string &source)
+{
+  shell.execute(fuse ? "set -o fusefilters" : "set +o fusefilters");
+  Outcome outcome;
+  std::string err;
+  shell.capture(source, outcome.out, &err);
+  outcome.statuses = shell.pipe_status();
+  for (size_t start = 0; start < err.size();)
+  {
+    size_t end = err.find('\n', start);
+    end = end == std::string::npos ? err.size() : end + 1;
+    outcome.errors.push_back(err.substr(start, end - start));
+    start = end;
+  }
+  std::sort(outcome.errors.begin(), outcome.errors.end());
+  return outcome;
+}
+
+// Last stage of the process each stage runs in with the option on: a run
+// of stages parse_text_filter() accepts is one process
+static std::vector<size_t> process_ends(const std::vector<std::string> &stages)
+{
+  std::vector<bool> fusable(stages.size());
+  for (size_t i = 0; i < stages.size(); i++)
+  {
+    TextFilter filter;
+    fusable[i] = parse_text_filter(parse_args(stages[i]), filter);
+  }
+  std::vector<size_t> ends(stages.size());
+  for (size_t i = stages.size(); i-- > 0;)
+  {
+    ends[i] = i + 1 < stages.size() && fusable[i] && fusable[i + 1] ? ends[i + 1] : i;
+  }
+  return ends;
+}
+
+static bool agree(const Outcome &off, const Outcome &on, const std::vector<size_t> &ends)
+{
+  if (off.out != on.out || off.errors != on.errors || off.statuses.size() != ends.size() ||
+      on.statuses.size() != ends.size())
+  {
+    return false;
+  }
+  for (size_t i = 0; i < ends.size(); i++)
+  {
+    // A process cut off writing to the next one ends all its stages
+    size_t end = ends[i];
+    bool racing = end + 1 < ends.size() && (off.statuses[end] == 141 || on.statuses[end] == 141);
+    if (off.statuses[i] != on.statuses[i] && !(racing && (off.statuses[i] == 141 || on.statuses[i] == 141)))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+static int cases = 0;
+static int retried = 0;
+static int skipped = 0;
+static int failures = 0;
+
+// Run pipeline over file both ways; from_file gives the first stage "< file"
+static void check_case(Shell &shell, const std::string &file, const std::string &pipeline, bool from_file)
+{
+  std::string path = data_dir + "/" + file;
+  std::string source;
+  if (from_file)
+  {
+    size_t bar = pipeline.find(" | ");
+    source = bar == std::string::npos ? pipeline + " < " + path
+                                      : pipeline.substr(0, bar) + " < " + path + pipeline.substr(bar);
+  }
+  else
+  {
+    source = "cat " + path + " | " + pipeline;
+  }
+
+  // Where grep turns binary on a NUL past its first read depends on how
+  // much each read from a pipe returns; the real grep varies there too
+  bool grep_reads_file = from_file && pipeline.rfind("grep", 0) == 0 && pipeline.find("| grep") == std::string::npos;
+  if (file == "nul_late.txt" && pipeline.find("grep") != std::string::npos && !grep_reads_file)
+  {
+    skipped++;
+    return;
+  }
+
+  std::vector<std::string> stages;
+  if (!from_file)
+  {
+    stages.push_back("cat " + path);
+  }
+  for (size_t start = 0;;)
+  {
+    size_t bar = pipeline.find(" | ", start);
+    stages.push_back(pipeline.substr(start, bar - start));
+    if (bar == std::string::npos)
+    {
+      break;
+    }
+    start = bar + 3;
+  }
+  std::vector<size_t> ends = process_ends(stages);
+
+  cases++;
+  Outcome on = run_case(shell, true, source);
+  Outcome off = run_case(shell, false, source);
+  if (agree(off, on, ends))
+  {
+    return;
+  }
+  // Only the real tools are run again: their statuses race with each
+  // other, while a fused run that differs from them has to fail
+  retried++;
+  for (int attempt = 0; attempt < 20; attempt++)
+  {
+    if (agree(run_case(shell, false, source), on, ends))
+    {
+      return;
+    }
+  }
+
+  failures++;
+  std::string locale = shell.variable("LC_ALL");
+  fprintf(stderr, "FAIL [%s] %s\n", locale.c_str(), source.c_str());
+  if (off.out != on.out)
+  {
+    fprintf(stderr, "  output: %zu bytes off, %zu bytes on\n", off.out.size(), on.out.size());
+  }
+  if (off.errors != on.errors)
+  {
+    fprintf(stderr, "  error messages: %zu lines off, %zu lines on\n", off.errors.size(), on.errors.size());
+  }
+  if (off.statuses != on.statuses)
+  {
+    std::string statuses[2];
+    for (int mode = 0; mode < 2; mode++)
+    {
+      for (int status : mode == 0 ? off.statuses : on.statuses)
+      {
+        statuses[mode] += " " + std::to_string(status);
+      }
+    }
+    fprintf(stderr, "  PIPESTATUS:%s off,%s on\n", statuses[0].c_str(), statuses[1].c_str());
+  }
+}
+
+// $PIPESTATUS and, with pipefail, $? of a fused run
+static void check_statuses(Shell &shell, const std::string &source, const std::string &expected)
+{
+  shell.execute("set -o fusefilters; set -o pipefail");
+  std::string out;
+  shell.capture(source + "; echo \"$? $PIPESTATUS\"", out);
+  shell.execute("set +o pipefail");
+  cases++;
+  if (out.empty() || out.substr(out.rfind('\n', out.size() - 2) + 1) != expected + "\n")
+  {
+    failures++;
+    fprintf(stderr, "FAIL %s\n  $? and PIPESTATUS: expected %s, got %s", source.c_str(), expected.c_str(),
+            out.substr(out.rfind('\n', out.size() - 2) + 1).c_str());
+  }
+}
+
+int main()
+{
+  char dir[] = "/tmp/fuse_filters_test.XXXXXX";
+  if (mkdtemp(dir) == nullptr)
+  {
+    perror("fuse_filters_test: temporary directory");
+    return 1;
+  }
+  data_dir = dir;
+  make_data_files();
+
+  Shell shell;
+  shell.execute("export LC_ALL=C");
+  // Output that fits in the pipe is all written before head exits
+  check_statuses(shell, "grep error < " + data_dir + "/medium.txt | head -n 5", "0 0 0");
+  check_statuses(shell, "grep error < " + data_dir + "/medium.txt | head -n 5 | wc -l", "0 0 0 0");
+  // More than that and grep writes after head has gone
+  check_statuses(shell, "grep error < " + data_dir + "/big.txt | head -n 5", "141 141 0");
+  // So does the stage feeding it, once grep stops reading
+  check_statuses(shell, "cut -b1- < " + data_dir + "/big.txt | grep error | head -n 5", "141 141 141 0");
+  // head -n 0 exits before anything is written to it
+  check_statuses(shell, "wc -l < " + data_dir + "/medium.txt | head -n 0", "141 141 0");
+  int expected = cases;
+  for (const char *locale : {"C", "C.UTF-8"})
+  {
+    shell.execute(std::string("export LC_ALL=") + locale);
+    for (const char *pipeline : pipelines)
+    {
+      for (const char *file : data_files)
+      {
+        check_case(shell, file, pipeline, false);
+        check_case(shell, file, pipeline, true);
+      }
+    }
+  }
+  int fixed = cases - expected;
+
+  for (int i = 0; i < 300; i++)
+  {
+    shell.execute(pick(2) == 0 ? "export LC_ALL=C" : "export LC_ALL=C.UTF-8");
+    check_case(shell, data_files[pick(sizeof(data_files) / sizeof(data_files[0]))], random_pipeline(), pick(2) == 0);
+  }
+
+  shell.execute(std::string("rm -r ") + dir);
+  fprintf(stderr, "fuse_filters_test: %d status checks, %d fixed and %d randomized cases, "
+                  "%d agreed only when run again, %d skipped\n",
+          expected, fixed, cases - expected - fixed, retried - failures, skipped);
+  fprintf(stderr, "%s\n", failures == 0 ? "fuse_filters_test: passed" : "fuse_filters_test: FAILED");
+  return failures == 0 ? 0 : 1;
+}